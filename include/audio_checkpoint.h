@@ -0,0 +1,157 @@
+#ifndef AUDIO_CHECKPOINT_H
+#define AUDIO_CHECKPOINT_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "audio_enc.h"
+
+/** Default audio time between checkpoints, in seconds. */
+#define AUDIO_CHECKPOINT_INTERVAL 30.0
+
+/**
+ * @brief Periodic, resumable progress of one transcode.
+ *
+ * The checkpoint directory holds a small `state` file and, for encoded
+ * output, a packet `journal`:
+ *  - encoded packets are appended to the journal instead of the muxer (see
+ *    `audio_enc.packet_sink`) and only muxed into the output once the
+ *    whole input was encoded, so any container works, including ones that
+ *    write their index at the end;
+ *  - raw PCM is appended to the output file directly.
+ * Every `interval` samples of output, at a packet (or frame) boundary, the
+ * journal or output is synced and the state is replaced atomically
+ * (written to a temporary file, then renamed) with the output position in
+ * samples and the matching byte offset.
+ *
+ * A rerun with the same key truncates the journal or output to the
+ * recorded offset and continues from the recorded position: the decoder
+ * seeks there, and the new encoder is primed with the samples just before
+ * it, whose packets are dropped with `audio_enc.min_pts` (as at segment
+ * boundaries of audio_segment), so the packets continue seamlessly. A state
+ * with another key (different input or settings) is discarded.
+ */
+struct audio_checkpoint {
+  char *dir;
+  char *state_path;
+  char *journal_path;
+
+  /** @brief Job identity: input and settings. */
+  char key[33];
+
+  /** @brief Samples between checkpoints and the output sample rate. */
+  int64_t interval;
+  int sample_rate;
+
+  /** @brief Packet journal, for encoded output. */
+  FILE *journal;
+
+  /**
+   * @brief Output position (samples) and size (bytes) written so far, and
+   *        at the last checkpoint.
+   */
+  int64_t position;
+  int64_t bytes;
+  int64_t saved_position;
+  int64_t saved_bytes;
+
+  /** @brief Set when a matching state was loaded. */
+  int resumed;
+
+  /** @brief Checkpoints written by this run. */
+  int saved;
+};
+
+/**
+ * @brief Open a checkpoint directory and load its state.
+ *
+ * @param cp Checkpoint to initialize.
+ * @param dir Directory, created if needed.
+ * @param key Job key; a stored state with another key is discarded.
+ * @param interval Seconds of output between checkpoints, or <= 0 for
+ * AUDIO_CHECKPOINT_INTERVAL.
+ * @param sample_rate Output sample rate.
+ * @param journal Whether the output is encoded through the packet journal.
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+int audio_checkpoint_init(struct audio_checkpoint *cp, const char *dir,
+                          const char *key, double interval, int sample_rate,
+                          int journal);
+
+/**
+ * @brief Route an encoder's packets into the journal and, when resuming,
+ *        prime it to continue at the checkpoint.
+ *
+ * @param cp Initialized checkpoint with a journal.
+ * @param encoder Freshly initialized encoder.
+ * @param start Receives the output sample position to decode from.
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+int audio_checkpoint_attach_encoder(struct audio_checkpoint *cp,
+                                    struct audio_enc *encoder,
+                                    int64_t *start);
+
+/**
+ * @brief Open a raw PCM output: created when starting, truncated to the
+ *        checkpoint when resuming.
+ *
+ * @param cp Initialized checkpoint without a journal.
+ * @param path Output file.
+ * @param frame_bytes Bytes per sample for all channels.
+ * @param file Receives the file, positioned at its end.
+ * @param start Receives the output sample position to decode from.
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+int audio_checkpoint_open_file(struct audio_checkpoint *cp, const char *path,
+                               int frame_bytes, FILE **file, int64_t *start);
+
+/**
+ * @brief audio_enc packet sink: append a packet to the journal and
+ *        checkpoint when due.
+ *
+ * @param opaque The audio_checkpoint.
+ * @param pkt Packet with timestamps in samples; it is not unreferenced.
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+int audio_checkpoint_write_packet(void *opaque, AVPacket *pkt);
+
+/**
+ * @brief Account samples appended to a raw PCM output and checkpoint when
+ *        due.
+ *
+ * @param cp Initialized checkpoint.
+ * @param file The output file.
+ * @param nb_samples Samples per channel just written.
+ * @param bytes Bytes just written.
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+int audio_checkpoint_file_written(struct audio_checkpoint *cp, FILE *file,
+                                  int nb_samples, int64_t bytes);
+
+/**
+ * @brief Flush the encoder into the journal, mux the journal into the
+ *        output and write the trailer.
+ *
+ * @param cp Initialized checkpoint with a journal.
+ * @param encoder Encoder given to audio_checkpoint_attach_encoder().
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+int audio_checkpoint_finish(struct audio_checkpoint *cp,
+                            struct audio_enc *encoder);
+
+/**
+ * @brief Delete the state and journal after the output was completed, and
+ *        the directory if it is then empty.
+ *
+ * @param cp Initialized checkpoint.
+ */
+void audio_checkpoint_remove(struct audio_checkpoint *cp);
+
+/**
+ * @brief Close the journal and free the checkpoint. Files stay on disk.
+ *
+ * @param cp Checkpoint to free.
+ */
+void audio_checkpoint_free(struct audio_checkpoint *cp);
+
+#endif /* AUDIO_CHECKPOINT_H */
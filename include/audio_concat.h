@@ -0,0 +1,106 @@
+#ifndef AUDIO_CONCAT_H
+#define AUDIO_CONCAT_H
+
+#include <stdint.h>
+
+#include <libavutil/channel_layout.h>
+#include <libavutil/samplefmt.h>
+
+#include "audio_dec.h"
+#include "audio_pool.h"
+#include "audio_resample.h"
+
+/**
+ * @brief Several inputs decoded back to back as one continuous PCM stream.
+ *
+ * Every input gets its own decoder converting to the rate and layout of the
+ * first input (or the requested ones), so one encoder takes the whole
+ * playlist with continuous timestamps and no intermediate file. While an
+ * input plays, the next one is opened (probed, codec and resampler set up)
+ * on a background thread, so switching inputs does not stall the output.
+ *
+ * With a crossfade, the last `crossfade` samples of each input are held
+ * back and mixed with the start of the next one using equal-power gains.
+ * An input shorter than the crossfade plays entirely within the fade from
+ * the previous one and is not faded into the following input.
+ */
+struct audio_concat {
+  /** @brief Input files (owned by the caller) and the one playing. */
+  char *const *paths;
+  int nb_inputs;
+  int current;
+
+  /**
+   * @brief Decoder of the current input and, while prefetching, of the
+   *        next one.
+   */
+  struct audio_dec decoders[2];
+  int active;
+  int next_open;
+
+  /** @brief Runs the prefetch job; `next_ret` is its result. */
+  struct audio_pool pool;
+  int prefetching;
+  int next_ret;
+
+  /** @brief Output format, the same for every input (packed S16). */
+  int sample_rate;
+  int channels;
+  enum AVSampleFormat format;
+  AVChannelLayout ch_layout;
+  enum audio_resample_quality resample_quality;
+  int frame_bytes;
+
+  /** @brief Crossfade length in samples, 0 for none. */
+  int crossfade;
+
+  /** @brief End of the current input, held back for the next crossfade. */
+  uint8_t *hold;
+  int nb_held;
+
+  /** @brief End of the previous input, being mixed into the current one. */
+  uint8_t *tail;
+  int tail_len;
+  int tail_pos;
+
+  int done;
+};
+
+/**
+ * @brief Open the first input and start prefetching the second.
+ *
+ * @param concat Playlist to initialize.
+ * @param paths Input files, kept by reference until audio_concat_free().
+ * @param nb_inputs Number of inputs, at least 1.
+ * @param sample_rate Output rate, or 0 for the first input's rate.
+ * @param ch_layout Output layout, or NULL for the first input's channel
+ * count.
+ * @param resample_quality Resampler preset of every input.
+ * @param crossfade Seconds of overlap between consecutive inputs, or 0.
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+int audio_concat_init(struct audio_concat *concat, char *const *paths,
+                      int nb_inputs, int sample_rate,
+                      const AVChannelLayout *ch_layout,
+                      enum audio_resample_quality resample_quality,
+                      double crossfade);
+
+/**
+ * @brief Next chunk of the playlist.
+ *
+ * @param out_data Receives the PCM buffer (owned by the caller).
+ * @param out_size Size of the PCM data in bytes.
+ * @return 1 with a chunk, 0 after the last input, or a negative AVERROR code
+ * (e.g., an input that could not be opened).
+ */
+int audio_concat_read(struct audio_concat *concat, uint8_t **out_data,
+                      int *out_size);
+
+/**
+ * @brief Stop prefetching and free the decoders.
+ *
+ * @param concat Playlist to free.
+ */
+void audio_concat_free(struct audio_concat *concat);
+
+#endif /* AUDIO_CONCAT_H */
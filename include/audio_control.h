@@ -0,0 +1,60 @@
+#ifndef AUDIO_CONTROL_H
+#define AUDIO_CONTROL_H
+
+#include "audio_filter.h"
+
+/** Longest accepted control line, including the newline. */
+#define AUDIO_CONTROL_LINE_MAX 1024
+
+/**
+ * @brief Line-based control channel for live filter changes.
+ *
+ * Reads commands from a file or named pipe without blocking. Each line has
+ * the form
+ *
+ *     [@<seconds>] <target> <command> [<argument>]
+ *
+ * e.g. "atempo tempo 1.5" or "@12.5 volume volume -6dB". Lines with a time
+ * are applied sample-accurately at that input time, others immediately.
+ * Empty lines and lines starting with '#' are ignored.
+ */
+struct audio_control {
+  /**
+   * @brief Non-blocking descriptor of the control file or pipe.
+   */
+  int fd;
+
+  /**
+   * @brief Bytes of a line not terminated yet.
+   */
+  char buf[AUDIO_CONTROL_LINE_MAX];
+  int len;
+};
+
+/**
+ * @brief Open a control channel.
+ *
+ * @param ctl Control channel to initialize.
+ * @param path File or named pipe (mkfifo) to read commands from.
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+int audio_control_open(struct audio_control *ctl, const char *path);
+
+/**
+ * @brief Apply every complete command line that is currently available.
+ *
+ * Never blocks; call it between frames. Invalid or failing commands are
+ * reported and skipped.
+ *
+ * @param ctl Open control channel.
+ * @param filter Filter receiving the commands.
+ * @return Number of commands applied, or negative AVERROR on read errors.
+ */
+int audio_control_poll(struct audio_control *ctl, struct audio_filter *filter);
+
+/**
+ * @brief Close the control channel.
+ */
+void audio_control_close(struct audio_control *ctl);
+
+#endif /* AUDIO_CONTROL_H */
@@ -8,6 +8,24 @@
 #include <libavutil/samplefmt.h>
 #include <libswresample/swresample.h>
 
+#include "audio_resample.h"
+
+/**
+ * @brief Open the input with minimal probing and demuxer buffering.
+ *
+ * For live inputs: the first packets are decoded as soon as they arrive
+ * instead of after a long stream analysis.
+ */
+#define AUDIO_DEC_LOW_LATENCY (1 << 0)
+
+/**
+ * @brief Output packed float samples instead of S16.
+ *
+ * Keeps the full resolution of high-bit-depth inputs (e.g., 24-bit FLAC)
+ * through every later stage, for --bit-depth.
+ */
+#define AUDIO_DEC_FLOAT (1 << 1)
+
 /**
  * @brief Audio decoder abstraction built around FFmpeg.
  *
@@ -82,7 +100,8 @@ struct audio_dec {
   /**
    * @brief Target output sample rate in Hz (e.g., 44100).
    *
-   * The resampler will convert to this rate if the source differs.
+   * The resampler will convert to this rate if the source differs. Reducing
+   * the rate here means every later stage processes the smaller stream.
    */
   int sample_rate;
 
@@ -106,6 +125,32 @@ struct audio_dec {
    * Used together with `channels` for correct resampling.
    */
   AVChannelLayout dst_ch_layout;
+
+  /**
+   * @brief Output sample position that decoding resumes at after
+   *        audio_dec_seek(), or AV_NOPTS_VALUE.
+   *
+   * Seeking lands on a packet at or before the target; decoded samples
+   * before it are dropped.
+   */
+  int64_t skip_to;
+
+  /**
+   * @brief Set once audio_decoder_read() reached the end of input and
+   *        started draining the codec.
+   */
+  int draining;
+
+  /**
+   * @brief Set once the resampler was flushed at the end of input.
+   */
+  int flushed;
+
+  /**
+   * @brief Set when `fmt_ctx` is shared with other decoders
+   *        (audio_dec_init_stream()); it is then not closed.
+   */
+  int shared;
 };
 
 /**
@@ -114,28 +159,103 @@ struct audio_dec {
  * Opens the given audio file, finds the audio stream, initializes
  * codec and resampler contexts, and prepares everything for decoding.
  *
+ * Channel downmix and sample rate reduction are applied here, once, in the
+ * decoder's resampler so that the filter graph and encoder only ever see
+ * the reduced stream.
+ *
  * @param decoder Pointer to an `audio_dec` struct to initialize.
  * @param filename Path to the input audio file (e.g., "song.mp3").
+ * @param sample_rate Target sample rate in Hz, or 0 to keep the source rate.
+ * @param ch_layout Target channel layout, or NULL to keep the source channel
+ * count.
+ * @param resample_quality Resampler preset used when the rate changes.
+ * @param flags AUDIO_DEC_* flags.
  * @return 0 on success, negative AVERROR code on failure.
  */
-int audio_dec_init(struct audio_dec *decoder, const char *filename);
+int audio_dec_init(struct audio_dec *decoder, const char *filename,
+                   int sample_rate, const AVChannelLayout *ch_layout,
+                   enum audio_resample_quality resample_quality, int flags);
 
 /**
- * @brief Read and decode the next audio packet into PCM data.
+ * @brief Initialize a decoder for one stream of an already open input.
  *
- * Reads one packet from the input file, decodes it, resamples
- * to the desired format, and writes the resulting PCM buffer to `out_data`.
+ * For demuxing once and feeding several decoders: packets are read by the
+ * caller and passed to audio_dec_send_packet(); the decoder never reads
+ * from `fmt_ctx` itself and does not close it.
+ *
+ * @param decoder Pointer to an `audio_dec` struct to initialize.
+ * @param fmt_ctx Open input with stream information.
+ * @param stream_index Index of an audio stream of `fmt_ctx`.
+ * @return 0 on success, negative AVERROR code on failure.
+ *
+ * The other parameters are those of audio_dec_init().
+ */
+int audio_dec_init_stream(struct audio_dec *decoder, AVFormatContext *fmt_ctx,
+                          int stream_index, int sample_rate,
+                          const AVChannelLayout *ch_layout,
+                          enum audio_resample_quality resample_quality);
+
+/**
+ * @brief Send a packet of the decoder's stream, or NULL at end of input.
+ *
+ * Call audio_dec_receive() until it returns AVERROR(EAGAIN) before sending
+ * the next packet.
+ *
+ * @return 0 on success, negative AVERROR code if the packet was rejected.
+ */
+int audio_dec_send_packet(struct audio_dec *decoder, const AVPacket *pkt);
+
+/**
+ * @brief Take the next chunk of PCM data from the packets sent so far.
+ *
+ * @param decoder Initialized `audio_dec` instance.
+ * @param out_data Receives the PCM buffer (owned by the caller), or NULL
+ * if a chunk could not be converted.
+ * @param out_size Size of the PCM data in bytes.
+ * @return 1 with a chunk, AVERROR(EAGAIN) if the decoder needs another
+ * packet, AVERROR_EOF once drained and flushed, or another negative
+ * AVERROR code on failure.
+ */
+int audio_dec_receive(struct audio_dec *decoder, uint8_t **out_data,
+                      int *out_size);
+
+/**
+ * @brief Decode the next chunk of PCM data.
+ *
+ * Returns the next frame the decoder holds, reading packets only when it
+ * holds none, resamples it to the desired format, and writes the resulting
+ * PCM buffer to `out_data`. At the end of input the decoder and resampler
+ * are drained.
  *
  * This function can be called repeatedly to read sequential PCM chunks.
+ * A frame the codec fails to decode is logged and skipped, like a corrupt
+ * packet; a read error ends the input.
  *
  * @param decoder Initialized `audio_dec` instance.
- * @param out_data Pointer to the decoded PCM buffer (allocated by FFmpeg).
+ * @param out_data Pointer to the decoded PCM buffer (allocated by FFmpeg),
+ * or NULL if a chunk could not be converted.
  * @param out_size Size of the decoded PCM data in bytes.
- * @return 1 on successful frame read, 0 on EOF, negative on error.
+ * @return 1 on successful frame read, 0 on EOF, or a negative AVERROR code
+ * on a failure that ends the decode (e.g., out of memory).
  */
 int audio_decoder_read(struct audio_dec *decoder, uint8_t **out_data,
                        int *out_size);
 
+/**
+ * @brief Continue decoding at an output sample position.
+ *
+ * Seeks the demuxer to the packet at or before `sample`, flushes the codec
+ * and resampler, and drops the decoded samples before `sample`, so the next
+ * audio_decoder_read() starts exactly there (to the accuracy of the
+ * stream's timestamps).
+ *
+ * @param decoder Initialized `audio_dec` instance.
+ * @param sample Position in samples at the output rate.
+ * @return 0 on success, negative AVERROR code on failure (e.g., the input
+ * is not seekable).
+ */
+int audio_dec_seek(struct audio_dec *decoder, int64_t sample);
+
 /**
  * @brief Release all allocated FFmpeg resources.
  *
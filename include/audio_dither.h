@@ -0,0 +1,85 @@
+#ifndef AUDIO_DITHER_H
+#define AUDIO_DITHER_H
+
+#include <stdint.h>
+
+#include <libavutil/frame.h>
+#include <libavutil/samplefmt.h>
+
+/** Shape the dither noise towards high frequencies. */
+#define AUDIO_DITHER_SHAPED (1 << 0)
+
+/** Convert without dither (plain rounding). */
+#define AUDIO_DITHER_NONE (1 << 1)
+
+/**
+ * @brief Final conversion of float frames to integer samples.
+ *
+ * The float pipeline (--bit-depth) keeps every stage in float and converts
+ * to integers exactly once, here, right before the encoder or raw output.
+ * 16- and 24-bit output get TPDF dither of +-1 LSB from the SIMD kernels of
+ * audio_dsp, which decorrelates the rounding error from the signal; 24-bit
+ * samples are stored in the top bits of S32. 32-bit output is not dithered,
+ * float holds less precision than its LSB.
+ *
+ * With AUDIO_DITHER_SHAPED, each channel's rounding error is fed back to
+ * the next sample (first-order error feedback), which moves the noise
+ * towards high frequencies where it is less audible. The feedback is
+ * sequential per channel, so this path is scalar.
+ *
+ * The generator is seeded the same for every run, so outputs are
+ * reproducible (e.g., for the output cache).
+ */
+struct audio_dither {
+  /** @brief Significant bits (16, 24 or 32) and output format. */
+  int bits;
+  enum AVSampleFormat format;
+  int channels;
+  int flags;
+
+  /** @brief xorshift generators, one per vector lane. */
+  uint32_t state[4];
+
+  /** @brief Last rounding error per channel, in LSB (noise shaping). */
+  float *error;
+
+  /** @brief Converted frame, reused for every call. */
+  AVFrame *frame;
+
+  /** @brief Statistics: samples converted and time spent, in us. */
+  int64_t samples;
+  int64_t time_us;
+};
+
+/**
+ * @brief Prepare the conversion of float frames to `bits`-bit integers.
+ *
+ * @param dither Converter to initialize.
+ * @param bits 16, 24 or 32.
+ * @param channels Channel count of the frames.
+ * @param flags AUDIO_DITHER_* flags.
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+int audio_dither_init(struct audio_dither *dither, int bits, int channels,
+                      int flags);
+
+/**
+ * @brief Convert a packed float frame.
+ *
+ * @param dither Initialized converter.
+ * @param in Frame in AV_SAMPLE_FMT_FLT.
+ * @param out Receives the converted frame (S16 or S32), owned by the
+ * converter and valid until the next call.
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+int audio_dither_process(struct audio_dither *dither, const AVFrame *in,
+                         AVFrame **out);
+
+/**
+ * @brief Free the converter's buffers.
+ *
+ * @param dither Converter to free.
+ */
+void audio_dither_free(struct audio_dither *dither);
+
+#endif /* AUDIO_DITHER_H */
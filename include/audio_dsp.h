@@ -0,0 +1,277 @@
+#ifndef AUDIO_DSP_H
+#define AUDIO_DSP_H
+
+#include <stdint.h>
+
+#include <libavutil/channel_layout.h>
+#include <libavutil/frame.h>
+#include <libavutil/samplefmt.h>
+
+/** Maximum number of operations in a native filter chain. */
+#define AUDIO_DSP_MAX_OPS 16
+
+/** Maximum channel count handled by the native downmix matrix. */
+#define AUDIO_DSP_MAX_CHANNELS 8
+
+/**
+ * @brief Operations supported by the native filter engine.
+ *
+ * Each one mirrors a libavfilter filter so that a `--filter` string made only
+ * of these can run without building a filter graph:
+ * - GAIN: `volume`
+ * - FADE: `afade` (tri and log curves)
+ * - MATRIX: `pan` (mono/stereo downmix and channel mapping)
+ * - CLIP: `asoftclip` (hard, cubic and tanh types)
+ */
+enum audio_dsp_op_type {
+  AUDIO_DSP_GAIN = 0,
+  AUDIO_DSP_FADE,
+  AUDIO_DSP_MATRIX,
+  AUDIO_DSP_CLIP,
+};
+
+enum audio_dsp_curve {
+  AUDIO_DSP_CURVE_TRI = 0, /* linear ramp */
+  AUDIO_DSP_CURVE_LOG,     /* logarithmic ramp, as afade's "log" */
+};
+
+enum audio_dsp_clip {
+  AUDIO_DSP_CLIP_HARD = 0,
+  AUDIO_DSP_CLIP_CUBIC,
+  AUDIO_DSP_CLIP_TANH,
+};
+
+/**
+ * @brief A single configured operation of a native filter chain.
+ */
+struct audio_dsp_op {
+  enum audio_dsp_op_type type;
+
+  /** GAIN: linear gain factor. */
+  float gain;
+  /** GAIN: gain scheduled by a command, taking effect at sample `next_at`. */
+  int has_next;
+  float next_gain;
+  int64_t next_at;
+
+  /** FADE: 1 for fade-in, 0 for fade-out. */
+  int fade_in;
+  /** FADE: first sample of the fade, in samples from stream start. */
+  int64_t start;
+  /** FADE: fade length in samples. */
+  int64_t length;
+  /** FADE: gain curve. */
+  enum audio_dsp_curve curve;
+
+  /** MATRIX: input and output channel counts. */
+  int in_channels;
+  int out_channels;
+  /** MATRIX: row-major gains, matrix[out * in_channels + in]. */
+  float matrix[AUDIO_DSP_MAX_CHANNELS * AUDIO_DSP_MAX_CHANNELS];
+
+  /** CLIP: clipping curve, input threshold and output gain. */
+  enum audio_dsp_clip clip;
+  float threshold;
+  float output;
+};
+
+/**
+ * @brief Native replacement for a simple libavfilter chain.
+ *
+ * All operations run in place on interleaved S16 or FLT frame buffers. The
+ * chain tracks the stream position itself, so fades stay sample accurate
+ * even when frames carry no timestamps.
+ */
+struct audio_dsp_chain {
+  struct audio_dsp_op ops[AUDIO_DSP_MAX_OPS];
+  int nb_ops;
+
+  int sample_rate;
+  enum AVSampleFormat format;
+
+  /** Channel layout of frames entering and leaving the chain. */
+  AVChannelLayout in_layout;
+  AVChannelLayout out_layout;
+
+  /** Number of samples processed so far (per channel). */
+  int64_t position;
+
+  /** Scratch buffer for per-sample gain curves. */
+  float *scratch;
+  int scratch_size;
+};
+
+/**
+ * @brief Build a native chain from an FFmpeg filter description.
+ *
+ * Succeeds only when every filter in the comma-separated chain (and every
+ * option used) is supported natively; anything else, such as expressions,
+ * labels or unknown filters, makes the caller fall back to libavfilter.
+ *
+ * @param chain Chain to initialize.
+ * @param filter_desc FFmpeg filter string (e.g., "volume=0.5,afade=t=in:d=2").
+ * @param sample_rate Input sample rate in Hz.
+ * @param format Input sample format (AV_SAMPLE_FMT_S16 or AV_SAMPLE_FMT_FLT).
+ * @param ch_layout Input channel layout.
+ * @return 0 on success, AVERROR(ENOSYS) if the chain is not supported
+ *         natively, or another negative AVERROR code on failure.
+ */
+int audio_dsp_chain_init(struct audio_dsp_chain *chain, const char *filter_desc,
+                         int sample_rate, enum AVSampleFormat format,
+                         const AVChannelLayout *ch_layout);
+
+/**
+ * @brief Run the chain in place on a writable frame.
+ *
+ * A MATRIX operation may reduce the channel count; the frame's channel
+ * layout is updated accordingly.
+ *
+ * @param chain Initialized chain.
+ * @param frame Writable interleaved frame in the chain's input format.
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+int audio_dsp_chain_process(struct audio_dsp_chain *chain, AVFrame *frame);
+
+/**
+ * @brief Change a parameter of a running chain.
+ *
+ * Mirrors the `volume` filter's runtime command: `target` is "volume" or
+ * "all", `cmd` is "volume" and `arg` a gain or dB value. The change takes
+ * effect at sample `at` of the stream (exactly, even inside a frame), or
+ * on the next frame when `at` is negative. A later timed command replaces
+ * one that has not taken effect yet.
+ *
+ * @return 0 on success, AVERROR(ENOSYS) if no operation supports the
+ *         command, or AVERROR(EINVAL) for an invalid argument.
+ */
+int audio_dsp_chain_command(struct audio_dsp_chain *chain, const char *target,
+                            const char *cmd, const char *arg, int64_t at);
+
+/**
+ * @brief Free the chain's buffers.
+ */
+void audio_dsp_chain_free(struct audio_dsp_chain *chain);
+
+/**
+ * @brief Multiply interleaved S16 samples by a constant gain (saturating).
+ */
+void audio_dsp_gain_s16(int16_t *samples, int count, float gain);
+
+/**
+ * @brief Multiply interleaved float samples by a constant gain.
+ */
+void audio_dsp_gain_flt(float *samples, int count, float gain);
+
+/**
+ * @brief Multiply S16 samples element-wise by a gain array (saturating).
+ */
+void audio_dsp_gains_s16(int16_t *samples, const float *gains, int count);
+
+/**
+ * @brief Multiply float samples element-wise by a gain array.
+ */
+void audio_dsp_gains_flt(float *samples, const float *gains, int count);
+
+/**
+ * @brief Add S16 samples times a gain to a float accumulator (S16 scale).
+ */
+void audio_dsp_mix_s16(float *acc, const int16_t *samples, int count,
+                       float gain);
+
+/**
+ * @brief Convert a float accumulator (S16 scale) to S16, saturating.
+ */
+void audio_dsp_store_s16(int16_t *dst, const float *acc, int count);
+
+/**
+ * @brief Convert float samples (full scale is 1.0) to S16 with TPDF dither
+ *        of +-1 LSB if `state` is not NULL, saturating.
+ *
+ * `state` holds four xorshift generators, one per vector lane; it must not
+ * be all zero.
+ */
+void audio_dsp_dither_s16(int16_t *dst, const float *src, int count,
+                          uint32_t *state);
+
+/**
+ * @brief Convert float samples to `bits`-bit integers (16 to 32) in the top
+ *        bits of S32, with TPDF dither if `state` is not NULL, saturating.
+ */
+void audio_dsp_dither_s32(int32_t *dst, const float *src, int count, int bits,
+                          uint32_t *state);
+
+/**
+ * @brief Apply a channel matrix in place to interleaved float samples.
+ *
+ * `out_channels` must not exceed `in_channels`.
+ */
+void audio_dsp_matrix_flt(float *samples, int nb_samples, int in_channels,
+                          int out_channels, const float *matrix);
+
+/**
+ * @brief Apply a channel matrix in place to interleaved S16 samples.
+ *
+ * `out_channels` must not exceed `in_channels`.
+ */
+void audio_dsp_matrix_s16(int16_t *samples, int nb_samples, int in_channels,
+                          int out_channels, const float *matrix);
+
+/**
+ * @brief Clip float samples in place (full scale is 1.0).
+ */
+void audio_dsp_clip_flt(float *samples, int count, enum audio_dsp_clip type,
+                        float threshold, float output);
+
+/**
+ * @brief Clip S16 samples in place (full scale is 32768).
+ */
+void audio_dsp_clip_s16(int16_t *samples, int count, enum audio_dsp_clip type,
+                        float threshold, float output);
+
+/**
+ * @brief Update the minimum, maximum and sum of squares of float samples.
+ *
+ * `min` and `max` are read as the starting values; the sum is added to
+ * `sumsq`.
+ */
+void audio_dsp_stats_flt(const float *samples, int count, float *min,
+                         float *max, double *sumsq);
+
+/**
+ * @brief Find the first and last sample whose magnitude exceeds `threshold`.
+ *
+ * `first` and `last` receive sample indexes, or -1 if every sample is at or
+ * under the threshold.
+ */
+void audio_dsp_find_loud_flt(const float *samples, int count, float threshold,
+                             int *first, int *last);
+
+/**
+ * @brief S16 variant of audio_dsp_find_loud_flt().
+ */
+void audio_dsp_find_loud_s16(const int16_t *samples, int count,
+                             int16_t threshold, int *first, int *last);
+
+/**
+ * @brief Convert one channel of a packed or planar s16, s32, flt or dbl
+ *        frame to floats (full scale is 1.0).
+ *
+ * `count` samples of channel `c`, starting at sample `offset` of the frame,
+ * are written `stride` floats apart from `dst` on, so the caller picks the
+ * layout: planar (1), interleaved (channels) or grouped. Returns
+ * AVERROR(EINVAL) for other formats.
+ */
+int audio_dsp_read_channel(const AVFrame *frame, int c, int offset, int count,
+                           float *dst, int stride);
+
+/**
+ * @brief Convert samples of a packed or planar s16, s32, flt or dbl frame to
+ *        planar floats (full scale is 1.0).
+ *
+ * `dst[c]` receives `count` samples of channel `c`, starting at sample
+ * `offset` of the frame. Returns AVERROR(EINVAL) for other formats.
+ */
+int audio_dsp_read_float(const AVFrame *frame, int offset, int count,
+                         float *const *dst);
+
+#endif /* AUDIO_DSP_H */
@@ -9,6 +9,9 @@
 #include <libavutil/samplefmt.h>
 #include <libswresample/swresample.h>
 
+#include "audio_pacer.h"
+#include "audio_resample.h"
+
 /**
  * @brief Quality presets for audio encoding.
  *
@@ -23,6 +26,39 @@ enum audio_quality {
   AUDIO_QUALITY_EXTREME = 3, /* 320k+ for lossy, max compression for lossless */
 };
 
+/**
+ * @brief Encode and mux for minimal end-to-end latency.
+ *
+ * Short codec frames (Opus `application=lowdelay`, AAC-ELD through
+ * libfdk_aac when available), unbuffered muxing with av_write_frame() and
+ * per-packet flushing, and input-to-output latency measurement.
+ */
+#define AUDIO_ENC_LOW_LATENCY (1 << 0)
+
+/**
+ * @brief Release packets in real time according to their timestamps.
+ *
+ * For streaming to network outputs (udp://, rtp://, tcp://). Packets are
+ * paced by `audio_enc.pacer` and flushed one by one.
+ */
+#define AUDIO_ENC_REALTIME (1 << 1)
+
+/**
+ * @brief Encode 32-bit integer samples, with the given number of
+ *        significant bits, or float samples, instead of the codec's first
+ *        sample format.
+ *
+ * For --bit-depth with lossless codecs: the codec must be lossless and
+ * support a matching sample format (e.g., flac and alac for 24 bits,
+ * pcm_s32le for 32, pcm_f32le for float).
+ */
+#define AUDIO_ENC_S32_24 (1 << 2)
+#define AUDIO_ENC_S32 (1 << 3)
+#define AUDIO_ENC_FLT (1 << 4)
+
+/** Number of input frames remembered for latency measurement. */
+#define AUDIO_ENC_LATENCY_SLOTS 64
+
 /**
  * @brief Audio encoder abstraction built around FFmpeg.
  *
@@ -93,6 +129,86 @@ struct audio_enc {
    * Handles sample format and channel layout conversions.
    */
   SwrContext *swr_ctx;
+
+  /**
+   * @brief Quality preset applied to `swr_ctx` when it is initialized.
+   *
+   * Only relevant when a filter changed the sample rate; requested output
+   * rates are normally applied once, in the decoder.
+   */
+  enum audio_resample_quality resample_quality;
+
+  /**
+   * @brief Whether input frames bypass the resampler.
+   *
+   * Set on the first frame: 1 when frames already have the encoder's sample
+   * format, rate and layout. Correctly sized frames (e.g., from a filter
+   * with audio_filter_set_frame_size()) then skip the FIFO as well.
+   * -1 until the first frame arrives.
+   */
+  int direct;
+
+  /**
+   * @brief AUDIO_ENC_* flags given to audio_enc_init().
+   */
+  int flags;
+
+  /**
+   * @brief Decode time (av_gettime_relative()) of recent input frames,
+   *        indexed by their first sample position in the encoder's timeline.
+   *
+   * Ring buffer of the last AUDIO_ENC_LATENCY_SLOTS frames, filled only in
+   * low-latency mode; `nb_arrivals` counts every frame ever recorded.
+   */
+  int64_t arrival_pos[AUDIO_ENC_LATENCY_SLOTS];
+  int64_t arrival_time[AUDIO_ENC_LATENCY_SLOTS];
+  int64_t nb_arrivals;
+
+  /**
+   * @brief Input samples received so far, at the encoder's sample rate.
+   */
+  int64_t in_samples;
+
+  /**
+   * @brief Input-to-output latency of written packets, in microseconds.
+   *
+   * Measured from the decode of a packet's first sample to the packet being
+   * handed to the output, so it includes filtering, queueing, FIFO
+   * buffering and codec delay. Only tracked in low-latency mode.
+   */
+  int64_t latency_last;
+  int64_t latency_max;
+  int64_t latency_sum;
+  int latency_count;
+
+  /**
+   * @brief Wall-clock pacing of written packets (AUDIO_ENC_REALTIME only).
+   */
+  struct audio_pacer pacer;
+
+  /**
+   * @brief Packets with a pts below this (in samples) are not written.
+   *
+   * INT64_MIN by default. Used to encode priming samples that warm up the
+   * codec without emitting them, e.g. for gapless segment boundaries.
+   */
+  int64_t min_pts;
+
+  /**
+   * @brief Receives encoded packets instead of the muxer when set.
+   *
+   * Packet timestamps are still in the codec time base (samples). Used to
+   * journal packets for checkpointed output; they reach the file later
+   * through audio_enc_write_packet().
+   */
+  int (*packet_sink)(void *opaque, AVPacket *pkt);
+  void *sink_opaque;
+
+  /**
+   * @brief Set when `fmt_ctx` is a container shared with other encoders
+   *        (audio_enc_init_shared()); it is then neither closed nor freed.
+   */
+  int shared;
 };
 
 /**
@@ -109,20 +225,68 @@ struct audio_enc {
  * - alac: Apple Lossless encoding
  * - pcm_s16le: Raw 16-bit PCM (WAV)
  *
+ * Network URLs are opened through avio as well. Their container defaults to
+ * "rtp" for rtp:// and "mpegts" for udp:// and tcp:// URLs.
+ *
  * @param encoder Pointer to audio_enc struct to initialize.
- * @param filename Output file path (determines container format).
+ * @param filename Output file path or URL.
+ * @param format_name Container name (e.g., "mpegts", "ogg"), or NULL to
+ * guess it from `filename`.
  * @param codec_name FFmpeg codec name (e.g., "libmp3lame", "libopus").
  * @param sample_rate Output sample rate in Hz (e.g., 44100).
  * @param ch_layout Channel layout structure (e.g., stereo, mono).
  * @param quality Quality preset (AUDIO_QUALITY_LOW to AUDIO_QUALITY_EXTREME).
  * @param bitrate_str Explicit bitrate string (e.g., "192k"), or NULL to use
  * quality preset.
+ * @param resample_quality Resampler preset used when the input sample rate
+ * differs from `sample_rate`.
+ * @param flags AUDIO_ENC_* flags.
+ * @param frame_ms Codec frame duration in milliseconds (Opus: 2.5, 5, 10, 20,
+ * 40 or 60), or 0 for the codec default (5 ms with AUDIO_ENC_LOW_LATENCY).
  * @return 0 on success, negative AVERROR code on failure.
  */
 int audio_enc_init(struct audio_enc *encoder, const char *filename,
-                   const char *codec_name, int sample_rate,
+                   const char *format_name, const char *codec_name,
+                   int sample_rate,
                    const AVChannelLayout *ch_layout, enum audio_quality quality,
-                   const char *bitrate_str);
+                   const char *bitrate_str,
+                   enum audio_resample_quality resample_quality, int flags,
+                   double frame_ms);
+
+/**
+ * @brief Initialize an encoder for one stream of a container shared with
+ *        other encoders.
+ *
+ * Adds an audio stream to `fmt_ctx` and opens the codec, but neither opens
+ * the output nor writes the header: the owner of `fmt_ctx` does that once
+ * every stream was added, muxes the packets (e.g., collected with
+ * `packet_sink` and passed to audio_enc_write_packet()) and writes the
+ * trailer. Flush the encoder with audio_enc_write_frame(encoder, NULL)
+ * instead of audio_enc_finalize().
+ *
+ * @param encoder Pointer to audio_enc struct to initialize.
+ * @param fmt_ctx Output container, before avformat_write_header().
+ * @return 0 on success, negative AVERROR code on failure.
+ *
+ * The other parameters are those of audio_enc_init().
+ */
+int audio_enc_init_shared(struct audio_enc *encoder, AVFormatContext *fmt_ctx,
+                          const char *codec_name, int sample_rate,
+                          const AVChannelLayout *ch_layout,
+                          enum audio_quality quality, const char *bitrate_str,
+                          enum audio_resample_quality resample_quality,
+                          double frame_ms);
+
+/**
+ * @brief Write the SDP description of an RTP output.
+ *
+ * Receivers need it to decode the RTP stream (e.g., `ffplay file.sdp`).
+ *
+ * @param encoder Initialized audio_enc instance with an "rtp" output.
+ * @param path File to write, or NULL to print it to stdout.
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+int audio_enc_write_sdp(struct audio_enc *encoder, const char *path);
 
 /**
  * @brief Encode and write a PCM audio frame to the output file.
@@ -130,12 +294,27 @@ int audio_enc_init(struct audio_enc *encoder, const char *filename,
  * Sends a PCM frame to the encoder, retrieves compressed packets,
  * and writes them to the output file.
  *
+ * In low-latency mode, `frame->opaque` may hold the av_gettime_relative()
+ * time at which the frame's first sample was decoded (cast to intptr_t);
+ * latency is measured from there instead of from this call. libavfilter
+ * carries `opaque` through filter graphs with the other frame properties.
+ *
  * @param encoder Initialized audio_enc instance.
  * @param frame PCM audio frame to encode (NULL to flush encoder).
  * @return 0 on success, negative AVERROR code on failure.
  */
 int audio_enc_write_frame(struct audio_enc *encoder, AVFrame *frame);
 
+/**
+ * @brief Mux an encoded packet into the output file.
+ *
+ * @param encoder Initialized audio_enc instance.
+ * @param pkt Packet with timestamps in the codec time base (samples); it is
+ * unreferenced.
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+int audio_enc_write_packet(struct audio_enc *encoder, AVPacket *pkt);
+
 /**
  * @brief Finalize encoding and close the output file.
  *
@@ -0,0 +1,169 @@
+#ifndef AUDIO_FEATURES_H
+#define AUDIO_FEATURES_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <libavutil/frame.h>
+#include <libavutil/tx.h>
+#include <libswresample/swresample.h>
+
+#include "audio_pool.h"
+
+/** Defaults: 16 kHz, 25 ms window, 10 ms hop, 80 mel bands. */
+#define AUDIO_FEATURES_RATE 16000
+#define AUDIO_FEATURES_WINDOW 400
+#define AUDIO_FEATURES_HOP 160
+#define AUDIO_FEATURES_MELS 80
+
+/** Feature frames computed by one pool job. */
+#define AUDIO_FEATURES_BATCH 64
+
+/** Floor applied to mel energies before the logarithm. */
+#define AUDIO_FEATURES_FLOOR 1e-10f
+
+/**
+ * @brief Log-mel analysis settings.
+ */
+struct audio_features_config {
+  /** @brief Rate the audio is resampled to, in Hz. */
+  int sample_rate;
+  /** @brief Window length and hop, in samples at `sample_rate`. */
+  int window;
+  int hop;
+  /** @brief Number of mel bands. */
+  int n_mels;
+};
+
+/**
+ * @brief Per-job FFT state and output range.
+ */
+struct audio_features_job {
+  struct audio_features *feat;
+  AVTXContext *tx;
+  av_tx_fn tx_fn;
+  float *fft_in;
+  AVComplexFloat *fft_out;
+  float *power;
+  /** @brief Frames of the current block this job computes. */
+  int first;
+  int count;
+};
+
+/**
+ * @brief Streaming log-mel spectrogram written as a .npy tensor.
+ *
+ * Frames are downmixed to mono and resampled to the configured rate. Frame
+ * `i` covers samples [i * hop, i * hop + window) under a periodic Hann
+ * window, zero-padded to the next power of two for the real FFT (libavutil's
+ * tx, which has SIMD implementations). The power spectrum goes through
+ * triangular HTK mel filters between 0 Hz and Nyquist and the natural
+ * logarithm of max(energy, AUDIO_FEATURES_FLOOR) is stored. The tail of the
+ * stream is zero-padded into a last frame.
+ *
+ * Samples are collected into blocks of AUDIO_FEATURES_BATCH frames per pool
+ * thread; the jobs of a block run in parallel and the block is appended in
+ * order. The output is a little- or big-endian (host order) float32 .npy
+ * file of shape (frames, n_mels) whose data starts at a 64-byte aligned
+ * offset, so it can be memory-mapped (numpy.load(path, mmap_mode="r")).
+ *
+ * The input format is taken from the first frame; later frames must match.
+ */
+struct audio_features {
+  struct audio_features_config config;
+  /** @brief FFT length: window rounded up to a power of two. */
+  int n_fft;
+  int nb_bins;
+
+  FILE *file;
+  /** @brief Feature frames written so far. */
+  int64_t frames;
+
+  /** @brief Downmix and resampler to the analysis format. */
+  SwrContext *swr;
+  int sample_rate;
+  int channels;
+
+  /** @brief Analysis window and mel filters (band `m` weights bins
+   *         `mel_start[m]` to `mel_start[m] + mel_len[m] - 1`). */
+  float *window;
+  float *mel_weights;
+  int *mel_start;
+  int *mel_len;
+  int *mel_offset;
+
+  /**
+   * @brief Mono samples not consumed yet; the first `covered` of them
+   *        already belong to an earlier frame.
+   */
+  float *pending;
+  int nb_pending;
+  int block_samples;
+  int covered;
+
+  /** @brief Output of one block, frames x n_mels. */
+  float *output;
+
+  struct audio_pool pool;
+  struct audio_features_job *jobs;
+  int nb_jobs;
+
+  /** @brief Resampler output. */
+  float *scratch;
+  unsigned int scratch_size;
+};
+
+/**
+ * @brief Fill a configuration with the defaults.
+ */
+void audio_features_config_default(struct audio_features_config *config);
+
+/**
+ * @brief Parse "key=value" settings (rate, window, hop, mels) separated by
+ *        commas into a configuration.
+ *
+ * @return 0 on success, AVERROR(EINVAL) for unknown keys or invalid values.
+ */
+int audio_features_config_parse(struct audio_features_config *config,
+                                const char *str);
+
+/**
+ * @brief Create the output file and start the worker pool.
+ *
+ * @param feat Extractor to initialize.
+ * @param path Output .npy file.
+ * @param config Analysis settings.
+ * @param nb_threads Pool threads, or <= 0 for one per CPU core.
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+int audio_features_init(struct audio_features *feat, const char *path,
+                        const struct audio_features_config *config,
+                        int nb_threads);
+
+/**
+ * @brief Add a frame.
+ *
+ * @param feat Initialized extractor.
+ * @param frame Frame in any sample format; it is not modified.
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+int audio_features_process(struct audio_features *feat, const AVFrame *frame);
+
+/**
+ * @brief Compute the remaining frames, write the final header and close the
+ *        file.
+ *
+ * @param feat Extractor.
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+int audio_features_finish(struct audio_features *feat);
+
+/**
+ * @brief Stop the pool and free the extractor. The file is closed if still
+ *        open.
+ *
+ * @param feat Extractor to free.
+ */
+void audio_features_free(struct audio_features *feat);
+
+#endif /* AUDIO_FEATURES_H */
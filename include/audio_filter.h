@@ -8,40 +8,131 @@
 #include <libavfilter/buffersink.h>
 #include <libavfilter/buffersrc.h>
 #include <libavformat/avformat.h>
+#include <libavutil/audio_fifo.h>
 #include <libavutil/opt.h>
 
+#include "audio_dsp.h"
+#include "audio_pool.h"
+
+/**
+ * Run channel-independent chains as one mono graph per channel, in parallel
+ * on a thread pool, and re-interleave the results.
+ */
+#define AUDIO_FILTER_SPLIT_CHANNELS (1 << 0)
+
+/** Maximum number of timed commands waiting for their input frame. */
+#define AUDIO_FILTER_MAX_PENDING 32
+
+struct audio_filter_channel;
+
 struct audio_filter {
   AVFilterGraph *graph;
   AVFilterContext *src_ctx;
   AVFilterContext *sink_ctx;
+
+  /* Native fast path, used instead of the graph when `use_dsp` is set */
+  int use_dsp;
+  int dsp_eof;
+  struct audio_dsp_chain dsp;
+  AVFrame *dsp_frame;
+
+  /* Input sample rate, for converting command times to sample positions */
+  int sample_rate;
+  /* Sample positions of queued commands; input frames are cut there so the
+   * commands take effect sample-accurately */
+  int64_t pending[AUDIO_FILTER_MAX_PENDING];
+  int nb_pending;
+
+  /* Per-channel mode (AUDIO_FILTER_SPLIT_CHANNELS), used when `nb_split` > 0 */
+  int nb_split;
+  struct audio_filter_channel *split;
+  struct audio_pool split_pool;
+  AVChannelLayout split_layout;
+  enum AVSampleFormat split_fmt;
+  int split_rate;
+  int split_frame_size;
+  int split_eof;
+  int64_t split_pts;
+  uint8_t *split_scratch;
+  int split_scratch_size;
+
+  /* Input bytes pushed since the filter last produced a frame, and their
+   * limit (0 for none): a graph that keeps swallowing input, e.g. areverse,
+   * fails instead of growing without bound */
+  int64_t held_bytes;
+  int64_t max_held_bytes;
+};
+
+/* One channel of the per-channel mode: a mono graph and its output FIFO */
+struct audio_filter_channel {
+  struct audio_filter filter;
+  AVFrame *in;
+  AVFrame *out;
+  AVAudioFifo *fifo;
+  int flush;
+  int ret;
 };
 
 /**
  * Initialize audio filter with a simple filter description (e.g. atempo,
  * asetrate).
  *
+ * Chains made only of volume, pan, afade and asoftclip run on the native
+ * DSP engine (audio_dsp.h) without building a libavfilter graph.
+ *
  * @param filter   Pointer to filter struct.
  * @param sample_rate Input audio sample rate.
  * @param format   Audio sample format.
  * @param ch_layout Audio channel layout.
  * @param filter_desc FFmpeg filter string (e.g. "atempo=1.2,aresample=44100").
+ * @param nb_threads libavfilter threads (or channel pool size in split mode),
+ *                   0 for the default.
+ * @param flags    AUDIO_FILTER_* flags.
  * @return 0 on success, negative AVERROR on failure.
  */
 int audio_filter_init(struct audio_filter *filter, int sample_rate,
                       enum AVSampleFormat format,
                       const AVChannelLayout *ch_layout,
-                      const char *filter_desc);
+                      const char *filter_desc, int nb_threads, int flags);
 
 /**
- * Push a decoded audio frame into the filter.
+ * Push a decoded audio frame into the filter, or NULL to flush.
+ * The frame's references are moved into the filter and the frame is reset.
  */
 int audio_filter_push(struct audio_filter *filter, AVFrame *frame);
 
 /**
- * Pull a filtered frame out of the filter.
- * Caller must free the frame with av_frame_free().
+ * Pull a filtered frame out of the filter into a caller-owned frame.
+ * The frame is unreferenced first, so one AVFrame can be reused for every
+ * pull. Returns AVERROR(EAGAIN) when more input is needed and AVERROR_EOF
+ * once a flushed filter is fully drained.
+ */
+int audio_filter_pull(struct audio_filter *filter, AVFrame *frame);
+
+/**
+ * Change a filter parameter without rebuilding the graph, e.g.
+ * ("atempo", "tempo", "1.5") or ("volume", "volume", "-6dB"). `target` is a
+ * filter instance or filter name, or "all". With `time` >= 0 (seconds of
+ * input) the change is queued and takes effect at exactly that sample;
+ * otherwise it applies immediately. The native engine supports volume
+ * commands; in per-channel mode every channel graph gets the command.
+ * Returns AVERROR(ENOSYS) if no filter in the chain handles the command.
+ */
+int audio_filter_command(struct audio_filter *filter, const char *target,
+                         const char *cmd, const char *arg, double time);
+
+/**
+ * Make pulled frames hold exactly `nb_samples` samples (except the last),
+ * e.g. the encoder's frame_size.
+ */
+void audio_filter_set_frame_size(struct audio_filter *filter, int nb_samples);
+
+/**
+ * Limit the input the filter may hold without producing output to
+ * `max_bytes` (0 for no limit); beyond it audio_filter_push() fails with
+ * AVERROR(ENOBUFS). Also resets the count, e.g. for a cached filter.
  */
-int audio_filter_pull(struct audio_filter *filter, AVFrame **out_frame);
+void audio_filter_set_max_held(struct audio_filter *filter, int64_t max_bytes);
 
 /**
  * Free and cleanup all filter resources.
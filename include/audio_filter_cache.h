@@ -0,0 +1,111 @@
+#ifndef AUDIO_FILTER_CACHE_H
+#define AUDIO_FILTER_CACHE_H
+
+#include <stdint.h>
+
+#include "audio_filter.h"
+#include "audio_pool.h"
+
+/** Number of distinct filter configurations kept by a cache. */
+#define AUDIO_FILTER_CACHE_SIZE 8
+
+/**
+ * @brief One cached filter configuration and its prebuilt spare.
+ */
+struct audio_filter_cache_entry {
+  /**
+   * @brief Key: filter description, input format and init options.
+   */
+  char *desc;
+  int sample_rate;
+  enum AVSampleFormat format;
+  AVChannelLayout ch_layout;
+  int nb_threads;
+  int flags;
+
+  /**
+   * @brief Configured, never used filter for the next job (may be NULL).
+   */
+  struct audio_filter *spare;
+
+  /**
+   * @brief Use counter value of the last acquire, for LRU eviction.
+   */
+  int64_t last_use;
+};
+
+/**
+ * @brief Per-worker cache of configured filters for batch workloads.
+ *
+ * libavfilter graphs cannot be rewound once they have seen end of stream,
+ * so finished filters are not recycled. Instead, every acquire hands out a
+ * filter that was configured in the background while the previous job with
+ * the same key was running, and immediately starts building the next one.
+ * Jobs that repeat a configuration therefore see no graph parsing or
+ * format negotiation in their setup path. Finished filters are freed in the
+ * background too.
+ *
+ * A cache is not thread safe; use one per worker thread.
+ */
+struct audio_filter_cache {
+  struct audio_filter_cache_entry entries[AUDIO_FILTER_CACHE_SIZE];
+  int nb_entries;
+
+  /**
+   * @brief Background thread that builds spares and frees used filters.
+   */
+  struct audio_pool pool;
+
+  /**
+   * @brief Monotonic use counter.
+   */
+  int64_t clock;
+
+  /**
+   * @brief Acquires served by a spare (hits) or built on demand (misses),
+   *        and the setup time spent in each, in microseconds.
+   */
+  int hits;
+  int misses;
+  int64_t hit_us;
+  int64_t miss_us;
+};
+
+/**
+ * @brief Initialize an empty cache and its background thread.
+ *
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+int audio_filter_cache_init(struct audio_filter_cache *cache);
+
+/**
+ * @brief Get a configured filter, as audio_filter_init() would build it.
+ *
+ * The returned filter is owned by the cache and must be handed back with
+ * audio_filter_cache_release() instead of audio_filter_free().
+ *
+ * @param cache Initialized cache.
+ * @param filter Receives the filter.
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+int audio_filter_cache_acquire(struct audio_filter_cache *cache,
+                               struct audio_filter **filter, int sample_rate,
+                               enum AVSampleFormat format,
+                               const AVChannelLayout *ch_layout,
+                               const char *filter_desc, int nb_threads,
+                               int flags);
+
+/**
+ * @brief Return a filter obtained from audio_filter_cache_acquire().
+ *
+ * The filter is freed in the background; `*filter` is set to NULL.
+ */
+void audio_filter_cache_release(struct audio_filter_cache *cache,
+                                struct audio_filter **filter);
+
+/**
+ * @brief Stop the background thread and free every cached filter.
+ */
+void audio_filter_cache_free(struct audio_filter_cache *cache);
+
+#endif /* AUDIO_FILTER_CACHE_H */
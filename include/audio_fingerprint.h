@@ -0,0 +1,126 @@
+#ifndef AUDIO_FINGERPRINT_H
+#define AUDIO_FINGERPRINT_H
+
+#include <stdint.h>
+
+#include <libavutil/frame.h>
+#include <libavutil/tx.h>
+#include <libswresample/swresample.h>
+
+/** Mono sample rate the fingerprint is computed at. */
+#define AUDIO_FINGERPRINT_RATE 11025
+
+/** Analysis window and hop in samples at AUDIO_FINGERPRINT_RATE. */
+#define AUDIO_FINGERPRINT_WINDOW 4096
+#define AUDIO_FINGERPRINT_HOP 1365
+
+/** Frequency range folded into the chroma vector, in Hz. */
+#define AUDIO_FINGERPRINT_MIN_FREQ 28
+#define AUDIO_FINGERPRINT_MAX_FREQ 3520
+
+/** Chroma vectors averaged before the bits of a sub-fingerprint are taken. */
+#define AUDIO_FINGERPRINT_SMOOTH 3
+
+#define AUDIO_FINGERPRINT_VERSION 1
+
+/**
+ * @brief Chroma-based acoustic fingerprint of a stream.
+ *
+ * Frames are downmixed to mono and resampled to AUDIO_FINGERPRINT_RATE by
+ * swresample. Every AUDIO_FINGERPRINT_HOP samples a Hann-windowed block goes
+ * through a real FFT (libavutil's tx, which has SIMD implementations), its
+ * power spectrum is folded into 12 pitch classes and normalized, and a
+ * 32-bit sub-fingerprint is derived from the signs of differences between
+ * neighbouring pitch classes and between consecutive (smoothed) vectors.
+ * Two recordings of the same audio give sub-fingerprints that mostly agree,
+ * so duplicates are found by the bit error rate of aligned sequences.
+ *
+ * The format is taken from the first frame; later frames must match it.
+ */
+struct audio_fingerprint {
+  /** @brief Samples to fingerprint at AUDIO_FINGERPRINT_RATE, 0 for all. */
+  int64_t max_samples;
+  /** @brief Samples analysed so far at AUDIO_FINGERPRINT_RATE. */
+  int64_t samples;
+  /** @brief Set once `max_samples` were analysed; later frames are ignored. */
+  int done;
+
+  /** @brief Downmix and resampler to the analysis format. */
+  SwrContext *swr;
+  int sample_rate;
+  int channels;
+
+  /** @brief Real FFT of one window. */
+  AVTXContext *tx;
+  av_tx_fn tx_fn;
+
+  /**
+   * @brief Pending mono samples (`filled` of AUDIO_FINGERPRINT_WINDOW), the
+   *        analysis window, FFT input and output.
+   */
+  float *block;
+  int filled;
+  float *window;
+  float *fft_in;
+  AVComplexFloat *fft_out;
+
+  /** @brief Pitch class of every FFT bin, -1 outside the analysed range. */
+  int8_t *bin_chroma;
+
+  /**
+   * @brief Last AUDIO_FINGERPRINT_SMOOTH chroma vectors, as a ring, and the
+   *        previous smoothed vector.
+   */
+  float chroma[AUDIO_FINGERPRINT_SMOOTH][12];
+  int nb_chroma;
+  float previous[12];
+
+  /** @brief Sub-fingerprints, one per hop once the smoothing is primed. */
+  uint32_t *values;
+  int nb_values;
+  int capacity;
+
+  /** @brief Resampler output. */
+  float *scratch;
+  unsigned int scratch_size;
+};
+
+/**
+ * @brief Initialize a fingerprinter. The format is fixed by the first frame.
+ *
+ * @param fp Fingerprinter to initialize.
+ * @param max_seconds Length of audio to fingerprint from the start, or 0 for
+ * the whole stream.
+ */
+void audio_fingerprint_init(struct audio_fingerprint *fp, double max_seconds);
+
+/**
+ * @brief Add a frame.
+ *
+ * @param fp Initialized fingerprinter.
+ * @param frame Frame in any sample format; it is not modified.
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+int audio_fingerprint_process(struct audio_fingerprint *fp,
+                              const AVFrame *frame);
+
+/**
+ * @brief Analyse the audio still buffered and write the fingerprint as JSON.
+ *
+ * The fingerprint is the little-endian uint32 sub-fingerprints, base64
+ * encoded.
+ *
+ * @param fp Fingerprinter.
+ * @param path Output file.
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+int audio_fingerprint_write(struct audio_fingerprint *fp, const char *path);
+
+/**
+ * @brief Free the fingerprinter's buffers.
+ *
+ * @param fp Fingerprinter to free.
+ */
+void audio_fingerprint_free(struct audio_fingerprint *fp);
+
+#endif /* AUDIO_FINGERPRINT_H */
@@ -0,0 +1,61 @@
+#ifndef AUDIO_MEMORY_H
+#define AUDIO_MEMORY_H
+
+#include <stdint.h>
+
+/** Calls to audio_memory_check() between two reads of the resident size. */
+#define AUDIO_MEMORY_CHECK_INTERVAL 64
+
+/**
+ * @brief Hard bound on the process's resident memory (--max-memory).
+ *
+ * Every buffer that grows with the input is bounded separately: the
+ * decoder returns the frames of one packet before reading the next, the
+ * encoder FIFO holds at most one codec frame plus one input frame, and the
+ * caller splits `budget()` between the spill buffers (which continue on
+ * disk), the segment encoders in flight and the audio a filter may hold
+ * without producing output. audio_memory_check() then verifies the result
+ * against the resident set size, so a job that would still outgrow the
+ * limit fails with AVERROR(ENOMEM) instead of being killed by the system.
+ */
+struct audio_memory {
+  /** @brief Limit in bytes, and the resident size when it was set. */
+  int64_t limit;
+  int64_t baseline;
+
+  /** @brief Largest resident size seen by the checks. */
+  int64_t peak;
+
+  int calls;
+};
+
+/**
+ * @brief Current resident set size of the process in bytes, or a negative
+ *        AVERROR code.
+ */
+int64_t audio_memory_rss(void);
+
+/**
+ * @brief Set a limit, measuring the memory already in use.
+ *
+ * @param mem Memory bound to initialize.
+ * @param limit Resident size limit in bytes.
+ * @return 0 on success, AVERROR(EINVAL) if the limit is not above the
+ * current resident size, or another negative AVERROR code.
+ */
+int audio_memory_init(struct audio_memory *mem, int64_t limit);
+
+/**
+ * @brief Bytes available to buffers on top of the baseline.
+ */
+int64_t audio_memory_budget(const struct audio_memory *mem);
+
+/**
+ * @brief Account one unit of work; every AUDIO_MEMORY_CHECK_INTERVAL calls,
+ *        compare the resident size with the limit.
+ *
+ * @return 0 while within the limit, AVERROR(ENOMEM) once exceeded.
+ */
+int audio_memory_check(struct audio_memory *mem);
+
+#endif /* AUDIO_MEMORY_H */
@@ -0,0 +1,169 @@
+#ifndef AUDIO_METER_H
+#define AUDIO_METER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <libavutil/frame.h>
+
+/** Length of a loudness sub-block in milliseconds (the gating block hop). */
+#define AUDIO_METER_STEP_MS 100
+
+/** Sub-blocks per momentary (400 ms) and short-term (3 s) window. */
+#define AUDIO_METER_MOMENTARY_STEPS 4
+#define AUDIO_METER_SHORT_TERM_STEPS 30
+
+/** Loudness histogram: 0.1 LU bins from -70 LUFS up to +10 LUFS. */
+#define AUDIO_METER_HIST_MIN (-70.0)
+#define AUDIO_METER_HIST_BINS 800
+
+/** True-peak interpolation: oversampling factor and FIR taps per phase. */
+#define AUDIO_METER_OVERSAMPLE 4
+#define AUDIO_METER_TP_TAPS 12
+
+/**
+ * @brief Final measurements of an audio_meter.
+ *
+ * Loudness values are -HUGE_VAL for silence.
+ */
+struct audio_loudness {
+  /** @brief Integrated loudness in LUFS (EBU R128 / ITU-R BS.1770-4). */
+  double integrated;
+  /** @brief Loudness range in LU (EBU Tech 3342). */
+  double range;
+  /** @brief Maximum true peak in dBTP (4x oversampled). */
+  double true_peak;
+  /** @brief Maximum sample peak in dBFS. */
+  double sample_peak;
+  /** @brief Highest momentary (400 ms) and short-term (3 s) loudness. */
+  double momentary_max;
+  double short_term_max;
+  /** @brief Samples per channel measured. */
+  int64_t samples;
+  int sample_rate;
+};
+
+/**
+ * @brief Streaming EBU R128 loudness and true-peak meter.
+ *
+ * Frames are measured as they pass through the pipeline, so no second
+ * decode is needed. Channels are processed in groups of four, one SSE lane
+ * per channel: each group runs the two K-weighting biquads and the polyphase
+ * true-peak interpolator as vector operations. Gating blocks are kept in
+ * fixed-size histograms, so memory does not grow with the input length.
+ *
+ * The format is taken from the first frame; later frames must match it.
+ */
+struct audio_meter {
+  int sample_rate;
+  int channels;
+  /** @brief Number of 4-channel groups. */
+  int nb_groups;
+
+  /**
+   * @brief Per-group state, four floats per group each: BS.1770 channel
+   *        weights (0 for LFE and unused lanes), biquad state, true-peak
+   *        history (AUDIO_METER_TP_TAPS samples stored twice so a window is
+   *        always contiguous) and running peaks.
+   */
+  float *weights;
+  float *biquad_state;
+  float *tp_history;
+  int tp_pos;
+  float *true_peak;
+  float *sample_peak;
+
+  /** @brief K-weighting coefficients: pre-filter (shelf) then RLB high-pass. */
+  float shelf_b[3], shelf_a[3];
+  float hp_b[3], hp_a[3];
+
+  /** @brief Polyphase interpolation filter, [phase][tap]. */
+  float tp_coeffs[AUDIO_METER_OVERSAMPLE][AUDIO_METER_TP_TAPS];
+
+  /**
+   * @brief Current sub-block: samples and weighted K-filtered energy so far,
+   *        and the energies of the last AUDIO_METER_SHORT_TERM_STEPS
+   *        sub-blocks.
+   */
+  int step_samples;
+  int step_filled;
+  double step_energy;
+  double steps[AUDIO_METER_SHORT_TERM_STEPS];
+  int64_t nb_steps;
+
+  /**
+   * @brief Gating histograms of momentary blocks (with summed energy, for
+   *        the integrated mean) and of short-term blocks (for the range).
+   */
+  int64_t block_hist[AUDIO_METER_HIST_BINS];
+  double block_energy[AUDIO_METER_HIST_BINS];
+  int64_t short_hist[AUDIO_METER_HIST_BINS];
+  double short_energy[AUDIO_METER_HIST_BINS];
+
+  double momentary_max;
+  double short_term_max;
+  int64_t samples;
+
+  /** @brief Input converted to float, channel groups of four interleaved. */
+  float *scratch;
+  unsigned int scratch_size;
+};
+
+/**
+ * @brief Initialize a meter. The format is fixed by the first frame.
+ *
+ * @param meter Meter to initialize.
+ */
+void audio_meter_init(struct audio_meter *meter);
+
+/**
+ * @brief Measure a frame.
+ *
+ * Accepts packed or planar s16, s32, float and double samples.
+ *
+ * @param meter Initialized meter.
+ * @param frame Frame to measure; it is not modified.
+ * @return 0 on success, negative AVERROR code on failure (e.g., AVERROR(EINVAL)
+ * if the sample rate or channel count changed).
+ */
+int audio_meter_process(struct audio_meter *meter, const AVFrame *frame);
+
+/**
+ * @brief Compute the measurements over everything processed so far.
+ *
+ * @param meter Meter.
+ * @param result Filled with the measurements.
+ */
+void audio_meter_result(const struct audio_meter *meter,
+                        struct audio_loudness *result);
+
+/**
+ * @brief Write measurements as a JSON object (no trailing newline).
+ *
+ * Values for silence are written as null.
+ *
+ * @param result Measurements.
+ * @param file Output stream.
+ */
+void audio_meter_write_json(const struct audio_loudness *result, FILE *file);
+
+/**
+ * @brief Compute the polyphase true-peak interpolation filter.
+ *
+ * Phase `p` of the output between input samples n-6 and n-5 (for p = 1..3;
+ * phase 0 is sample n-6 itself) is the dot product of `coeffs[p]` with the
+ * last AUDIO_METER_TP_TAPS input samples, oldest first.
+ *
+ * @param coeffs Receives the coefficients, [phase][tap].
+ */
+void audio_meter_true_peak_filter(
+    float coeffs[AUDIO_METER_OVERSAMPLE][AUDIO_METER_TP_TAPS]);
+
+/**
+ * @brief Free the meter's buffers.
+ *
+ * @param meter Meter to free.
+ */
+void audio_meter_free(struct audio_meter *meter);
+
+#endif /* AUDIO_METER_H */
@@ -0,0 +1,160 @@
+#ifndef AUDIO_MIX_H
+#define AUDIO_MIX_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include <libavutil/channel_layout.h>
+#include <libavutil/samplefmt.h>
+
+#include "audio_dec.h"
+#include "audio_pool.h"
+#include "audio_resample.h"
+
+/** Decoded chunks queued per input ahead of the mixer. */
+#define AUDIO_MIX_QUEUE 16
+
+/** Samples per channel of each mixed output chunk. */
+#define AUDIO_MIX_BLOCK 1024
+
+/**
+ * @brief Stop the mix when the first input ends, instead of the last one.
+ */
+#define AUDIO_MIX_END_FIRST (1 << 0)
+
+/**
+ * @brief One input of the mix and its settings.
+ */
+struct audio_mix_source {
+  const char *path;
+  /** @brief Gain in dB. */
+  double gain;
+  /** @brief Seconds of output before the input starts. */
+  double offset;
+  /** @brief Seconds over which the input's gain ramps up from silence. */
+  double fade;
+};
+
+/**
+ * @brief Decoded PCM chunk passed from a decoder thread to the mixer.
+ */
+struct audio_mix_chunk {
+  uint8_t *data;
+  int nb_samples;
+};
+
+/**
+ * @brief Decoder thread of one input and its queue to the mixer.
+ *
+ * The queue is a single-producer, single-consumer ring: the decoder thread
+ * only advances `tail` and the mixer only `head`, so neither side takes a
+ * lock to pass a chunk. A side finding the ring full or empty sleeps on the
+ * mix's condition variable until the other one moves its index.
+ */
+struct audio_mix_input {
+  struct audio_mix *mix;
+  const char *path;
+  struct audio_dec decoder;
+  int open;
+
+  /** @brief Linear gain, start and gain ramp length in samples. */
+  float gain;
+  int64_t offset;
+  int64_t fade;
+
+  /** @brief Decoder thread: samples decoded so far and ramp gains. */
+  int64_t decoded;
+  float *ramp;
+  unsigned ramp_size;
+
+  struct audio_mix_chunk queue[AUDIO_MIX_QUEUE];
+  atomic_uint head;
+  atomic_uint tail;
+  /** @brief Set by the decoder thread after its last chunk; `ret` first. */
+  atomic_int eof;
+  int ret;
+
+  /** @brief Mixer: chunk being mixed and how much of it was used. */
+  struct audio_mix_chunk current;
+  int current_pos;
+  int finished;
+};
+
+/**
+ * @brief Mix of several inputs with per-input gain, offset and fade-in.
+ *
+ * Every input is decoded on its own thread (jobs of a pool sized to the
+ * number of inputs), converted to the rate and layout of the first input
+ * (or the requested ones) and queued for the mixer, so decoding scales with
+ * the cores up to the number of inputs. The mixer sums blocks of
+ * AUDIO_MIX_BLOCK samples in float with the SSE2 kernels of audio_dsp and
+ * saturates the sum to S16; inputs before their offset or after their end
+ * contribute silence. The mix lasts until the last input ends, or the first
+ * one with AUDIO_MIX_END_FIRST.
+ */
+struct audio_mix {
+  struct audio_mix_input *inputs;
+  int nb_inputs;
+  int flags;
+
+  struct audio_pool pool;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int sync_init;
+  /** @brief Threads sleeping on `cond`, and the stop request. */
+  atomic_int waiting;
+  atomic_int abort;
+
+  /** @brief Output format, the same for every input (packed S16). */
+  int sample_rate;
+  int channels;
+  enum AVSampleFormat format;
+  AVChannelLayout ch_layout;
+  enum audio_resample_quality resample_quality;
+  int frame_bytes;
+
+  float *acc;
+  int64_t position;
+  int done;
+};
+
+/**
+ * @brief Open the first input and start every decoder thread.
+ *
+ * The other inputs are opened on their threads; an input that cannot be
+ * opened fails the mix at its first read.
+ *
+ * @param mix Mix to initialize.
+ * @param sources Inputs, kept by reference until audio_mix_free().
+ * @param nb_inputs Number of inputs, at least 1.
+ * @param sample_rate Output rate, or 0 for the first input's rate.
+ * @param ch_layout Output layout, or NULL for the first input's channel
+ * count.
+ * @param resample_quality Resampler preset of every input.
+ * @param flags AUDIO_MIX_* flags.
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+int audio_mix_init(struct audio_mix *mix,
+                   const struct audio_mix_source *sources, int nb_inputs,
+                   int sample_rate, const AVChannelLayout *ch_layout,
+                   enum audio_resample_quality resample_quality, int flags);
+
+/**
+ * @brief Next mixed chunk.
+ *
+ * @param out_data Receives the PCM buffer (owned by the caller).
+ * @param out_size Size of the PCM data in bytes.
+ * @return 1 with a chunk, 0 at the end of the mix, or a negative AVERROR
+ * code.
+ */
+int audio_mix_read(struct audio_mix *mix, uint8_t **out_data, int *out_size);
+
+/**
+ * @brief Stop the decoder threads and free the inputs.
+ *
+ * @param mix Mix to free.
+ */
+void audio_mix_free(struct audio_mix *mix);
+
+#endif /* AUDIO_MIX_H */
@@ -0,0 +1,171 @@
+#ifndef AUDIO_NORMALIZE_H
+#define AUDIO_NORMALIZE_H
+
+#include <stdint.h>
+
+#include <libavutil/channel_layout.h>
+#include <libavutil/frame.h>
+
+#include "audio_meter.h"
+
+/** Default true-peak ceiling in dBTP. */
+#define AUDIO_NORMALIZE_CEILING (-1.0)
+
+/** Limiter lookahead and release time, in milliseconds. */
+#define AUDIO_NORMALIZE_LOOKAHEAD_MS 5
+#define AUDIO_NORMALIZE_RELEASE_MS 100
+
+/** Suffix of the sidecar file caching an input's loudness measurements. */
+#define AUDIO_NORMALIZE_SIDECAR ".audx-loudness"
+
+/**
+ * @brief Applies a normalization gain, limiting true peaks to a ceiling.
+ *
+ * When the measured true peak plus the gain stays under the ceiling, frames
+ * are only scaled, in place, with the SIMD gain kernels. Otherwise a
+ * lookahead limiter runs: peaks are detected on the 4x oversampled signal,
+ * the gain reduction is the minimum over the lookahead window smoothed by a
+ * moving average of the same length (so it is reached by the time the peak
+ * plays), and it recovers with an exponential release. The limiter delays
+ * the audio internally; audio_normalize_flush() returns the tail.
+ */
+struct audio_normalizer {
+  /** @brief Makeup gain and true-peak ceiling, linear. */
+  float gain;
+  float ceiling;
+  /** @brief Whether the limiter runs (otherwise only the gain is applied). */
+  int limit;
+
+  /** @brief Format of the frames, from the first one. */
+  int sample_rate;
+  AVChannelLayout ch_layout;
+  int format;
+
+  /** @brief Lookahead in samples and total delay of the limiter. */
+  int lookahead;
+  int delay;
+
+  /**
+   * @brief Peak detector: interpolation filter, input history per channel
+   *        (stored twice, see audio_meter) and the pending peak of the
+   *        sample whose right-hand interval is not interpolated yet.
+   */
+  float tp_coeffs[AUDIO_METER_OVERSAMPLE][AUDIO_METER_TP_TAPS];
+  float *tp_history;
+  int tp_pos;
+  float prev_interval;
+
+  /**
+   * @brief Gain computer: ring of required gains with a monotonic deque for
+   *        the sliding minimum, ring of minimums with their running sum for
+   *        the moving average, and the released envelope.
+   */
+  float *gains;
+  int64_t *deque;
+  int deque_head;
+  int deque_len;
+  float *minimums;
+  double minimum_sum;
+  float envelope;
+  float release;
+
+  /** @brief Delay line of `delay` + 1 interleaved input samples. */
+  float *delay_line;
+
+  /** @brief Input samples consumed so far. */
+  int64_t consumed;
+
+  /**
+   * @brief Statistics: deepest gain reduction (linear) and samples limited.
+   */
+  float min_gain;
+  int64_t limited;
+
+  /** @brief Frame converted to interleaved floats. */
+  float *scratch;
+  unsigned int scratch_size;
+
+  /** @brief Limiter gain of each value of `scratch`. */
+  float *sample_gains;
+  unsigned int sample_gains_size;
+};
+
+/**
+ * @brief Initialize a normalizer. The format is fixed by the first frame.
+ *
+ * @param norm Normalizer to initialize.
+ * @param gain_db Gain to apply in dB.
+ * @param true_peak_db Measured true peak of the input in dBTP; decides
+ * whether the limiter is needed.
+ * @param ceiling_db True-peak ceiling in dBTP.
+ */
+void audio_normalize_init(struct audio_normalizer *norm, double gain_db,
+                          double true_peak_db, double ceiling_db);
+
+/**
+ * @brief Normalize a frame in place.
+ *
+ * With the limiter the frame holds delayed audio afterwards and can have
+ * fewer samples (none while the lookahead fills).
+ *
+ * @param norm Initialized normalizer.
+ * @param frame Frame (s16, s32, flt or dbl, packed or planar) in the
+ * format of the first one.
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+int audio_normalize_process(struct audio_normalizer *norm, AVFrame *frame);
+
+/**
+ * @brief Return the audio still held by the limiter.
+ *
+ * @param norm Initialized normalizer.
+ * @param frame Caller-owned frame, unreferenced first; gets no samples if
+ * nothing is left.
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+int audio_normalize_flush(struct audio_normalizer *norm, AVFrame *frame);
+
+/**
+ * @brief Free the normalizer's buffers.
+ *
+ * @param norm Normalizer to free.
+ */
+void audio_normalize_free(struct audio_normalizer *norm);
+
+/**
+ * @brief Compute the cache key of a measurement.
+ *
+ * MurmurHash3 of the file's content followed by `settings`, which should
+ * hold everything else the measurement depends on (filter, rate, layout).
+ *
+ * @param path Input file; must be a regular file.
+ * @param settings Processing settings.
+ * @param key Receives the key as 32 hex digits.
+ * @return 0 on success, AVERROR(ENOTSUP) if `path` is not a regular file,
+ * or another negative AVERROR code on failure.
+ */
+int audio_normalize_key(const char *path, const char *settings, char key[33]);
+
+/**
+ * @brief Look up a measurement in the sidecar file of an input.
+ *
+ * @param path Input file; its sidecar is `path` + AUDIO_NORMALIZE_SIDECAR.
+ * @param key Cache key from audio_normalize_key().
+ * @param result Filled on a hit.
+ * @return 1 on a hit, 0 on a miss.
+ */
+int audio_normalize_cache_load(const char *path, const char *key,
+                               struct audio_loudness *result);
+
+/**
+ * @brief Append a measurement to the sidecar file of an input.
+ *
+ * @param path Input file.
+ * @param key Cache key from audio_normalize_key().
+ * @param result Measurement to store.
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+int audio_normalize_cache_store(const char *path, const char *key,
+                                const struct audio_loudness *result);
+
+#endif /* AUDIO_NORMALIZE_H */
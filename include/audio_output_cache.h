@@ -0,0 +1,96 @@
+#ifndef AUDIO_OUTPUT_CACHE_H
+#define AUDIO_OUTPUT_CACHE_H
+
+#include <stdint.h>
+
+/** Default size cap of a cache directory in bytes. */
+#define AUDIO_OUTPUT_CACHE_SIZE (1LL << 30)
+
+/**
+ * @brief Content-addressed store of finished outputs.
+ *
+ * Every entry is a file named after its job key in `dir`. The key is a
+ * MurmurHash3 of the input (its bytes, or in fast mode its size,
+ * modification time, device and inode) followed by a caller-supplied string
+ * holding everything else the output depends on. A hit copies the entry to
+ * the output (a reflink where the file system supports it), so no decoding
+ * happens at all. Entry and output never share an inode: later jobs
+ * rewriting the output in place cannot alter the entry.
+ *
+ * Entries are published atomically: the output is copied to a temporary
+ * name in `dir` and renamed over the entry, so concurrent jobs never see a
+ * partial file. Hits refresh an entry's modification time; once the
+ * directory grows past `max_size`, the least recently used entries are
+ * removed.
+ */
+struct audio_output_cache {
+  char *dir;
+  int64_t max_size;
+  /** @brief Key inputs by size, mtime, device and inode instead of bytes. */
+  int fast;
+
+  /** @brief Statistics of this run. */
+  int hits;
+  int misses;
+  int stores;
+  int evicted;
+  int64_t hit_us;
+};
+
+/**
+ * @brief Open a cache directory, creating it if needed.
+ *
+ * @param cache Cache to initialize.
+ * @param dir Cache directory.
+ * @param max_size Size cap in bytes, or 0 for AUDIO_OUTPUT_CACHE_SIZE.
+ * @param fast Key inputs by metadata instead of content.
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+int audio_output_cache_init(struct audio_output_cache *cache, const char *dir,
+                            int64_t max_size, int fast);
+
+/**
+ * @brief Compute the job key of an input.
+ *
+ * @param cache Initialized cache.
+ * @param input Input file; must be a regular file.
+ * @param settings Normalized options, versions and anything else the output
+ * depends on.
+ * @param key Receives the key as 32 hex digits.
+ * @return 0 on success, AVERROR(ENOTSUP) if `input` is not a regular file,
+ * or another negative AVERROR code on failure.
+ */
+int audio_output_cache_key(const struct audio_output_cache *cache,
+                           const char *input, const char *settings,
+                           char key[33]);
+
+/**
+ * @brief Materialize a cached output.
+ *
+ * @param cache Initialized cache.
+ * @param key Job key.
+ * @param output Path to create (replaced atomically if it exists).
+ * @return 1 on a hit, 0 on a miss, negative AVERROR code on failure.
+ */
+int audio_output_cache_fetch(struct audio_output_cache *cache,
+                             const char *key, const char *output);
+
+/**
+ * @brief Publish a finished output under a key and enforce the size cap.
+ *
+ * @param cache Initialized cache.
+ * @param key Job key.
+ * @param output Finished output file.
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+int audio_output_cache_store(struct audio_output_cache *cache,
+                             const char *key, const char *output);
+
+/**
+ * @brief Free the cache handle. Entries stay on disk.
+ *
+ * @param cache Cache to free.
+ */
+void audio_output_cache_free(struct audio_output_cache *cache);
+
+#endif /* AUDIO_OUTPUT_CACHE_H */
@@ -0,0 +1,66 @@
+#ifndef AUDIO_PACER_H
+#define AUDIO_PACER_H
+
+#include <stdint.h>
+
+/** Default window before a deadline that is busy-waited instead of slept. */
+#define AUDIO_PACER_SPIN_US 500
+
+/** Default lateness after which a packet counts as a missed deadline. */
+#define AUDIO_PACER_LATE_US 2000
+
+/**
+ * @brief Releases packets at the wall-clock time given by their timestamps.
+ *
+ * The first packet is released immediately and fixes the mapping between
+ * presentation time and wall-clock time, like ffmpeg's `-re`. Later packets
+ * are held until their deadline: the pacer sleeps on the monotonic clock
+ * until shortly before it, then spins for the last `spin_us` microseconds,
+ * which keeps release jitter in the tens of microseconds without burning a
+ * core between packets.
+ */
+struct audio_pacer {
+  /**
+   * @brief Wall-clock time (av_gettime_relative()) and presentation time of
+   *        the first packet, in microseconds.
+   */
+  int64_t base_time;
+  int64_t base_pts;
+  int started;
+
+  /**
+   * @brief Busy-wait window and late threshold, in microseconds.
+   */
+  int64_t spin_us;
+  int64_t late_us;
+
+  /**
+   * @brief Statistics: packets released, release jitter (absolute
+   *        difference to the deadline) and packets later than `late_us`.
+   */
+  int64_t packets;
+  int64_t jitter_sum;
+  int64_t jitter_max;
+  int64_t late;
+};
+
+/**
+ * @brief Initialize a pacer.
+ *
+ * @param pacer Pacer to initialize.
+ * @param spin_us Busy-wait window, or <= 0 for AUDIO_PACER_SPIN_US.
+ * @param late_us Late threshold, or <= 0 for AUDIO_PACER_LATE_US.
+ */
+void audio_pacer_init(struct audio_pacer *pacer, int64_t spin_us,
+                      int64_t late_us);
+
+/**
+ * @brief Wait until the deadline of a packet and update the statistics.
+ *
+ * @param pacer Initialized pacer.
+ * @param pts_us Presentation time of the packet in microseconds.
+ * @return Lateness in microseconds (negative if released early).
+ */
+int64_t audio_pacer_wait(struct audio_pacer *pacer, int64_t pts_us);
+
+#endif /* AUDIO_PACER_H */
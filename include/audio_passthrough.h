@@ -0,0 +1,53 @@
+#ifndef AUDIO_PASSTHROUGH_H
+#define AUDIO_PASSTHROUGH_H
+
+#include <stdint.h>
+
+/**
+ * @brief Location and format of the PCM data of a WAV or AIFF-C file.
+ *
+ * Raw PCM output of an input that already holds packed s16le samples at
+ * the output rate and layout is a byte range of the input: decoding,
+ * resampling and writing it back would only copy the same bytes through
+ * user space. audio_passthrough_probe() finds that range by reading the
+ * RIFF or AIFF-C chunks, and audio_passthrough_copy() copies it in the
+ * kernel with copy_file_range(), falling back to sendfile() and then to
+ * read()/write() where the file systems do not support it.
+ */
+struct audio_passthrough {
+  /** @brief Byte range of the sample data in the input. */
+  int64_t offset;
+  int64_t size;
+
+  int sample_rate;
+  int channels;
+  /** @brief WAVE_FORMAT_EXTENSIBLE speaker mask, 0 for the default order. */
+  uint64_t channel_mask;
+
+  /** @brief Bytes copied and the system call that copied them. */
+  int64_t copied;
+  const char *method;
+};
+
+/**
+ * @brief Find the s16le sample data of a WAV or AIFF-C ('sowt') file.
+ *
+ * @param pt Receives the data range and format.
+ * @param path Input file.
+ * @return 1 if the input holds packed s16le PCM, 0 otherwise (other
+ * formats, other containers, or files that cannot be read).
+ */
+int audio_passthrough_probe(struct audio_passthrough *pt, const char *path);
+
+/**
+ * @brief Copy the probed sample data to a new raw PCM file.
+ *
+ * @param pt Range found by audio_passthrough_probe().
+ * @param input Input file.
+ * @param output Output file, created or truncated.
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+int audio_passthrough_copy(struct audio_passthrough *pt, const char *input,
+                           const char *output);
+
+#endif /* AUDIO_PASSTHROUGH_H */
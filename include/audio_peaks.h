@@ -0,0 +1,102 @@
+#ifndef AUDIO_PEAKS_H
+#define AUDIO_PEAKS_H
+
+#include <stdint.h>
+
+#include <libavutil/frame.h>
+
+/** Samples per bucket of the finest zoom level. */
+#define AUDIO_PEAKS_BASE 256
+
+/** Number of zoom levels; each one has buckets twice as long as the last. */
+#define AUDIO_PEAKS_LEVELS 8
+
+/** Magic bytes at the start of a peaks file. */
+#define AUDIO_PEAKS_MAGIC "AUDXPEAK"
+#define AUDIO_PEAKS_VERSION 1
+
+/**
+ * @brief One zoom level: finished buckets and the bucket being filled.
+ */
+struct audio_peaks_level {
+  /** @brief Samples per channel covered by one bucket. */
+  int samples_per_bucket;
+
+  /**
+   * @brief Finished buckets as stored in the file: per channel, little-endian
+   *        int16 minimum, maximum and RMS.
+   */
+  uint8_t *data;
+  int64_t nb_buckets;
+  int64_t capacity;
+
+  /** @brief Partial bucket: per-channel minimum, maximum, sum of squares. */
+  float *min;
+  float *max;
+  double *sumsq;
+  int filled;
+};
+
+/**
+ * @brief Streaming waveform overview at several zoom levels.
+ *
+ * The finest level reduces the samples directly with the SIMD statistics
+ * kernel; every coarser level merges pairs of buckets of the level below, so
+ * all levels come out of a single pass.
+ *
+ * The file starts with a 32-byte little-endian header (magic, u32 version,
+ * sample rate, channels and level count, u64 samples per channel), then one
+ * 24-byte entry per level (u32 samples per bucket, u32 reserved, u64 bucket
+ * count, u64 byte offset of the level's data). Level data is 8-byte aligned
+ * and holds `channels` (min, max, rms) int16 triples per bucket, so a level
+ * can be memory-mapped and indexed directly.
+ *
+ * The format is taken from the first frame; later frames must match it.
+ */
+struct audio_peaks {
+  int sample_rate;
+  int channels;
+  int64_t samples;
+  struct audio_peaks_level levels[AUDIO_PEAKS_LEVELS];
+
+  /** @brief Frame converted to planar floats. */
+  float *scratch;
+  unsigned int scratch_size;
+  float **planes;
+};
+
+/**
+ * @brief Initialize a peaks generator. The format is fixed by the first frame.
+ *
+ * @param peaks Generator to initialize.
+ */
+void audio_peaks_init(struct audio_peaks *peaks);
+
+/**
+ * @brief Add a frame.
+ *
+ * @param peaks Initialized generator.
+ * @param frame Frame (s16, s32, flt or dbl, packed or planar); it is not
+ * modified.
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+int audio_peaks_process(struct audio_peaks *peaks, const AVFrame *frame);
+
+/**
+ * @brief Close the partial buckets and write the peaks file, plus a JSON
+ *        description of its layout as `path` + ".json".
+ *
+ * @param peaks Generator.
+ * @param path Output file.
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+int audio_peaks_write(struct audio_peaks *peaks, const char *path);
+
+/**
+ * @brief Free the generator's buffers.
+ *
+ * @param peaks Generator to free.
+ */
+void audio_peaks_free(struct audio_peaks *peaks);
+
+#endif /* AUDIO_PEAKS_H */
@@ -0,0 +1,92 @@
+#ifndef AUDIO_POOL_H
+#define AUDIO_POOL_H
+
+#include <pthread.h>
+
+/**
+ * @brief Work function executed by a pool thread.
+ */
+typedef void (*audio_pool_fn)(void *arg);
+
+/**
+ * @brief Queued unit of work.
+ */
+struct audio_pool_job {
+  audio_pool_fn fn;
+  void *arg;
+  struct audio_pool_job *next;
+};
+
+/**
+ * @brief Fixed-size worker thread pool.
+ *
+ * Jobs are executed in submission order by the first idle thread.
+ * audio_pool_wait() blocks until every submitted job has finished, which
+ * gives a simple fork/join pattern for per-frame parallel work.
+ */
+struct audio_pool {
+  /**
+   * @brief Worker threads.
+   */
+  pthread_t *threads;
+  int nb_threads;
+
+  /**
+   * @brief Protects the queue and counters below.
+   */
+  pthread_mutex_t lock;
+
+  /**
+   * @brief Signalled when a job is queued or the pool shuts down.
+   */
+  pthread_cond_t work_cond;
+
+  /**
+   * @brief Signalled when `pending` drops to zero.
+   */
+  pthread_cond_t done_cond;
+
+  /**
+   * @brief FIFO of jobs not yet picked up by a worker.
+   */
+  struct audio_pool_job *head;
+  struct audio_pool_job *tail;
+
+  /**
+   * @brief Number of jobs queued or running.
+   */
+  int pending;
+
+  /**
+   * @brief Set by audio_pool_free() to stop the workers.
+   */
+  int quit;
+};
+
+/**
+ * @brief Start a pool of worker threads.
+ *
+ * @param pool Pool to initialize.
+ * @param nb_threads Number of threads, or <= 0 for one per CPU core.
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+int audio_pool_init(struct audio_pool *pool, int nb_threads);
+
+/**
+ * @brief Queue `fn(arg)` for execution on a worker thread.
+ *
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+int audio_pool_submit(struct audio_pool *pool, audio_pool_fn fn, void *arg);
+
+/**
+ * @brief Block until every submitted job has finished.
+ */
+void audio_pool_wait(struct audio_pool *pool);
+
+/**
+ * @brief Wait for outstanding jobs, stop the workers and free the pool.
+ */
+void audio_pool_free(struct audio_pool *pool);
+
+#endif /* AUDIO_POOL_H */
@@ -0,0 +1,42 @@
+#ifndef AUDIO_RESAMPLE_H
+#define AUDIO_RESAMPLE_H
+
+#include <libavutil/opt.h>
+#include <libswresample/swresample.h>
+
+/**
+ * @brief Resampler quality/speed presets.
+ *
+ * Each preset maps to a set of libswresample options applied right before
+ * `swr_init()`:
+ * - FAST: short filter without phase interpolation, for previews
+ * - DEFAULT: libswresample defaults (unchanged behaviour)
+ * - HIGH: long filter, finer phase table and a steeper cutoff
+ * - SOXR: the SoX resampler engine at very high precision
+ */
+enum audio_resample_quality {
+  AUDIO_RESAMPLE_DEFAULT = 0,
+  AUDIO_RESAMPLE_FAST = 1,
+  AUDIO_RESAMPLE_HIGH = 2,
+  AUDIO_RESAMPLE_SOXR = 3,
+};
+
+/**
+ * @brief Apply a quality preset to a configured SwrContext and initialize it.
+ *
+ * The channel layout, sample rate and sample format options must already be
+ * set on `swr`. If the SoX engine was requested but libswresample was built
+ * without it, the context is reinitialized with the HIGH preset instead.
+ *
+ * @param swr Allocated and configured resampler context.
+ * @param quality Quality preset to apply.
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+int audio_resample_init(SwrContext *swr, enum audio_resample_quality quality);
+
+/**
+ * @brief Get the preset name (e.g., "fast", "soxr").
+ */
+const char *audio_resample_quality_name(enum audio_resample_quality quality);
+
+#endif /* AUDIO_RESAMPLE_H */
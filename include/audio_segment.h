@@ -0,0 +1,128 @@
+#ifndef AUDIO_SEGMENT_H
+#define AUDIO_SEGMENT_H
+
+#include <stdint.h>
+
+#include <libavutil/audio_fifo.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/frame.h>
+
+#include "audio_enc.h"
+#include "audio_pool.h"
+
+/**
+ * @brief Settings shared by every segment encoder.
+ */
+struct audio_segment_config {
+  const char *codec_name;
+  enum audio_quality quality;
+  const char *bitrate_str;
+  enum audio_resample_quality resample_quality;
+  double frame_ms;
+
+  /** Target segment duration in seconds. */
+  double segment_seconds;
+
+  /** Worker threads encoding segments, or <= 0 for one per CPU core. */
+  int nb_threads;
+
+  /** Bytes of PCM held by queued and running segments, or 0 for two
+   * segments per thread. */
+  int64_t max_memory;
+};
+
+struct audio_segment_job;
+
+/**
+ * @brief HLS output: MPEG-TS segments and an m3u8 playlist.
+ *
+ * Incoming PCM is cut into segments of a whole number of encoder frames,
+ * and every segment is encoded by its own encoder on a worker thread. To
+ * keep playback gapless, each segment after the first also encodes the
+ * last `overlap` samples of the previous one: they prime the codec (MDCT
+ * overlap, lookahead) and their packets are dropped with `audio_enc.min_pts`,
+ * so the first packet written starts exactly at the segment boundary with
+ * timestamps continuing from the previous segment.
+ */
+struct audio_segmenter {
+  struct audio_segment_config config;
+
+  /** Playlist path and the segment file name prefix derived from it. */
+  char *playlist_path;
+  char *segment_prefix;
+
+  /** Input (and encoder) format. */
+  int sample_rate;
+  enum AVSampleFormat format;
+  AVChannelLayout ch_layout;
+
+  /** Samples per segment, codec frame size and priming overlap. */
+  int64_t segment_samples;
+  int frame_size;
+  int overlap;
+
+  /** Samples not yet assigned to a segment. */
+  AVAudioFifo *fifo;
+
+  /** Last `overlap` samples of the previous segment. */
+  uint8_t *tail;
+  int tail_samples;
+
+  /** Index and first sample of the next segment. */
+  int index;
+  int64_t next_start;
+
+  /** Encoder of segment 0, opened up front to learn the codec's framing. */
+  struct audio_enc *first_enc;
+
+  /** Segment encoding on worker threads, at most `max_inflight` at once. */
+  struct audio_pool pool;
+  struct audio_segment_job **inflight;
+  int nb_inflight;
+  int max_inflight;
+
+  /** Duration of every segment in seconds, for the playlist. */
+  double *durations;
+  int nb_durations;
+
+  /** First error of a segment job. */
+  int error;
+};
+
+/**
+ * @brief Prepare segmented output.
+ *
+ * @param seg Segmenter to initialize.
+ * @param playlist_path Output .m3u8 path; segments are written next to it as
+ * `<name>_00000.ts`, `<name>_00001.ts`, ...
+ * @param config Encoder and segment settings (strings must outlive `seg`).
+ * @param sample_rate Input sample rate in Hz.
+ * @param format Input sample format (packed).
+ * @param ch_layout Input channel layout.
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+int audio_segment_init(struct audio_segmenter *seg, const char *playlist_path,
+                       const struct audio_segment_config *config,
+                       int sample_rate, enum AVSampleFormat format,
+                       const AVChannelLayout *ch_layout);
+
+/**
+ * @brief Queue PCM samples; complete segments are encoded in the background.
+ *
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+int audio_segment_write_frame(struct audio_segmenter *seg, const AVFrame *frame);
+
+/**
+ * @brief Encode the final segment, wait for all jobs and write the playlist.
+ *
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+int audio_segment_finalize(struct audio_segmenter *seg);
+
+/**
+ * @brief Free all segmenter resources.
+ */
+void audio_segment_free(struct audio_segmenter *seg);
+
+#endif /* AUDIO_SEGMENT_H */
@@ -0,0 +1,113 @@
+#ifndef AUDIO_SPILL_H
+#define AUDIO_SPILL_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <libavutil/channel_layout.h>
+#include <libavutil/frame.h>
+
+/** Default bytes kept in memory before spilling to a temporary file. */
+#define AUDIO_SPILL_MEMORY (64 << 20)
+
+/** Default bytes allowed in the temporary file before giving up. */
+#define AUDIO_SPILL_DISK (4LL << 30)
+
+/**
+ * @brief Memory-bounded store for a stream of PCM frames.
+ *
+ * Frames are appended to a memory buffer of at most `mem_max` bytes; beyond
+ * that they go to an anonymous temporary file of at most `disk_max` bytes.
+ * When both are full the spill overflows: everything stored is dropped,
+ * `overflow` is set and further writes are ignored, so the caller can fall
+ * back to producing the stream again.
+ *
+ * All frames must share the format, rate and layout of the first one.
+ */
+struct audio_spill {
+  /**
+   * @brief In-memory part: buffer, allocated size and bytes used.
+   */
+  uint8_t *mem;
+  size_t mem_size;
+  size_t mem_used;
+  size_t mem_max;
+
+  /**
+   * @brief On-disk part: temporary file (NULL until needed) and its size.
+   */
+  FILE *file;
+  int64_t file_used;
+  int64_t disk_max;
+
+  /**
+   * @brief Set once the limits were exceeded; nothing is stored then.
+   */
+  int overflow;
+
+  /**
+   * @brief Format of the stored frames, taken from the first one.
+   */
+  int format;
+  int sample_rate;
+  AVChannelLayout ch_layout;
+  int64_t nb_frames;
+
+  /**
+   * @brief Read cursor: position in the memory part, then in the file.
+   */
+  size_t mem_read;
+  int reading;
+};
+
+/**
+ * @brief Initialize an empty spill.
+ *
+ * @param spill Spill to initialize.
+ * @param mem_max Memory limit in bytes, or 0 for AUDIO_SPILL_MEMORY.
+ * @param disk_max Temporary file limit in bytes, or 0 for AUDIO_SPILL_DISK.
+ */
+void audio_spill_init(struct audio_spill *spill, size_t mem_max,
+                      int64_t disk_max);
+
+/**
+ * @brief Append a frame.
+ *
+ * @param spill Initialized spill.
+ * @param frame Frame to store; it is not modified.
+ * @return 0 on success (including when the spill overflows), negative
+ * AVERROR code on failure.
+ */
+int audio_spill_write_frame(struct audio_spill *spill, const AVFrame *frame);
+
+/**
+ * @brief Read the next stored frame, in write order.
+ *
+ * The first call switches the spill to reading; no frames can be written
+ * afterwards.
+ *
+ * @param spill Spill that has not overflowed.
+ * @param frame Caller-owned frame, unreferenced first and filled with a new
+ * buffer.
+ * @return 0 on success, AVERROR_EOF after the last frame, or another
+ * negative AVERROR code on failure.
+ */
+int audio_spill_read_frame(struct audio_spill *spill, AVFrame *frame);
+
+/**
+ * @brief Drop the stored frames so the spill can be written again.
+ *
+ * The memory buffer and the format are kept; the temporary file is closed.
+ *
+ * @param spill Spill to empty.
+ */
+void audio_spill_reset(struct audio_spill *spill);
+
+/**
+ * @brief Free the stored data and close the temporary file.
+ *
+ * @param spill Spill to free.
+ */
+void audio_spill_free(struct audio_spill *spill);
+
+#endif /* AUDIO_SPILL_H */
@@ -0,0 +1,137 @@
+#ifndef AUDIO_STREAMS_H
+#define AUDIO_STREAMS_H
+
+#include <stdint.h>
+
+#include <libavformat/avformat.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/frame.h>
+
+#include "audio_dec.h"
+#include "audio_enc.h"
+#include "audio_filter.h"
+#include "audio_pool.h"
+
+/** Packets queued per stream before the chains run on the pool. */
+#define AUDIO_STREAMS_BATCH 64
+
+/**
+ * @brief Settings shared by every stream's chain.
+ */
+struct audio_streams_config {
+  const char *codec_name;
+  const char *format_name;
+  enum audio_quality quality;
+  const char *bitrate_str;
+  enum audio_resample_quality resample_quality;
+  double frame_ms;
+
+  /** Output rate, or 0 to keep each stream's rate. */
+  int sample_rate;
+  /** Output layout, or NULL to keep each stream's channel count. */
+  const AVChannelLayout *ch_layout;
+
+  /** Filter chain applied to every stream, or NULL. */
+  const char *filter_desc;
+
+  /** Worker threads, or <= 0 for one per CPU core. */
+  int nb_threads;
+};
+
+/**
+ * @brief Decoder, filter and encoder of one input audio stream.
+ */
+struct audio_stream_chain {
+  /** Index in the input container and among its audio streams. */
+  int input_index;
+  int number;
+
+  struct audio_dec decoder;
+  struct audio_filter filter;
+  int has_filter;
+  struct audio_enc encoder;
+  int encoder_open;
+
+  /** Output file, or NULL when the output container is shared. */
+  char *path;
+
+  /** Demuxed packets waiting for the next run of the chain. */
+  AVPacket *queue[AUDIO_STREAMS_BATCH];
+  int nb_queued;
+
+  /** Encoded packets for the shared container, muxed after each run. */
+  AVPacket **out;
+  int nb_out;
+  int out_size;
+
+  AVFrame *frame;
+  AVFrame *filtered;
+  int64_t samples;
+
+  /** Set by the demuxer at end of input: the next run drains the chain. */
+  int eof;
+  int ret;
+};
+
+/**
+ * @brief Transcode several audio streams of one input in a single demux
+ *        pass.
+ *
+ * Packets are read once and routed to one chain per selected stream. When
+ * a chain has AUDIO_STREAMS_BATCH packets queued (or the input ends), every
+ * chain with queued packets runs as a job on the pool, decoding, filtering
+ * and encoding its packets in parallel with the others; the demuxer waits
+ * for the jobs before reading on, which bounds the queued packets.
+ *
+ * Streams go to separate files when the output name contains "%d" (replaced
+ * by the audio stream number), or otherwise to one container with an audio
+ * stream per input stream. A shared container is muxed on the demuxing
+ * thread after each run, in stream order, so the output does not depend on
+ * thread timing. Language and title tags are copied to the output streams.
+ */
+struct audio_streams {
+  AVFormatContext *in_ctx;
+  /** Shared output container, or NULL for one file per stream. */
+  AVFormatContext *out_ctx;
+  int header_written;
+
+  struct audio_stream_chain *chains;
+  int nb_chains;
+  /** Chain of every input stream, or -1 for unselected ones. */
+  int *route;
+
+  struct audio_pool pool;
+  AVPacket *pkt;
+};
+
+/**
+ * @brief Open the input, select its audio streams and open every chain.
+ *
+ * @param streams Multi-stream transcoder to initialize.
+ * @param input Input file.
+ * @param output Output file, or pattern containing "%d" for one file per
+ * stream.
+ * @param selection "all", or comma-separated audio stream numbers counted
+ * from 0 (e.g., "0,2").
+ * @param config Chain settings.
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+int audio_streams_init(struct audio_streams *streams, const char *input,
+                       const char *output, const char *selection,
+                       const struct audio_streams_config *config);
+
+/**
+ * @brief Demux the whole input, run the chains and finish every output.
+ *
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+int audio_streams_run(struct audio_streams *streams);
+
+/**
+ * @brief Free the chains, pool and contexts.
+ *
+ * @param streams Multi-stream transcoder to free.
+ */
+void audio_streams_free(struct audio_streams *streams);
+
+#endif /* AUDIO_STREAMS_H */
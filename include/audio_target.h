@@ -0,0 +1,145 @@
+#ifndef AUDIO_TARGET_H
+#define AUDIO_TARGET_H
+
+#include <stdint.h>
+
+#include <libavutil/channel_layout.h>
+#include <libavutil/tx.h>
+
+#include "audio_pool.h"
+#include "audio_resample.h"
+
+/** Windows sampled from the input, and their length in seconds. */
+#define AUDIO_TARGET_WINDOWS 4
+#define AUDIO_TARGET_WINDOW_SECONDS 5.0
+
+/** The search stops once the bitrate is known to this many bit/s. */
+#define AUDIO_TARGET_STEP 4000
+
+/** FFT size and number of frequency bands of the quality score. */
+#define AUDIO_TARGET_FFT 2048
+#define AUDIO_TARGET_BANDS 24
+
+/**
+ * @brief Encoder settings of the full run and the score to reach.
+ */
+struct audio_target_config {
+  const char *codec_name;
+  enum audio_resample_quality resample_quality;
+  double frame_ms;
+
+  /** Rate and layout of the audio the encoder will get. */
+  int sample_rate;
+  const AVChannelLayout *ch_layout;
+
+  /** Minimum score of every window, in dB. */
+  double target;
+
+  /** Worker threads, or <= 0 for one per CPU core. */
+  int nb_threads;
+};
+
+/**
+ * @brief Decoded input window, packed float.
+ */
+struct audio_target_window {
+  float *samples;
+  int nb_samples;
+};
+
+/**
+ * @brief One encode, decode and score of a window at a candidate bitrate.
+ */
+struct audio_target_job {
+  struct audio_target *target;
+  int window;
+  int64_t bitrate;
+
+  /** Score in dB, or NAN for a window too quiet to score. */
+  double score;
+  int ret;
+};
+
+/**
+ * @brief Search for the lowest bitrate that reaches a quality score.
+ *
+ * A few windows spread over the input are decoded once. Each round of the
+ * search encodes every window at several candidate bitrates in parallel on
+ * a thread pool, decodes the packets back and scores them against the
+ * source; the next round narrows down between the highest failing and the
+ * lowest passing candidate, until they are AUDIO_TARGET_STEP apart. The
+ * first round includes the codec's lowest and highest bitrate, so the
+ * result is always bounded.
+ *
+ * The score is a spectral signal-to-noise ratio: for every frame of
+ * AUDIO_TARGET_FFT samples and channel, the magnitude spectra of source and
+ * decoded audio are compared in AUDIO_TARGET_BANDS log-spaced bands, and
+ * the band SNRs (0 to 50 dB) are averaged over the bands carrying energy
+ * and the frames that are not silent. Comparing magnitudes ignores the
+ * phase changes and small delays of lossy codecs. A candidate passes when
+ * its worst window reaches the target, so short difficult passages are
+ * not averaged away.
+ */
+struct audio_target {
+  struct audio_target_config config;
+  AVChannelLayout ch_layout;
+  int channels;
+
+  struct audio_target_window windows[AUDIO_TARGET_WINDOWS];
+  int nb_windows;
+
+  /** Bitrate range of the codec, in bit/s. */
+  int64_t min_bitrate;
+  int64_t max_bitrate;
+
+  struct audio_pool pool;
+  struct audio_target_job *jobs;
+  int candidates_per_round;
+
+  /** First FFT bin of each band, and the end of the last one. */
+  int band_start[AUDIO_TARGET_BANDS + 1];
+  /** Hann window of the score's frames. */
+  float window[AUDIO_TARGET_FFT];
+
+  /** Result: the bitrate, its worst window score and whether it met the
+   *  target (not at the codec's highest bitrate). */
+  int64_t bitrate;
+  double score;
+  int met;
+
+  /** Search cost: rounds, bitrates tried, window encodes and time in us. */
+  int rounds;
+  int candidates;
+  int encodes;
+  int64_t time_us;
+};
+
+/**
+ * @brief Decode the input's windows and start the worker threads.
+ *
+ * @param target Search to initialize.
+ * @param input Input file.
+ * @param config Encoder settings and target; copied, `ch_layout` included.
+ * @return 0 on success, negative AVERROR code on failure (e.g., a lossless
+ * codec or an input that cannot be seeked).
+ */
+int audio_target_init(struct audio_target *target, const char *input,
+                      const struct audio_target_config *config);
+
+/**
+ * @brief Run the search; the result is left in `bitrate`, `score` and
+ *        `met`.
+ *
+ * @param target Initialized search.
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+int audio_target_search(struct audio_target *target);
+
+/**
+ * @brief Stop the worker threads and free the windows.
+ *
+ * @param target Search to free.
+ */
+void audio_target_free(struct audio_target *target);
+
+#endif /* AUDIO_TARGET_H */
@@ -0,0 +1,126 @@
+#ifndef AUDIO_TRIM_H
+#define AUDIO_TRIM_H
+
+#include <stdint.h>
+
+#include <libavutil/frame.h>
+
+#include "audio_spill.h"
+
+/** Default shortest silence that is trimmed, in seconds. */
+#define AUDIO_TRIM_MIN_DURATION 0.5
+
+/**
+ * @brief Receives the frames that survive trimming.
+ *
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+typedef int (*audio_trim_emit)(void *opaque, AVFrame *frame);
+
+/**
+ * @brief Removes leading and trailing silence and optionally shortens long
+ *        internal gaps.
+ *
+ * Every frame is scanned with the SIMD threshold kernels for its first and
+ * last sample over the threshold (on any channel). Samples before, between
+ * and after loud frames form silent runs; a run is only held back until it
+ * is known how it ends:
+ *  - a leading run of at least `min_samples` is dropped, so it is held for
+ *    at most `min_samples`;
+ *  - with `compress_gaps`, internal runs keep their first `min_samples` and
+ *    drop the rest, so at most `min_samples` are held;
+ *  - otherwise an internal run is held in full (it might turn out to be the
+ *    tail) in an audio_spill, i.e. in bounded memory plus a temporary file.
+ * A trailing run of at least `min_samples` is dropped at flush. Silence
+ * inside a frame is not split out, so gaps are found to frame resolution
+ * while the edges of the audio are cut to the sample.
+ *
+ * The format is taken from the first frame; later frames must match it.
+ */
+struct audio_trim {
+  /** @brief Linear magnitude threshold and its S16 equivalent. */
+  float threshold;
+  int16_t threshold_s16;
+  double min_duration;
+  int compress_gaps;
+
+  /** @brief Format of the frames, from the first one. */
+  int sample_rate;
+  int channels;
+  int format;
+  int64_t min_samples;
+
+  /** @brief Set once a sample over the threshold was seen. */
+  int started;
+
+  /**
+   * @brief Current silent run: its length and the part of it held in
+   *        `spill`.
+   */
+  int64_t run;
+  int64_t held;
+  struct audio_spill spill;
+
+  /** @brief Statistics: samples per channel seen and removed. */
+  int64_t samples;
+  int64_t removed_head;
+  int64_t removed_tail;
+  int64_t removed_gaps;
+
+  /** @brief Reused frames: slice views and frames read back. */
+  AVFrame *view;
+  AVFrame *release;
+
+  /** @brief Frame converted to planar floats, for s32 and dbl input. */
+  float *scratch;
+  unsigned int scratch_size;
+  float **planes;
+};
+
+/**
+ * @brief Initialize a trimmer. The format is fixed by the first frame.
+ *
+ * @param trim Trimmer to initialize.
+ * @param threshold_db Level under which audio is silent, in dBFS.
+ * @param min_duration Shortest silence removed, in seconds.
+ * @param compress_gaps Shorten internal silences to `min_duration`.
+ * @param max_memory Memory for held silence before it continues on disk, or
+ * 0 for AUDIO_SPILL_MEMORY.
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+int audio_trim_init(struct audio_trim *trim, double threshold_db,
+                    double min_duration, int compress_gaps,
+                    size_t max_memory);
+
+/**
+ * @brief Trim a frame.
+ *
+ * The frames passed to `emit` (none, or parts of held and current frames)
+ * are only valid during the call.
+ *
+ * @param trim Initialized trimmer.
+ * @param frame Frame (s16, s32, flt or dbl, packed or planar); it is not
+ * modified.
+ * @param emit Called with every frame to keep, in order.
+ * @param opaque Passed to `emit`.
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+int audio_trim_process(struct audio_trim *trim, const AVFrame *frame,
+                       audio_trim_emit emit, void *opaque);
+
+/**
+ * @brief End of stream: drop the trailing silence or emit what is held.
+ *
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+int audio_trim_flush(struct audio_trim *trim, audio_trim_emit emit,
+                     void *opaque);
+
+/**
+ * @brief Free the trimmer's buffers.
+ *
+ * @param trim Trimmer to free.
+ */
+void audio_trim_free(struct audio_trim *trim);
+
+#endif /* AUDIO_TRIM_H */
@@ -1,7 +1,33 @@
+#include "include/audio_checkpoint.h"
+#include "include/audio_concat.h"
+#include "include/audio_control.h"
 #include "include/audio_dec.h"
+#include "include/audio_dither.h"
 #include "include/audio_enc.h"
+#include "include/audio_features.h"
+#include "include/audio_memory.h"
+#include "include/audio_mix.h"
 #include "include/audio_filter.h"
+#include "include/audio_filter_cache.h"
+#include "include/audio_fingerprint.h"
+#include "include/audio_meter.h"
+#include "include/audio_normalize.h"
+#include "include/audio_output_cache.h"
+#include "include/audio_passthrough.h"
+#include "include/audio_peaks.h"
+#include "include/audio_resample.h"
+#include "include/audio_segment.h"
+#include "include/audio_spill.h"
+#include "include/audio_streams.h"
+#include "include/audio_target.h"
+#include "include/audio_trim.h"
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <libavutil/avstring.h>
+#include <libavutil/time.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 /**
@@ -35,12 +61,68 @@ static void print_version(void) {
  * @brief Print usage information for audx.
  */
 static void print_usage(const char *prog_name) {
-  fprintf(stderr, "Usage: %s <input> <output> [OPTIONS]\n\n", prog_name);
+  fprintf(stderr, "Usage: %s <input> <output> [OPTIONS]\n", prog_name);
+  fprintf(stderr, "       %s <input> --analyze-only [OPTIONS]\n", prog_name);
+  fprintf(stderr, "       %s --batch=<list> [OPTIONS]\n", prog_name);
+  fprintf(stderr, "       %s --concat=<list> <output> [OPTIONS]\n", prog_name);
+  fprintf(stderr, "       %s --mix=<list> <output> [OPTIONS]\n\n", prog_name);
   fprintf(stderr, "OPTIONS:\n");
   fprintf(stderr, "  --codec=<name>       Encoder codec (libmp3lame, aac, libopus, flac, alac, pcm_s16le)\n");
   fprintf(stderr, "  --quality=<preset>   Quality preset: low, medium, high, extreme (default: high)\n");
   fprintf(stderr, "  --bitrate=<rate>     Explicit bitrate (e.g., 192k, 320k) - overrides quality\n");
   fprintf(stderr, "  --filter=<desc>      FFmpeg filter chain (e.g., \"atempo=1.25,volume=0.5\")\n");
+  fprintf(stderr, "  --sample-rate=<hz>   Output sample rate (default: same as input)\n");
+  fprintf(stderr, "  --channels=<n>       Output channel count, e.g. 2 to downmix 5.1 (default: same as input)\n");
+  fprintf(stderr, "  --layout=<name>      Output channel layout (e.g., mono, stereo, 5.1) - overrides channels\n");
+  fprintf(stderr, "  --resample-quality=<preset>\n");
+  fprintf(stderr, "                       Resampler preset: fast, default, high, soxr (default: default)\n");
+  fprintf(stderr, "  --filter-threads=<n> Threads for filtering (default: auto)\n");
+  fprintf(stderr, "  --filter-split       Filter each channel separately, in parallel\n");
+  fprintf(stderr, "  --threads=<n>        Threads for segments, streams, features and --target-quality (default: auto)\n");
+  fprintf(stderr, "  --control=<path>     Read live filter commands from a file or named pipe\n");
+  fprintf(stderr, "  --format=<name>      Output container (e.g., mpegts, ogg, rtp) - default: from output name\n");
+  fprintf(stderr, "  --realtime           Pace output to wall-clock time (implied for udp://, rtp://, tcp://)\n");
+  fprintf(stderr, "  --sdp=<path>         Write the SDP of an rtp:// output to a file (default: stdout)\n");
+  fprintf(stderr, "  --segment=<seconds>  HLS output: <output>.m3u8 playlist plus MPEG-TS segments\n");
+  fprintf(stderr, "  --low-latency[=<ms>] Low-delay encoding and muxing, optional Opus frame length: 2.5, 5, 10,\n");
+  fprintf(stderr, "                       20, 40 or 60 (default: 5)\n");
+  fprintf(stderr, "  --measure            Measure EBU R128 loudness, loudness range and true peak\n");
+  fprintf(stderr, "  --analyze-only       Measure without writing an output (implies --measure)\n");
+  fprintf(stderr, "  --normalize=<LUFS>[,<dBTP>]\n");
+  fprintf(stderr, "                       Normalize loudness in two passes over one decode, limiting true peaks (default: -1 dBTP)\n");
+  fprintf(stderr, "  --peaks=<path>       Write multi-resolution waveform peaks (plus <path>.json); no output needed\n");
+  fprintf(stderr, "  --fingerprint[=<path>]\n");
+  fprintf(stderr, "                       Write a chroma fingerprint of the decoded audio (default: <output>.fingerprint)\n");
+  fprintf(stderr, "  --fingerprint-seconds=<n>\n");
+  fprintf(stderr, "                       Fingerprint only the first n seconds; without an output, decoding stops there\n");
+  fprintf(stderr, "  --trim-silence=<dB>[,<seconds>][,gaps]\n");
+  fprintf(stderr, "                       Drop leading/trailing silence under <dB> lasting <seconds> (default: 0.5);\n");
+  fprintf(stderr, "                       gaps also shortens longer internal silences to <seconds>\n");
+  fprintf(stderr, "  --cache-dir=<dir>    Reuse outputs of repeated jobs from a content-addressed cache\n");
+  fprintf(stderr, "  --cache-size=<MB>    Cache size cap, least recently used entries go first (default: 1024)\n");
+  fprintf(stderr, "  --cache-fast         Key inputs by size, mtime and inode instead of their bytes\n");
+  fprintf(stderr, "  --checkpoint=<dir>   Record progress periodically; rerunning the same job resumes from it\n");
+  fprintf(stderr, "  --checkpoint-interval=<seconds>\n");
+  fprintf(stderr, "                       Output audio between checkpoints (default: 30)\n");
+  fprintf(stderr, "  --features=logmel[,rate=<hz>,window=<n>,hop=<n>,mels=<n>]\n");
+  fprintf(stderr, "                       Write log-mel features as a float32 .npy (default: 16000 Hz, 400, 160, 80)\n");
+  fprintf(stderr, "  --features-out=<path>\n");
+  fprintf(stderr, "                       Feature file (default: <output>.logmel.npy); no output needed\n");
+  fprintf(stderr, "  --target-quality=<dB>\n");
+  fprintf(stderr, "                       Lowest bitrate whose sampled windows reach a spectral SNR (e.g., 20)\n");
+  fprintf(stderr, "  --bit-depth=<depth>  Output 16, 24 or 32-bit integers or float, processing in float (24, 32\n");
+  fprintf(stderr, "                       and float need raw output or a lossless codec; lossy codecs get float)\n");
+  fprintf(stderr, "  --dither=<type>      Dither of --bit-depth 16 and 24: tpdf, shaped, none (default: tpdf)\n");
+  fprintf(stderr, "  --max-memory=<MB>    Bound resident memory; buffers spill to disk or the job fails instead\n");
+  fprintf(stderr, "  --streams=all|<list> Transcode several audio streams (e.g., 0,2) in one pass; an output\n");
+  fprintf(stderr, "                       name with %%d writes one file per stream, otherwise one container\n");
+  fprintf(stderr, "  --stats=<path>       Write run statistics and measurements as JSON (- for stdout)\n");
+  fprintf(stderr, "  --concat=<list>      Play every input file listed (one per line) into one output\n");
+  fprintf(stderr, "  --crossfade=<seconds>\n");
+  fprintf(stderr, "                       Overlap consecutive --concat inputs with an equal-power crossfade\n");
+  fprintf(stderr, "  --mix=<list>         Mix the inputs listed as \"<path> [gain=<dB>] [offset=<s>] [fade=<s>]\"\n");
+  fprintf(stderr, "  --mix-duration=<end> End the mix with the longest or first input (default: longest)\n");
+  fprintf(stderr, "  --batch=<list>       Transcode every \"<input> <output>\" line of a list file\n");
   fprintf(stderr, "  -h, --help           Show this help message\n");
   fprintf(stderr, "  -v, --version        Show version information\n\n");
   fprintf(stderr, "EXAMPLES:\n");
@@ -66,6 +148,1832 @@ static enum audio_quality parse_quality(const char *quality_str) {
   return AUDIO_QUALITY_HIGH;
 }
 
+/**
+ * @brief Parse resampler preset string to enum value.
+ */
+static enum audio_resample_quality parse_resample_quality(const char *str) {
+  if (!str)
+    return AUDIO_RESAMPLE_DEFAULT;
+  if (strcmp(str, "fast") == 0)
+    return AUDIO_RESAMPLE_FAST;
+  if (strcmp(str, "high") == 0)
+    return AUDIO_RESAMPLE_HIGH;
+  if (strcmp(str, "soxr") == 0)
+    return AUDIO_RESAMPLE_SOXR;
+  return AUDIO_RESAMPLE_DEFAULT;
+}
+
+/**
+ * @brief Parse a positive size in megabytes (MiB).
+ *
+ * @return The size in bytes, or -1 if `str` is not a positive integer or
+ * the size does not fit in 64 bits.
+ */
+static int64_t parse_megabytes(const char *str) {
+  char *end;
+
+  errno = 0;
+  long long mb = strtoll(str, &end, 10);
+  if (end == str || *end != '\0' || errno == ERANGE || mb <= 0 ||
+      mb > INT64_MAX >> 20)
+    return -1;
+  return (int64_t)mb << 20;
+}
+
+/**
+ * @brief Destination of the processed PCM frames.
+ *
+ * At most one of encoder, segmenter and file is set; with none, frames are
+ * only measured or kept.
+ */
+struct audx_output {
+  struct audio_enc *encoder;         // encoded file or stream
+  struct audio_segmenter *segmenter; // segmented HLS output
+  FILE *file;                        // raw PCM
+  struct audio_trim *trim;           // silence removal applied first
+  struct audio_normalizer *normalizer; // gain and limiter
+  struct audio_meter *meter;         // loudness meter tapping every frame
+  struct audio_peaks *peaks;         // waveform overview tapping every frame
+  struct audio_spill *spill;         // frames kept for a second pass
+  struct audio_checkpoint *checkpoint; // progress of the raw PCM file
+  struct audio_dither *dither;       // float to integer conversion, last
+};
+
+/**
+ * @brief Append 24-bit samples held in the top bits of packed S32 to the
+ *        raw file as packed little-endian S24.
+ */
+static int write_s24(FILE *file, const AVFrame *frame) {
+  const uint8_t *src = frame->data[0];
+  int count = frame->nb_samples * frame->ch_layout.nb_channels;
+  uint8_t buf[3 * 1024];
+
+  while (count > 0) {
+    int n = FFMIN(count, 1024);
+    for (int i = 0; i < n; i++) {
+      uint32_t v = (uint32_t)((const int32_t *)src)[i];
+      buf[3 * i] = v >> 8;
+      buf[3 * i + 1] = v >> 16;
+      buf[3 * i + 2] = v >> 24;
+    }
+    if (fwrite(buf, 3, n, file) != (size_t)n)
+      return AVERROR(EIO);
+    src += (size_t)n * 4;
+    count -= n;
+  }
+  return 0;
+}
+
+static int write_trimmed(void *opaque, AVFrame *frame);
+
+/**
+ * @brief Send one PCM frame to the encoder or segmenter, or append it to the
+ *        raw file.
+ *
+ * @param out Output destination.
+ * @param frame Packed PCM frame.
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+static int write_output(struct audx_output *out, AVFrame *frame) {
+  int ret;
+
+  if (out->trim) {
+    struct audx_output rest = *out;
+    rest.trim = NULL;
+    ret = audio_trim_process(out->trim, frame, write_trimmed, &rest);
+    if (ret < 0)
+      fprintf(stderr, "Error trimming frame\n");
+    return ret;
+  }
+
+  if (out->normalizer) {
+    if ((ret = audio_normalize_process(out->normalizer, frame)) < 0) {
+      fprintf(stderr, "Error normalizing frame\n");
+      return ret;
+    }
+    /* The limiter holds back its lookahead */
+    if (frame->nb_samples == 0)
+      return 0;
+  }
+
+  if (out->spill && (ret = audio_spill_write_frame(out->spill, frame)) < 0) {
+    fprintf(stderr, "Error storing frame\n");
+    return ret;
+  }
+
+  if (out->meter && (ret = audio_meter_process(out->meter, frame)) < 0) {
+    fprintf(stderr, "Error measuring frame\n");
+    return ret;
+  }
+
+  if (out->peaks && (ret = audio_peaks_process(out->peaks, frame)) < 0) {
+    fprintf(stderr, "Error computing peaks\n");
+    return ret;
+  }
+
+  /* Every stage before ran in float; round to the output depth once */
+  if (out->dither && (ret = audio_dither_process(out->dither, frame,
+                                                 &frame)) < 0) {
+    fprintf(stderr, "Error converting frame\n");
+    return ret;
+  }
+
+  if (out->encoder) {
+    ret = audio_enc_write_frame(out->encoder, frame);
+    if (ret < 0)
+      fprintf(stderr, "Error encoding frame\n");
+    return ret;
+  }
+
+  if (out->segmenter) {
+    ret = audio_segment_write_frame(out->segmenter, frame);
+    if (ret < 0)
+      fprintf(stderr, "Error segmenting frame\n");
+    return ret;
+  }
+
+  if (!out->file)
+    return 0;
+
+  int buf_size = av_samples_get_buffer_size(
+      NULL, frame->ch_layout.nb_channels, frame->nb_samples, frame->format, 1);
+  if (out->dither && out->dither->bits == 24) {
+    buf_size = buf_size / 4 * 3;
+    if (write_s24(out->file, frame) < 0) {
+      fprintf(stderr, "Error writing PCM data\n");
+      return AVERROR(EIO);
+    }
+  } else if (buf_size > 0 &&
+             fwrite(frame->data[0], 1, buf_size, out->file) !=
+                 (size_t)buf_size) {
+    fprintf(stderr, "Error writing PCM data\n");
+    return AVERROR(EIO);
+  }
+  if (out->checkpoint &&
+      (ret = audio_checkpoint_file_written(out->checkpoint, out->file,
+                                           frame->nb_samples, buf_size)) < 0) {
+    fprintf(stderr, "Error writing checkpoint\n");
+    return ret;
+  }
+  return 0;
+}
+
+/**
+ * @brief audio_trim_emit callback: send the kept audio to the rest of the
+ *        output.
+ */
+static int write_trimmed(void *opaque, AVFrame *frame) {
+  return write_output(opaque, frame);
+}
+
+/**
+ * @brief Pull every frame the filter can currently produce and write it.
+ *
+ * `filtered` is a caller-owned frame reused for every pull.
+ *
+ * @return 0 once the filter needs more input or is drained, negative
+ * AVERROR code if filtering or writing a frame failed.
+ */
+static int drain_filter(struct audio_filter *filter, AVFrame *filtered,
+                        struct audx_output *out) {
+  int ret;
+
+  while ((ret = audio_filter_pull(filter, filtered)) >= 0) {
+    /* write_output() reports its own errors */
+    if ((ret = write_output(out, filtered)) < 0) {
+      av_frame_unref(filtered);
+      return ret;
+    }
+  }
+  av_frame_unref(filtered);
+  if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
+    return 0;
+  fprintf(stderr, "Error pulling frame from filter\n");
+  return ret;
+}
+
+/**
+ * @brief Wrap a PCM chunk in `frame`, which takes ownership of `data` (it
+ *        is freed on failure as well).
+ *
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+static int fill_frame(AVFrame *frame, uint8_t *data, int size, int channels,
+                      enum AVSampleFormat format, int sample_rate,
+                      const AVChannelLayout *ch_layout, int64_t pts) {
+  int ret;
+
+  frame->nb_samples = size / (channels * av_get_bytes_per_sample(format));
+  frame->format = format;
+  frame->sample_rate = sample_rate;
+  frame->pts = pts;
+  av_channel_layout_copy(&frame->ch_layout, ch_layout);
+
+  ret = avcodec_fill_audio_frame(frame, channels, format, data, size, 1);
+
+  /* Make the frame own the buffer so later stages can take the reference
+   * instead of copying the samples */
+  if (ret >= 0) {
+    frame->buf[0] = av_buffer_create(data, size, av_buffer_default_free,
+                                     NULL, 0);
+    if (!frame->buf[0])
+      ret = AVERROR(ENOMEM);
+  }
+  if (ret < 0) {
+    fprintf(stderr, "Error filling frame\n");
+    av_frame_unref(frame);
+    av_freep(&data);
+  }
+  return ret;
+}
+
+/**
+ * @brief Send a frame through the filter (if any) to the output, then
+ *        unreference it. NULL flushes the filter.
+ *
+ * A frame the filter rejects is skipped, unless the filter would hold back
+ * more audio than --max-memory allows.
+ *
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+static int output_frame(struct audio_filter *filter, AVFrame *frame,
+                        AVFrame *filtered, struct audx_output *out) {
+  int ret;
+
+  if (!filter) {
+    if (!frame)
+      return 0;
+    ret = write_output(out, frame);
+    av_frame_unref(frame);
+    return ret;
+  }
+
+  ret = audio_filter_push(filter, frame);
+  if (frame)
+    av_frame_unref(frame);
+  if (ret == AVERROR(ENOBUFS)) {
+    fprintf(stderr, "The filter holds back more audio than "
+                    "--max-memory allows\n");
+    return ret;
+  }
+  if (ret < 0) {
+    fprintf(stderr, "Error pushing frame to filter\n");
+    return 0;
+  }
+  return drain_filter(filter, filtered, out);
+}
+
+/**
+ * @brief Whether an output is a network URL that needs pacing.
+ */
+static int is_network_url(const char *filename) {
+  return strncmp(filename, "udp://", 6) == 0 ||
+         strncmp(filename, "rtp://", 6) == 0 ||
+         strncmp(filename, "tcp://", 6) == 0;
+}
+
+/**
+ * @brief Whether an encoder is lossy. Lossy encoders keep no integer
+ *        samples, so --bit-depth=16 hands them the float chain undithered.
+ */
+static int is_lossy_codec(const char *codec_name) {
+  const AVCodec *codec = avcodec_find_encoder_by_name(codec_name);
+  const AVCodecDescriptor *desc =
+      codec ? avcodec_descriptor_get(codec->id) : NULL;
+  return desc && !(desc->props & AV_CODEC_PROP_LOSSLESS);
+}
+
+/**
+ * @brief Settings shared by every file of a run.
+ */
+struct audx_options {
+  const char *codec_name;
+  const char *format_name;
+  const char *sdp_path;
+  const char *bitrate_str;
+  const char *filter_desc;
+  const char *control_path;
+  enum audio_quality quality;
+  enum audio_resample_quality resample_quality;
+  AVChannelLayout out_layout; // empty to keep the input layout
+  int out_sample_rate;        // 0 to keep the input rate
+  int filter_threads;
+  int filter_flags;
+  int threads; // worker pools of the parallel stages, 0 for one per core
+  int low_latency;
+  double segment_seconds; // > 0 for segmented HLS output
+  int realtime;    // pace output packets to wall-clock time
+  double frame_ms; // codec frame duration, 0 for the default
+  int measure;      // loudness metering
+  int analyze_only; // measure without writing an output
+  int normalize;    // two-pass loudness normalization
+  double normalize_target;  // LUFS
+  double normalize_ceiling; // dBTP
+  const char *stats_path;
+  const char *peaks_path; // waveform peaks file
+  int fingerprint;                 // acoustic fingerprint
+  const char *fingerprint_path;    // NULL for <output>.fingerprint
+  double fingerprint_seconds;      // > 0 to fingerprint only the start
+  int trim_silence;                // head/tail silence removal
+  double trim_threshold;           // dBFS
+  double trim_min_duration;        // seconds
+  int trim_gaps;                   // also shorten internal silences
+  struct audio_output_cache *output_cache; // NULL without --cache-dir
+  struct audio_memory *memory;     // NULL without --max-memory
+  const char *checkpoint_dir;      // resumable progress of the job
+  double checkpoint_interval;      // seconds of output, 0 for the default
+  int features;                    // log-mel feature tensor
+  const char *features_path;       // NULL for <output>.logmel.npy
+  struct audio_features_config features_config;
+  const char *streams;             // audio streams to transcode in one pass
+  double crossfade;                // seconds between --concat inputs
+  int mix_end_first;               // --mix ends with its first input
+  int bit_depth;                   // 16, 24, 32, -1 for float, 0 for S16
+  int dither_flags;                // AUDIO_DITHER_* for --bit-depth
+  double target_quality;           // score the bitrate search must reach
+  int verbose;
+};
+
+/**
+ * @brief Write a string as a quoted JSON string.
+ */
+static void write_json_string(FILE *file, const char *str) {
+  fputc('"', file);
+  for (; *str; str++) {
+    unsigned char c = *str;
+    if (c == '"' || c == '\\')
+      fprintf(file, "\\%c", c);
+    else if (c < 0x20)
+      fprintf(file, "\\u%04x", c);
+    else
+      fputc(c, file);
+  }
+  fputc('"', file);
+}
+
+/**
+ * @brief Outcome of the --target-quality search of one run.
+ */
+struct audx_target_result {
+  double quality; // score to reach, in dB
+  int64_t bitrate;
+  double score; // worst window at that bitrate
+  int met;
+};
+
+/**
+ * @brief Write the statistics of one run as a JSON object.
+ *
+ * @param path File to write, or "-" for stdout.
+ * @param output Output name, or NULL for analysis-only runs.
+ * @param loudness Measurements, or NULL when not measuring.
+ * @param target Bitrate search result, or NULL without --target-quality.
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+static int write_stats(const char *path, const char *input, const char *output,
+                       double duration, double elapsed,
+                       const struct audio_loudness *loudness,
+                       const struct audx_target_result *target) {
+  FILE *file = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+  if (!file) {
+    perror("Failed to open stats file");
+    return AVERROR(errno);
+  }
+
+  fprintf(file, "{\n  \"input\": ");
+  write_json_string(file, input);
+  fprintf(file, ",\n  \"output\": ");
+  if (output)
+    write_json_string(file, output);
+  else
+    fprintf(file, "null");
+  fprintf(file, ",\n  \"duration\": %.3f,\n  \"elapsed\": %.3f", duration,
+          elapsed);
+  if (loudness) {
+    fprintf(file, ",\n  \"loudness\": ");
+    audio_meter_write_json(loudness, file);
+  }
+  if (target)
+    fprintf(file,
+            ",\n  \"target\": {\"quality_db\": %.1f, \"bitrate\": %lld, "
+            "\"worst_window_db\": %.1f, \"met\": %s}",
+            target->quality, (long long)target->bitrate, target->score,
+            target->met ? "true" : "false");
+  fprintf(file, "\n}\n");
+
+  if (file != stdout && fclose(file) != 0) {
+    perror("Failed to write stats file");
+    return AVERROR(EIO);
+  }
+  return 0;
+}
+
+/**
+ * @brief Decoder, filter and control channel producing the PCM frames.
+ */
+struct audx_source {
+  struct audio_dec decoder;
+  struct audio_filter local_filter;
+  struct audio_filter *filter;
+  struct audio_control control;
+  struct audio_fingerprint *fingerprint; // taps on the decoded frames
+  struct audio_features *features;
+  struct audio_memory *memory; // resident size bound, or NULL
+  int taps_only; // nothing after the taps needs the audio
+  int64_t position; // samples before the first decoded frame (resumed run)
+  int open;
+};
+
+/**
+ * @brief Close a source opened by open_source().
+ */
+static void close_source(struct audx_source *src,
+                         struct audio_filter_cache *cache) {
+  if (!src->open)
+    return;
+  audio_control_close(&src->control);
+  if (src->filter) {
+    if (cache)
+      audio_filter_cache_release(cache, &src->filter);
+    else
+      audio_filter_free(src->filter);
+    src->filter = NULL;
+  }
+  audio_dec_free(&src->decoder);
+  src->open = 0;
+}
+
+/**
+ * @brief Open the decoder and, if requested, the filter and control channel.
+ *
+ * @param verbose Print stream and filter information.
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+static int open_source(struct audx_source *src, const char *input_filename,
+                       const struct audx_options *opts,
+                       struct audio_filter_cache *cache, int verbose) {
+  struct audio_dec *decoder = &src->decoder;
+  int ret;
+
+  src->filter = NULL;
+  src->control.fd = -1;
+
+  ret = audio_dec_init(
+      decoder, input_filename, opts->out_sample_rate,
+      opts->out_layout.nb_channels ? &opts->out_layout : NULL,
+      opts->resample_quality,
+      (opts->low_latency ? AUDIO_DEC_LOW_LATENCY : 0) |
+          (opts->bit_depth ? AUDIO_DEC_FLOAT : 0));
+  if (ret < 0) {
+    fprintf(stderr, "Failed to initialize decoder\n");
+    return ret;
+  }
+  src->open = 1;
+
+  if (verbose) {
+    printf("Audio stream info\n");
+    printf("  Sample rate : %d Hz\n", decoder->codec_ctx->sample_rate);
+    printf("  Channels    : %d\n", decoder->codec_ctx->ch_layout.nb_channels);
+    if (decoder->sample_rate != decoder->codec_ctx->sample_rate ||
+        decoder->channels != decoder->codec_ctx->ch_layout.nb_channels) {
+      printf("  Converting  : %d Hz, %d ch (%s resampler)\n",
+             decoder->sample_rate, decoder->channels,
+             audio_resample_quality_name(opts->resample_quality));
+    }
+  }
+
+  if (!opts->filter_desc || opts->filter_desc[0] == '\0')
+    return 0;
+
+  if (cache) {
+    ret = audio_filter_cache_acquire(
+        cache, &src->filter, decoder->sample_rate, decoder->dst_fmt,
+        &decoder->dst_ch_layout, opts->filter_desc, opts->filter_threads,
+        opts->filter_flags);
+  } else {
+    ret = audio_filter_init(&src->local_filter, decoder->sample_rate,
+                            decoder->dst_fmt, &decoder->dst_ch_layout,
+                            opts->filter_desc, opts->filter_threads,
+                            opts->filter_flags);
+    if (ret >= 0)
+      src->filter = &src->local_filter;
+  }
+  if (ret < 0) {
+    fprintf(stderr, "Failed to initialize filter\n");
+    close_source(src, cache);
+    return ret;
+  }
+  /* Cached filters keep the previous job's limit otherwise */
+  audio_filter_set_max_held(
+      src->filter, opts->memory ? audio_memory_budget(opts->memory) / 4 : 0);
+  if (verbose)
+    printf("Applying filter: %s%s\n", opts->filter_desc,
+           src->filter->use_dsp    ? " (native)"
+           : src->filter->nb_split ? " (per channel)"
+                                   : "");
+
+  if (opts->control_path &&
+      (ret = audio_control_open(&src->control, opts->control_path)) < 0) {
+    close_source(src, cache);
+    return ret;
+  }
+  return 0;
+}
+
+/**
+ * @brief Decode and filter the whole source, writing every frame to `out`.
+ *
+ * @param nb_samples Receives the number of decoded samples per channel.
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+static int run_source(struct audx_source *src, struct audx_output *out,
+                      int64_t *nb_samples) {
+  struct audio_dec *decoder = &src->decoder;
+  struct audio_filter *filter = src->filter;
+  AVFrame *frame = av_frame_alloc();
+  AVFrame *filtered_frame = av_frame_alloc();
+  int ret;
+
+  if (!frame || !filtered_frame) {
+    fprintf(stderr, "Failed to allocate frame\n");
+    av_frame_free(&frame);
+    av_frame_free(&filtered_frame);
+    return AVERROR(ENOMEM);
+  }
+
+  uint8_t *data = NULL;
+  int size = 0;
+  int64_t next_pts = src->position;
+  int err = 0;
+
+  for (;;) {
+    /* Decode time of the frame, carried to the encoder's latency
+     * measurement in `opaque` */
+    int64_t read_time = av_gettime_relative();
+    if ((ret = audio_decoder_read(decoder, &data, &size)) <= 0) {
+      if (ret < 0) {
+        fprintf(stderr, "Error decoding input\n");
+        err = ret;
+      }
+      break;
+    }
+    if (!data || size <= 0)
+      continue;
+
+    if (src->memory && (err = audio_memory_check(src->memory)) < 0) {
+      fprintf(stderr, "Memory limit exceeded: %.1f MB resident\n",
+              src->memory->peak / 1048576.0);
+      av_freep(&data);
+      break;
+    }
+
+    /* Fill frame with decoded PCM data */
+    if (fill_frame(frame, data, size, decoder->channels, decoder->dst_fmt,
+                   decoder->sample_rate, &decoder->dst_ch_layout,
+                   next_pts) < 0)
+      continue;
+    frame->opaque = (void *)(intptr_t)read_time;
+    next_pts += frame->nb_samples;
+
+    if (src->fingerprint) {
+      err = audio_fingerprint_process(src->fingerprint, frame);
+      if (err < 0) {
+        fprintf(stderr, "Error fingerprinting frame\n");
+        av_frame_unref(frame);
+        break;
+      }
+    }
+    if (src->features) {
+      err = audio_features_process(src->features, frame);
+      if (err < 0) {
+        fprintf(stderr, "Error extracting features\n");
+        av_frame_unref(frame);
+        break;
+      }
+    }
+    if (src->taps_only) {
+      av_frame_unref(frame);
+      /* A limited fingerprint can stop the decode early */
+      if (!src->features && src->fingerprint && src->fingerprint->done)
+        break;
+      continue;
+    }
+
+    /* Apply live parameter changes before the next frame goes in */
+    if (filter && src->control.fd >= 0)
+      audio_control_poll(&src->control, filter);
+
+    if ((err = output_frame(filter, frame, filtered_frame, out)) < 0)
+      break;
+  }
+
+  /* Flush the filter so buffered samples (e.g., atempo) reach the output */
+  if (err >= 0 && !src->taps_only)
+    err = output_frame(filter, NULL, filtered_frame, out);
+
+  av_frame_free(&frame);
+  av_frame_free(&filtered_frame);
+  *nb_samples = next_pts - src->position;
+  return err;
+}
+
+/**
+ * @brief First pass of --normalize: get the loudness of the source.
+ *
+ * The measurement is looked up in the input's sidecar cache first. On a miss
+ * the source is run through a meter while its frames are kept in `spill`
+ * for the second pass, and the result is added to the cache.
+ *
+ * @param consumed Set to 1 if the source was run.
+ * @param nb_samples Receives the number of decoded samples per channel if
+ * the source was run.
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+static int measure_source(struct audx_source *src, const char *input_filename,
+                          const struct audx_options *opts,
+                          struct audio_spill *spill,
+                          struct audio_loudness *loudness, int *consumed,
+                          int64_t *nb_samples) {
+  struct audio_dec *decoder = &src->decoder;
+  char layout[64] = "";
+  char settings[1024];
+  char key[33];
+  int ret;
+
+  *consumed = 0;
+
+  /* The measurement covers what leaves the filter */
+  av_channel_layout_describe(&decoder->dst_ch_layout, layout, sizeof(layout));
+  snprintf(settings, sizeof(settings), "rate=%d;layout=%s;fmt=%d;filter=%s",
+           decoder->sample_rate, layout, decoder->dst_fmt,
+           opts->filter_desc ? opts->filter_desc : "");
+  int cacheable = audio_normalize_key(input_filename, settings, key) >= 0;
+
+  if (cacheable && audio_normalize_cache_load(input_filename, key, loudness)) {
+    if (opts->verbose)
+      printf("Loudness: %.1f LUFS, %.1f dBTP (cached)\n", loudness->integrated,
+             loudness->true_peak);
+    return 0;
+  }
+
+  struct audio_meter meter;
+  struct audx_output probe = {.meter = &meter, .spill = spill};
+
+  audio_meter_init(&meter);
+  ret = run_source(src, &probe, nb_samples);
+  *consumed = 1;
+  if (ret >= 0) {
+    audio_meter_result(&meter, loudness);
+    if (opts->verbose)
+      printf("Loudness: %.1f LUFS, %.1f dBTP (measured)\n",
+             loudness->integrated, loudness->true_peak);
+    if (cacheable &&
+        audio_normalize_cache_store(input_filename, key, loudness) < 0 &&
+        opts->verbose)
+      fprintf(stderr, "Could not write the loudness sidecar of %s\n",
+              input_filename);
+  }
+  audio_meter_free(&meter);
+  return ret;
+}
+
+/**
+ * @brief Send the frames kept by the first pass to the output.
+ */
+static int replay_spill(struct audio_spill *spill, struct audx_output *out) {
+  AVFrame *frame = av_frame_alloc();
+  int ret;
+
+  if (!frame)
+    return AVERROR(ENOMEM);
+  while ((ret = audio_spill_read_frame(spill, frame)) >= 0 &&
+         (ret = write_output(out, frame)) >= 0)
+    ;
+  av_frame_free(&frame);
+  return ret == AVERROR_EOF ? 0 : ret;
+}
+
+/**
+ * @brief Whether a job's output can come from the output cache: a single
+ *        local file and no side outputs that would need the decode.
+ */
+static int output_cacheable(const struct audx_options *opts,
+                            const char *output_filename) {
+  return opts->output_cache && output_filename && !opts->analyze_only &&
+         opts->segment_seconds <= 0 && !opts->realtime &&
+         !opts->control_path && !opts->measure && !opts->stats_path &&
+         !opts->peaks_path && !opts->fingerprint && !opts->features &&
+         strcmp(output_filename, "-") != 0 && !is_network_url(output_filename);
+}
+
+/**
+ * @brief Everything besides the input that an output depends on: the
+ *        normalized options, the output's extension (which picks the
+ *        container) and the audx and FFmpeg versions.
+ */
+static void output_cache_settings(const struct audx_options *opts,
+                                  const char *output_filename, char *buf,
+                                  size_t size) {
+  const char *ext = strrchr(output_filename, '.');
+  char layout[64] = "";
+
+  if (opts->out_layout.nb_channels)
+    av_channel_layout_describe(&opts->out_layout, layout, sizeof(layout));
+  snprintf(buf, size,
+           "audx=%s;ffmpeg=%s;lavc=%u;lavf=%u;lavu=%u;lavfi=%u;swr=%u;"
+           "codec=%s;format=%s;ext=%s;quality=%d;bitrate=%s;filter=%s;"
+           "rate=%d;layout=%s;resample=%d;frame_ms=%g;low_latency=%d;"
+           "normalize=%d,%g,%g;trim=%d,%g,%g,%d;depth=%d,%d;target=%g",
+           AUDX_VERSION, av_version_info(), avcodec_version(),
+           avformat_version(), avutil_version(), avfilter_version(),
+           swresample_version(), opts->codec_name ? opts->codec_name : "",
+           opts->format_name ? opts->format_name : "", ext ? ext : "",
+           opts->bitrate_str ? -1 : (int)opts->quality,
+           opts->bitrate_str ? opts->bitrate_str : "",
+           opts->filter_desc ? opts->filter_desc : "", opts->out_sample_rate,
+           layout, (int)opts->resample_quality, opts->frame_ms,
+           opts->low_latency, opts->normalize, opts->normalize_target,
+           opts->normalize_ceiling, opts->trim_silence, opts->trim_threshold,
+           opts->trim_min_duration, opts->trim_gaps, opts->bit_depth,
+           opts->dither_flags, opts->target_quality);
+}
+
+/**
+ * @brief Bytes per sample of the raw PCM output.
+ */
+static int output_sample_bytes(const struct audx_options *opts) {
+  switch (opts->bit_depth) {
+  case 24:
+    return 3;
+  case 32:
+  case -1:
+    return 4;
+  default:
+    return 2;
+  }
+}
+
+/**
+ * @brief Identity of a checkpointed job: the input's size, mtime and inode,
+ *        the output settings and the output path.
+ *
+ * @return 0 on success, AVERROR(ENOTSUP) if the input is not a regular file,
+ * or another negative AVERROR code on failure.
+ */
+static int checkpoint_key(const struct audx_options *opts,
+                          const char *input_filename,
+                          const char *output_filename, char key[33]) {
+  struct audio_output_cache identity = {.fast = 1};
+  char settings[2048 + 256];
+
+  output_cache_settings(opts, output_filename, settings, 2048);
+  size_t len = strlen(settings);
+  snprintf(settings + len, sizeof(settings) - len, ";output=%s",
+           output_filename);
+  return audio_output_cache_key(&identity, input_filename, settings, key);
+}
+
+/**
+ * @brief Copy the samples of a raw PCM job straight from the input when
+ *        decoding would only reproduce them: an s16le WAV or AIFF-C input,
+ *        no codec, no conversion and nothing that needs the decoded audio.
+ *
+ * @return 1 if the output was written, 0 if the job needs the decoder, or a
+ * negative AVERROR code on failure.
+ */
+static int copy_raw_pcm(const char *input_filename,
+                        const char *output_filename,
+                        const struct audx_options *opts) {
+  struct audio_passthrough pt;
+  AVChannelLayout layout = {0}, target = {0};
+  int ret;
+
+  if (opts->codec_name || opts->analyze_only || opts->segment_seconds > 0 ||
+      (opts->filter_desc && opts->filter_desc[0] != '\0') ||
+      opts->normalize || opts->trim_silence || opts->measure ||
+      opts->peaks_path || opts->fingerprint || opts->features ||
+      opts->checkpoint_dir || opts->control_path || opts->stats_path ||
+      opts->bit_depth || !audio_passthrough_probe(&pt, input_filename))
+    return 0;
+
+  /* The decoder converts to the default layout of the input's channel
+   * count (or the requested one); only an unchanged layout is a copy */
+  ret = 0;
+  if (pt.channel_mask)
+    ret = av_channel_layout_from_mask(&layout, pt.channel_mask);
+  else
+    av_channel_layout_default(&layout, pt.channels);
+  if (!opts->out_layout.nb_channels)
+    av_channel_layout_default(&target, pt.channels);
+  else if (ret >= 0)
+    ret = av_channel_layout_copy(&target, &opts->out_layout);
+  int same = ret >= 0 && layout.nb_channels == pt.channels &&
+             av_channel_layout_compare(&layout, &target) == 0 &&
+             (!opts->out_sample_rate || opts->out_sample_rate == pt.sample_rate);
+  av_channel_layout_uninit(&layout);
+  av_channel_layout_uninit(&target);
+  if (!same)
+    return 0;
+
+  ret = audio_passthrough_copy(&pt, input_filename, output_filename);
+  if (ret < 0) {
+    fprintf(stderr, "Failed to copy PCM data to %s\n", output_filename);
+    return ret;
+  }
+  if (opts->verbose)
+    printf("Copied raw PCM: %.1f MB, %d Hz, %d ch, no decoding (%s)\n",
+           pt.copied / 1048576.0, pt.sample_rate, pt.channels, pt.method);
+  return 1;
+}
+
+/**
+ * @brief Decode, filter and encode one file.
+ *
+ * @param opts Run settings.
+ * @param cache Filter cache for batch runs, or NULL to build the filter
+ *              directly.
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+static int transcode(const char *input_filename, const char *output_filename,
+                     const struct audx_options *opts,
+                     struct audio_filter_cache *cache) {
+  int use_encoder = (opts->codec_name != NULL);
+
+  struct audx_source src = {0};
+  struct audio_enc encoder;
+  struct audio_segmenter segmenter;
+  struct audio_meter meter;
+  struct audio_peaks peaks;
+  struct audio_fingerprint fingerprint;
+  struct audio_features features;
+  int features_open = 0;
+  struct audio_trim trim;
+  int trim_open = 0;
+  struct audio_normalizer normalizer;
+  struct audio_spill spill;
+  struct audio_checkpoint checkpoint;
+  int checkpoint_open = 0;
+  struct audio_dither dither;
+  int dither_open = 0;
+  const char *bitrate_str = opts->bitrate_str;
+  char target_bitrate[32];
+  struct audx_target_result target_result;
+  int target_run = 0;
+  int64_t resume_at = 0;
+  struct audx_output out = {0};
+  int encoder_open = 0;
+  int segmenter_open = 0;
+  int replay = 0;
+  int64_t nb_samples = 0;
+  int64_t start_time = av_gettime_relative();
+  /* --max-memory: a quarter of the budget for each bounded buffer */
+  int64_t buffer_budget =
+      opts->memory ? audio_memory_budget(opts->memory) / 4 : 0;
+  char cache_key[33];
+  int cacheable = output_cacheable(opts, output_filename);
+
+  /* A repeated job is served from the output cache without decoding */
+  if (cacheable) {
+    char settings[2048];
+    output_cache_settings(opts, output_filename, settings, sizeof(settings));
+    cacheable = audio_output_cache_key(opts->output_cache, input_filename,
+                                       settings, cache_key) >= 0;
+  }
+  if (cacheable) {
+    int hit = audio_output_cache_fetch(opts->output_cache, cache_key,
+                                       output_filename);
+    if (hit > 0) {
+      if (opts->verbose)
+        printf("Output cache hit: %s (%.1f ms)\n", output_filename,
+               (av_gettime_relative() - start_time) / 1000.0);
+      return 0;
+    }
+    if (hit < 0)
+      fprintf(stderr, "Could not read the output cache, transcoding\n");
+  }
+
+  /* Raw PCM already in the output format skips decoding altogether */
+  int copied = copy_raw_pcm(input_filename, output_filename, opts);
+  if (copied != 0) {
+    if (copied > 0 && cacheable &&
+        audio_output_cache_store(opts->output_cache, cache_key,
+                                 output_filename) < 0)
+      fprintf(stderr, "Could not store %s in the output cache\n",
+              output_filename);
+    return copied < 0 ? copied : 0;
+  }
+
+  audio_meter_init(&meter);
+  audio_peaks_init(&peaks);
+  audio_fingerprint_init(&fingerprint, opts->fingerprint_seconds);
+  audio_spill_init(&spill, buffer_budget, 0);
+  audio_normalize_init(&normalizer, 0.0, -HUGE_VAL, 0.0);
+  if (opts->measure)
+    out.meter = &meter;
+  if (opts->peaks_path)
+    out.peaks = &peaks;
+
+  int ret = open_source(&src, input_filename, opts, cache, opts->verbose);
+  if (ret < 0)
+    goto end;
+  struct audio_dec *decoder = &src.decoder;
+  src.memory = opts->memory;
+
+  if (opts->fingerprint)
+    src.fingerprint = &fingerprint;
+  if (opts->features) {
+    char *path = opts->features_path
+                     ? av_strdup(opts->features_path)
+                     : av_asprintf("%s.logmel.npy", output_filename);
+    if (!path) {
+      ret = AVERROR(ENOMEM);
+      goto end;
+    }
+    ret = audio_features_init(&features, path, &opts->features_config,
+                              opts->threads);
+    if (ret < 0)
+      fprintf(stderr, "Failed to create feature file %s\n", path);
+    else if (opts->verbose)
+      printf("Log-mel features to: %s (%d Hz, window %d, hop %d, %d mels)\n",
+             path, opts->features_config.sample_rate,
+             opts->features_config.window, opts->features_config.hop,
+             opts->features_config.n_mels);
+    av_free(path);
+    if (ret < 0)
+      goto end;
+    features_open = 1;
+    src.features = &features;
+  }
+  if (opts->trim_silence) {
+    if ((ret = audio_trim_init(&trim, opts->trim_threshold,
+                               opts->trim_min_duration, opts->trim_gaps,
+                               buffer_budget)) < 0)
+      goto end;
+    trim_open = 1;
+    out.trim = &trim;
+  }
+  src.taps_only = opts->analyze_only && !opts->measure && !opts->peaks_path &&
+                  !opts->normalize;
+
+  /* First pass of --normalize, then the gain that reaches the target */
+  if (opts->normalize) {
+    struct audio_loudness measured;
+    int consumed;
+
+    ret = measure_source(&src, input_filename, opts, &spill, &measured,
+                         &consumed, &nb_samples);
+    if (ret < 0)
+      goto end;
+    /* The first pass saw every decoded frame */
+    if (consumed) {
+      src.fingerprint = NULL;
+      src.features = NULL;
+    }
+
+    double gain_db = isfinite(measured.integrated)
+                         ? opts->normalize_target - measured.integrated
+                         : 0.0;
+    audio_normalize_init(&normalizer, gain_db, measured.true_peak,
+                         opts->normalize_ceiling);
+    out.normalizer = &normalizer;
+    if (opts->verbose)
+      printf("Normalizing to %.1f LUFS: gain %+.1f dB%s\n",
+             opts->normalize_target, gain_db,
+             normalizer.limit ? ", limiting true peaks" : "");
+
+    /* Replay the kept frames; decode again only if they did not fit */
+    if (consumed && !spill.overflow) {
+      replay = 1;
+    } else if (consumed) {
+      if (opts->verbose)
+        printf("Decoded audio exceeded the spill buffer, decoding again\n");
+      close_source(&src, cache);
+      if ((ret = open_source(&src, input_filename, opts, cache, 0)) < 0)
+        goto end;
+    }
+  }
+
+  if (opts->checkpoint_dir) {
+    char key[33];
+    ret = checkpoint_key(opts, input_filename, output_filename, key);
+    if (ret == AVERROR(ENOTSUP))
+      fprintf(stderr, "--checkpoint needs a seekable input file\n");
+    if (ret < 0)
+      goto end;
+    ret = audio_checkpoint_init(&checkpoint, opts->checkpoint_dir, key,
+                                opts->checkpoint_interval,
+                                decoder->sample_rate, use_encoder);
+    if (ret < 0) {
+      fprintf(stderr, "Cannot use checkpoint directory %s\n",
+              opts->checkpoint_dir);
+      goto end;
+    }
+    checkpoint_open = 1;
+  }
+
+  /* Integer output of the float pipeline */
+  if (opts->bit_depth > 0 && !opts->analyze_only &&
+      !(opts->codec_name && is_lossy_codec(opts->codec_name))) {
+    ret = audio_dither_init(&dither, opts->bit_depth, decoder->channels,
+                            opts->dither_flags);
+    if (ret < 0)
+      goto end;
+    dither_open = 1;
+    out.dither = &dither;
+  }
+
+  /* --target-quality: search the bitrate on samples of the input first */
+  if (opts->target_quality > 0 && !opts->analyze_only) {
+    struct audio_target target;
+    const struct audio_target_config config = {
+        .codec_name = opts->codec_name,
+        .resample_quality = opts->resample_quality,
+        .frame_ms = opts->frame_ms,
+        .sample_rate = decoder->sample_rate,
+        .ch_layout = &decoder->dst_ch_layout,
+        .target = opts->target_quality,
+        .nb_threads = opts->threads,
+    };
+    ret = audio_target_init(&target, input_filename, &config);
+    if (ret >= 0)
+      ret = audio_target_search(&target);
+    if (ret >= 0) {
+      snprintf(target_bitrate, sizeof(target_bitrate), "%lld",
+               (long long)target.bitrate);
+      bitrate_str = target_bitrate;
+      target_result = (struct audx_target_result){
+          opts->target_quality, target.bitrate, target.score, target.met};
+      target_run = 1;
+      if (!target.met)
+        fprintf(stderr, "Target quality %.1f not reached, using the highest "
+                        "bitrate\n", opts->target_quality);
+      printf("Target quality %.1f: %lld kbps (worst window %.1f)\n",
+             opts->target_quality, (long long)target.bitrate / 1000,
+             target.score);
+      if (opts->verbose)
+        printf("  Search: %d bitrates in %d rounds, %d window encodes over "
+               "%d windows, %.2f s\n",
+               target.candidates, target.rounds, target.encodes,
+               target.nb_windows, target.time_us / 1e6);
+    }
+    audio_target_free(&target);
+    if (ret < 0) {
+      fprintf(stderr, "Bitrate search failed\n");
+      goto end;
+    }
+  }
+
+  /* Initialize segmenter, encoder or open raw PCM file */
+  if (opts->analyze_only) {
+    if (opts->verbose)
+      printf("No output written\n");
+  } else if (opts->segment_seconds > 0) {
+    struct audio_segment_config config = {
+        .codec_name = opts->codec_name,
+        .quality = opts->quality,
+        .bitrate_str = bitrate_str,
+        .resample_quality = opts->resample_quality,
+        .frame_ms = opts->frame_ms,
+        .segment_seconds = opts->segment_seconds,
+        .nb_threads = opts->threads,
+        .max_memory = buffer_budget,
+    };
+    ret = audio_segment_init(&segmenter, output_filename, &config,
+                             decoder->sample_rate, decoder->dst_fmt,
+                             &decoder->dst_ch_layout);
+    if (ret < 0) {
+      fprintf(stderr, "Failed to initialize segmented output\n");
+      goto end;
+    }
+    segmenter_open = 1;
+    out.segmenter = &segmenter;
+    if (opts->verbose)
+      printf("Segmenting to: %s (codec: %s, %.1f s segments, %d threads)\n",
+             output_filename, opts->codec_name, opts->segment_seconds,
+             segmenter.pool.nb_threads);
+  } else if (use_encoder) {
+    int enc_flags = (opts->low_latency ? AUDIO_ENC_LOW_LATENCY : 0) |
+                    (opts->realtime ? AUDIO_ENC_REALTIME : 0) |
+                    (opts->bit_depth == 24   ? AUDIO_ENC_S32_24
+                     : opts->bit_depth == 32 ? AUDIO_ENC_S32
+                     : opts->bit_depth < 0   ? AUDIO_ENC_FLT
+                                             : 0);
+    ret = audio_enc_init(&encoder, output_filename, opts->format_name,
+                         opts->codec_name, decoder->sample_rate,
+                         &decoder->dst_ch_layout, opts->quality,
+                         bitrate_str, opts->resample_quality, enc_flags,
+                         opts->frame_ms);
+    if (ret < 0) {
+      fprintf(stderr, "Failed to initialize encoder\n");
+      goto end;
+    }
+    encoder_open = 1;
+    out.encoder = &encoder;
+
+    /* Packets go to the journal until the end */
+    if (checkpoint_open &&
+        (ret = audio_checkpoint_attach_encoder(&checkpoint, &encoder,
+                                               &resume_at)) < 0)
+      goto end;
+
+    /* RTP receivers need the session description */
+    if (strcmp(encoder.fmt_ctx->oformat->name, "rtp") == 0 &&
+        (ret = audio_enc_write_sdp(&encoder, opts->sdp_path)) < 0)
+      goto end;
+    if (opts->verbose)
+      printf("Encoding to: %s (codec: %s)\n", output_filename,
+             opts->codec_name);
+  } else if (checkpoint_open) {
+    int frame_bytes = decoder->channels * output_sample_bytes(opts);
+    ret = audio_checkpoint_open_file(&checkpoint, output_filename,
+                                     frame_bytes, &out.file, &resume_at);
+    if (ret < 0) {
+      fprintf(stderr, "Failed to open output file\n");
+      goto end;
+    }
+    out.checkpoint = &checkpoint;
+    if (opts->verbose)
+      printf("Writing raw PCM to: %s\n", output_filename);
+  } else {
+    out.file = fopen(output_filename, "wb");
+    if (!out.file) {
+      perror("Failed to open output file");
+      ret = AVERROR(errno);
+      goto end;
+    }
+    if (opts->verbose)
+      printf("Writing raw PCM to: %s\n", output_filename);
+  }
+
+  /* Continue where the last checkpoint left off */
+  if (resume_at > 0) {
+    if ((ret = audio_dec_seek(decoder, resume_at)) < 0)
+      goto end;
+    src.position = resume_at;
+    if (opts->verbose)
+      printf("Resuming from checkpoint at %.1f s\n",
+             (double)checkpoint.position / decoder->sample_rate);
+  }
+
+  /* Filtered frames leave the graph already sized for the encoder */
+  if (src.filter && out.encoder)
+    audio_filter_set_frame_size(src.filter, encoder.codec_ctx->frame_size);
+
+  /* Main decode/filter/encode loop */
+  if (replay) {
+    ret = replay_spill(&spill, &out);
+  } else {
+    ret = run_source(&src, &out, &nb_samples);
+  }
+  if (ret < 0)
+    goto end;
+
+  /* Trailing silence is only known at the end */
+  if (out.trim) {
+    struct audx_output rest = out;
+    rest.trim = NULL;
+    ret = audio_trim_flush(&trim, write_trimmed, &rest);
+    if (ret < 0)
+      goto end;
+    if (opts->verbose) {
+      int64_t removed = trim.removed_head + trim.removed_tail +
+                        trim.removed_gaps;
+      double rate = trim.sample_rate > 0 ? trim.sample_rate : 1;
+      printf("Trimmed: %.2f s of %.2f s (head %.2f s, tail %.2f s, "
+             "gaps %.2f s)\n",
+             removed / rate, trim.samples / rate, trim.removed_head / rate,
+             trim.removed_tail / rate, trim.removed_gaps / rate);
+    }
+  }
+
+  /* The limiter's lookahead still holds the end of the audio */
+  if (out.normalizer) {
+    AVFrame *tail = av_frame_alloc();
+    struct audx_output rest = out;
+    rest.trim = NULL;
+    rest.normalizer = NULL;
+    if (!tail) {
+      ret = AVERROR(ENOMEM);
+      goto end;
+    }
+    ret = audio_normalize_flush(&normalizer, tail);
+    if (ret >= 0 && tail->nb_samples > 0)
+      ret = write_output(&rest, tail);
+    av_frame_free(&tail);
+    if (ret < 0)
+      goto end;
+    if (opts->verbose && normalizer.limited > 0)
+      printf("Limiter: %lld samples reduced, up to %.1f dB\n",
+             (long long)normalizer.limited, 20.0 * log10(normalizer.min_gain));
+  }
+
+  /* Finalize encoding */
+  if (out.segmenter) {
+    ret = audio_segment_finalize(&segmenter);
+    if (ret < 0) {
+      fprintf(stderr, "Failed to finish segmented output\n");
+      goto end;
+    }
+  } else if (out.encoder && checkpoint_open) {
+    ret = audio_checkpoint_finish(&checkpoint, &encoder);
+    if (ret < 0) {
+      fprintf(stderr, "Failed to write the output from the checkpoint "
+                      "journal\n");
+      goto end;
+    }
+  } else if (out.encoder) {
+    ret = audio_enc_finalize(&encoder);
+    if (ret < 0) {
+      fprintf(stderr, "Failed to finish the output\n");
+      goto end;
+    }
+    if (opts->low_latency && encoder.latency_count > 0)
+      printf("Latency: avg %.2f ms, max %.2f ms over %d packets "
+             "(codec delay %.2f ms)\n",
+             encoder.latency_sum / 1000.0 / encoder.latency_count,
+             encoder.latency_max / 1000.0, encoder.latency_count,
+             encoder.codec_ctx->initial_padding * 1000.0 /
+                 encoder.codec_ctx->sample_rate);
+    if (opts->realtime && encoder.pacer.packets > 0)
+      printf("Pacing: %lld packets, jitter avg %.1f us, max %lld us, "
+             "%lld missed deadlines (> %lld us late)\n",
+             (long long)encoder.pacer.packets,
+             (double)encoder.pacer.jitter_sum / encoder.pacer.packets,
+             (long long)encoder.pacer.jitter_max,
+             (long long)encoder.pacer.late,
+             (long long)encoder.pacer.late_us);
+  }
+
+  if (dither_open && opts->verbose) {
+    double run_ms = (av_gettime_relative() - start_time) / 1000.0;
+    printf("Dither: %d-bit %s, %.1f ms for %lld samples (%.1f%% of %.1f ms)\n",
+           dither.bits,
+           dither.flags & AUDIO_DITHER_NONE     ? "rounding"
+           : dither.flags & AUDIO_DITHER_SHAPED ? "shaped TPDF"
+                                                : "TPDF",
+           dither.time_us / 1000.0, (long long)dither.samples,
+           run_ms > 0 ? 100.0 * dither.time_us / 1000.0 / run_ms : 0.0,
+           run_ms);
+  }
+
+  if (checkpoint_open && opts->verbose)
+    printf("Checkpoints: %d written%s\n", checkpoint.saved,
+           checkpoint.resumed ? " (resumed run)" : "");
+
+  if (out.peaks) {
+    ret = audio_peaks_write(&peaks, opts->peaks_path);
+    if (ret < 0) {
+      fprintf(stderr, "Failed to write peaks to %s\n", opts->peaks_path);
+      goto end;
+    }
+    if (opts->verbose)
+      printf("Peaks written to: %s (%d zoom levels)\n", opts->peaks_path,
+             AUDIO_PEAKS_LEVELS);
+  }
+
+  if (opts->fingerprint) {
+    char *path = opts->fingerprint_path
+                     ? av_strdup(opts->fingerprint_path)
+                     : av_asprintf("%s.fingerprint", output_filename);
+    if (!path) {
+      ret = AVERROR(ENOMEM);
+      goto end;
+    }
+    ret = audio_fingerprint_write(&fingerprint, path);
+    if (ret < 0)
+      fprintf(stderr, "Failed to write fingerprint to %s\n", path);
+    else if (opts->verbose)
+      printf("Fingerprint written to: %s (%.1f s analysed)\n", path,
+             (double)fingerprint.samples / AUDIO_FINGERPRINT_RATE);
+    av_free(path);
+    if (ret < 0)
+      goto end;
+  }
+
+  if (features_open) {
+    ret = audio_features_finish(&features);
+    if (ret < 0) {
+      fprintf(stderr, "Failed to write features\n");
+      goto end;
+    }
+    if (opts->verbose)
+      printf("Features: %lld frames x %d mels\n", (long long)features.frames,
+             opts->features_config.n_mels);
+  }
+
+  if (opts->memory && opts->verbose) {
+    int64_t rss = audio_memory_rss();
+    printf("Memory: %.1f MB peak resident of %.1f MB allowed\n",
+           FFMAX(opts->memory->peak, rss) / 1048576.0,
+           opts->memory->limit / 1048576.0);
+  }
+
+  struct audio_loudness loudness;
+  if (opts->measure) {
+    audio_meter_result(&meter, &loudness);
+    printf("Loudness: %.1f LUFS integrated, %.1f LU range, "
+           "%.1f dBTP true peak (sample peak %.1f dBFS)\n",
+           loudness.integrated, loudness.range, loudness.true_peak,
+           loudness.sample_peak);
+  }
+  if (opts->stats_path) {
+    ret = write_stats(opts->stats_path, input_filename,
+                      opts->analyze_only ? NULL : output_filename,
+                      (double)nb_samples / decoder->sample_rate,
+                      (av_gettime_relative() - start_time) / 1e6,
+                      opts->measure ? &loudness : NULL,
+                      target_run ? &target_result : NULL);
+    if (ret < 0)
+      goto end;
+  }
+  ret = 0;
+
+end:
+  if (segmenter_open)
+    audio_segment_free(&segmenter);
+  if (encoder_open)
+    audio_enc_free(&encoder);
+  if (out.file)
+    fclose(out.file);
+  if (checkpoint_open) {
+    /* The job is complete; nothing left to resume */
+    if (ret == 0)
+      audio_checkpoint_remove(&checkpoint);
+    audio_checkpoint_free(&checkpoint);
+  }
+  if (dither_open)
+    audio_dither_free(&dither);
+  audio_normalize_free(&normalizer);
+  audio_spill_free(&spill);
+  if (trim_open)
+    audio_trim_free(&trim);
+  if (features_open)
+    audio_features_free(&features);
+  audio_fingerprint_free(&fingerprint);
+  audio_peaks_free(&peaks);
+  audio_meter_free(&meter);
+  close_source(&src, cache);
+
+  /* Publish once the output is closed */
+  if (ret == 0 && cacheable &&
+      audio_output_cache_store(opts->output_cache, cache_key,
+                               output_filename) < 0)
+    fprintf(stderr, "Could not store %s in the output cache\n",
+            output_filename);
+  return ret;
+}
+
+/**
+ * @brief Transcode the selected audio streams of one input (--streams).
+ *
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+static int run_streams(const char *input_filename,
+                       const char *output_filename,
+                       const struct audx_options *opts) {
+  struct audio_streams streams;
+  const struct audio_streams_config config = {
+      .codec_name = opts->codec_name,
+      .format_name = opts->format_name,
+      .quality = opts->quality,
+      .bitrate_str = opts->bitrate_str,
+      .resample_quality = opts->resample_quality,
+      .frame_ms = opts->frame_ms,
+      .sample_rate = opts->out_sample_rate,
+      .ch_layout = opts->out_layout.nb_channels ? &opts->out_layout : NULL,
+      .filter_desc = opts->filter_desc && opts->filter_desc[0] != '\0'
+                         ? opts->filter_desc
+                         : NULL,
+      .nb_threads = opts->threads,
+  };
+
+  int ret = audio_streams_init(&streams, input_filename, output_filename,
+                               opts->streams, &config);
+  if (ret < 0)
+    return ret;
+
+  if (opts->verbose) {
+    printf("Input: %s\n", input_filename);
+    for (int i = 0; i < streams.nb_chains; i++) {
+      const struct audio_stream_chain *chain = &streams.chains[i];
+      printf("  Audio stream %d: %d Hz, %d channels -> %s\n", chain->number,
+             chain->decoder.sample_rate, chain->decoder.channels,
+             chain->path ? chain->path : output_filename);
+    }
+  }
+
+  ret = audio_streams_run(&streams);
+  audio_streams_free(&streams);
+  return ret;
+}
+
+/**
+ * @brief Resolve a path read from a list file against the list's directory,
+ *        the way playlists are read. Absolute paths and URLs are kept.
+ *
+ * @return Newly allocated path, or NULL if out of memory.
+ */
+static char *list_relative_path(const char *list_path, const char *path) {
+  const char *slash = strrchr(list_path, '/');
+
+  if (!slash || path[0] == '/' || strstr(path, "://"))
+    return av_strdup(path);
+  return av_asprintf("%.*s/%s", (int)(slash - list_path), list_path, path);
+}
+
+/**
+ * @brief Read the input files of a --concat list: one path per line, empty
+ *        lines and lines starting with '#' skipped. Relative paths are
+ *        relative to the list file.
+ *
+ * @return Number of inputs, or a negative AVERROR code.
+ */
+static int read_concat_list(const char *list_path, char ***paths) {
+  char line[4096];
+  int nb = 0;
+
+  *paths = NULL;
+  FILE *list = fopen(list_path, "r");
+  if (!list) {
+    perror("Failed to open concat list");
+    return AVERROR(errno);
+  }
+
+  while (fgets(line, sizeof(line), list)) {
+    line[strcspn(line, "\r\n")] = '\0';
+    if (line[0] == '\0' || line[0] == '#')
+      continue;
+
+    char **grown = av_realloc_array(*paths, nb + 1, sizeof(*grown));
+    char *path = list_relative_path(list_path, line);
+    if (grown)
+      *paths = grown;
+    if (!grown || !path) {
+      av_free(path);
+      nb = AVERROR(ENOMEM);
+      break;
+    }
+    (*paths)[nb++] = path;
+  }
+  fclose(list);
+  return nb;
+}
+
+/**
+ * @brief PCM produced by a playlist or mix (audio_concat_read() and
+ *        audio_mix_read() have this signature).
+ */
+struct audx_pcm_source {
+  int (*read)(void *opaque, uint8_t **data, int *size);
+  void *opaque;
+  int sample_rate;
+  int channels;
+  enum AVSampleFormat format;
+  const AVChannelLayout *ch_layout;
+};
+
+static int read_concat(void *opaque, uint8_t **data, int *size) {
+  return audio_concat_read(opaque, data, size);
+}
+
+static int read_mix(void *opaque, uint8_t **data, int *size) {
+  return audio_mix_read(opaque, data, size);
+}
+
+/**
+ * @brief Filter and encode (or write as raw PCM) everything a source
+ *        produces, with one encoder and filter for the whole run.
+ *
+ * @param samples Receives the samples per channel written.
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+static int encode_pcm(const struct audx_pcm_source *pcm,
+                      const char *output_filename,
+                      const struct audx_options *opts, int64_t *samples) {
+  struct audio_enc encoder;
+  struct audio_filter filter;
+  struct audx_output out = {0};
+  int encoder_open = 0, filter_open = 0;
+  AVFrame *frame = NULL, *filtered = NULL;
+  int ret;
+
+  *samples = 0;
+
+  if (opts->codec_name) {
+    int enc_flags = (opts->low_latency ? AUDIO_ENC_LOW_LATENCY : 0) |
+                    (opts->realtime ? AUDIO_ENC_REALTIME : 0);
+    ret = audio_enc_init(&encoder, output_filename, opts->format_name,
+                         opts->codec_name, pcm->sample_rate, pcm->ch_layout,
+                         opts->quality, opts->bitrate_str,
+                         opts->resample_quality, enc_flags, opts->frame_ms);
+    if (ret < 0) {
+      fprintf(stderr, "Failed to initialize encoder\n");
+      goto end;
+    }
+    encoder_open = 1;
+    out.encoder = &encoder;
+  } else if (!(out.file = fopen(output_filename, "wb"))) {
+    perror("Failed to open output file");
+    ret = AVERROR(errno);
+    goto end;
+  }
+
+  if (opts->filter_desc && opts->filter_desc[0] != '\0') {
+    ret = audio_filter_init(&filter, pcm->sample_rate, pcm->format,
+                            pcm->ch_layout, opts->filter_desc,
+                            opts->filter_threads, opts->filter_flags);
+    if (ret < 0) {
+      fprintf(stderr, "Failed to initialize filter\n");
+      goto end;
+    }
+    filter_open = 1;
+    if (out.encoder)
+      audio_filter_set_frame_size(&filter, encoder.codec_ctx->frame_size);
+  }
+
+  frame = av_frame_alloc();
+  filtered = av_frame_alloc();
+  if (!frame || !filtered) {
+    ret = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  /* The same output stage as run_source(), fed from the PCM source */
+  struct audio_filter *stage = filter_open ? &filter : NULL;
+  uint8_t *data;
+  int size;
+  while ((ret = pcm->read(pcm->opaque, &data, &size)) > 0) {
+    if ((ret = fill_frame(frame, data, size, pcm->channels, pcm->format,
+                          pcm->sample_rate, pcm->ch_layout, *samples)) < 0)
+      goto end;
+    *samples += frame->nb_samples;
+    if ((ret = output_frame(stage, frame, filtered, &out)) < 0)
+      goto end;
+  }
+  if (ret < 0 || (ret = output_frame(stage, NULL, filtered, &out)) < 0)
+    goto end;
+  if (out.encoder)
+    ret = audio_enc_finalize(&encoder);
+
+end:
+  av_frame_free(&frame);
+  av_frame_free(&filtered);
+  if (filter_open)
+    audio_filter_free(&filter);
+  if (encoder_open)
+    audio_enc_free(&encoder);
+  if (out.file)
+    fclose(out.file);
+  return ret;
+}
+
+/**
+ * @brief Play every input of a --concat list into one output.
+ *
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+static int run_concat(const char *list_path, const char *output_filename,
+                      const struct audx_options *opts) {
+  struct audio_concat concat;
+  char **paths = NULL;
+  int64_t samples;
+  int ret;
+
+  int nb_inputs = read_concat_list(list_path, &paths);
+  if (nb_inputs <= 0) {
+    if (nb_inputs == 0)
+      fprintf(stderr, "Concat list %s names no inputs\n", list_path);
+    av_free(paths);
+    return nb_inputs < 0 ? nb_inputs : AVERROR(EINVAL);
+  }
+
+  ret = audio_concat_init(&concat, paths, nb_inputs, opts->out_sample_rate,
+                          opts->out_layout.nb_channels ? &opts->out_layout
+                                                       : NULL,
+                          opts->resample_quality, opts->crossfade);
+  if (ret >= 0) {
+    if (opts->verbose) {
+      printf("Concatenating %d inputs at %d Hz, %d channels", nb_inputs,
+             concat.sample_rate, concat.channels);
+      if (concat.crossfade > 0)
+        printf(" (%.2f s crossfades)", opts->crossfade);
+      printf("\n");
+    }
+
+    const struct audx_pcm_source pcm = {
+        read_concat,     &concat,        concat.sample_rate,
+        concat.channels, concat.format, &concat.ch_layout,
+    };
+    ret = encode_pcm(&pcm, output_filename, opts, &samples);
+    if (ret >= 0 && opts->verbose)
+      printf("Output: %.2f s from %d inputs\n",
+             (double)samples / concat.sample_rate, nb_inputs);
+    audio_concat_free(&concat);
+  }
+
+  for (int i = 0; i < nb_inputs; i++)
+    av_free(paths[i]);
+  av_free(paths);
+  return ret;
+}
+
+/**
+ * @brief Read the inputs of a --mix list: one input per line, the path
+ *        followed by optional gain=<dB>, offset=<seconds> and fade=<seconds>.
+ *
+ * A path containing spaces is written in double quotes. Relative paths are
+ * relative to the list file, as in --concat lists.
+ *
+ * @return Number of inputs, or a negative AVERROR code.
+ */
+static int read_mix_list(const char *list_path,
+                         struct audio_mix_source **sources) {
+  char line[4096];
+  int nb = 0, ret = 0;
+
+  *sources = NULL;
+  FILE *list = fopen(list_path, "r");
+  if (!list) {
+    perror("Failed to open mix list");
+    return AVERROR(errno);
+  }
+
+  while (ret == 0 && fgets(line, sizeof(line), list)) {
+    char *save = NULL, *path;
+    char *next = line + strspn(line, " \t");
+
+    line[strcspn(line, "\r\n")] = '\0';
+    if (*next == '"') {
+      path = next + 1;
+      if (!(next = strchr(path, '"'))) {
+        fprintf(stderr, "Unterminated quote in mix list: %s\n", line);
+        ret = AVERROR(EINVAL);
+        break;
+      }
+      *next++ = '\0'; // settings follow the closing quote
+    } else {
+      path = strtok_r(next, " \t\r\n", &save);
+      if (!path || path[0] == '#')
+        continue;
+      next = NULL; // settings follow in the same tokenization
+    }
+
+    struct audio_mix_source source = {
+        .path = list_relative_path(list_path, path)};
+    struct audio_mix_source *grown =
+        av_realloc_array(*sources, nb + 1, sizeof(*grown));
+    if (grown)
+      *sources = grown;
+    if (!grown || !source.path) {
+      av_free((char *)source.path);
+      ret = AVERROR(ENOMEM);
+      break;
+    }
+    (*sources)[nb++] = source;
+
+    char *opt;
+    while ((opt = strtok_r(next, " \t\r\n", &save))) {
+      struct audio_mix_source *src = &(*sources)[nb - 1];
+      next = NULL;
+      double *value = strncmp(opt, "gain=", 5) == 0     ? &src->gain
+                      : strncmp(opt, "offset=", 7) == 0 ? &src->offset
+                      : strncmp(opt, "fade=", 5) == 0   ? &src->fade
+                                                        : NULL;
+      char *end;
+      if (value)
+        *value = strtod(strchr(opt, '=') + 1, &end);
+      if (!value || end == strchr(opt, '=') + 1 || *end != '\0' ||
+          (value != &src->gain && *value < 0.0)) {
+        fprintf(stderr, "Invalid mix setting for %s: %s\n", src->path, opt);
+        ret = AVERROR(EINVAL);
+        break;
+      }
+    }
+  }
+  fclose(list);
+
+  if (ret < 0) {
+    for (int i = 0; i < nb; i++)
+      av_free((char *)(*sources)[i].path);
+    av_freep(sources);
+    return ret;
+  }
+  return nb;
+}
+
+/**
+ * @brief Mix every input of a --mix list into one output.
+ *
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+static int run_mix(const char *list_path, const char *output_filename,
+                   const struct audx_options *opts) {
+  struct audio_mix mix;
+  struct audio_mix_source *sources = NULL;
+  int64_t samples;
+  int ret;
+
+  int nb_inputs = read_mix_list(list_path, &sources);
+  if (nb_inputs <= 0) {
+    if (nb_inputs == 0)
+      fprintf(stderr, "Mix list %s names no inputs\n", list_path);
+    return nb_inputs < 0 ? nb_inputs : AVERROR(EINVAL);
+  }
+
+  ret = audio_mix_init(&mix, sources, nb_inputs, opts->out_sample_rate,
+                       opts->out_layout.nb_channels ? &opts->out_layout : NULL,
+                       opts->resample_quality,
+                       opts->mix_end_first ? AUDIO_MIX_END_FIRST : 0);
+  if (ret >= 0) {
+    if (opts->verbose) {
+      printf("Mixing %d inputs at %d Hz, %d channels\n", nb_inputs,
+             mix.sample_rate, mix.channels);
+      for (int i = 0; i < nb_inputs; i++)
+        printf("  %s: %+.1f dB at %.2f s\n", sources[i].path, sources[i].gain,
+               sources[i].offset);
+    }
+
+    const struct audx_pcm_source pcm = {
+        read_mix,     &mix,       mix.sample_rate,
+        mix.channels, mix.format, &mix.ch_layout,
+    };
+    ret = encode_pcm(&pcm, output_filename, opts, &samples);
+    if (ret >= 0 && opts->verbose)
+      printf("Output: %.2f s\n", (double)samples / mix.sample_rate);
+    audio_mix_free(&mix);
+  }
+
+  for (int i = 0; i < nb_inputs; i++)
+    av_free((char *)sources[i].path);
+  av_free(sources);
+  return ret;
+}
+
+/**
+ * @brief Transcode every "<input> <output>" line of a list file.
+ *
+ * All jobs share one filter cache, so jobs repeating the same filter and
+ * input format get a preconfigured filter instead of building a new graph.
+ *
+ * @return Number of failed jobs, or -1 if the list cannot be read.
+ */
+static int run_batch(const char *list_path, const struct audx_options *opts) {
+  struct audio_filter_cache cache;
+  char line[4096];
+  int jobs = 0, failed = 0;
+
+  FILE *list = fopen(list_path, "r");
+  if (!list) {
+    perror("Failed to open batch list");
+    return -1;
+  }
+  if (audio_filter_cache_init(&cache) < 0) {
+    fprintf(stderr, "Failed to initialize filter cache\n");
+    fclose(list);
+    return -1;
+  }
+
+  while (fgets(line, sizeof(line), list)) {
+    char *save = NULL;
+    char *input = strtok_r(line, " \t\r\n", &save);
+    char *output = strtok_r(NULL, " \t\r\n", &save);
+
+    if (!input || input[0] == '#')
+      continue;
+    if (!output) {
+      fprintf(stderr, "Batch line without output: %s\n", input);
+      failed++;
+      continue;
+    }
+
+    jobs++;
+    if (transcode(input, output, opts, &cache) < 0) {
+      fprintf(stderr, "Failed: %s\n", input);
+      failed++;
+    }
+  }
+  fclose(list);
+
+  printf("Batch finished: %d jobs, %d failed\n", jobs, failed);
+  if (cache.hits + cache.misses > 0) {
+    printf("Filter setup: %d cached (avg %.1f us), %d built (avg %.1f us)\n",
+           cache.hits, cache.hits ? (double)cache.hit_us / cache.hits : 0.0,
+           cache.misses,
+           cache.misses ? (double)cache.miss_us / cache.misses : 0.0);
+  }
+
+  if (opts->output_cache) {
+    const struct audio_output_cache *oc = opts->output_cache;
+    printf("Output cache: %d hits (avg %.1f ms), %d misses, %d stored, "
+           "%d evicted\n",
+           oc->hits, oc->hits ? oc->hit_us / 1000.0 / oc->hits : 0.0,
+           oc->misses, oc->stores, oc->evicted);
+  }
+
+  audio_filter_cache_free(&cache);
+  return failed;
+}
+
 int main(int argc, char *argv[]) {
   /* Check for --help/-h or --version/-v flags */
   for (int i = 1; i < argc; i++) {
@@ -79,176 +1987,481 @@ int main(int argc, char *argv[]) {
     }
   }
 
-  if (argc < 3) {
-    print_usage(argv[0]);
-    return 1;
-  }
-
-  const char *input_filename = argv[1];
-  const char *output_filename = argv[2];
-  const char *codec_name = NULL;
+  const char *input_filename = NULL;
+  const char *output_filename = NULL;
   const char *quality_str = NULL;
-  const char *bitrate_str = NULL;
-  const char *filter_desc = NULL;
+  const char *resample_str = NULL;
+  const char *layout_str = NULL;
+  const char *batch_path = NULL;
+  const char *concat_path = NULL;
+  const char *mix_path = NULL;
+  const char *cache_dir = NULL;
+  int64_t cache_size = 0;
+  int cache_fast = 0;
+  int64_t max_memory = 0;
+  int out_channels = 0;
+  int dither_set = 0;
+  struct audx_options opts = {0};
 
   /* Parse command-line arguments */
-  for (int i = 3; i < argc; i++) {
+  for (int i = 1; i < argc; i++) {
     if (strncmp(argv[i], "--codec=", 8) == 0) {
-      codec_name = argv[i] + 8;
+      opts.codec_name = argv[i] + 8;
     } else if (strncmp(argv[i], "--quality=", 10) == 0) {
       quality_str = argv[i] + 10;
     } else if (strncmp(argv[i], "--bitrate=", 10) == 0) {
-      bitrate_str = argv[i] + 10;
+      opts.bitrate_str = argv[i] + 10;
     } else if (strncmp(argv[i], "--filter=", 9) == 0) {
-      filter_desc = argv[i] + 9;
+      opts.filter_desc = argv[i] + 9;
+    } else if (strncmp(argv[i], "--sample-rate=", 14) == 0) {
+      char *end;
+      long rate = strtol(argv[i] + 14, &end, 10);
+      if (end == argv[i] + 14 || *end != '\0' || rate <= 0 || rate > INT_MAX) {
+        fprintf(stderr, "Invalid sample rate: %s\n", argv[i] + 14);
+        return 1;
+      }
+      opts.out_sample_rate = (int)rate;
+    } else if (strncmp(argv[i], "--channels=", 11) == 0) {
+      char *end;
+      long channels = strtol(argv[i] + 11, &end, 10);
+      if (end == argv[i] + 11 || *end != '\0' || channels <= 0 ||
+          channels > INT_MAX) {
+        fprintf(stderr, "Invalid channel count: %s\n", argv[i] + 11);
+        return 1;
+      }
+      out_channels = (int)channels;
+    } else if (strncmp(argv[i], "--layout=", 9) == 0) {
+      layout_str = argv[i] + 9;
+    } else if (strncmp(argv[i], "--resample-quality=", 19) == 0) {
+      resample_str = argv[i] + 19;
+    } else if (strncmp(argv[i], "--filter-threads=", 17) == 0) {
+      char *end;
+      long threads = strtol(argv[i] + 17, &end, 10);
+      if (end == argv[i] + 17 || *end != '\0' || threads <= 0 ||
+          threads > INT_MAX) {
+        fprintf(stderr, "Invalid thread count: %s\n", argv[i] + 17);
+        return 1;
+      }
+      opts.filter_threads = (int)threads;
+    } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+      char *end;
+      long threads = strtol(argv[i] + 10, &end, 10);
+      if (end == argv[i] + 10 || *end != '\0' || threads <= 0 ||
+          threads > INT_MAX) {
+        fprintf(stderr, "Invalid thread count: %s\n", argv[i] + 10);
+        return 1;
+      }
+      opts.threads = (int)threads;
+    } else if (strcmp(argv[i], "--filter-split") == 0) {
+      opts.filter_flags |= AUDIO_FILTER_SPLIT_CHANNELS;
+    } else if (strncmp(argv[i], "--control=", 10) == 0) {
+      opts.control_path = argv[i] + 10;
+    } else if (strncmp(argv[i], "--format=", 9) == 0) {
+      opts.format_name = argv[i] + 9;
+    } else if (strcmp(argv[i], "--realtime") == 0) {
+      opts.realtime = 1;
+    } else if (strncmp(argv[i], "--sdp=", 6) == 0) {
+      opts.sdp_path = argv[i] + 6;
+    } else if (strncmp(argv[i], "--segment=", 10) == 0) {
+      char *end;
+      opts.segment_seconds = strtod(argv[i] + 10, &end);
+      if (end == argv[i] + 10 || *end != '\0' ||
+          !(opts.segment_seconds > 0.0) || isinf(opts.segment_seconds)) {
+        fprintf(stderr, "Invalid segment duration: %s\n", argv[i] + 10);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--low-latency") == 0) {
+      opts.low_latency = 1;
+    } else if (strncmp(argv[i], "--low-latency=", 14) == 0) {
+      char *end;
+      opts.low_latency = 1;
+      opts.frame_ms = strtod(argv[i] + 14, &end);
+      /* The frame lengths libopus can encode */
+      if (end == argv[i] + 14 || *end != '\0' ||
+          (opts.frame_ms != 2.5 && opts.frame_ms != 5.0 &&
+           opts.frame_ms != 10.0 && opts.frame_ms != 20.0 &&
+           opts.frame_ms != 40.0 && opts.frame_ms != 60.0)) {
+        fprintf(stderr, "Invalid frame duration: %s (2.5, 5, 10, 20, 40 or "
+                        "60 ms)\n", argv[i] + 14);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--measure") == 0) {
+      opts.measure = 1;
+    } else if (strcmp(argv[i], "--analyze-only") == 0) {
+      opts.measure = 1;
+      opts.analyze_only = 1;
+    } else if (strncmp(argv[i], "--normalize=", 12) == 0) {
+      char *end;
+      opts.normalize = 1;
+      opts.normalize_target = strtod(argv[i] + 12, &end);
+      opts.normalize_ceiling = AUDIO_NORMALIZE_CEILING;
+      if (*end == ',')
+        opts.normalize_ceiling = strtod(end + 1, &end);
+      if (end == argv[i] + 12 || *end != '\0' ||
+          opts.normalize_target >= 0.0) {
+        fprintf(stderr, "Invalid normalization target: %s\n", argv[i] + 12);
+        return 1;
+      }
+    } else if (strncmp(argv[i], "--peaks=", 8) == 0) {
+      opts.peaks_path = argv[i] + 8;
+    } else if (strcmp(argv[i], "--fingerprint") == 0) {
+      opts.fingerprint = 1;
+    } else if (strncmp(argv[i], "--fingerprint=", 14) == 0) {
+      opts.fingerprint = 1;
+      opts.fingerprint_path = argv[i] + 14;
+    } else if (strncmp(argv[i], "--fingerprint-seconds=", 22) == 0) {
+      char *end;
+      opts.fingerprint_seconds = strtod(argv[i] + 22, &end);
+      if (end == argv[i] + 22 || *end != '\0' ||
+          opts.fingerprint_seconds <= 0.0) {
+        fprintf(stderr, "Invalid fingerprint length: %s\n", argv[i] + 22);
+        return 1;
+      }
+      opts.fingerprint = 1;
+    } else if (strncmp(argv[i], "--trim-silence=", 15) == 0) {
+      char *end;
+      opts.trim_silence = 1;
+      opts.trim_threshold = strtod(argv[i] + 15, &end);
+      opts.trim_min_duration = AUDIO_TRIM_MIN_DURATION;
+      if (*end == ',' && strcmp(end + 1, "gaps") != 0)
+        opts.trim_min_duration = strtod(end + 1, &end);
+      if (*end == ',' && strcmp(end + 1, "gaps") == 0) {
+        opts.trim_gaps = 1;
+        end += 5;
+      }
+      if (end == argv[i] + 15 || *end != '\0' || opts.trim_threshold >= 0.0 ||
+          opts.trim_min_duration < 0.0) {
+        fprintf(stderr, "Invalid silence trimming: %s\n", argv[i] + 15);
+        return 1;
+      }
+    } else if (strncmp(argv[i], "--cache-dir=", 12) == 0) {
+      cache_dir = argv[i] + 12;
+    } else if (strncmp(argv[i], "--cache-size=", 13) == 0) {
+      cache_size = parse_megabytes(argv[i] + 13);
+      if (cache_size < 0) {
+        fprintf(stderr, "Invalid cache size: %s\n", argv[i] + 13);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--cache-fast") == 0) {
+      cache_fast = 1;
+    } else if (strncmp(argv[i], "--checkpoint=", 13) == 0) {
+      opts.checkpoint_dir = argv[i] + 13;
+    } else if (strncmp(argv[i], "--checkpoint-interval=", 22) == 0) {
+      char *end;
+      opts.checkpoint_interval = strtod(argv[i] + 22, &end);
+      if (end == argv[i] + 22 || *end != '\0' ||
+          opts.checkpoint_interval <= 0.0) {
+        fprintf(stderr, "Invalid checkpoint interval: %s\n", argv[i] + 22);
+        return 1;
+      }
+    } else if (strncmp(argv[i], "--features=", 11) == 0) {
+      const char *type = argv[i] + 11;
+      audio_features_config_default(&opts.features_config);
+      if (strncmp(type, "logmel", 6) != 0 ||
+          (type[6] != '\0' && type[6] != ',') ||
+          (type[6] == ',' &&
+           audio_features_config_parse(&opts.features_config, type + 7) < 0)) {
+        fprintf(stderr, "Invalid features: %s (logmel[,rate=,window=,hop=,"
+                        "mels=])\n", type);
+        return 1;
+      }
+      opts.features = 1;
+    } else if (strncmp(argv[i], "--features-out=", 15) == 0) {
+      opts.features_path = argv[i] + 15;
+    } else if (strncmp(argv[i], "--max-memory=", 13) == 0) {
+      max_memory = parse_megabytes(argv[i] + 13);
+      if (max_memory < 0) {
+        fprintf(stderr, "Invalid memory limit: %s\n", argv[i] + 13);
+        return 1;
+      }
+    } else if (strncmp(argv[i], "--concat=", 9) == 0) {
+      concat_path = argv[i] + 9;
+    } else if (strncmp(argv[i], "--crossfade=", 12) == 0) {
+      char *end;
+      opts.crossfade = strtod(argv[i] + 12, &end);
+      if (end == argv[i] + 12 || *end != '\0' || opts.crossfade <= 0.0) {
+        fprintf(stderr, "Invalid crossfade: %s\n", argv[i] + 12);
+        return 1;
+      }
+    } else if (strncmp(argv[i], "--mix=", 6) == 0) {
+      mix_path = argv[i] + 6;
+    } else if (strncmp(argv[i], "--mix-duration=", 15) == 0) {
+      if (strcmp(argv[i] + 15, "first") == 0) {
+        opts.mix_end_first = 1;
+      } else if (strcmp(argv[i] + 15, "longest") != 0) {
+        fprintf(stderr, "Invalid mix duration: %s\n", argv[i] + 15);
+        return 1;
+      }
+    } else if (strncmp(argv[i], "--target-quality=", 17) == 0) {
+      char *end;
+      opts.target_quality = strtod(argv[i] + 17, &end);
+      if (end == argv[i] + 17 || *end != '\0' || opts.target_quality <= 0.0 ||
+          opts.target_quality > 50.0) {
+        fprintf(stderr, "Invalid target quality: %s\n", argv[i] + 17);
+        return 1;
+      }
+    } else if (strncmp(argv[i], "--bit-depth=", 12) == 0) {
+      const char *depth = argv[i] + 12;
+      if (strcmp(depth, "float") == 0) {
+        opts.bit_depth = -1;
+      } else {
+        char *end;
+        long bits = strtol(depth, &end, 10);
+        if (end == depth || *end != '\0' ||
+            (bits != 16 && bits != 24 && bits != 32)) {
+          fprintf(stderr, "Invalid bit depth: %s\n", depth);
+          return 1;
+        }
+        opts.bit_depth = (int)bits;
+      }
+    } else if (strncmp(argv[i], "--dither=", 9) == 0) {
+      const char *type = argv[i] + 9;
+      dither_set = 1;
+      if (strcmp(type, "shaped") == 0) {
+        opts.dither_flags = AUDIO_DITHER_SHAPED;
+      } else if (strcmp(type, "none") == 0) {
+        opts.dither_flags = AUDIO_DITHER_NONE;
+      } else if (strcmp(type, "tpdf") != 0) {
+        fprintf(stderr, "Invalid dither: %s\n", type);
+        return 1;
+      }
+    } else if (strncmp(argv[i], "--streams=", 10) == 0) {
+      opts.streams = argv[i] + 10;
+    } else if (strncmp(argv[i], "--stats=", 8) == 0) {
+      opts.stats_path = argv[i] + 8;
+    } else if (strncmp(argv[i], "--batch=", 8) == 0) {
+      batch_path = argv[i] + 8;
+    } else if (!input_filename) {
+      input_filename = argv[i];
+    } else if (!output_filename && !opts.analyze_only) {
+      output_filename = argv[i];
     } else {
       /* Backward compatibility: treat positional arg as filter */
-      if (!filter_desc)
-        filter_desc = argv[i];
+      if (!opts.filter_desc)
+        opts.filter_desc = argv[i];
     }
   }
 
-  enum audio_quality quality = parse_quality(quality_str);
-  int use_encoder = (codec_name != NULL);
-  int use_filter = (filter_desc != NULL && filter_desc[0] != '\0');
+  if (opts.crossfade > 0 && !concat_path) {
+    fprintf(stderr, "--crossfade needs --concat\n");
+    return 1;
+  }
 
-  struct audio_dec decoder;
-  struct audio_filter filter;
-  struct audio_enc encoder;
-  FILE *output_file = NULL;
+  if (opts.mix_end_first && !mix_path) {
+    fprintf(stderr, "--mix-duration needs --mix\n");
+    return 1;
+  }
 
-  /* Initialize decoder */
-  int ret = audio_dec_init(&decoder, input_filename);
-  if (ret < 0) {
-    fprintf(stderr, "Failed to initialize decoder\n");
+  if (dither_set && opts.bit_depth != 16 && opts.bit_depth != 24) {
+    fprintf(stderr, "--dither needs --bit-depth=16 or 24\n");
+    return 1;
+  }
+  if (dither_set && opts.codec_name && is_lossy_codec(opts.codec_name)) {
+    fprintf(stderr, "--dither needs raw output or a lossless codec; lossy "
+                    "codecs are fed float samples\n");
     return 1;
   }
 
-  printf("Audio stream info\n");
-  printf("  Sample rate : %d Hz\n", decoder.sample_rate);
-  printf("  Channels    : %d\n", decoder.channels);
+  /* The search samples one input for transcode()'s encoder */
+  if (opts.target_quality > 0 &&
+      (!opts.codec_name || opts.bitrate_str || opts.bit_depth ||
+       opts.analyze_only || concat_path || mix_path || opts.streams)) {
+    fprintf(stderr, "--target-quality needs a lossy --codec, without "
+                    "--bitrate, --bit-depth, --analyze-only, --concat, --mix "
+                    "or --streams\n");
+    return 1;
+  }
 
-  /* Initialize filter if specified */
-  if (use_filter) {
-    ret = audio_filter_init(&filter, decoder.sample_rate, decoder.dst_fmt,
-                            &decoder.dst_ch_layout, filter_desc);
-    if (ret < 0) {
-      fprintf(stderr, "Failed to initialize filter\n");
-      audio_dec_free(&decoder);
-      return 1;
-    }
-    printf("Applying filter: %s\n", filter_desc);
+  /* The float path runs in transcode(); the other pipelines stay in S16 */
+  if (opts.bit_depth &&
+      (concat_path || mix_path || opts.streams || opts.segment_seconds > 0)) {
+    fprintf(stderr, "--bit-depth cannot be combined with --concat, --mix, "
+                    "--streams or --segment\n");
+    return 1;
   }
 
-  /* Initialize encoder or open raw PCM file */
-  if (use_encoder) {
-    ret = audio_enc_init(&encoder, output_filename, codec_name,
-                         decoder.sample_rate, &decoder.dst_ch_layout, quality,
-                         bitrate_str);
-    if (ret < 0) {
-      fprintf(stderr, "Failed to initialize encoder\n");
-      if (use_filter)
-        audio_filter_free(&filter);
-      audio_dec_free(&decoder);
+  /* With --concat or --mix the only positional argument is the output */
+  if (concat_path || mix_path) {
+    if (!input_filename || output_filename) {
+      print_usage(argv[0]);
       return 1;
     }
-    printf("Encoding to: %s (codec: %s)\n", output_filename, codec_name);
-  } else {
-    output_file = fopen(output_filename, "wb");
-    if (!output_file) {
-      perror("Failed to open output file");
-      if (use_filter)
-        audio_filter_free(&filter);
-      audio_dec_free(&decoder);
+    if (batch_path || opts.analyze_only || opts.streams ||
+        (concat_path && mix_path) ||
+        opts.segment_seconds > 0 || opts.normalize || opts.trim_silence ||
+        opts.measure || opts.peaks_path || opts.fingerprint ||
+        opts.features || opts.checkpoint_dir || opts.control_path ||
+        opts.stats_path || cache_dir || max_memory > 0) {
+      fprintf(stderr, "--concat and --mix cannot be combined with each "
+                      "other, --batch, --streams, "
+                      "--segment, --normalize, --trim-silence, --measure, "
+                      "--peaks, --fingerprint, --features, --checkpoint, "
+                      "--control, --stats, --cache-dir or --max-memory\n");
       return 1;
     }
-    printf("Writing raw PCM to: %s\n", output_filename);
+    output_filename = input_filename;
+    input_filename = NULL;
   }
 
-  /* Main decode/filter/encode loop */
-  uint8_t *data = NULL;
-  int size = 0;
+  if (opts.features_path && !opts.features) {
+    fprintf(stderr, "--features-out needs --features\n");
+    return 1;
+  }
 
-  while (audio_decoder_read(&decoder, &data, &size)) {
-    if (data && size > 0) {
-      AVFrame *frame = av_frame_alloc();
-      if (!frame) {
-        fprintf(stderr, "Failed to allocate frame\n");
-        break;
-      }
+  /* Peaks, fingerprints and features alone need no output */
+  if (input_filename && !output_filename &&
+      (opts.peaks_path || opts.fingerprint_path || opts.features_path))
+    opts.analyze_only = 1;
 
-      /* Fill frame with decoded PCM data */
-      frame->nb_samples =
-          size / (decoder.channels * av_get_bytes_per_sample(decoder.dst_fmt));
-      frame->format = decoder.dst_fmt;
-      frame->sample_rate = decoder.sample_rate;
-      av_channel_layout_copy(&frame->ch_layout, &decoder.dst_ch_layout);
+  if (opts.features && !opts.features_path && !output_filename &&
+      !batch_path) {
+    fprintf(stderr, "--features without an output needs --features-out\n");
+    return 1;
+  }
 
-      ret = avcodec_fill_audio_frame(frame, decoder.channels, decoder.dst_fmt,
-                                     data, size, 1);
-      if (ret < 0) {
-        fprintf(stderr, "Error filling frame\n");
-        av_frame_free(&frame);
-        av_freep(&data);
-        continue;
-      }
+  if (opts.fingerprint && !opts.fingerprint_path && !output_filename &&
+      !batch_path) {
+    fprintf(stderr, "--fingerprint without an output needs a path "
+                    "(--fingerprint=<path>)\n");
+    return 1;
+  }
 
-      if (use_filter) {
-        /* Push frame to filter */
-        ret = audio_filter_push(&filter, frame);
-        av_frame_free(&frame);
-        av_freep(&data);
+  if (!batch_path && !concat_path && !mix_path &&
+      (!input_filename || (!output_filename && !opts.analyze_only))) {
+    print_usage(argv[0]);
+    return 1;
+  }
 
-        if (ret < 0) {
-          fprintf(stderr, "Error pushing frame to filter\n");
-          continue;
-        }
+  if (batch_path &&
+      (opts.analyze_only || opts.stats_path || opts.peaks_path ||
+       opts.fingerprint_path || opts.features_path)) {
+    fprintf(stderr, "--analyze-only, --stats, --peaks, --fingerprint=<path> "
+                    "and --features-out work on single files, not with "
+                    "--batch\n");
+    return 1;
+  }
 
-        /* Pull and process filtered frames */
-        AVFrame *filtered_frame = NULL;
-        while ((ret = audio_filter_pull(&filter, &filtered_frame)) >= 0) {
-          if (use_encoder) {
-            /* Encode filtered frame */
-            ret = audio_enc_write_frame(&encoder, filtered_frame);
-            if (ret < 0)
-              fprintf(stderr, "Error encoding frame\n");
-          } else {
-            /* Write filtered PCM to file */
-            int buf_size = av_samples_get_buffer_size(
-                NULL, filtered_frame->ch_layout.nb_channels,
-                filtered_frame->nb_samples, filtered_frame->format, 1);
-            fwrite(filtered_frame->data[0], 1, buf_size, output_file);
-          }
-          av_frame_free(&filtered_frame);
-        }
-      } else {
-        /* No filter: encode or write directly */
-        if (use_encoder) {
-          ret = audio_enc_write_frame(&encoder, frame);
-          if (ret < 0)
-            fprintf(stderr, "Error encoding frame\n");
-        } else {
-          fwrite(data, 1, size, output_file);
-        }
-        av_frame_free(&frame);
-        av_freep(&data);
-      }
+  if (opts.segment_seconds > 0 && !opts.codec_name) {
+    fprintf(stderr, "--segment needs a --codec (e.g., aac)\n");
+    return 1;
+  }
+
+  /* Network outputs are always paced; unpaced UDP overruns receivers */
+  if (output_filename && is_network_url(output_filename)) {
+    if (!opts.codec_name) {
+      fprintf(stderr, "Network output needs a --codec\n");
+      return 1;
     }
+    opts.realtime = 1;
+    avformat_network_init();
   }
 
-  /* Finalize encoding or close PCM file */
-  if (use_encoder) {
-    audio_enc_finalize(&encoder);
-    audio_enc_free(&encoder);
-  } else {
-    fclose(output_file);
+  if (opts.checkpoint_interval > 0 && !opts.checkpoint_dir) {
+    fprintf(stderr, "--checkpoint-interval needs --checkpoint\n");
+    return 1;
   }
 
-  /* Cleanup */
-  if (use_filter)
-    audio_filter_free(&filter);
-  audio_dec_free(&decoder);
+  /* Resuming continues one output stream; side outputs and stages that
+   * depend on everything before the resume point cannot be continued.
+   * Filters would restart with fresh state (fades, echoes, loudnorm) and
+   * can move the output away from the input position (atempo) */
+  if (opts.checkpoint_dir &&
+      (batch_path || opts.analyze_only || opts.segment_seconds > 0 ||
+       opts.realtime || opts.normalize || opts.trim_silence || opts.measure ||
+       opts.peaks_path || opts.fingerprint || opts.features ||
+       (opts.filter_desc && opts.filter_desc[0] != '\0') ||
+       opts.control_path || strcmp(output_filename, "-") == 0)) {
+    fprintf(stderr, "--checkpoint works on a single file output, without "
+                    "--batch, --segment, network outputs, --normalize, "
+                    "--trim-silence, --measure, --peaks, --fingerprint, "
+                    "--features, --filter or --control\n");
+    return 1;
+  }
 
-  printf("Finished. Output written to %s\n", output_filename);
-  return 0;
+  /* Each stream gets a plain decode, filter and encode chain */
+  if (opts.streams &&
+      (batch_path || opts.analyze_only || !opts.codec_name ||
+       opts.segment_seconds > 0 || opts.realtime || opts.normalize ||
+       opts.trim_silence || opts.measure || opts.peaks_path ||
+       opts.fingerprint || opts.features || opts.checkpoint_dir ||
+       opts.control_path || opts.stats_path || cache_dir || max_memory > 0)) {
+    fprintf(stderr, "--streams needs a --codec and a file output, without "
+                    "--batch, --segment, network outputs, --normalize, "
+                    "--trim-silence, --measure, --peaks, --fingerprint, "
+                    "--features, --checkpoint, --control, --stats, "
+                    "--cache-dir or --max-memory\n");
+    return 1;
+  }
+
+  opts.quality = parse_quality(quality_str);
+  opts.resample_quality = parse_resample_quality(resample_str);
+  opts.verbose = !batch_path;
+
+  if (opts.control_path &&
+      (!opts.filter_desc || opts.filter_desc[0] == '\0')) {
+    fprintf(stderr, "--control needs a --filter to send commands to\n");
+    return 1;
+  }
+
+  if (opts.control_path && opts.normalize) {
+    fprintf(stderr, "--normalize measures the whole input first and cannot "
+                    "follow live --control commands\n");
+    return 1;
+  }
+
+  /* Resolve the requested output layout; applied once in the decoder */
+  if (layout_str) {
+    if (av_channel_layout_from_string(&opts.out_layout, layout_str) < 0) {
+      fprintf(stderr, "Invalid channel layout: %s\n", layout_str);
+      return 1;
+    }
+  } else if (out_channels > 0) {
+    av_channel_layout_default(&opts.out_layout, out_channels);
+  }
+
+  struct audio_output_cache output_cache;
+  if (cache_dir) {
+    if (audio_output_cache_init(&output_cache, cache_dir, cache_size,
+                                cache_fast) < 0) {
+      fprintf(stderr, "Cannot use cache directory %s\n", cache_dir);
+      audio_output_cache_free(&output_cache);
+      return 1;
+    }
+    opts.output_cache = &output_cache;
+  }
+
+  struct audio_memory memory;
+  if (max_memory > 0) {
+    if (audio_memory_init(&memory, max_memory) < 0) {
+      fprintf(stderr, "--max-memory must exceed the %.1f MB audx already "
+                      "uses\n", memory.baseline / 1048576.0);
+      if (opts.output_cache)
+        audio_output_cache_free(&output_cache);
+      return 1;
+    }
+    opts.memory = &memory;
+  }
+
+  int ret;
+  if (batch_path) {
+    ret = run_batch(batch_path, &opts) != 0;
+  } else if (concat_path || mix_path) {
+    ret = (concat_path ? run_concat(concat_path, output_filename, &opts)
+                       : run_mix(mix_path, output_filename, &opts)) < 0;
+    if (!ret)
+      printf("Finished. Output written to %s\n", output_filename);
+  } else if (opts.streams) {
+    ret = run_streams(input_filename, output_filename, &opts) < 0;
+    if (!ret)
+      printf("Finished. Output written to %s\n", output_filename);
+  } else {
+    ret = transcode(input_filename, output_filename, &opts, NULL) < 0;
+    if (!ret && !opts.analyze_only)
+      printf("Finished. Output written to %s\n", output_filename);
+  }
+
+  if (opts.output_cache)
+    audio_output_cache_free(&output_cache);
+  av_channel_layout_uninit(&opts.out_layout);
+  return ret;
 }
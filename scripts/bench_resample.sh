@@ -0,0 +1,103 @@
+#!/bin/bash
+#
+# Quality and speed of the --resample-quality presets, converting 44.1 kHz
+# to 48 kHz:
+#  - THD+N of a 997 Hz and a 15 kHz tone: the output is written as float
+#    (--bit-depth=float), so 16-bit quantization does not mask the
+#    resampler. A sine of the tone frequency is least-squares fitted to the
+#    output, and everything it does not explain (harmonics, aliasing,
+#    imaging, noise) counts as distortion; 0.1 s at each end is left out.
+#  - Runtime of the default S16 path over a long stereo input, as a multiple
+#    of real time (decoding and writing included).
+#
+# Usage: scripts/bench_resample.sh [path/to/audx]   (default: build/bin/audx)
+# LONG_SECONDS sets the length of the runtime input (default: 600).
+# Needs ffmpeg, od and awk in PATH.
+
+set -u
+
+AUDX="${1:-build/bin/audx}"
+RATE_IN=44100
+RATE_OUT=48000
+LONG_SECONDS="${LONG_SECONDS:-600}"
+TMP="$(mktemp -d)"
+trap 'rm -rf "$TMP"' EXIT
+
+for tool in "$AUDX" ffmpeg od awk; do
+  if ! command -v "$tool" >/dev/null 2>&1; then
+    echo "SKIP: $tool not found"
+    exit 77
+  fi
+done
+
+for freq in 997 15000; do
+  ffmpeg -v error -f lavfi \
+    -i "aevalsrc=0.5*sin(2*PI*$freq*t):s=$RATE_IN:d=5" \
+    -c:a pcm_f32le "$TMP/tone$freq.wav" || exit 1
+done
+ffmpeg -v error -f lavfi \
+  -i "aevalsrc=0.3*sin(2*PI*(220+110*sin(0.3*t))*t)+0.05*(random(0)-0.5)|0.3*sin(2*PI*330*t):s=$RATE_IN:d=$LONG_SECONDS" \
+  -c:a pcm_s16le "$TMP/long.wav" || exit 1
+
+# thdn <raw float file> <frequency>: THD+N in dB relative to the signal
+thdn() {
+  od -An -v -t f4 -w4 "$1" | awk -v f="$2" -v rate=$RATE_OUT '
+    { x[NR] = $1 }
+    END {
+      w = 2 * atan2(0, -1) * f / rate
+      skip = int(rate / 10)
+      for (i = skip + 1; i <= NR - skip; i++) {
+        c = cos(w * (i - 1)); s = sin(w * (i - 1))
+        scc += c * c; sss += s * s; scs += c * s
+        sxc += x[i] * c; sxs += x[i] * s; sxx += x[i] * x[i]
+      }
+      det = scc * sss - scs * scs
+      a = (sxc * sss - sxs * scs) / det
+      b = (sxs * scc - sxc * scs) / det
+      res = 0
+      for (i = skip + 1; i <= NR - skip; i++) {
+        e = x[i] - a * cos(w * (i - 1)) - b * sin(w * (i - 1))
+        res += e * e
+      }
+      if (sxx <= 0 || res <= 0)
+        print "n/a"
+      else
+        printf "%.1f dB\n", 10 * log(res / sxx) / log(10)
+    }'
+}
+
+failed=0
+printf "%-8s %14s %14s %12s\n" preset "THD+N 997 Hz" "THD+N 15 kHz" runtime
+for preset in fast default high soxr; do
+  row=()
+  for freq in 997 15000; do
+    if ! "$AUDX" "$TMP/tone$freq.wav" "$TMP/out.f32" --bit-depth=float \
+        --sample-rate=$RATE_OUT --resample-quality=$preset \
+        >/dev/null 2>"$TMP/$preset.log"; then
+      echo "FAIL: $preset at $freq Hz"
+      cat "$TMP/$preset.log"
+      failed=1
+      continue 2
+    fi
+    row+=("$(thdn "$TMP/out.f32" $freq)")
+  done
+
+  start=$(date +%s%N)
+  if ! "$AUDX" "$TMP/long.wav" /dev/null --sample-rate=$RATE_OUT \
+      --resample-quality=$preset >/dev/null 2>>"$TMP/$preset.log"; then
+    echo "FAIL: $preset runtime run"
+    failed=1
+    continue
+  fi
+  elapsed=$(($(date +%s%N) - start))
+  speed=$(awk -v s="$LONG_SECONDS" -v ns=$elapsed \
+    'BEGIN { printf "%.0fx", s / (ns / 1e9) }')
+
+  note=""
+  grep -q "soxr resampler unavailable" "$TMP/$preset.log" &&
+    note=" (no soxr, ran 'high')"
+  printf "%-8s %14s %14s %12s%s\n" $preset "${row[0]}" "${row[1]}" \
+    "$speed" "$note"
+done
+
+exit $failed
@@ -0,0 +1,125 @@
+#!/bin/bash
+#
+# Kill-and-resume check of --checkpoint: each job is killed with SIGKILL
+# right after it wrote its first checkpoint, run again with the same
+# command, and the result is compared with an uninterrupted run:
+#  - raw PCM must be byte-identical,
+#  - FLAC must decode to the same samples,
+#  - AAC must decode and have the same length (the resumed encoder is primed
+#    with earlier audio, so its packets are not bit-identical at the seam).
+#
+# Usage: scripts/test_checkpoint.sh [path/to/audx]   (default: build/bin/audx)
+# Needs ffmpeg and ffprobe in PATH.
+
+set -u
+
+AUDX="${1:-build/bin/audx}"
+MINUTES=20
+TMP="$(mktemp -d)"
+trap 'kill -9 $(jobs -p) 2>/dev/null; rm -rf "$TMP"' EXIT
+
+for tool in "$AUDX" ffmpeg ffprobe; do
+  if ! command -v "$tool" >/dev/null 2>&1; then
+    echo "SKIP: $tool not found"
+    exit 77
+  fi
+done
+
+# A long input, so the job is still running when its first checkpoint lands
+ffmpeg -v error -f lavfi \
+  -i "aevalsrc=0.4*sin(2*PI*(220+110*sin(0.3*t))*t)|0.3*sin(2*PI*330*t):s=44100:d=$((MINUTES * 60))" \
+  -c:a flac "$TMP/in.flac" || exit 1
+
+failed=0
+
+# interrupt <name> <output> <audx options...>: kill after the first
+# checkpoint, then resume. Returns non-zero if the job could not be killed
+# mid-run or the resumed run failed.
+interrupt() {
+  local name=$1 output=$2
+  shift 2
+  local ckpt="$TMP/$name.ckpt"
+
+  "$AUDX" "$TMP/in.flac" "$output" "$@" --checkpoint="$ckpt" \
+    --checkpoint-interval=2 >"$TMP/$name.first.log" 2>&1 &
+  local pid=$!
+  while kill -0 $pid 2>/dev/null && [ ! -s "$ckpt/state" ]; do
+    sleep 0.01
+  done
+  kill -9 $pid 2>/dev/null
+  wait $pid 2>/dev/null
+  if [ ! -s "$ckpt/state" ] || [ ! -d "$ckpt" ]; then
+    echo "FAIL: $name finished before it could be killed; raise MINUTES"
+    return 1
+  fi
+  echo "  $name killed at $(sed -n 's/^position //p' "$ckpt/state") samples"
+
+  if ! "$AUDX" "$TMP/in.flac" "$output" "$@" --checkpoint="$ckpt" \
+      >"$TMP/$name.resume.log" 2>&1; then
+    echo "FAIL: resumed $name run failed"
+    cat "$TMP/$name.resume.log"
+    return 1
+  fi
+  if ! grep -q "Resuming from checkpoint" "$TMP/$name.resume.log"; then
+    echo "FAIL: $name started over instead of resuming"
+    return 1
+  fi
+  if [ -d "$ckpt" ]; then
+    echo "FAIL: $name left its checkpoint directory behind"
+    return 1
+  fi
+}
+
+decoded_md5() {
+  ffmpeg -v error -i "$1" -f s16le - | md5sum | cut -d' ' -f1
+}
+
+samples() {
+  ffprobe -v error -select_streams a:0 -show_entries stream=duration_ts \
+    -of csv=p=0 "$1"
+}
+
+# Raw PCM: appended to the output directly
+"$AUDX" "$TMP/in.flac" "$TMP/ref.raw" >/dev/null 2>&1 || exit 1
+if interrupt raw "$TMP/out.raw"; then
+  if cmp -s "$TMP/ref.raw" "$TMP/out.raw"; then
+    echo "PASS: raw PCM identical after resume"
+  else
+    echo "FAIL: raw PCM differs after resume"
+    failed=1
+  fi
+else
+  failed=1
+fi
+
+# FLAC: lossless, so the samples must match exactly
+"$AUDX" "$TMP/in.flac" "$TMP/ref.flac" --codec=flac >/dev/null 2>&1 || exit 1
+if interrupt flac "$TMP/out.flac" --codec=flac; then
+  if [ "$(decoded_md5 "$TMP/ref.flac")" = "$(decoded_md5 "$TMP/out.flac")" ]; then
+    echo "PASS: FLAC decodes to identical samples after resume"
+  else
+    echo "FAIL: FLAC samples differ after resume"
+    failed=1
+  fi
+else
+  failed=1
+fi
+
+# AAC in MP4: index written at the end, muxed from the journal
+"$AUDX" "$TMP/in.flac" "$TMP/ref.m4a" --codec=aac >/dev/null 2>&1 || exit 1
+if interrupt aac "$TMP/out.m4a" --codec=aac; then
+  if ! ffmpeg -v error -xerror -i "$TMP/out.m4a" -f null - 2>/dev/null; then
+    echo "FAIL: AAC output does not decode after resume"
+    failed=1
+  elif [ "$(samples "$TMP/ref.m4a")" != "$(samples "$TMP/out.m4a")" ]; then
+    echo "FAIL: AAC length differs after resume:" \
+      "$(samples "$TMP/ref.m4a") vs $(samples "$TMP/out.m4a")"
+    failed=1
+  else
+    echo "PASS: AAC decodes with the same length after resume"
+  fi
+else
+  failed=1
+fi
+
+exit $failed
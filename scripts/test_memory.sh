@@ -0,0 +1,89 @@
+#!/bin/bash
+#
+# Soak test of --max-memory: stream a long synthetic input through every
+# codec and check that the resident size stays flat. The input is generated
+# on the fly into a named pipe, so no multi-hour file is written; outputs go
+# to /dev/null in streamable containers (MP4 and CAF indexes grow with the
+# length by design and are left out).
+#
+# VmRSS is sampled twice a second. A run passes when it succeeds, never
+# exceeds the limit, and the peak of its last third is within SLACK_KB of
+# the peak of its first third (after warm-up).
+#
+# Usage: scripts/test_memory.sh [path/to/audx]   (default: build/bin/audx)
+# HOURS=24 runs the full-day soak (default: 2). Needs ffmpeg in PATH.
+
+set -u
+
+AUDX="${1:-build/bin/audx}"
+HOURS="${HOURS:-2}"
+LIMIT_MB=64
+SLACK_KB=4096
+TMP="$(mktemp -d)"
+trap 'kill -9 $(jobs -p) 2>/dev/null; rm -rf "$TMP"' EXIT
+
+for tool in "$AUDX" ffmpeg; do
+  if ! command -v "$tool" >/dev/null 2>&1; then
+    echo "SKIP: $tool not found"
+    exit 77
+  fi
+done
+
+failed=0
+
+# soak <codec> <format> <sample rate>
+soak() {
+  local codec=$1 format=$2 rate=$3
+  local fifo="$TMP/$codec.wav" log="$TMP/$codec.rss"
+
+  mkfifo "$fifo"
+  ffmpeg -v error -f lavfi \
+    -i "aevalsrc=0.3*sin(2*PI*(220+110*sin(0.05*t))*t)|0.3*sin(2*PI*330*t):s=$rate:d=$((HOURS * 3600))" \
+    -f wav -y "$fifo" &
+  local generator=$!
+
+  "$AUDX" "$fifo" /dev/null --codec="$codec" --format="$format" \
+    --max-memory=$LIMIT_MB >"$TMP/$codec.log" 2>&1 &
+  local pid=$!
+
+  : >"$log"
+  while kill -0 $pid 2>/dev/null; do
+    awk '/^VmRSS:/ { print $2 }' "/proc/$pid/status" 2>/dev/null >>"$log"
+    sleep 0.5
+  done
+  wait $pid
+  local status=$?
+  wait $generator 2>/dev/null
+  rm -f "$fifo"
+
+  if [ $status -ne 0 ]; then
+    echo "FAIL: $codec exited with $status"
+    tail -5 "$TMP/$codec.log"
+    return 1
+  fi
+
+  # Peaks of the first and last third, skipping the first 10% as warm-up
+  awk -v name="$codec" -v limit=$((LIMIT_MB * 1024)) -v slack=$SLACK_KB '
+    { rss[NR] = $1 }
+    END {
+      if (NR < 10) { printf "FAIL: %s: too few samples (%d)\n", name, NR; exit 1 }
+      start = int(NR / 10) + 1; third = int((NR - start + 1) / 3)
+      for (i = 1; i <= NR; i++) if (rss[i] > max) max = rss[i]
+      for (i = start; i < start + third; i++) if (rss[i] > early) early = rss[i]
+      for (i = NR - third + 1; i <= NR; i++) if (rss[i] > late) late = rss[i]
+      printf "  %s: %d samples, RSS early %d kB, late %d kB, max %d kB\n",
+             name, NR, early, late, max
+      if (max > limit) { printf "FAIL: %s exceeds %d kB\n", name, limit; exit 1 }
+      if (late > early + slack) { printf "FAIL: %s RSS grows\n", name; exit 1 }
+      printf "PASS: %s\n", name
+    }' "$log"
+}
+
+echo "Soaking $HOURS h of audio per codec, --max-memory=$LIMIT_MB"
+soak libmp3lame mp3 44100 || failed=1
+soak aac adts 44100 || failed=1
+soak libopus ogg 48000 || failed=1
+soak flac flac 44100 || failed=1
+soak pcm_s16le wav 44100 || failed=1
+
+exit $failed
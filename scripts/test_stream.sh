@@ -0,0 +1,67 @@
+#!/bin/bash
+#
+# End-to-end check of network output: stream a short generated tone to a
+# listener on localhost over TCP and UDP (MPEG-TS), then make sure what was
+# received decodes and lasts about as long as the input.
+#
+# Usage: scripts/test_stream.sh [path/to/audx]   (default: build/bin/audx)
+# Needs ffmpeg and ffprobe in PATH.
+
+set -u
+
+AUDX="${1:-build/bin/audx}"
+SECONDS_IN=3
+TMP="$(mktemp -d)"
+trap 'kill $(jobs -p) 2>/dev/null; rm -rf "$TMP"' EXIT
+
+for tool in "$AUDX" ffmpeg ffprobe; do
+  if ! command -v "$tool" >/dev/null 2>&1; then
+    echo "SKIP: $tool not found"
+    exit 77
+  fi
+done
+
+ffmpeg -v error -f lavfi -i "sine=frequency=440:sample_rate=48000:duration=$SECONDS_IN" \
+  -ac 2 "$TMP/in.wav" || exit 1
+
+failed=0
+
+# check <name> <received file>
+check() {
+  local duration
+  duration=$(ffprobe -v error -show_entries format=duration -of csv=p=0 "$2")
+  if ! ffmpeg -v error -xerror -i "$2" -f null - 2>"$TMP/$1.err"; then
+    echo "FAIL: $1 stream does not decode"
+    cat "$TMP/$1.err"
+    failed=1
+  elif ! awk -v d="$duration" -v e="$SECONDS_IN" \
+      'BEGIN { exit !(d != "" && d > e - 0.5 && d < e + 0.5) }'; then
+    echo "FAIL: $1 stream lasts ${duration:-?} s, expected about $SECONDS_IN s"
+    failed=1
+  else
+    echo "PASS: $1 (${duration} s received)"
+  fi
+}
+
+# TCP: the receiver listens, audx connects
+ffmpeg -v error -y -f mpegts -listen 1 -i "tcp://127.0.0.1:16000" -c copy \
+  "$TMP/tcp.ts" &
+receiver=$!
+sleep 1
+"$AUDX" "$TMP/in.wav" "tcp://127.0.0.1:16000" --codec=aac >"$TMP/tcp.log" 2>&1 ||
+  { echo "FAIL: audx tcp exited with $?"; cat "$TMP/tcp.log"; failed=1; }
+wait $receiver
+check tcp "$TMP/tcp.ts"
+
+# UDP: the receiver stops once the stream has been idle for a second
+ffmpeg -v error -y -f mpegts -i "udp://127.0.0.1:16002?timeout=1000000" \
+  -c copy "$TMP/udp.ts" &
+receiver=$!
+sleep 1
+"$AUDX" "$TMP/in.wav" "udp://127.0.0.1:16002?pkt_size=1316" --codec=aac \
+  >"$TMP/udp.log" 2>&1 ||
+  { echo "FAIL: audx udp exited with $?"; cat "$TMP/udp.log"; failed=1; }
+wait $receiver
+check udp "$TMP/udp.ts"
+
+exit $failed
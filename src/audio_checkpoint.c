@@ -0,0 +1,281 @@
+#include "../include/audio_checkpoint.h"
+#include <errno.h>
+#include <libavutil/avstring.h>
+#include <libavutil/error.h>
+#include <libavutil/intreadwrite.h>
+#include <libavutil/mem.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/** Journal record header: pts, dts, duration, flags and size. */
+#define RECORD_HEADER 32
+
+/**
+ * @brief Read the state file; 1 if it exists and belongs to this job.
+ */
+static int load_state(struct audio_checkpoint *cp) {
+  char key[33];
+  long long position, bytes;
+  int version;
+
+  FILE *file = fopen(cp->state_path, "r");
+  if (!file)
+    return 0;
+  int n = fscanf(file, "audx-checkpoint %d key %32s position %lld bytes %lld",
+                 &version, key, &position, &bytes);
+  fclose(file);
+  if (n != 4 || version != 1 || strcmp(key, cp->key) != 0 || position < 0 ||
+      bytes < 0)
+    return 0;
+
+  cp->position = cp->saved_position = position;
+  cp->bytes = cp->saved_bytes = bytes;
+  return 1;
+}
+
+/**
+ * @brief Sync the output written so far and record it as the new state.
+ */
+static int save_state(struct audio_checkpoint *cp, FILE *output) {
+  int ret = 0;
+
+  if (fflush(output) != 0 || fsync(fileno(output)) < 0)
+    return AVERROR(errno);
+
+  char *tmp = av_asprintf("%s.tmp", cp->state_path);
+  if (!tmp)
+    return AVERROR(ENOMEM);
+  FILE *file = fopen(tmp, "w");
+  if (!file) {
+    ret = AVERROR(errno);
+    av_free(tmp);
+    return ret;
+  }
+  fprintf(file, "audx-checkpoint 1\nkey %s\nposition %lld\nbytes %lld\n",
+          cp->key, (long long)cp->position, (long long)cp->bytes);
+  if (fflush(file) != 0 || fsync(fileno(file)) < 0)
+    ret = AVERROR(errno);
+  if (fclose(file) != 0 && ret == 0)
+    ret = AVERROR(EIO);
+  if (ret == 0 && rename(tmp, cp->state_path) < 0)
+    ret = AVERROR(errno);
+  if (ret < 0)
+    unlink(tmp);
+  av_free(tmp);
+  if (ret < 0)
+    return ret;
+
+  cp->saved_position = cp->position;
+  cp->saved_bytes = cp->bytes;
+  cp->saved++;
+  return 0;
+}
+
+/**
+ * @brief Open `path` for appending after its first `bytes` bytes.
+ *
+ * @return The file, or NULL if it is missing or shorter than `bytes`.
+ */
+static FILE *open_truncated(const char *path, int64_t bytes) {
+  struct stat st;
+
+  FILE *file = fopen(path, "r+b");
+  if (!file)
+    return NULL;
+  if (fstat(fileno(file), &st) < 0 || st.st_size < bytes ||
+      ftruncate(fileno(file), bytes) < 0 || fseeko(file, 0, SEEK_END) < 0) {
+    fclose(file);
+    return NULL;
+  }
+  return file;
+}
+
+/**
+ * @brief Forget a loaded state and start from the beginning.
+ */
+static void restart(struct audio_checkpoint *cp) {
+  cp->resumed = 0;
+  cp->position = cp->saved_position = 0;
+  cp->bytes = cp->saved_bytes = 0;
+}
+
+int audio_checkpoint_init(struct audio_checkpoint *cp, const char *dir,
+                          const char *key, double interval, int sample_rate,
+                          int journal) {
+  int ret;
+
+  memset(cp, 0, sizeof(*cp));
+  av_strlcpy(cp->key, key, sizeof(cp->key));
+  cp->sample_rate = sample_rate;
+  cp->interval = FFMAX(
+      llrint((interval > 0 ? interval : AUDIO_CHECKPOINT_INTERVAL) *
+             sample_rate),
+      1);
+
+  if (mkdir(dir, 0777) < 0 && errno != EEXIST)
+    return AVERROR(errno);
+
+  cp->dir = av_strdup(dir);
+  cp->state_path = av_asprintf("%s/state", dir);
+  cp->journal_path = av_asprintf("%s/journal", dir);
+  if (!cp->dir || !cp->state_path || !cp->journal_path) {
+    ret = AVERROR(ENOMEM);
+    goto fail;
+  }
+
+  cp->resumed = load_state(cp);
+  if (!journal)
+    return 0;
+
+  /* Packets after the last checkpoint may be partial; drop them */
+  if (cp->resumed && !(cp->journal = open_truncated(cp->journal_path,
+                                                    cp->bytes)))
+    restart(cp);
+  if (!cp->journal && !(cp->journal = fopen(cp->journal_path, "w+b"))) {
+    ret = AVERROR(errno);
+    goto fail;
+  }
+  return 0;
+
+fail:
+  audio_checkpoint_free(cp);
+  return ret;
+}
+
+int audio_checkpoint_attach_encoder(struct audio_checkpoint *cp,
+                                    struct audio_enc *encoder,
+                                    int64_t *start) {
+  AVCodecContext *codec_ctx = encoder->codec_ctx;
+
+  if (!cp->journal)
+    return AVERROR(EINVAL);
+  encoder->packet_sink = audio_checkpoint_write_packet;
+  encoder->sink_opaque = cp;
+  *start = 0;
+  if (!cp->resumed)
+    return 0;
+
+  /* Prime with whole frames before the checkpoint, aligned so that a packet
+   * starts exactly there after the encoder's delay */
+  int64_t overlap = 0;
+  if (codec_ctx->frame_size > 0) {
+    int padding = FFMAX(codec_ctx->initial_padding, 0);
+    int frames = (padding + codec_ctx->frame_size - 1) / codec_ctx->frame_size +
+                 1;
+    overlap = (int64_t)frames * codec_ctx->frame_size - padding;
+  }
+  *start = FFMAX(cp->position - overlap, 0);
+  encoder->pts = *start;
+  encoder->min_pts = cp->position;
+  return 0;
+}
+
+int audio_checkpoint_open_file(struct audio_checkpoint *cp, const char *path,
+                               int frame_bytes, FILE **file, int64_t *start) {
+  *file = NULL;
+  *start = 0;
+
+  if (cp->resumed) {
+    if (cp->bytes == cp->position * frame_bytes)
+      *file = open_truncated(path, cp->bytes);
+    if (!*file)
+      restart(cp);
+  }
+  if (!*file && !(*file = fopen(path, "wb")))
+    return AVERROR(errno);
+  *start = cp->position;
+  return 0;
+}
+
+int audio_checkpoint_write_packet(void *opaque, AVPacket *pkt) {
+  struct audio_checkpoint *cp = opaque;
+  uint8_t header[RECORD_HEADER];
+
+  AV_WL64(header, pkt->pts);
+  AV_WL64(header + 8, pkt->dts);
+  AV_WL64(header + 16, pkt->duration);
+  AV_WL32(header + 24, pkt->flags);
+  AV_WL32(header + 28, pkt->size);
+  if (fwrite(header, 1, RECORD_HEADER, cp->journal) != RECORD_HEADER ||
+      fwrite(pkt->data, 1, pkt->size, cp->journal) != (size_t)pkt->size)
+    return AVERROR(EIO);
+
+  cp->bytes += RECORD_HEADER + pkt->size;
+  if (pkt->pts != AV_NOPTS_VALUE)
+    cp->position = FFMAX(cp->position, pkt->pts + pkt->duration);
+  if (cp->position - cp->saved_position < cp->interval)
+    return 0;
+  return save_state(cp, cp->journal);
+}
+
+int audio_checkpoint_file_written(struct audio_checkpoint *cp, FILE *file,
+                                  int nb_samples, int64_t bytes) {
+  cp->position += nb_samples;
+  cp->bytes += bytes;
+  if (cp->position - cp->saved_position < cp->interval)
+    return 0;
+  return save_state(cp, file);
+}
+
+int audio_checkpoint_finish(struct audio_checkpoint *cp,
+                            struct audio_enc *encoder) {
+  uint8_t header[RECORD_HEADER];
+  int ret;
+
+  /* The encoder's delayed packets go to the journal like all others */
+  if ((ret = audio_enc_write_frame(encoder, NULL)) < 0)
+    return ret;
+  encoder->packet_sink = NULL;
+  if (fflush(cp->journal) != 0 || fseeko(cp->journal, 0, SEEK_SET) < 0)
+    return AVERROR(errno);
+
+  AVPacket *pkt = av_packet_alloc();
+  if (!pkt)
+    return AVERROR(ENOMEM);
+
+  while (fread(header, 1, RECORD_HEADER, cp->journal) == RECORD_HEADER) {
+    int size = (int)AV_RL32(header + 28);
+    if (size < 0 || (ret = av_new_packet(pkt, size)) < 0) {
+      ret = size < 0 ? AVERROR_INVALIDDATA : ret;
+      break;
+    }
+    if (fread(pkt->data, 1, size, cp->journal) != (size_t)size) {
+      ret = AVERROR_INVALIDDATA;
+      break;
+    }
+    pkt->pts = AV_RL64(header);
+    pkt->dts = AV_RL64(header + 8);
+    pkt->duration = AV_RL64(header + 16);
+    pkt->flags = (int)AV_RL32(header + 24);
+    if ((ret = audio_enc_write_packet(encoder, pkt)) < 0)
+      break;
+  }
+  av_packet_free(&pkt);
+  if (ret < 0)
+    return ret;
+  if (ferror(cp->journal))
+    return AVERROR(EIO);
+
+  return av_write_trailer(encoder->fmt_ctx);
+}
+
+void audio_checkpoint_remove(struct audio_checkpoint *cp) {
+  if (!cp->dir)
+    return;
+  unlink(cp->state_path);
+  unlink(cp->journal_path);
+  /* Only if nothing else is kept there */
+  rmdir(cp->dir);
+}
+
+void audio_checkpoint_free(struct audio_checkpoint *cp) {
+  if (cp->journal)
+    fclose(cp->journal);
+  cp->journal = NULL;
+  av_freep(&cp->dir);
+  av_freep(&cp->state_path);
+  av_freep(&cp->journal_path);
+}
@@ -0,0 +1,266 @@
+#include "../include/audio_concat.h"
+#include <errno.h>
+#include <libavutil/common.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * @brief Pool job: open the input after the current one.
+ */
+static void prefetch(void *arg) {
+  struct audio_concat *concat = arg;
+  int slot = !concat->active;
+
+  concat->next_ret = audio_dec_init(
+      &concat->decoders[slot], concat->paths[concat->current + 1],
+      concat->sample_rate, &concat->ch_layout, concat->resample_quality, 0);
+  concat->next_open = concat->next_ret >= 0;
+}
+
+static int start_prefetch(struct audio_concat *concat) {
+  if (concat->current + 1 >= concat->nb_inputs)
+    return 0;
+  int ret = audio_pool_submit(&concat->pool, prefetch, concat);
+  if (ret < 0)
+    return ret;
+  concat->prefetching = 1;
+  return 0;
+}
+
+int audio_concat_init(struct audio_concat *concat, char *const *paths,
+                      int nb_inputs, int sample_rate,
+                      const AVChannelLayout *ch_layout,
+                      enum audio_resample_quality resample_quality,
+                      double crossfade) {
+  int ret;
+
+  memset(concat, 0, sizeof(*concat));
+  concat->paths = paths;
+  concat->nb_inputs = nb_inputs;
+  concat->resample_quality = resample_quality;
+  if (nb_inputs < 1)
+    return AVERROR(EINVAL);
+
+  struct audio_dec *first = &concat->decoders[0];
+  ret = audio_dec_init(first, paths[0], sample_rate, ch_layout,
+                       resample_quality, 0);
+  if (ret < 0) {
+    fprintf(stderr, "Cannot open %s\n", paths[0]);
+    return ret;
+  }
+
+  /* Every later input is converted to the first one's format */
+  concat->sample_rate = first->sample_rate;
+  concat->channels = first->channels;
+  concat->format = first->dst_fmt;
+  if ((ret = av_channel_layout_copy(&concat->ch_layout,
+                                    &first->dst_ch_layout)) < 0)
+    goto fail;
+  concat->frame_bytes =
+      concat->channels * av_get_bytes_per_sample(concat->format);
+
+  if (crossfade > 0 && nb_inputs > 1) {
+    concat->crossfade = (int)lrint(crossfade * concat->sample_rate);
+    concat->hold = av_malloc((size_t)concat->crossfade * concat->frame_bytes);
+    concat->tail = av_malloc((size_t)concat->crossfade * concat->frame_bytes);
+    if (!concat->hold || !concat->tail) {
+      ret = AVERROR(ENOMEM);
+      goto fail;
+    }
+  }
+
+  if (nb_inputs > 1) {
+    if ((ret = audio_pool_init(&concat->pool, 1)) < 0 ||
+        (ret = start_prefetch(concat)) < 0)
+      goto fail;
+  }
+  return 0;
+
+fail:
+  audio_concat_free(concat);
+  return ret;
+}
+
+/**
+ * @brief Mix the start of a chunk with the tail of the previous input:
+ *        equal-power fade-out of the tail, fade-in of the chunk.
+ *
+ * With `data` NULL, the rest of the tail is faded out over silence into
+ * `out`.
+ */
+static void mix_tail(struct audio_concat *concat, const int16_t *data,
+                     int16_t *out, int nb_samples) {
+  const int16_t *tail =
+      (const int16_t *)concat->tail + concat->tail_pos * concat->channels;
+  int channels = concat->channels;
+
+  for (int i = 0; i < nb_samples; i++) {
+    double t = (concat->tail_pos + i + 0.5) / concat->tail_len;
+    double fade_out = cos(t * M_PI_2), fade_in = sin(t * M_PI_2);
+    for (int c = 0; c < channels; c++) {
+      double in = data ? data[i * channels + c] * fade_in : 0.0;
+      out[i * channels + c] =
+          av_clip_int16(lrint(tail[i * channels + c] * fade_out + in));
+    }
+  }
+  concat->tail_pos += nb_samples;
+}
+
+/**
+ * @brief Hold back the last `crossfade` samples of the current input.
+ *
+ * Takes ownership of `data`; `*out_data` receives the samples that are
+ * ready, or NULL.
+ */
+static int hold_back(struct audio_concat *concat, uint8_t *data,
+                     int nb_samples, uint8_t **out_data, int *out_size) {
+  int fb = concat->frame_bytes;
+  int total = concat->nb_held + nb_samples;
+
+  if (total <= concat->crossfade) {
+    memcpy(concat->hold + (size_t)concat->nb_held * fb, data,
+           (size_t)nb_samples * fb);
+    concat->nb_held = total;
+    av_free(data);
+    return 0;
+  }
+
+  int emit = total - concat->crossfade;
+  uint8_t *out = av_malloc((size_t)emit * fb);
+  if (!out) {
+    av_free(data);
+    return AVERROR(ENOMEM);
+  }
+
+  /* Oldest samples first: the held ones, then the start of the chunk */
+  int from_hold = FFMIN(concat->nb_held, emit);
+  memcpy(out, concat->hold, (size_t)from_hold * fb);
+  memcpy(out + (size_t)from_hold * fb, data, (size_t)(emit - from_hold) * fb);
+
+  int kept = concat->nb_held - from_hold;
+  memmove(concat->hold, concat->hold + (size_t)from_hold * fb,
+          (size_t)kept * fb);
+  int used = emit - from_hold;
+  memcpy(concat->hold + (size_t)kept * fb, data + (size_t)used * fb,
+         (size_t)(nb_samples - used) * fb);
+  concat->nb_held = kept + nb_samples - used;
+  av_free(data);
+
+  *out_data = out;
+  *out_size = emit * fb;
+  return 0;
+}
+
+/**
+ * @brief End of the current input: keep its held end for the crossfade,
+ *        or emit what is left, and switch to the prefetched input.
+ */
+static int next_input(struct audio_concat *concat, uint8_t **out_data,
+                      int *out_size) {
+  int fb = concat->frame_bytes;
+  int last = concat->current + 1 >= concat->nb_inputs;
+
+  /* An input shorter than the fade ends it early: emit what it held, then
+   * the rest of the previous tail faded out over silence. The last input
+   * also emits its held samples. */
+  int rest = concat->tail_len - concat->tail_pos;
+  if (rest > 0 || (last && concat->nb_held > 0)) {
+    int nb = concat->nb_held + rest;
+    uint8_t *out = av_malloc((size_t)nb * fb);
+    if (!out)
+      return AVERROR(ENOMEM);
+    memcpy(out, concat->hold, (size_t)concat->nb_held * fb);
+    if (rest > 0)
+      mix_tail(concat, NULL, (int16_t *)(out + (size_t)concat->nb_held * fb),
+               rest);
+    concat->nb_held = 0;
+    concat->tail_len = concat->tail_pos = 0;
+    *out_data = out;
+    *out_size = nb * fb;
+  } else if (concat->nb_held > 0) {
+    uint8_t *tail = concat->tail;
+    concat->tail = concat->hold;
+    concat->hold = tail;
+    concat->tail_len = concat->nb_held;
+    concat->tail_pos = 0;
+    concat->nb_held = 0;
+  }
+
+  if (last) {
+    concat->done = 1;
+    return 0;
+  }
+
+  audio_pool_wait(&concat->pool);
+  concat->prefetching = 0;
+  if (concat->next_ret < 0) {
+    fprintf(stderr, "Cannot open %s\n", concat->paths[concat->current + 1]);
+    return concat->next_ret;
+  }
+
+  audio_dec_free(&concat->decoders[concat->active]);
+  concat->active = !concat->active;
+  concat->next_open = 0;
+  concat->current++;
+  return start_prefetch(concat);
+}
+
+int audio_concat_read(struct audio_concat *concat, uint8_t **out_data,
+                      int *out_size) {
+  uint8_t *data;
+  int size, ret;
+
+  *out_data = NULL;
+  *out_size = 0;
+
+  while (!concat->done) {
+    struct audio_dec *decoder = &concat->decoders[concat->active];
+
+    if ((ret = audio_decoder_read(decoder, &data, &size)) <= 0) {
+      if (ret < 0 || (ret = next_input(concat, out_data, out_size)) < 0)
+        return ret;
+      if (*out_data)
+        return 1;
+      continue;
+    }
+    if (!data || size <= 0)
+      continue;
+
+    int nb_samples = size / concat->frame_bytes;
+    int mixed = FFMIN(nb_samples, concat->tail_len - concat->tail_pos);
+    if (mixed > 0)
+      mix_tail(concat, (const int16_t *)data, (int16_t *)data, mixed);
+    if (concat->tail_pos == concat->tail_len)
+      concat->tail_len = concat->tail_pos = 0;
+
+    /* Only an input followed by another one is crossfaded */
+    if (!concat->crossfade || concat->current + 1 >= concat->nb_inputs) {
+      *out_data = data;
+      *out_size = size;
+      return 1;
+    }
+    if ((ret = hold_back(concat, data, nb_samples, out_data, out_size)) < 0)
+      return ret;
+    if (*out_data)
+      return 1;
+  }
+  return 0;
+}
+
+void audio_concat_free(struct audio_concat *concat) {
+  /* Waits for a prefetch still opening the next input */
+  audio_pool_free(&concat->pool);
+  concat->prefetching = 0;
+
+  audio_dec_free(&concat->decoders[concat->active]);
+  if (concat->next_open)
+    audio_dec_free(&concat->decoders[!concat->active]);
+  concat->next_open = 0;
+
+  av_freep(&concat->hold);
+  av_freep(&concat->tail);
+  av_channel_layout_uninit(&concat->ch_layout);
+}
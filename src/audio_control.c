@@ -0,0 +1,105 @@
+#include "../include/audio_control.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+int audio_control_open(struct audio_control *ctl, const char *path) {
+  memset(ctl, 0, sizeof(*ctl));
+
+  /* O_NONBLOCK also keeps open() from waiting for a writer on a FIFO */
+  ctl->fd = open(path, O_RDONLY | O_NONBLOCK);
+  if (ctl->fd < 0) {
+    int err = errno;
+    ctl->fd = -1;
+    fprintf(stderr, "Cannot open control channel %s: %s\n", path,
+            strerror(err));
+    return AVERROR(err);
+  }
+  return 0;
+}
+
+/**
+ * @brief Parse and apply a single control line (modified in place).
+ *
+ * @return 1 if a command was applied, 0 if the line was skipped.
+ */
+static int run_line(struct audio_filter *filter, char *line) {
+  char *save = NULL;
+  double time = -1.0;
+
+  char *tok = strtok_r(line, " \t\r", &save);
+  if (!tok || tok[0] == '#')
+    return 0;
+
+  if (tok[0] == '@') {
+    char *end;
+    time = strtod(tok + 1, &end);
+    if (end == tok + 1 || *end != '\0' || time < 0) {
+      fprintf(stderr, "Invalid control time: %s\n", tok);
+      return 0;
+    }
+    tok = strtok_r(NULL, " \t\r", &save);
+  }
+
+  const char *target = tok;
+  const char *cmd = strtok_r(NULL, " \t\r", &save);
+  const char *arg = strtok_r(NULL, "\r", &save);
+  if (!target || !cmd) {
+    fprintf(stderr, "Invalid control line, expected "
+                    "\"[@<seconds>] <target> <command> [<argument>]\"\n");
+    return 0;
+  }
+  while (arg && (*arg == ' ' || *arg == '\t'))
+    arg++;
+
+  return audio_filter_command(filter, target, cmd, arg ? arg : "", time) >= 0;
+}
+
+int audio_control_poll(struct audio_control *ctl, struct audio_filter *filter) {
+  int applied = 0;
+
+  for (;;) {
+    ssize_t n = read(ctl->fd, ctl->buf + ctl->len,
+                     sizeof(ctl->buf) - 1 - ctl->len);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        break;
+      return AVERROR(errno);
+    }
+    if (n == 0) // no writer connected, or end of a regular file
+      break;
+    ctl->len += (int)n;
+
+    /* Run every complete line, keep the rest for the next poll */
+    char *start = ctl->buf;
+    char *nl;
+    ctl->buf[ctl->len] = '\0';
+    while ((nl = strchr(start, '\n'))) {
+      *nl = '\0';
+      applied += run_line(filter, start);
+      start = nl + 1;
+    }
+    ctl->len -= (int)(start - ctl->buf);
+    memmove(ctl->buf, start, ctl->len);
+
+    /* A line longer than the buffer can never complete */
+    if (ctl->len == (int)sizeof(ctl->buf) - 1) {
+      fprintf(stderr, "Control line too long, discarded\n");
+      ctl->len = 0;
+    }
+  }
+
+  return applied;
+}
+
+void audio_control_close(struct audio_control *ctl) {
+  if (ctl->fd >= 0)
+    close(ctl->fd);
+  ctl->fd = -1;
+  ctl->len = 0;
+}
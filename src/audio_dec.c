@@ -1,5 +1,6 @@
 #include "../include/audio_dec.h"
 #include <stdio.h>
+#include <string.h>
 
 /**
  * @brief Print a human-readable FFmpeg error message.
@@ -13,77 +14,46 @@ static void logerr(const char *msg, int errnum) {
 }
 
 /**
- * @brief Initialize an audio decoder for a given file.
+ * @brief Open the codec and resampler of `decoder->stream_index`.
  *
- * This function sets up all FFmpeg contexts (format, codec, resampler)
- * required to decode an input audio file into PCM frames.
+ * On failure the caller frees the decoder.
  */
-int audio_dec_init(struct audio_dec *decoder, const char *filename) {
-  av_log_set_level(AV_LOG_ERROR); // Only log critical FFmpeg errors
-
-  if (decoder == NULL) {
-    fprintf(stderr, "Cannot open input file\n");
-    return -1;
-  }
-
+static int open_stream(struct audio_dec *decoder, int sample_rate,
+                       const AVChannelLayout *ch_layout,
+                       enum audio_resample_quality resample_quality,
+                       int flags) {
   int ret;
 
-  // Initialize all fields of the decoder struct to zero
-  // to ensure safe cleanup even if initialization fails midway.
-  memset(decoder, 0, sizeof(*decoder));
-
-  // Open the input file
-  ret = avformat_open_input(&decoder->fmt_ctx, filename, NULL, NULL);
-  if (ret < 0) {
-    logerr("Cannot open input file", ret);
-    return ret;
-  }
-
-  // Read stream information (metadata, codecs, etc.)
-  ret = avformat_find_stream_info(decoder->fmt_ctx, NULL);
-  if (ret < 0) {
-    logerr("Cannot find stream info", ret);
-    goto fail;
-  }
-
-  //  Locate the first audio stream in the file
-  decoder->stream_index = av_find_best_stream(
-      decoder->fmt_ctx, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
-  if (decoder->stream_index < 0) {
-    fprintf(stderr, "No audio stream found\n");
-    ret = decoder->stream_index;
-    goto fail;
-  }
-
   AVStream *stream = decoder->fmt_ctx->streams[decoder->stream_index];
 
   // Find and open the appropriate decoder
   decoder->codec = avcodec_find_decoder(stream->codecpar->codec_id);
   if (!decoder->codec) {
     fprintf(stderr, "Unsupported codec\n");
-    ret = AVERROR_DECODER_NOT_FOUND;
-    goto fail;
+    return AVERROR_DECODER_NOT_FOUND;
   }
 
   decoder->codec_ctx = avcodec_alloc_context3(decoder->codec);
   if (!decoder->codec_ctx) {
     fprintf(stderr, "Failed to allocate codec context\n");
-    ret = AVERROR(ENOMEM);
-    goto fail;
+    return AVERROR(ENOMEM);
   }
 
   // Copy codec parameters from stream to codec context
   ret = avcodec_parameters_to_context(decoder->codec_ctx, stream->codecpar);
   if (ret < 0) {
     logerr("Cannot copy codec parameters", ret);
-    goto fail;
+    return ret;
   }
 
+  if (flags & AUDIO_DEC_LOW_LATENCY)
+    decoder->codec_ctx->flags |= AV_CODEC_FLAG_LOW_DELAY;
+
   // Open the codec
   ret = avcodec_open2(decoder->codec_ctx, decoder->codec, NULL);
   if (ret < 0) {
     logerr("Cannot open codec", ret);
-    goto fail;
+    return ret;
   }
 
   // Allocate reusable packet & frame
@@ -91,23 +61,34 @@ int audio_dec_init(struct audio_dec *decoder, const char *filename) {
   decoder->frame = av_frame_alloc();
   if (!decoder->pkt || !decoder->frame) {
     fprintf(stderr, "Failed to allocate packet/frame\n");
-    ret = AVERROR(ENOMEM);
-    goto fail;
+    return AVERROR(ENOMEM);
   }
 
-  // Configure resampler (SwrContext)
-  decoder->sample_rate = decoder->codec_ctx->sample_rate;
-  decoder->channels = decoder->codec_ctx->ch_layout.nb_channels;
+  // Configure resampler (SwrContext), keeping the source rate and
+  // channel count unless a reduced target was requested
+  decoder->sample_rate =
+      sample_rate > 0 ? sample_rate : decoder->codec_ctx->sample_rate;
 
   // Set target channel layout and output format
-  av_channel_layout_default(&decoder->dst_ch_layout, decoder->channels);
-  decoder->dst_fmt = AV_SAMPLE_FMT_S16; // output as signed 16-bit PCM
+  if (ch_layout && ch_layout->nb_channels > 0) {
+    ret = av_channel_layout_copy(&decoder->dst_ch_layout, ch_layout);
+    if (ret < 0) {
+      logerr("Cannot copy channel layout", ret);
+      return ret;
+    }
+  } else {
+    av_channel_layout_default(&decoder->dst_ch_layout,
+                              decoder->codec_ctx->ch_layout.nb_channels);
+  }
+  decoder->channels = decoder->dst_ch_layout.nb_channels;
+  // Output as signed 16-bit PCM, or float for the high-resolution path
+  decoder->dst_fmt =
+      flags & AUDIO_DEC_FLOAT ? AV_SAMPLE_FMT_FLT : AV_SAMPLE_FMT_S16;
 
   decoder->swr_ctx = swr_alloc();
   if (!decoder->swr_ctx) {
     fprintf(stderr, "Failed to allocate SwrContext\n");
-    ret = AVERROR(ENOMEM);
-    goto fail;
+    return AVERROR(ENOMEM);
   }
 
   // Configure conversion parameters for SwrContext
@@ -124,16 +105,77 @@ int audio_dec_init(struct audio_dec *decoder, const char *filename) {
       (ret = av_opt_set_sample_fmt(decoder->swr_ctx, "out_sample_fmt",
                                    decoder->dst_fmt, 0)) < 0) {
     logerr("Failed to configure SwrContext", ret);
-    goto fail;
+    return ret;
   }
 
   // Initialize resampler
-  ret = swr_init(decoder->swr_ctx);
+  ret = audio_resample_init(decoder->swr_ctx, resample_quality);
   if (ret < 0) {
     logerr("Cannot initialize SwrContext", ret);
+    return ret;
+  }
+
+  decoder->skip_to = AV_NOPTS_VALUE;
+  return 0;
+}
+
+/**
+ * @brief Initialize an audio decoder for a given file.
+ *
+ * This function sets up all FFmpeg contexts (format, codec, resampler)
+ * required to decode an input audio file into PCM frames.
+ */
+int audio_dec_init(struct audio_dec *decoder, const char *filename,
+                   int sample_rate, const AVChannelLayout *ch_layout,
+                   enum audio_resample_quality resample_quality, int flags) {
+  av_log_set_level(AV_LOG_ERROR); // Only log critical FFmpeg errors
+
+  if (decoder == NULL) {
+    fprintf(stderr, "Cannot open input file\n");
+    return -1;
+  }
+
+  int ret;
+
+  // Initialize all fields of the decoder struct to zero
+  // to ensure safe cleanup even if initialization fails midway.
+  memset(decoder, 0, sizeof(*decoder));
+
+  // Low latency: probe as little as possible and don't buffer packets
+  AVDictionary *opts = NULL;
+  if (flags & AUDIO_DEC_LOW_LATENCY) {
+    av_dict_set(&opts, "probesize", "32", 0);
+    av_dict_set(&opts, "analyzeduration", "0", 0);
+    av_dict_set(&opts, "fflags", "nobuffer", 0);
+  }
+
+  // Open the input file
+  ret = avformat_open_input(&decoder->fmt_ctx, filename, NULL, &opts);
+  av_dict_free(&opts);
+  if (ret < 0) {
+    logerr("Cannot open input file", ret);
+    return ret;
+  }
+
+  // Read stream information (metadata, codecs, etc.)
+  ret = avformat_find_stream_info(decoder->fmt_ctx, NULL);
+  if (ret < 0) {
+    logerr("Cannot find stream info", ret);
     goto fail;
   }
 
+  //  Locate the first audio stream in the file
+  decoder->stream_index = av_find_best_stream(
+      decoder->fmt_ctx, AVMEDIA_TYPE_AUDIO, -1, -1, NULL, 0);
+  if (decoder->stream_index < 0) {
+    fprintf(stderr, "No audio stream found\n");
+    ret = decoder->stream_index;
+    goto fail;
+  }
+
+  ret = open_stream(decoder, sample_rate, ch_layout, resample_quality, flags);
+  if (ret < 0)
+    goto fail;
   return 0; // success
 
 // Unified cleanup path for failures
@@ -142,102 +184,229 @@ fail:
   return ret;
 }
 
+int audio_dec_init_stream(struct audio_dec *decoder, AVFormatContext *fmt_ctx,
+                          int stream_index, int sample_rate,
+                          const AVChannelLayout *ch_layout,
+                          enum audio_resample_quality resample_quality) {
+  int ret;
+
+  memset(decoder, 0, sizeof(*decoder));
+  decoder->fmt_ctx = fmt_ctx;
+  decoder->shared = 1;
+  decoder->stream_index = stream_index;
+
+  ret = open_stream(decoder, sample_rate, ch_layout, resample_quality, 0);
+  if (ret < 0)
+    audio_dec_free(decoder);
+  return ret;
+}
+
 /**
- * @brief Read and decode the next PCM chunk.
+ * @brief Number of leading samples of the current frame to drop after a
+ *        seek.
  *
- * Reads one packet from the audio file, decodes it, converts it
- * into the desired PCM format, and returns the raw buffer.
+ * Clears `skip_to` once the frame reaches the target. Frames without a
+ * timestamp are taken to start at the target.
  */
-int audio_decoder_read(struct audio_dec *decoder, uint8_t **out_data,
-                       int *out_size) {
-  *out_data = NULL;
-  *out_size = 0;
+static int frame_skip(struct audio_dec *decoder, int nb_samples) {
+  AVStream *stream = decoder->fmt_ctx->streams[decoder->stream_index];
+  int64_t ts = decoder->frame->best_effort_timestamp;
+  int64_t pos = decoder->skip_to;
+
+  if (ts != AV_NOPTS_VALUE) {
+    if (stream->start_time != AV_NOPTS_VALUE)
+      ts -= stream->start_time;
+    pos = av_rescale_q(ts, stream->time_base,
+                       (AVRational){1, decoder->sample_rate});
+  }
+
+  int64_t drop = decoder->skip_to - pos;
+  if (drop < nb_samples)
+    decoder->skip_to = AV_NOPTS_VALUE;
+  return (int)av_clip64(drop, 0, nb_samples);
+}
+
+int audio_dec_seek(struct audio_dec *decoder, int64_t sample) {
+  AVStream *stream = decoder->fmt_ctx->streams[decoder->stream_index];
   int ret;
 
-  //  Read encoded packet
-  ret = av_read_frame(decoder->fmt_ctx, decoder->pkt);
+  // Seek to the packet at or before the target
+  int64_t ts = av_rescale_q(sample, (AVRational){1, decoder->sample_rate},
+                            stream->time_base);
+  if (stream->start_time != AV_NOPTS_VALUE)
+    ts += stream->start_time;
+  ret = av_seek_frame(decoder->fmt_ctx, decoder->stream_index, ts,
+                      AVSEEK_FLAG_BACKWARD);
   if (ret < 0) {
-    if (ret != AVERROR_EOF) {
-      logerr("Error reading frame", ret);
-    }
-    return 0; // EOF or error
-  }
-
-  // Skip non-audio packets (e.g., metadata or other streams)
-  if (decoder->pkt->stream_index != decoder->stream_index) {
-    av_packet_unref(decoder->pkt);
-    return 1;
+    logerr("Cannot seek input", ret);
+    return ret;
   }
 
-  // Send packet to decoder
-  ret = avcodec_send_packet(decoder->codec_ctx, decoder->pkt);
+  // Forget the codec and resampler state from before the seek
+  avcodec_flush_buffers(decoder->codec_ctx);
+  decoder->flushed = 0;
+  decoder->draining = 0;
+  ret = swr_init(decoder->swr_ctx);
   if (ret < 0) {
-    logerr("Error sending packet to decoder", ret);
-    av_packet_unref(decoder->pkt);
-    return 1;
+    logerr("Cannot reset SwrContext", ret);
+    return ret;
   }
 
-  // Receive decoded frame
-  ret = avcodec_receive_frame(decoder->codec_ctx, decoder->frame);
-  while (ret >= 0) {
-    // Calculate number of samples after resampling
-    int dst_nb_samples = av_rescale_rnd(
-        swr_get_delay(decoder->swr_ctx, decoder->codec_ctx->sample_rate) +
-            decoder->frame->nb_samples,
-        decoder->sample_rate, decoder->codec_ctx->sample_rate, AV_ROUND_UP);
+  decoder->skip_to = sample;
+  return 0;
+}
+
+/**
+ * @brief Resample decoded samples (or, with NULL input, the resampler's
+ *        delayed tail) into a newly allocated PCM buffer.
+ *
+ * @return 1 if samples were produced, 0 if none, negative on error.
+ */
+static int convert(struct audio_dec *decoder, const uint8_t **in,
+                   int in_samples, uint8_t **out_data, int *out_size) {
+  uint8_t **converted = NULL;
+  int ret;
 
-    uint8_t **converted = NULL;
+  // Calculate number of samples after resampling
+  int dst_nb_samples = av_rescale_rnd(
+      swr_get_delay(decoder->swr_ctx, decoder->codec_ctx->sample_rate) +
+          in_samples,
+      decoder->sample_rate, decoder->codec_ctx->sample_rate, AV_ROUND_UP);
+  if (dst_nb_samples <= 0)
+    return 0;
 
-    // Allocate output buffer for resampled PCM
-    ret =
-        av_samples_alloc_array_and_samples(&converted, NULL, decoder->channels,
+  // Allocate output buffer for resampled PCM
+  ret = av_samples_alloc_array_and_samples(&converted, NULL, decoder->channels,
                                            dst_nb_samples, decoder->dst_fmt, 0);
+  if (ret < 0) {
+    logerr("Failed to allocate output buffer", ret);
+    return ret;
+  }
 
-    if (ret < 0) {
-      logerr("Failed to allocate output buffer", ret);
-      break;
+  // Perform sample format & rate conversion
+  int samples_converted = swr_convert(decoder->swr_ctx, converted,
+                                      dst_nb_samples, in, in_samples);
+  if (samples_converted < 0) {
+    logerr("Error during resampling", samples_converted);
+    av_freep(&converted[0]);
+    av_freep(&converted);
+    return samples_converted;
+  }
+
+  // After a seek, drop what precedes the target position
+  if (in && decoder->skip_to != AV_NOPTS_VALUE) {
+    int drop = frame_skip(decoder, samples_converted);
+    if (drop > 0) {
+      int frame_bytes =
+          decoder->channels * av_get_bytes_per_sample(decoder->dst_fmt);
+      samples_converted -= drop;
+      memmove(converted[0], converted[0] + (size_t)drop * frame_bytes,
+              (size_t)samples_converted * frame_bytes);
     }
+  }
 
-    // Perform sample format & rate conversion
-    int samples_converted = swr_convert(
-        decoder->swr_ctx, converted, dst_nb_samples,
-        (const uint8_t **)decoder->frame->data, decoder->frame->nb_samples);
+  if (samples_converted == 0) {
+    av_freep(&converted[0]);
+    av_freep(&converted);
+    return 0;
+  }
 
-    if (samples_converted < 0) {
-      logerr("Error during resampling", samples_converted);
-      av_freep(&converted[0]);
-      av_freep(&converted);
-      break;
-    }
+  // Assign decoded PCM data to output; the caller owns the buffer
+  *out_data = converted[0];
+  *out_size = av_samples_get_buffer_size(NULL, decoder->channels,
+                                         samples_converted, decoder->dst_fmt,
+                                         1);
+  av_freep(&converted);
+  return 1;
+}
 
-    // Calculate output buffer size in bytes
-    int buffer_size = av_samples_get_buffer_size(
-        NULL, decoder->channels, samples_converted, decoder->dst_fmt, 1);
+int audio_dec_receive(struct audio_dec *decoder, uint8_t **out_data,
+                      int *out_size) {
+  *out_data = NULL;
+  *out_size = 0;
+  int ret;
 
-    if (buffer_size < 0) {
-      logerr("Invalid buffer size", buffer_size);
-      av_freep(&converted[0]);
-      av_freep(&converted);
-      break;
+  for (;;) {
+    // Hand out frames the decoder already produced
+    ret = avcodec_receive_frame(decoder->codec_ctx, decoder->frame);
+    if (ret >= 0) {
+      ret = convert(decoder, (const uint8_t **)decoder->frame->extended_data,
+                    decoder->frame->nb_samples, out_data, out_size);
+      av_frame_unref(decoder->frame);
+      if (ret != 0)
+        return 1; // a chunk, or an error the caller skips like before
+      continue;
     }
 
-    // Assign decoded PCM data to output
-    *out_data = converted[0];
-    *out_size = buffer_size;
+    if (ret == AVERROR_EOF) {
+      // Codec drained: flush the resampler once, then report the end
+      if (decoder->flushed)
+        return AVERROR_EOF;
+      decoder->flushed = 1;
+      ret = convert(decoder, NULL, 0, out_data, out_size);
+      return ret > 0 ? 1 : AVERROR_EOF;
+    }
 
-    // Free container array (not the actual buffer, owned by caller)
-    av_freep(&converted);
-    av_packet_unref(decoder->pkt);
-    return 1; // processed one frame successfully
+    if (ret != AVERROR(EAGAIN))
+      logerr("Error receiving frame", ret);
+    return ret;
   }
+}
 
-  // If not EOF or EAGAIN, report error
-  if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF) {
-    logerr("Error receiving frame", ret);
-  }
+int audio_dec_send_packet(struct audio_dec *decoder, const AVPacket *pkt) {
+  int ret = avcodec_send_packet(decoder->codec_ctx, pkt);
 
-  av_packet_unref(decoder->pkt);
-  return 1;
+  // A corrupt packet is skipped; draining twice is harmless
+  if (ret == AVERROR_EOF && !pkt)
+    return 0;
+  if (ret < 0)
+    logerr(pkt ? "Error sending packet to decoder" : "Error draining decoder",
+           ret);
+  return ret;
+}
+
+/**
+ * @brief Read and decode the next PCM chunk.
+ *
+ * Frames the decoder already holds are returned before another packet is
+ * read, so at most one packet's worth of frames is ever queued inside the
+ * codec. At end of input the codec is drained and then the resampler's
+ * delayed samples are flushed, so the tail of the audio is not lost.
+ */
+int audio_decoder_read(struct audio_dec *decoder, uint8_t **out_data,
+                       int *out_size) {
+  int ret;
+
+  for (;;) {
+    ret = audio_dec_receive(decoder, out_data, out_size);
+    if (ret > 0)
+      return 1;
+    if (ret == AVERROR_EOF)
+      return 0;
+    if (ret == AVERROR(ENOMEM))
+      return ret;
+    /* Any other error was logged by audio_dec_receive(): the bad frame is
+     * skipped and decoding goes on with the next packet. A codec failing
+     * while it drains has nothing more to give. */
+    if (ret != AVERROR(EAGAIN) && decoder->draining)
+      return 0;
+
+    // Read encoded packet; at the end, drain the decoder
+    ret = av_read_frame(decoder->fmt_ctx, decoder->pkt);
+    if (ret < 0) {
+      if (ret != AVERROR_EOF)
+        logerr("Error reading frame", ret);
+      decoder->draining = 1;
+      if (audio_dec_send_packet(decoder, NULL) < 0)
+        return 0;
+      continue;
+    }
+
+    // Skip non-audio packets (e.g., metadata or other streams)
+    if (decoder->pkt->stream_index == decoder->stream_index)
+      audio_dec_send_packet(decoder, decoder->pkt);
+    av_packet_unref(decoder->pkt);
+  }
 }
 
 /**
@@ -254,6 +423,8 @@ void audio_dec_free(struct audio_dec *decoder) {
     av_packet_free(&decoder->pkt);
   if (decoder->codec_ctx)
     avcodec_free_context(&decoder->codec_ctx);
-  if (decoder->fmt_ctx)
+  if (decoder->fmt_ctx && !decoder->shared)
     avformat_close_input(&decoder->fmt_ctx);
+  decoder->fmt_ctx = NULL;
+  av_channel_layout_uninit(&decoder->dst_ch_layout);
 }
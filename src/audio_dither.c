@@ -0,0 +1,113 @@
+#include "../include/audio_dither.h"
+#include "../include/audio_dsp.h"
+#include <errno.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+#include <math.h>
+#include <string.h>
+
+int audio_dither_init(struct audio_dither *dither, int bits, int channels,
+                      int flags) {
+  memset(dither, 0, sizeof(*dither));
+  if ((bits != 16 && bits != 24 && bits != 32) || channels <= 0)
+    return AVERROR(EINVAL);
+
+  dither->bits = bits;
+  dither->format = bits == 16 ? AV_SAMPLE_FMT_S16 : AV_SAMPLE_FMT_S32;
+  dither->channels = channels;
+  dither->flags = bits == 32 ? AUDIO_DITHER_NONE : flags;
+
+  /* Any fixed non-zero seeds; distinct lanes give independent sequences */
+  dither->state[0] = 0x9e3779b9;
+  dither->state[1] = 0x7f4a7c15;
+  dither->state[2] = 0x94d049bb;
+  dither->state[3] = 0xbf58476d;
+
+  dither->error = av_calloc(channels, sizeof(*dither->error));
+  dither->frame = av_frame_alloc();
+  if (!dither->error || !dither->frame) {
+    audio_dither_free(dither);
+    return AVERROR(ENOMEM);
+  }
+  return 0;
+}
+
+/**
+ * @brief First-order noise-shaped TPDF dither: the previous rounding error
+ *        of the channel is subtracted before rounding.
+ */
+static void dither_shaped(struct audio_dither *dither, const float *src,
+                          uint8_t *dst, int nb_samples) {
+  const float scale = ldexpf(1.0f, dither->bits - 1);
+  const float max = scale - 1.0f;
+  const int shift = 32 - dither->bits;
+  int channels = dither->channels;
+  uint32_t x = dither->state[0];
+
+  for (int i = 0; i < nb_samples; i++) {
+    for (int c = 0; c < channels; c++) {
+      float v = src[i * channels + c] * scale - dither->error[c];
+
+      x ^= x << 13;
+      x ^= x >> 17;
+      x ^= x << 5;
+      float q = rintf(v + ((int)(x & 0xffff) - (int)(x >> 16)) / 65536.0f);
+      q = q < -scale ? -scale : q > max ? max : q;
+
+      /* A clipped sample's error is not noise; keep the loop stable */
+      float err = q - v;
+      dither->error[c] = err < -1.0f ? -1.0f : err > 1.0f ? 1.0f : err;
+
+      if (dither->bits == 16)
+        ((int16_t *)dst)[i * channels + c] = (int16_t)q;
+      else
+        ((int32_t *)dst)[i * channels + c] =
+            (int32_t)((uint32_t)(int32_t)q << shift);
+    }
+  }
+  dither->state[0] = x;
+}
+
+int audio_dither_process(struct audio_dither *dither, const AVFrame *in,
+                         AVFrame **out) {
+  AVFrame *frame = dither->frame;
+  int ret;
+
+  if (in->format != AV_SAMPLE_FMT_FLT ||
+      in->ch_layout.nb_channels != dither->channels)
+    return AVERROR(EINVAL);
+
+  int64_t start = av_gettime_relative();
+
+  av_frame_unref(frame);
+  frame->format = dither->format;
+  frame->nb_samples = in->nb_samples;
+  frame->sample_rate = in->sample_rate;
+  frame->pts = in->pts;
+  frame->opaque = in->opaque;
+  if ((ret = av_channel_layout_copy(&frame->ch_layout, &in->ch_layout)) < 0 ||
+      (ret = av_frame_get_buffer(frame, 0)) < 0)
+    return ret;
+
+  const float *src = (const float *)in->data[0];
+  uint32_t *state = dither->flags & AUDIO_DITHER_NONE ? NULL : dither->state;
+  int count = in->nb_samples * dither->channels;
+  if (state && (dither->flags & AUDIO_DITHER_SHAPED))
+    dither_shaped(dither, src, frame->data[0], in->nb_samples);
+  else if (dither->bits == 16)
+    audio_dsp_dither_s16((int16_t *)frame->data[0], src, count, state);
+  else
+    audio_dsp_dither_s32((int32_t *)frame->data[0], src, count, dither->bits,
+                         state);
+
+  dither->samples += in->nb_samples;
+  dither->time_us += av_gettime_relative() - start;
+  *out = frame;
+  return 0;
+}
+
+void audio_dither_free(struct audio_dither *dither) {
+  av_freep(&dither->error);
+  av_frame_free(&dither->frame);
+}
@@ -0,0 +1,1211 @@
+#include "../include/audio_dsp.h"
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+#include <libavutil/parseutils.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define AUDIO_DSP_SSE2 1
+#endif
+
+/* ------------------------------------------------------------------------ */
+/* Kernels                                                                  */
+/* ------------------------------------------------------------------------ */
+
+/**
+ * @brief Round a float to the nearest S16 value with saturation.
+ */
+static inline int16_t clip_s16(float v) {
+  if (v >= 32767.0f)
+    return 32767;
+  if (v <= -32768.0f)
+    return -32768;
+  return (int16_t)lrintf(v);
+}
+
+#ifdef AUDIO_DSP_SSE2
+/**
+ * @brief Multiply 8 S16 samples by two vectors of 4 gains, saturating.
+ */
+static inline __m128i mul_s16x8(__m128i x, __m128 g_lo, __m128 g_hi) {
+  const __m128 max = _mm_set1_ps(32767.0f);
+  const __m128 min = _mm_set1_ps(-32768.0f);
+
+  /* Sign-extend the 16-bit lanes to 32-bit, then convert to float */
+  __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+  __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+  __m128 flo = _mm_mul_ps(_mm_cvtepi32_ps(lo), g_lo);
+  __m128 fhi = _mm_mul_ps(_mm_cvtepi32_ps(hi), g_hi);
+
+  flo = _mm_min_ps(_mm_max_ps(flo, min), max);
+  fhi = _mm_min_ps(_mm_max_ps(fhi, min), max);
+  return _mm_packs_epi32(_mm_cvtps_epi32(flo), _mm_cvtps_epi32(fhi));
+}
+#endif
+
+void audio_dsp_gain_s16(int16_t *samples, int count, float gain) {
+  int i = 0;
+
+#ifdef AUDIO_DSP_SSE2
+  const __m128 g = _mm_set1_ps(gain);
+  for (; i + 8 <= count; i += 8) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(samples + i));
+    _mm_storeu_si128((__m128i *)(samples + i), mul_s16x8(x, g, g));
+  }
+#endif
+
+  for (; i < count; i++)
+    samples[i] = clip_s16(samples[i] * gain);
+}
+
+void audio_dsp_gain_flt(float *samples, int count, float gain) {
+  int i = 0;
+
+#ifdef AUDIO_DSP_SSE2
+  const __m128 g = _mm_set1_ps(gain);
+  for (; i + 4 <= count; i += 4)
+    _mm_storeu_ps(samples + i, _mm_mul_ps(_mm_loadu_ps(samples + i), g));
+#endif
+
+  for (; i < count; i++)
+    samples[i] *= gain;
+}
+
+void audio_dsp_gains_s16(int16_t *samples, const float *gains, int count) {
+  int i = 0;
+
+#ifdef AUDIO_DSP_SSE2
+  for (; i + 8 <= count; i += 8) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(samples + i));
+    __m128 g_lo = _mm_loadu_ps(gains + i);
+    __m128 g_hi = _mm_loadu_ps(gains + i + 4);
+    _mm_storeu_si128((__m128i *)(samples + i), mul_s16x8(x, g_lo, g_hi));
+  }
+#endif
+
+  for (; i < count; i++)
+    samples[i] = clip_s16(samples[i] * gains[i]);
+}
+
+void audio_dsp_gains_flt(float *samples, const float *gains, int count) {
+  int i = 0;
+
+#ifdef AUDIO_DSP_SSE2
+  for (; i + 4 <= count; i += 4)
+    _mm_storeu_ps(samples + i, _mm_mul_ps(_mm_loadu_ps(samples + i),
+                                          _mm_loadu_ps(gains + i)));
+#endif
+
+  for (; i < count; i++)
+    samples[i] *= gains[i];
+}
+
+void audio_dsp_mix_s16(float *acc, const int16_t *samples, int count,
+                       float gain) {
+  int i = 0;
+
+#ifdef AUDIO_DSP_SSE2
+  const __m128 g = _mm_set1_ps(gain);
+  for (; i + 8 <= count; i += 8) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(samples + i));
+    __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+    __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+    _mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i),
+                                      _mm_mul_ps(_mm_cvtepi32_ps(lo), g)));
+    _mm_storeu_ps(acc + i + 4,
+                  _mm_add_ps(_mm_loadu_ps(acc + i + 4),
+                             _mm_mul_ps(_mm_cvtepi32_ps(hi), g)));
+  }
+#endif
+
+  for (; i < count; i++)
+    acc[i] += samples[i] * gain;
+}
+
+void audio_dsp_store_s16(int16_t *dst, const float *acc, int count) {
+  int i = 0;
+
+#ifdef AUDIO_DSP_SSE2
+  const __m128 max = _mm_set1_ps(32767.0f);
+  const __m128 min = _mm_set1_ps(-32768.0f);
+  for (; i + 8 <= count; i += 8) {
+    __m128 lo = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(acc + i), min), max);
+    __m128 hi = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(acc + i + 4), min), max);
+    _mm_storeu_si128((__m128i *)(dst + i),
+                     _mm_packs_epi32(_mm_cvtps_epi32(lo), _mm_cvtps_epi32(hi)));
+  }
+#endif
+
+  for (; i < count; i++)
+    dst[i] = clip_s16(acc[i]);
+}
+
+/*
+ * TPDF dither: the difference of the two 16-bit halves of a 32-bit random
+ * number is triangular over (-1, 1) once scaled by 1/65536.
+ */
+
+static inline uint32_t xorshift32(uint32_t x) {
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return x;
+}
+
+static inline float tpdf(uint32_t x) {
+  return ((int)(x & 0xffff) - (int)(x >> 16)) * (1.0f / 65536.0f);
+}
+
+#ifdef AUDIO_DSP_SSE2
+static inline __m128i xorshift32_epi32(__m128i x) {
+  x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+  x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+  return _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+}
+
+static inline __m128 tpdf_ps(__m128i x) {
+  __m128i lo = _mm_and_si128(x, _mm_set1_epi32(0xffff));
+  __m128i hi = _mm_srli_epi32(x, 16);
+  return _mm_mul_ps(_mm_cvtepi32_ps(_mm_sub_epi32(lo, hi)),
+                    _mm_set1_ps(1.0f / 65536.0f));
+}
+#endif
+
+void audio_dsp_dither_s16(int16_t *dst, const float *src, int count,
+                          uint32_t *state) {
+  int i = 0;
+
+#ifdef AUDIO_DSP_SSE2
+  const __m128 scale = _mm_set1_ps(32768.0f);
+  const __m128 max = _mm_set1_ps(32767.0f);
+  const __m128 min = _mm_set1_ps(-32768.0f);
+  __m128i rng = state ? _mm_loadu_si128((const __m128i *)state)
+                      : _mm_setzero_si128();
+  for (; i + 8 <= count; i += 8) {
+    __m128 lo = _mm_mul_ps(_mm_loadu_ps(src + i), scale);
+    __m128 hi = _mm_mul_ps(_mm_loadu_ps(src + i + 4), scale);
+    if (state) {
+      rng = xorshift32_epi32(rng);
+      lo = _mm_add_ps(lo, tpdf_ps(rng));
+      rng = xorshift32_epi32(rng);
+      hi = _mm_add_ps(hi, tpdf_ps(rng));
+    }
+    lo = _mm_min_ps(_mm_max_ps(lo, min), max);
+    hi = _mm_min_ps(_mm_max_ps(hi, min), max);
+    _mm_storeu_si128((__m128i *)(dst + i),
+                     _mm_packs_epi32(_mm_cvtps_epi32(lo), _mm_cvtps_epi32(hi)));
+  }
+  if (state)
+    _mm_storeu_si128((__m128i *)state, rng);
+#endif
+
+  for (; i < count; i++) {
+    float x = src[i] * 32768.0f;
+    if (state) {
+      state[0] = xorshift32(state[0]);
+      x += tpdf(state[0]);
+    }
+    dst[i] = clip_s16(x);
+  }
+}
+
+void audio_dsp_dither_s32(int32_t *dst, const float *src, int count, int bits,
+                          uint32_t *state) {
+  /* 2^31 itself is not an int32; the largest float below it is */
+  const float scale = ldexpf(1.0f, bits - 1);
+  const float max = bits == 32 ? 2147483520.0f : scale - 1.0f;
+  const int shift = 32 - bits;
+  int i = 0;
+
+#ifdef AUDIO_DSP_SSE2
+  const __m128 vscale = _mm_set1_ps(scale);
+  const __m128 vmax = _mm_set1_ps(max);
+  const __m128 vmin = _mm_set1_ps(-scale);
+  __m128i rng = state ? _mm_loadu_si128((const __m128i *)state)
+                      : _mm_setzero_si128();
+  for (; i + 4 <= count; i += 4) {
+    __m128 x = _mm_mul_ps(_mm_loadu_ps(src + i), vscale);
+    if (state) {
+      rng = xorshift32_epi32(rng);
+      x = _mm_add_ps(x, tpdf_ps(rng));
+    }
+    x = _mm_min_ps(_mm_max_ps(x, vmin), vmax);
+    _mm_storeu_si128((__m128i *)(dst + i),
+                     _mm_sll_epi32(_mm_cvtps_epi32(x), _mm_cvtsi32_si128(shift)));
+  }
+  if (state)
+    _mm_storeu_si128((__m128i *)state, rng);
+#endif
+
+  for (; i < count; i++) {
+    float x = src[i] * scale;
+    if (state) {
+      state[0] = xorshift32(state[0]);
+      x += tpdf(state[0]);
+    }
+    x = x < -scale ? -scale : x > max ? max : x;
+    dst[i] = (int32_t)((uint32_t)(int32_t)lrintf(x) << shift);
+  }
+}
+
+/*
+ * The matrix kernels work in place: frame n is written to n * out_channels,
+ * which never passes the start of frame n + 1 in the input because
+ * out_channels <= in_channels, and each frame is read before it is written.
+ */
+
+void audio_dsp_matrix_flt(float *samples, int nb_samples, int in_channels,
+                          int out_channels, const float *matrix) {
+  int n = 0;
+
+#ifdef AUDIO_DSP_SSE2
+  /* Stereo to mono: deinterleave 4 frames at a time */
+  if (in_channels == 2 && out_channels == 1) {
+    const __m128 gl = _mm_set1_ps(matrix[0]);
+    const __m128 gr = _mm_set1_ps(matrix[1]);
+    for (; n + 4 <= nb_samples; n += 4) {
+      __m128 a = _mm_loadu_ps(samples + 2 * n);
+      __m128 b = _mm_loadu_ps(samples + 2 * n + 4);
+      __m128 l = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+      __m128 r = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+      _mm_storeu_ps(samples + n,
+                    _mm_add_ps(_mm_mul_ps(l, gl), _mm_mul_ps(r, gr)));
+    }
+  }
+#endif
+
+  for (; n < nb_samples; n++) {
+    float in[AUDIO_DSP_MAX_CHANNELS];
+    const float *src = samples + (int64_t)n * in_channels;
+    float *dst = samples + (int64_t)n * out_channels;
+
+    for (int c = 0; c < in_channels; c++)
+      in[c] = src[c];
+    for (int o = 0; o < out_channels; o++) {
+      const float *row = matrix + o * in_channels;
+      float sum = 0.0f;
+      for (int c = 0; c < in_channels; c++)
+        sum += row[c] * in[c];
+      dst[o] = sum;
+    }
+  }
+}
+
+void audio_dsp_matrix_s16(int16_t *samples, int nb_samples, int in_channels,
+                          int out_channels, const float *matrix) {
+  int n = 0;
+
+#ifdef AUDIO_DSP_SSE2
+  /* Stereo to mono in Q14 fixed point: one madd per 4 frames */
+  if (in_channels == 2 && out_channels == 1 && fabsf(matrix[0]) < 2.0f &&
+      fabsf(matrix[1]) < 2.0f) {
+    const int16_t ql = (int16_t)lrintf(matrix[0] * 16384.0f);
+    const int16_t qr = (int16_t)lrintf(matrix[1] * 16384.0f);
+    const __m128i coef = _mm_set_epi16(qr, ql, qr, ql, qr, ql, qr, ql);
+    const __m128i round = _mm_set1_epi32(1 << 13);
+    for (; n + 4 <= nb_samples; n += 4) {
+      __m128i x = _mm_loadu_si128((const __m128i *)(samples + 2 * n));
+      __m128i sum = _mm_add_epi32(_mm_madd_epi16(x, coef), round);
+      sum = _mm_srai_epi32(sum, 14);
+      _mm_storel_epi64((__m128i *)(samples + n), _mm_packs_epi32(sum, sum));
+    }
+  }
+#endif
+
+  for (; n < nb_samples; n++) {
+    float in[AUDIO_DSP_MAX_CHANNELS];
+    const int16_t *src = samples + (int64_t)n * in_channels;
+    int16_t *dst = samples + (int64_t)n * out_channels;
+
+    for (int c = 0; c < in_channels; c++)
+      in[c] = src[c];
+    for (int o = 0; o < out_channels; o++) {
+      const float *row = matrix + o * in_channels;
+      float sum = 0.0f;
+      for (int c = 0; c < in_channels; c++)
+        sum += row[c] * in[c];
+      dst[o] = clip_s16(sum);
+    }
+  }
+}
+
+/**
+ * @brief Scalar clipping curve, matching libavfilter's asoftclip.
+ *
+ * `x` is already divided by the threshold.
+ */
+static inline float clip_curve(float x, enum audio_dsp_clip type) {
+  switch (type) {
+  case AUDIO_DSP_CLIP_CUBIC:
+    if (fabsf(x) >= 1.5f)
+      return x > 0.0f ? 1.0f : -1.0f;
+    return x - 0.1481f * x * x * x;
+  case AUDIO_DSP_CLIP_TANH:
+    return tanhf(x);
+  case AUDIO_DSP_CLIP_HARD:
+  default:
+    return x > 1.0f ? 1.0f : (x < -1.0f ? -1.0f : x);
+  }
+}
+
+#ifdef AUDIO_DSP_SSE2
+/**
+ * @brief Vector version of clip_curve() for the hard and cubic curves.
+ */
+static inline __m128 clip_curve_ps(__m128 x, enum audio_dsp_clip type) {
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 sign = _mm_set1_ps(-0.0f);
+
+  if (type == AUDIO_DSP_CLIP_HARD)
+    return _mm_min_ps(_mm_max_ps(x, _mm_sub_ps(_mm_setzero_ps(), one)), one);
+
+  /* cubic: x - 0.1481 x^3, or sign(x) once |x| >= 1.5 */
+  __m128 x3 = _mm_mul_ps(_mm_mul_ps(x, x), x);
+  __m128 poly = _mm_sub_ps(x, _mm_mul_ps(_mm_set1_ps(0.1481f), x3));
+  __m128 sat = _mm_or_ps(_mm_and_ps(x, sign), one);
+  __m128 over = _mm_cmpge_ps(_mm_andnot_ps(sign, x), _mm_set1_ps(1.5f));
+  return _mm_or_ps(_mm_and_ps(over, sat), _mm_andnot_ps(over, poly));
+}
+#endif
+
+void audio_dsp_clip_flt(float *samples, int count, enum audio_dsp_clip type,
+                        float threshold, float output) {
+  const float factor = 1.0f / threshold;
+  const float gain = threshold * output;
+  int i = 0;
+
+#ifdef AUDIO_DSP_SSE2
+  if (type != AUDIO_DSP_CLIP_TANH) {
+    const __m128 f = _mm_set1_ps(factor);
+    const __m128 g = _mm_set1_ps(gain);
+    for (; i + 4 <= count; i += 4) {
+      __m128 x = _mm_mul_ps(_mm_loadu_ps(samples + i), f);
+      _mm_storeu_ps(samples + i, _mm_mul_ps(clip_curve_ps(x, type), g));
+    }
+  }
+#endif
+
+  for (; i < count; i++)
+    samples[i] = clip_curve(samples[i] * factor, type) * gain;
+}
+
+void audio_dsp_clip_s16(int16_t *samples, int count, enum audio_dsp_clip type,
+                        float threshold, float output) {
+  const float factor = 1.0f / (threshold * 32768.0f);
+  const float gain = threshold * output * 32768.0f;
+  int i = 0;
+
+#ifdef AUDIO_DSP_SSE2
+  if (type != AUDIO_DSP_CLIP_TANH) {
+    const __m128 f = _mm_set1_ps(factor);
+    const __m128 g = _mm_set1_ps(gain);
+    const __m128 max = _mm_set1_ps(32767.0f);
+    const __m128 min = _mm_set1_ps(-32768.0f);
+    for (; i + 8 <= count; i += 8) {
+      __m128i x = _mm_loadu_si128((const __m128i *)(samples + i));
+      __m128 lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16));
+      __m128 hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16));
+      lo = _mm_mul_ps(clip_curve_ps(_mm_mul_ps(lo, f), type), g);
+      hi = _mm_mul_ps(clip_curve_ps(_mm_mul_ps(hi, f), type), g);
+      lo = _mm_min_ps(_mm_max_ps(lo, min), max);
+      hi = _mm_min_ps(_mm_max_ps(hi, min), max);
+      _mm_storeu_si128((__m128i *)(samples + i),
+                       _mm_packs_epi32(_mm_cvtps_epi32(lo), _mm_cvtps_epi32(hi)));
+    }
+  }
+#endif
+
+  for (; i < count; i++)
+    samples[i] = clip_s16(clip_curve(samples[i] * factor, type) * gain);
+}
+
+void audio_dsp_stats_flt(const float *samples, int count, float *min,
+                         float *max, double *sumsq) {
+  float lo = *min, hi = *max;
+  double sum = 0.0;
+  int i = 0;
+
+#ifdef AUDIO_DSP_SSE2
+  if (count >= 4) {
+    __m128 vlo = _mm_set1_ps(lo);
+    __m128 vhi = _mm_set1_ps(hi);
+    __m128 vsum = _mm_setzero_ps();
+    for (; i + 4 <= count; i += 4) {
+      __m128 x = _mm_loadu_ps(samples + i);
+      vlo = _mm_min_ps(vlo, x);
+      vhi = _mm_max_ps(vhi, x);
+      vsum = _mm_add_ps(vsum, _mm_mul_ps(x, x));
+    }
+
+    float l[4], h[4], s[4];
+    _mm_storeu_ps(l, vlo);
+    _mm_storeu_ps(h, vhi);
+    _mm_storeu_ps(s, vsum);
+    for (int j = 0; j < 4; j++) {
+      lo = fminf(lo, l[j]);
+      hi = fmaxf(hi, h[j]);
+      sum += s[j];
+    }
+  }
+#endif
+
+  for (; i < count; i++) {
+    lo = fminf(lo, samples[i]);
+    hi = fmaxf(hi, samples[i]);
+    sum += (double)samples[i] * samples[i];
+  }
+
+  *min = lo;
+  *max = hi;
+  *sumsq += sum;
+}
+
+void audio_dsp_find_loud_flt(const float *samples, int count, float threshold,
+                             int *first, int *last) {
+  int i = 0, j = count;
+
+  *first = *last = -1;
+
+#ifdef AUDIO_DSP_SSE2
+  const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+  const __m128 vthr = _mm_set1_ps(threshold);
+
+  for (; i + 4 <= count; i += 4) {
+    __m128 x = _mm_and_ps(_mm_loadu_ps(samples + i), abs_mask);
+    int mask = _mm_movemask_ps(_mm_cmpgt_ps(x, vthr));
+    if (mask) {
+      *first = i + __builtin_ctz(mask);
+      break;
+    }
+  }
+#endif
+  for (; *first < 0 && i < count; i++)
+    if (fabsf(samples[i]) > threshold)
+      *first = i;
+  if (*first < 0)
+    return;
+
+  /* Scan back from the end; the first hit bounds the search */
+#ifdef AUDIO_DSP_SSE2
+  for (; j - 4 >= *first; j -= 4) {
+    __m128 x = _mm_and_ps(_mm_loadu_ps(samples + j - 4), abs_mask);
+    int mask = _mm_movemask_ps(_mm_cmpgt_ps(x, vthr));
+    if (mask) {
+      *last = j - 4 + 31 - __builtin_clz(mask);
+      return;
+    }
+  }
+#endif
+  for (; j > *first; j--) {
+    if (fabsf(samples[j - 1]) > threshold) {
+      *last = j - 1;
+      return;
+    }
+  }
+  *last = *first;
+}
+
+void audio_dsp_find_loud_s16(const int16_t *samples, int count,
+                             int16_t threshold, int *first, int *last) {
+  int i = 0, j = count;
+
+  *first = *last = -1;
+
+#ifdef AUDIO_DSP_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i vthr = _mm_set1_epi16(threshold);
+
+  /* |x| with saturation, so -32768 maps to 32767 */
+  for (; i + 8 <= count; i += 8) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(samples + i));
+    x = _mm_max_epi16(x, _mm_subs_epi16(zero, x));
+    int mask = _mm_movemask_epi8(_mm_cmpgt_epi16(x, vthr));
+    if (mask) {
+      *first = i + __builtin_ctz(mask) / 2;
+      break;
+    }
+  }
+#endif
+  for (; *first < 0 && i < count; i++)
+    if (abs(samples[i]) > threshold)
+      *first = i;
+  if (*first < 0)
+    return;
+
+#ifdef AUDIO_DSP_SSE2
+  for (; j - 8 >= *first; j -= 8) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(samples + j - 8));
+    x = _mm_max_epi16(x, _mm_subs_epi16(zero, x));
+    int mask = _mm_movemask_epi8(_mm_cmpgt_epi16(x, vthr));
+    if (mask) {
+      *last = j - 8 + (31 - __builtin_clz(mask)) / 2;
+      return;
+    }
+  }
+#endif
+  for (; j > *first; j--) {
+    if (abs(samples[j - 1]) > threshold) {
+      *last = j - 1;
+      return;
+    }
+  }
+  *last = *first;
+}
+
+#define READ_FLOAT(type, scale)                                                \
+  do {                                                                         \
+    const type *src = planar ? (const type *)frame->extended_data[c] + offset  \
+                             : (const type *)frame->data[0] +                  \
+                                   offset * channels + c;                      \
+    int step = planar ? 1 : channels;                                          \
+    for (int i = 0; i < count; i++)                                            \
+      dst[i * stride] = src[i * step] * (scale);                               \
+  } while (0)
+
+int audio_dsp_read_channel(const AVFrame *frame, int c, int offset, int count,
+                           float *dst, int stride) {
+  int channels = frame->ch_layout.nb_channels;
+  int planar = av_sample_fmt_is_planar(frame->format);
+
+  switch (av_get_packed_sample_fmt(frame->format)) {
+  case AV_SAMPLE_FMT_S16:
+    READ_FLOAT(int16_t, 1.0f / 32768.0f);
+    return 0;
+  case AV_SAMPLE_FMT_S32:
+    READ_FLOAT(int32_t, 1.0f / 2147483648.0f);
+    return 0;
+  case AV_SAMPLE_FMT_FLT:
+    READ_FLOAT(float, 1.0f);
+    return 0;
+  case AV_SAMPLE_FMT_DBL:
+    READ_FLOAT(double, 1.0);
+    return 0;
+  default:
+    return AVERROR(EINVAL);
+  }
+}
+
+int audio_dsp_read_float(const AVFrame *frame, int offset, int count,
+                         float *const *dst) {
+  int ret;
+
+  for (int c = 0; c < frame->ch_layout.nb_channels; c++)
+    if ((ret = audio_dsp_read_channel(frame, c, offset, count, dst[c], 1)) <
+        0)
+      return ret;
+  return 0;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Filter description parsing                                               */
+/* ------------------------------------------------------------------------ */
+
+/** One `key=value` option of a filter; positional values get their key. */
+struct dsp_option {
+  char key[32];
+  char value[128];
+};
+
+#define DSP_MAX_OPTIONS 8
+
+/**
+ * @brief Split "a:b:key=value" into options, naming positional values.
+ *
+ * @return Number of options, or AVERROR(ENOSYS) for anything unexpected.
+ */
+static int split_options(const char *args, const char *const *positional,
+                         struct dsp_option *opts) {
+  int nb = 0;
+  int pos = 0;
+
+  while (args && *args) {
+    const char *end = strchr(args, ':');
+    size_t len = end ? (size_t)(end - args) : strlen(args);
+    const char *eq = memchr(args, '=', len);
+
+    if (nb >= DSP_MAX_OPTIONS)
+      return AVERROR(ENOSYS);
+
+    if (eq) {
+      size_t klen = eq - args;
+      size_t vlen = len - klen - 1;
+      if (klen == 0 || klen >= sizeof(opts[nb].key) ||
+          vlen >= sizeof(opts[nb].value))
+        return AVERROR(ENOSYS);
+      memcpy(opts[nb].key, args, klen);
+      opts[nb].key[klen] = '\0';
+      memcpy(opts[nb].value, eq + 1, vlen);
+      opts[nb].value[vlen] = '\0';
+    } else {
+      if (!positional || !positional[pos] || len >= sizeof(opts[nb].value))
+        return AVERROR(ENOSYS);
+      snprintf(opts[nb].key, sizeof(opts[nb].key), "%s", positional[pos++]);
+      memcpy(opts[nb].value, args, len);
+      opts[nb].value[len] = '\0';
+    }
+
+    nb++;
+    args = end ? end + 1 : NULL;
+  }
+
+  return nb;
+}
+
+/**
+ * @brief Parse a plain number, with an optional "dB" suffix.
+ *
+ * Expressions are rejected so that they go to libavfilter.
+ */
+static int parse_number(const char *str, int allow_db, double *out) {
+  char *end;
+  double v = strtod(str, &end);
+
+  if (end == str)
+    return AVERROR(ENOSYS);
+  if (allow_db && (strcmp(end, "dB") == 0 || strcmp(end, "db") == 0)) {
+    *out = pow(10.0, v / 20.0);
+    return 0;
+  }
+  if (*end != '\0')
+    return AVERROR(ENOSYS);
+
+  *out = v;
+  return 0;
+}
+
+/** volume=<gain>[:precision=...] */
+static int parse_volume(struct audio_dsp_op *op, const char *args) {
+  static const char *const positional[] = {"volume", NULL};
+  struct dsp_option opts[DSP_MAX_OPTIONS];
+  int nb = split_options(args, positional, opts);
+  double gain = 1.0;
+
+  if (nb < 0)
+    return nb;
+
+  for (int i = 0; i < nb; i++) {
+    if (strcmp(opts[i].key, "volume") == 0) {
+      if (parse_number(opts[i].value, 1, &gain) < 0)
+        return AVERROR(ENOSYS);
+    } else if (strcmp(opts[i].key, "precision") == 0) {
+      /* Output precision does not change the result beyond rounding */
+    } else if (strcmp(opts[i].key, "eval") == 0) {
+      if (strcmp(opts[i].value, "once") != 0)
+        return AVERROR(ENOSYS);
+    } else {
+      return AVERROR(ENOSYS);
+    }
+  }
+
+  op->type = AUDIO_DSP_GAIN;
+  op->gain = (float)gain;
+  return 0;
+}
+
+/** afade=t=in|out:ss=..:ns=..:st=..:d=..:curve=tri|log */
+static int parse_afade(struct audio_dsp_op *op, const char *args,
+                       int sample_rate) {
+  static const char *const positional[] = {"type", "start_sample",
+                                           "nb_samples", NULL};
+  struct dsp_option opts[DSP_MAX_OPTIONS];
+  int nb = split_options(args, positional, opts);
+  int64_t start = 0, length = 44100;
+  int64_t start_time = -1, duration = -1;
+
+  if (nb < 0)
+    return nb;
+
+  op->type = AUDIO_DSP_FADE;
+  op->fade_in = 1;
+  op->curve = AUDIO_DSP_CURVE_TRI;
+
+  for (int i = 0; i < nb; i++) {
+    const char *k = opts[i].key;
+    const char *v = opts[i].value;
+    double num;
+
+    if (strcmp(k, "type") == 0 || strcmp(k, "t") == 0) {
+      if (strcmp(v, "in") == 0)
+        op->fade_in = 1;
+      else if (strcmp(v, "out") == 0)
+        op->fade_in = 0;
+      else
+        return AVERROR(ENOSYS);
+    } else if (strcmp(k, "start_sample") == 0 || strcmp(k, "ss") == 0) {
+      if (parse_number(v, 0, &num) < 0 || num < 0)
+        return AVERROR(ENOSYS);
+      start = (int64_t)num;
+    } else if (strcmp(k, "nb_samples") == 0 || strcmp(k, "ns") == 0) {
+      if (parse_number(v, 0, &num) < 0 || num < 1)
+        return AVERROR(ENOSYS);
+      length = (int64_t)num;
+    } else if (strcmp(k, "start_time") == 0 || strcmp(k, "st") == 0) {
+      if (av_parse_time(&start_time, v, 1) < 0 || start_time < 0)
+        return AVERROR(ENOSYS);
+    } else if (strcmp(k, "duration") == 0 || strcmp(k, "d") == 0) {
+      if (av_parse_time(&duration, v, 1) < 0 || duration < 0)
+        return AVERROR(ENOSYS);
+    } else if (strcmp(k, "curve") == 0 || strcmp(k, "c") == 0) {
+      if (strcmp(v, "tri") == 0)
+        op->curve = AUDIO_DSP_CURVE_TRI;
+      else if (strcmp(v, "log") == 0)
+        op->curve = AUDIO_DSP_CURVE_LOG;
+      else
+        return AVERROR(ENOSYS);
+    } else {
+      return AVERROR(ENOSYS);
+    }
+  }
+
+  /* Times (in microseconds) take precedence over sample counts */
+  if (start_time >= 0)
+    start = start_time * sample_rate / 1000000;
+  if (duration > 0)
+    length = duration * sample_rate / 1000000;
+
+  op->start = start;
+  op->length = length > 0 ? length : 1;
+  return 0;
+}
+
+/** asoftclip=type=hard|cubic|tanh:threshold=..:output=.. */
+static int parse_asoftclip(struct audio_dsp_op *op, const char *args) {
+  static const char *const positional[] = {"type", "threshold", "output",
+                                           NULL};
+  struct dsp_option opts[DSP_MAX_OPTIONS];
+  int nb = split_options(args, positional, opts);
+  double num;
+
+  if (nb < 0)
+    return nb;
+
+  op->type = AUDIO_DSP_CLIP;
+  op->clip = AUDIO_DSP_CLIP_TANH;
+  op->threshold = 1.0f;
+  op->output = 1.0f;
+
+  for (int i = 0; i < nb; i++) {
+    const char *k = opts[i].key;
+    const char *v = opts[i].value;
+
+    if (strcmp(k, "type") == 0) {
+      if (strcmp(v, "hard") == 0)
+        op->clip = AUDIO_DSP_CLIP_HARD;
+      else if (strcmp(v, "cubic") == 0)
+        op->clip = AUDIO_DSP_CLIP_CUBIC;
+      else if (strcmp(v, "tanh") == 0)
+        op->clip = AUDIO_DSP_CLIP_TANH;
+      else
+        return AVERROR(ENOSYS);
+    } else if (strcmp(k, "threshold") == 0) {
+      if (parse_number(v, 0, &num) < 0 || num <= 0.0)
+        return AVERROR(ENOSYS);
+      op->threshold = (float)num;
+    } else if (strcmp(k, "output") == 0) {
+      if (parse_number(v, 0, &num) < 0)
+        return AVERROR(ENOSYS);
+      op->output = (float)num;
+    } else {
+      return AVERROR(ENOSYS);
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Resolve a pan channel reference ("c1" or a name like "FL").
+ *
+ * @return Channel index, or a negative value if it does not exist.
+ */
+static int pan_channel(const char *name, size_t len,
+                       const AVChannelLayout *layout) {
+  char buf[32];
+
+  if (len == 0 || len >= sizeof(buf))
+    return -1;
+  memcpy(buf, name, len);
+  buf[len] = '\0';
+
+  if (buf[0] == 'c' && buf[1] >= '0' && buf[1] <= '9') {
+    char *end;
+    long idx = strtol(buf + 1, &end, 10);
+    if (*end != '\0' || idx < 0 || idx >= layout->nb_channels)
+      return -1;
+    return (int)idx;
+  }
+
+  enum AVChannel ch = av_channel_from_string(buf);
+  if (ch == AV_CHAN_NONE)
+    return -1;
+  return av_channel_layout_index_from_channel(layout, ch);
+}
+
+/**
+ * @brief pan=<layout>|<out>=<gain>*<in>+...|...
+ *
+ * Only output channel counts not larger than the input are supported, which
+ * covers downmixes and channel mapping.
+ */
+static int parse_pan(struct audio_dsp_op *op, const char *args,
+                     const AVChannelLayout *in_layout,
+                     AVChannelLayout *out_layout) {
+  char buf[512];
+  char *save = NULL;
+  int ret;
+
+  if (!args || strlen(args) >= sizeof(buf))
+    return AVERROR(ENOSYS);
+  snprintf(buf, sizeof(buf), "%s", args);
+
+  /* First token is the output layout */
+  char *tok = strtok_r(buf, "|", &save);
+  if (!tok)
+    return AVERROR(ENOSYS);
+  while (*tok == ' ')
+    tok++;
+
+  av_channel_layout_uninit(out_layout);
+  ret = av_channel_layout_from_string(out_layout, tok);
+  if (ret < 0)
+    return AVERROR(ENOSYS);
+
+  if (in_layout->nb_channels > AUDIO_DSP_MAX_CHANNELS ||
+      out_layout->nb_channels > in_layout->nb_channels)
+    return AVERROR(ENOSYS);
+
+  op->type = AUDIO_DSP_MATRIX;
+  op->in_channels = in_layout->nb_channels;
+  op->out_channels = out_layout->nb_channels;
+  memset(op->matrix, 0, sizeof(op->matrix));
+
+  /* Each following token defines one output channel */
+  while ((tok = strtok_r(NULL, "|", &save))) {
+    char *sep = strpbrk(tok, "=<");
+    if (!sep)
+      return AVERROR(ENOSYS);
+
+    char *name = tok;
+    while (*name == ' ')
+      name++;
+    size_t name_len = sep - name;
+    while (name_len > 0 && name[name_len - 1] == ' ')
+      name_len--;
+
+    int out = pan_channel(name, name_len, out_layout);
+    if (out < 0)
+      return AVERROR(ENOSYS);
+
+    int normalize = (*sep == '<');
+    float *row = op->matrix + out * op->in_channels;
+    const char *p = sep + 1;
+    float total = 0.0f;
+
+    /* Terms: [+|-][gain*]channel */
+    while (*p) {
+      float sign = 1.0f;
+      double gain = 1.0;
+
+      while (*p == ' ')
+        p++;
+      if (*p == '+' || *p == '-') {
+        sign = (*p == '-') ? -1.0f : 1.0f;
+        p++;
+        while (*p == ' ')
+          p++;
+      }
+
+      const char *term = p;
+      while (*p && *p != '+' && *p != '-')
+        p++;
+      size_t term_len = p - term;
+      while (term_len > 0 && term[term_len - 1] == ' ')
+        term_len--;
+
+      const char *star = memchr(term, '*', term_len);
+      if (star) {
+        char num[32];
+        size_t num_len = star - term;
+        if (num_len == 0 || num_len >= sizeof(num))
+          return AVERROR(ENOSYS);
+        memcpy(num, term, num_len);
+        num[num_len] = '\0';
+        if (parse_number(num, 0, &gain) < 0)
+          return AVERROR(ENOSYS);
+        term_len -= num_len + 1;
+        term = star + 1;
+      }
+
+      int in = pan_channel(term, term_len, in_layout);
+      if (in < 0)
+        return AVERROR(ENOSYS);
+
+      row[in] += sign * (float)gain;
+      total += sign * (float)gain;
+    }
+
+    if (normalize && total != 0.0f) {
+      for (int c = 0; c < op->in_channels; c++)
+        row[c] /= total;
+    }
+  }
+
+  return 0;
+}
+
+int audio_dsp_chain_init(struct audio_dsp_chain *chain, const char *filter_desc,
+                         int sample_rate, enum AVSampleFormat format,
+                         const AVChannelLayout *ch_layout) {
+  char desc[1024];
+  char *save = NULL;
+  int ret;
+
+  memset(chain, 0, sizeof(*chain));
+
+  if (format != AV_SAMPLE_FMT_S16 && format != AV_SAMPLE_FMT_FLT)
+    return AVERROR(ENOSYS);
+
+  /* Labels, multiple chains and escaping need the real graph parser */
+  if (!filter_desc || strlen(filter_desc) >= sizeof(desc) ||
+      strpbrk(filter_desc, "[];'\\"))
+    return AVERROR(ENOSYS);
+  snprintf(desc, sizeof(desc), "%s", filter_desc);
+
+  chain->sample_rate = sample_rate;
+  chain->format = format;
+  if ((ret = av_channel_layout_copy(&chain->in_layout, ch_layout)) < 0 ||
+      (ret = av_channel_layout_copy(&chain->out_layout, ch_layout)) < 0)
+    goto fail;
+
+  for (char *tok = strtok_r(desc, ",", &save); tok;
+       tok = strtok_r(NULL, ",", &save)) {
+    while (*tok == ' ')
+      tok++;
+
+    char *args = strchr(tok, '=');
+    if (args)
+      *args++ = '\0';
+
+    if (chain->nb_ops >= AUDIO_DSP_MAX_OPS) {
+      ret = AVERROR(ENOSYS);
+      goto fail;
+    }
+
+    struct audio_dsp_op *op = &chain->ops[chain->nb_ops];
+    memset(op, 0, sizeof(*op));
+    op->in_channels = chain->out_layout.nb_channels;
+    op->out_channels = op->in_channels;
+
+    if (strcmp(tok, "volume") == 0) {
+      ret = parse_volume(op, args);
+    } else if (strcmp(tok, "afade") == 0) {
+      ret = parse_afade(op, args, sample_rate);
+    } else if (strcmp(tok, "asoftclip") == 0) {
+      ret = parse_asoftclip(op, args);
+    } else if (strcmp(tok, "pan") == 0) {
+      AVChannelLayout layout = {0};
+      ret = parse_pan(op, args, &chain->out_layout, &layout);
+      if (ret >= 0) {
+        av_channel_layout_uninit(&chain->out_layout);
+        chain->out_layout = layout;
+      } else {
+        av_channel_layout_uninit(&layout);
+      }
+    } else if (strcmp(tok, "anull") == 0 && !args) {
+      continue;
+    } else {
+      ret = AVERROR(ENOSYS);
+    }
+
+    if (ret < 0)
+      goto fail;
+    chain->nb_ops++;
+  }
+
+  return 0;
+
+fail:
+  audio_dsp_chain_free(chain);
+  return ret;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Processing                                                               */
+/* ------------------------------------------------------------------------ */
+
+/**
+ * @brief Fade gain at `index` samples into a fade of `range` samples.
+ */
+static inline float fade_gain(enum audio_dsp_curve curve, int64_t index,
+                              int64_t range) {
+  float gain = (float)index / (float)range;
+
+  gain = gain < 0.0f ? 0.0f : (gain > 1.0f ? 1.0f : gain);
+  if (curve == AUDIO_DSP_CURVE_LOG) {
+    gain = gain > 0.0f ? 1.0f + 0.2f * log10f(gain) : 0.0f;
+    gain = gain < 0.0f ? 0.0f : gain;
+  }
+  return gain;
+}
+
+static void apply_gain(const struct audio_dsp_chain *chain, uint8_t *data,
+                       int count, float gain) {
+  if (chain->format == AV_SAMPLE_FMT_S16)
+    audio_dsp_gain_s16((int16_t *)data, count, gain);
+  else
+    audio_dsp_gain_flt((float *)data, count, gain);
+}
+
+/**
+ * @brief Apply a GAIN op, switching to a scheduled gain mid-frame if needed.
+ */
+static void apply_gain_op(const struct audio_dsp_chain *chain,
+                          struct audio_dsp_op *op, AVFrame *frame) {
+  const int channels = op->in_channels;
+  int head = 0;
+
+  if (op->has_next && op->next_at < chain->position + frame->nb_samples) {
+    head = (int)FFMAX(op->next_at - chain->position, 0);
+    if (head > 0)
+      apply_gain(chain, frame->data[0], head * channels, op->gain);
+    op->gain = op->next_gain;
+    op->has_next = 0;
+  }
+
+  apply_gain(chain, frame->data[0] +
+                        head * channels * av_get_bytes_per_sample(chain->format),
+             (frame->nb_samples - head) * channels, op->gain);
+}
+
+static int apply_fade(struct audio_dsp_chain *chain,
+                      const struct audio_dsp_op *op, AVFrame *frame) {
+  const int channels = op->in_channels;
+  const int count = frame->nb_samples * channels;
+  const int64_t first = chain->position;
+  const int64_t last = first + frame->nb_samples;
+  const int64_t fade_end = op->start + op->length;
+
+  /* Entirely before or after the fade: constant gain */
+  if (last <= op->start || first >= fade_end) {
+    int before = last <= op->start;
+    float gain = (before == op->fade_in) ? 0.0f : 1.0f;
+    if (gain != 1.0f)
+      apply_gain(chain, frame->data[0], count, gain);
+    return 0;
+  }
+
+  /* Frame overlaps the fade: expand a per-sample gain curve */
+  if (chain->scratch_size < count) {
+    float *buf = av_realloc_array(chain->scratch, count, sizeof(float));
+    if (!buf)
+      return AVERROR(ENOMEM);
+    chain->scratch = buf;
+    chain->scratch_size = count;
+  }
+
+  for (int n = 0; n < frame->nb_samples; n++) {
+    int64_t index = first + n - op->start;
+    float gain = op->fade_in ? fade_gain(op->curve, index, op->length)
+                             : fade_gain(op->curve, op->length - index,
+                                         op->length);
+    for (int c = 0; c < channels; c++)
+      chain->scratch[n * channels + c] = gain;
+  }
+
+  if (chain->format == AV_SAMPLE_FMT_S16)
+    audio_dsp_gains_s16((int16_t *)frame->data[0], chain->scratch, count);
+  else
+    audio_dsp_gains_flt((float *)frame->data[0], chain->scratch, count);
+  return 0;
+}
+
+int audio_dsp_chain_process(struct audio_dsp_chain *chain, AVFrame *frame) {
+  int ret;
+
+  for (int i = 0; i < chain->nb_ops; i++) {
+    struct audio_dsp_op *op = &chain->ops[i];
+    const int count = frame->nb_samples * op->in_channels;
+
+    switch (op->type) {
+    case AUDIO_DSP_GAIN:
+      apply_gain_op(chain, op, frame);
+      break;
+    case AUDIO_DSP_FADE:
+      if ((ret = apply_fade(chain, op, frame)) < 0)
+        return ret;
+      break;
+    case AUDIO_DSP_MATRIX:
+      if (chain->format == AV_SAMPLE_FMT_S16)
+        audio_dsp_matrix_s16((int16_t *)frame->data[0], frame->nb_samples,
+                             op->in_channels, op->out_channels, op->matrix);
+      else
+        audio_dsp_matrix_flt((float *)frame->data[0], frame->nb_samples,
+                             op->in_channels, op->out_channels, op->matrix);
+      break;
+    case AUDIO_DSP_CLIP:
+      if (chain->format == AV_SAMPLE_FMT_S16)
+        audio_dsp_clip_s16((int16_t *)frame->data[0], count, op->clip,
+                           op->threshold, op->output);
+      else
+        audio_dsp_clip_flt((float *)frame->data[0], count, op->clip,
+                           op->threshold, op->output);
+      break;
+    }
+  }
+
+  chain->position += frame->nb_samples;
+
+  /* A matrix may have changed the channel layout */
+  if (av_channel_layout_compare(&frame->ch_layout, &chain->out_layout) != 0) {
+    av_channel_layout_uninit(&frame->ch_layout);
+    ret = av_channel_layout_copy(&frame->ch_layout, &chain->out_layout);
+    if (ret < 0)
+      return ret;
+    frame->linesize[0] = frame->nb_samples * chain->out_layout.nb_channels *
+                         av_get_bytes_per_sample(chain->format);
+  }
+
+  return 0;
+}
+
+int audio_dsp_chain_command(struct audio_dsp_chain *chain, const char *target,
+                            const char *cmd, const char *arg, int64_t at) {
+  double value;
+  int found = 0;
+
+  if (!target || !cmd || strcmp(cmd, "volume") != 0 ||
+      (strcmp(target, "volume") != 0 && strcmp(target, "all") != 0))
+    return AVERROR(ENOSYS);
+  if (!arg || parse_number(arg, 1, &value) < 0)
+    return AVERROR(EINVAL);
+
+  for (int i = 0; i < chain->nb_ops; i++) {
+    struct audio_dsp_op *op = &chain->ops[i];
+    if (op->type != AUDIO_DSP_GAIN)
+      continue;
+
+    if (at < 0) {
+      op->gain = (float)value;
+      op->has_next = 0;
+    } else {
+      op->next_gain = (float)value;
+      op->next_at = at;
+      op->has_next = 1;
+    }
+    found = 1;
+  }
+
+  return found ? 0 : AVERROR(ENOSYS);
+}
+
+void audio_dsp_chain_free(struct audio_dsp_chain *chain) {
+  av_freep(&chain->scratch);
+  chain->scratch_size = 0;
+  chain->nb_ops = 0;
+  av_channel_layout_uninit(&chain->in_layout);
+  av_channel_layout_uninit(&chain->out_layout);
+}
@@ -1,4 +1,5 @@
 #include "../include/audio_enc.h"
+#include <libavutil/time.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -61,49 +62,129 @@ static int get_compression_level(enum audio_quality quality) {
   return levels[quality];
 }
 
-int audio_enc_init(struct audio_enc *encoder, const char *filename,
-                   const char *codec_name, int sample_rate,
-                   const AVChannelLayout *ch_layout, enum audio_quality quality,
-                   const char *bitrate_str) {
-  int ret;
+/**
+ * @brief Find the encoder, preferring low-delay implementations.
+ *
+ * In low-latency mode, "aac" maps to libfdk_aac (which provides AAC-LD and
+ * AAC-ELD) when FFmpeg was built with it; the native encoder only does
+ * AAC-LC with 1024-sample frames.
+ */
+static const AVCodec *find_encoder(const char *codec_name, int flags) {
+  if ((flags & AUDIO_ENC_LOW_LATENCY) && strcmp(codec_name, "aac") == 0) {
+    const AVCodec *fdk = avcodec_find_encoder_by_name("libfdk_aac");
+    if (fdk)
+      return fdk;
+    fprintf(stderr, "Warning: AAC-LD/ELD needs libfdk_aac, "
+                    "using the native AAC-LC encoder\n");
+  }
+  return avcodec_find_encoder_by_name(codec_name);
+}
 
-  if (!encoder || !filename || !codec_name || !ch_layout) {
-    fprintf(stderr, "Invalid parameters to audio_enc_init\n");
-    return AVERROR(EINVAL);
+/**
+ * @brief Configure codec options for low-delay encoding.
+ */
+static void set_low_latency_options(struct audio_enc *encoder,
+                                    double frame_ms) {
+  AVCodecContext *ctx = encoder->codec_ctx;
+
+  ctx->flags |= AV_CODEC_FLAG_LOW_DELAY;
+
+  if (strcmp(encoder->codec->name, "libopus") == 0) {
+    av_opt_set(ctx, "application", "lowdelay", AV_OPT_SEARCH_CHILDREN);
+    av_opt_set_double(ctx, "frame_duration", frame_ms > 0 ? frame_ms : 5.0,
+                      AV_OPT_SEARCH_CHILDREN);
+  } else if (strcmp(encoder->codec->name, "libfdk_aac") == 0) {
+    /* ELD has the lowest delay and keeps quality up with SBR */
+    ctx->profile = AV_PROFILE_AAC_ELD;
   }
+}
 
-  /* Initialize all fields to zero */
-  memset(encoder, 0, sizeof(*encoder));
+/**
+ * @brief Default container for network URLs, which have no file extension.
+ *
+ * @return Format name, or NULL to let FFmpeg guess from the filename.
+ */
+static const char *guess_network_format(const char *filename) {
+  if (strncmp(filename, "rtp://", 6) == 0)
+    return "rtp";
+  if (strncmp(filename, "udp://", 6) == 0 ||
+      strncmp(filename, "tcp://", 6) == 0)
+    return "mpegts";
+  return NULL;
+}
 
-  /* Allocate output format context based on filename */
-  ret = avformat_alloc_output_context2(&encoder->fmt_ctx, NULL, NULL, filename);
-  if (ret < 0) {
-    logerr("Failed to allocate output context", ret);
-    return ret;
+/**
+ * @brief Remember when the input of the frame starting at `in_samples` was
+ *        decoded: the time stamped in `frame->opaque` by the caller, or now.
+ */
+static void record_arrival(struct audio_enc *encoder, const AVFrame *frame) {
+  int slot = encoder->nb_arrivals % AUDIO_ENC_LATENCY_SLOTS;
+
+  encoder->arrival_pos[slot] = encoder->in_samples;
+  encoder->arrival_time[slot] =
+      frame->opaque ? (int64_t)(intptr_t)frame->opaque : av_gettime_relative();
+  encoder->nb_arrivals++;
+  encoder->in_samples += av_rescale(
+      frame->nb_samples, encoder->codec_ctx->sample_rate, frame->sample_rate);
+}
+
+/**
+ * @brief Account the latency of a packet starting at sample `pos`.
+ */
+static void record_latency(struct audio_enc *encoder, int64_t pos) {
+  int64_t count = FFMIN(encoder->nb_arrivals, AUDIO_ENC_LATENCY_SLOTS);
+  int64_t arrival = -1;
+
+  if (count == 0)
+    return;
+
+  /* Newest frame that starts at or before the packet's first sample; fall
+   * back to the oldest remembered one */
+  for (int64_t n = encoder->nb_arrivals - 1;
+       n >= encoder->nb_arrivals - count; n--) {
+    int slot = n % AUDIO_ENC_LATENCY_SLOTS;
+    arrival = encoder->arrival_time[slot];
+    if (encoder->arrival_pos[slot] <= pos)
+      break;
   }
 
+  encoder->latency_last = av_gettime_relative() - arrival;
+  encoder->latency_max = FFMAX(encoder->latency_max, encoder->latency_last);
+  encoder->latency_sum += encoder->latency_last;
+  encoder->latency_count++;
+}
+
+/**
+ * @brief Add the audio stream to `encoder->fmt_ctx` and open the codec.
+ *
+ * The container must already be allocated: its flags decide whether the
+ * codec writes global headers.
+ */
+static int open_codec(struct audio_enc *encoder, const char *codec_name,
+                      int sample_rate, const AVChannelLayout *ch_layout,
+                      enum audio_quality quality, const char *bitrate_str,
+                      int flags, double frame_ms) {
+  int ret;
+
   /* Find the encoder codec */
-  encoder->codec = avcodec_find_encoder_by_name(codec_name);
+  encoder->codec = find_encoder(codec_name, flags);
   if (!encoder->codec) {
     fprintf(stderr, "Codec '%s' not found\n", codec_name);
-    ret = AVERROR_ENCODER_NOT_FOUND;
-    goto fail;
+    return AVERROR_ENCODER_NOT_FOUND;
   }
 
   /* Create a new audio stream in the output file */
   encoder->stream = avformat_new_stream(encoder->fmt_ctx, NULL);
   if (!encoder->stream) {
     fprintf(stderr, "Failed to create output stream\n");
-    ret = AVERROR(ENOMEM);
-    goto fail;
+    return AVERROR(ENOMEM);
   }
 
   /* Allocate encoder context */
   encoder->codec_ctx = avcodec_alloc_context3(encoder->codec);
   if (!encoder->codec_ctx) {
     fprintf(stderr, "Failed to allocate encoder context\n");
-    ret = AVERROR(ENOMEM);
-    goto fail;
+    return AVERROR(ENOMEM);
   }
 
   /* Set encoder parameters */
@@ -111,7 +192,7 @@ int audio_enc_init(struct audio_enc *encoder, const char *filename,
   ret = av_channel_layout_copy(&encoder->codec_ctx->ch_layout, ch_layout);
   if (ret < 0) {
     logerr("Failed to copy channel layout", ret);
-    goto fail;
+    return ret;
   }
 
   /* Select sample format supported by the encoder (using modern API) */
@@ -126,6 +207,31 @@ int audio_enc_init(struct audio_enc *encoder, const char *filename,
     encoder->codec_ctx->sample_fmt = AV_SAMPLE_FMT_S16;
   }
 
+  /* High bit depths: only lossless codecs keep them */
+  if (flags & (AUDIO_ENC_S32_24 | AUDIO_ENC_S32 | AUDIO_ENC_FLT)) {
+    const AVCodecDescriptor *desc = avcodec_descriptor_get(encoder->codec->id);
+    enum AVSampleFormat want =
+        flags & AUDIO_ENC_FLT ? AV_SAMPLE_FMT_FLT : AV_SAMPLE_FMT_S32;
+    int found = 0;
+
+    for (int i = 0; i < num_fmts && !found; i++) {
+      if (av_get_packed_sample_fmt(sample_fmts[i]) == want) {
+        encoder->codec_ctx->sample_fmt = sample_fmts[i];
+        found = 1;
+      }
+    }
+    if (!found || !desc || !(desc->props & AV_CODEC_PROP_LOSSLESS)) {
+      fprintf(stderr, "Codec '%s' cannot store %s samples losslessly\n",
+              encoder->codec->name,
+              flags & AUDIO_ENC_FLT      ? "float"
+              : flags & AUDIO_ENC_S32_24 ? "24-bit"
+                                         : "32-bit");
+      return AVERROR(EINVAL);
+    }
+    if (flags & AUDIO_ENC_S32_24)
+      encoder->codec_ctx->bits_per_raw_sample = 24;
+  }
+
   /* Set bitrate or compression level */
   if (bitrate_str) {
     /* Parse explicit bitrate string (e.g., "192k") */
@@ -135,16 +241,14 @@ int audio_enc_init(struct audio_enc *encoder, const char *filename,
 
     if (errno == ERANGE || bitrate < 0) {
       fprintf(stderr, "Invalid bitrate value: %s\n", bitrate_str);
-      ret = AVERROR(EINVAL);
-      goto fail;
+      return AVERROR(EINVAL);
     }
 
     if (*endptr == 'k' || *endptr == 'K') {
       /* Check for overflow before multiplication */
       if (bitrate > INT64_MAX / 1000) {
         fprintf(stderr, "Bitrate value too large: %s\n", bitrate_str);
-        ret = AVERROR(EINVAL);
-        goto fail;
+        return AVERROR(EINVAL);
       }
       bitrate *= 1000;
     }
@@ -166,6 +270,13 @@ int audio_enc_init(struct audio_enc *encoder, const char *filename,
   encoder->codec_ctx->time_base = (AVRational){1, sample_rate};
   encoder->stream->time_base = encoder->codec_ctx->time_base;
 
+  if (flags & AUDIO_ENC_LOW_LATENCY) {
+    set_low_latency_options(encoder, frame_ms);
+  } else if (frame_ms > 0 && strcmp(encoder->codec->name, "libopus") == 0) {
+    av_opt_set_double(encoder->codec_ctx, "frame_duration", frame_ms,
+                      AV_OPT_SEARCH_CHILDREN);
+  }
+
   /* Some formats require global headers */
   if (encoder->fmt_ctx->oformat->flags & AVFMT_GLOBALHEADER)
     encoder->codec_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
@@ -174,7 +285,7 @@ int audio_enc_init(struct audio_enc *encoder, const char *filename,
   ret = avcodec_open2(encoder->codec_ctx, encoder->codec, NULL);
   if (ret < 0) {
     logerr("Failed to open encoder", ret);
-    goto fail;
+    return ret;
   }
 
   /* Copy encoder parameters to output stream */
@@ -182,31 +293,24 @@ int audio_enc_init(struct audio_enc *encoder, const char *filename,
                                         encoder->codec_ctx);
   if (ret < 0) {
     logerr("Failed to copy encoder parameters to stream", ret);
-    goto fail;
-  }
-
-  /* Open the output file */
-  if (!(encoder->fmt_ctx->oformat->flags & AVFMT_NOFILE)) {
-    ret = avio_open(&encoder->fmt_ctx->pb, filename, AVIO_FLAG_WRITE);
-    if (ret < 0) {
-      logerr("Failed to open output file", ret);
-      goto fail;
-    }
+    return ret;
   }
+  return 0;
+}
 
-  /* Write the stream header */
-  ret = avformat_write_header(encoder->fmt_ctx, NULL);
-  if (ret < 0) {
-    logerr("Failed to write format header", ret);
-    goto fail;
-  }
+/**
+ * @brief Allocate the packet, FIFO and resampler used while encoding.
+ */
+static int open_buffers(struct audio_enc *encoder,
+                        enum audio_resample_quality resample_quality,
+                        int flags) {
+  int ret;
 
   /* Allocate packet for encoded data */
   encoder->pkt = av_packet_alloc();
   if (!encoder->pkt) {
     fprintf(stderr, "Failed to allocate packet\n");
-    ret = AVERROR(ENOMEM);
-    goto fail;
+    return AVERROR(ENOMEM);
   }
 
   /* Allocate audio FIFO buffer for frame size management */
@@ -215,16 +319,14 @@ int audio_enc_init(struct audio_enc *encoder, const char *filename,
                                        encoder->codec_ctx->frame_size);
   if (!encoder->fifo) {
     fprintf(stderr, "Failed to allocate audio FIFO\n");
-    ret = AVERROR(ENOMEM);
-    goto fail;
+    return AVERROR(ENOMEM);
   }
 
   /* Initialize resampler for format conversion (input will be S16, might need conversion) */
   encoder->swr_ctx = swr_alloc();
   if (!encoder->swr_ctx) {
     fprintf(stderr, "Failed to allocate SwrContext\n");
-    ret = AVERROR(ENOMEM);
-    goto fail;
+    return AVERROR(ENOMEM);
   }
 
   /* Configure resampler - we'll set input format dynamically when we receive the first frame */
@@ -235,17 +337,111 @@ int audio_enc_init(struct audio_enc *encoder, const char *filename,
       (ret = av_opt_set_sample_fmt(encoder->swr_ctx, "out_sample_fmt",
                                     encoder->codec_ctx->sample_fmt, 0)) < 0) {
     logerr("Failed to configure output SwrContext parameters", ret);
-    goto fail;
+    return ret;
   }
 
+  encoder->resample_quality = resample_quality;
+  encoder->flags = flags;
+  encoder->direct = -1;
+  encoder->min_pts = INT64_MIN;
+  if (flags & AUDIO_ENC_REALTIME)
+    audio_pacer_init(&encoder->pacer, 0, 0);
   encoder->pts = 0;
   return 0;
+}
+
+int audio_enc_init(struct audio_enc *encoder, const char *filename,
+                   const char *format_name, const char *codec_name,
+                   int sample_rate,
+                   const AVChannelLayout *ch_layout, enum audio_quality quality,
+                   const char *bitrate_str,
+                   enum audio_resample_quality resample_quality, int flags,
+                   double frame_ms) {
+  int ret;
+
+  if (!encoder || !filename || !codec_name || !ch_layout) {
+    fprintf(stderr, "Invalid parameters to audio_enc_init\n");
+    return AVERROR(EINVAL);
+  }
+
+  /* Initialize all fields to zero */
+  memset(encoder, 0, sizeof(*encoder));
+
+  /* Allocate output format context based on format name or filename */
+  if (!format_name)
+    format_name = guess_network_format(filename);
+  ret = avformat_alloc_output_context2(&encoder->fmt_ctx, NULL, format_name,
+                                       filename);
+  if (ret < 0) {
+    logerr("Failed to allocate output context", ret);
+    return ret;
+  }
+
+  ret = open_codec(encoder, codec_name, sample_rate, ch_layout, quality,
+                   bitrate_str, flags, frame_ms);
+  if (ret < 0)
+    goto fail;
+
+  /* Open the output file */
+  if (!(encoder->fmt_ctx->oformat->flags & AVFMT_NOFILE)) {
+    ret = avio_open(&encoder->fmt_ctx->pb, filename, AVIO_FLAG_WRITE);
+    if (ret < 0) {
+      logerr("Failed to open output file", ret);
+      goto fail;
+    }
+  }
+
+  /* Low latency and real time: hand every packet to the output as soon as
+   * it is written */
+  if (flags & (AUDIO_ENC_LOW_LATENCY | AUDIO_ENC_REALTIME)) {
+    encoder->fmt_ctx->flags |= AVFMT_FLAG_FLUSH_PACKETS;
+    encoder->fmt_ctx->flush_packets = 1;
+    encoder->fmt_ctx->max_delay = 0;
+  }
+
+  /* Write the stream header */
+  ret = avformat_write_header(encoder->fmt_ctx, NULL);
+  if (ret < 0) {
+    logerr("Failed to write format header", ret);
+    goto fail;
+  }
+
+  ret = open_buffers(encoder, resample_quality, flags);
+  if (ret < 0)
+    goto fail;
+  return 0;
 
 fail:
   audio_enc_free(encoder);
   return ret;
 }
 
+int audio_enc_init_shared(struct audio_enc *encoder, AVFormatContext *fmt_ctx,
+                          const char *codec_name, int sample_rate,
+                          const AVChannelLayout *ch_layout,
+                          enum audio_quality quality, const char *bitrate_str,
+                          enum audio_resample_quality resample_quality,
+                          double frame_ms) {
+  int ret;
+
+  if (!encoder || !fmt_ctx || !codec_name || !ch_layout) {
+    fprintf(stderr, "Invalid parameters to audio_enc_init_shared\n");
+    return AVERROR(EINVAL);
+  }
+
+  memset(encoder, 0, sizeof(*encoder));
+  encoder->fmt_ctx = fmt_ctx;
+  encoder->shared = 1;
+
+  ret = open_codec(encoder, codec_name, sample_rate, ch_layout, quality,
+                   bitrate_str, 0, frame_ms);
+  if (ret >= 0)
+    ret = open_buffers(encoder, resample_quality, 0);
+  if (ret < 0)
+    audio_enc_free(encoder);
+  return ret;
+}
+
 /**
  * @brief Helper function to encode a single frame from properly sized data.
  *
@@ -279,25 +475,63 @@ static int encode_frame(struct audio_enc *encoder, AVFrame *frame) {
       return ret;
     }
 
-    /* Set packet stream index and rescale timestamps */
-    encoder->pkt->stream_index = encoder->stream->index;
-    av_packet_rescale_ts(encoder->pkt, encoder->codec_ctx->time_base,
-                         encoder->stream->time_base);
+    /* Packet pts still counts samples here; codec delay makes the first
+     * ones negative */
+    int64_t pkt_pos = FFMAX(encoder->pkt->pts, 0);
 
-    /* Write the compressed packet to the output file */
-    ret = av_interleaved_write_frame(encoder->fmt_ctx, encoder->pkt);
-    if (ret < 0) {
-      logerr("Error writing packet to output file", ret);
+    /* Priming output requested to be dropped */
+    if (encoder->pkt->pts < encoder->min_pts) {
       av_packet_unref(encoder->pkt);
-      return ret;
+      continue;
     }
 
-    av_packet_unref(encoder->pkt);
+    /* Real time: hold the packet until its presentation time */
+    if (encoder->flags & AUDIO_ENC_REALTIME)
+      audio_pacer_wait(&encoder->pacer,
+                       av_rescale_q(encoder->pkt->pts,
+                                    encoder->codec_ctx->time_base,
+                                    AV_TIME_BASE_Q));
+
+    /* Journaled output: the packet is muxed later */
+    if (encoder->packet_sink) {
+      ret = encoder->packet_sink(encoder->sink_opaque, encoder->pkt);
+      av_packet_unref(encoder->pkt);
+      if (ret < 0)
+        return ret;
+      continue;
+    }
+
+    ret = audio_enc_write_packet(encoder, encoder->pkt);
+    if (ret < 0)
+      return ret;
+    if (encoder->flags & AUDIO_ENC_LOW_LATENCY)
+      record_latency(encoder, pkt_pos);
   }
 
   return 0;
 }
 
+int audio_enc_write_packet(struct audio_enc *encoder, AVPacket *pkt) {
+  int ret;
+
+  /* Set packet stream index and rescale timestamps */
+  pkt->stream_index = encoder->stream->index;
+  av_packet_rescale_ts(pkt, encoder->codec_ctx->time_base,
+                       encoder->stream->time_base);
+
+  /* Write the compressed packet to the output file. With a single stream
+   * there is nothing to interleave, so low-latency mode skips the
+   * interleaving queue */
+  if (encoder->flags & (AUDIO_ENC_LOW_LATENCY | AUDIO_ENC_REALTIME))
+    ret = av_write_frame(encoder->fmt_ctx, pkt);
+  else
+    ret = av_interleaved_write_frame(encoder->fmt_ctx, pkt);
+  av_packet_unref(pkt);
+  if (ret < 0)
+    logerr("Error writing packet to output file", ret);
+  return ret;
+}
+
 /**
  * @brief Read samples from FIFO and encode frames of correct size.
  *
@@ -309,8 +543,12 @@ static int encode_from_fifo(struct audio_enc *encoder, int finish) {
   int ret;
   int frame_size = encoder->codec_ctx->frame_size;
 
+  /* Encoders without a fixed frame size (e.g., PCM) take any amount */
+  if (frame_size <= 0)
+    frame_size = av_audio_fifo_size(encoder->fifo);
+
   /* Encode all complete frames in the FIFO */
-  while (av_audio_fifo_size(encoder->fifo) >= frame_size ||
+  while ((frame_size > 0 && av_audio_fifo_size(encoder->fifo) >= frame_size) ||
          (finish && av_audio_fifo_size(encoder->fifo) > 0)) {
 
     int samples_to_read = av_audio_fifo_size(encoder->fifo);
@@ -366,6 +604,36 @@ int audio_enc_write_frame(struct audio_enc *encoder, AVFrame *frame) {
   }
 
   if (frame) {
+    if (encoder->flags & AUDIO_ENC_LOW_LATENCY)
+      record_arrival(encoder, frame);
+
+    /* On the first frame, check whether input already matches the encoder */
+    if (encoder->direct < 0) {
+      encoder->direct =
+          frame->format == encoder->codec_ctx->sample_fmt &&
+          frame->sample_rate == encoder->codec_ctx->sample_rate &&
+          av_channel_layout_compare(&frame->ch_layout,
+                                    &encoder->codec_ctx->ch_layout) == 0;
+    }
+
+    if (encoder->direct) {
+      int frame_size = encoder->codec_ctx->frame_size;
+
+      /* Correctly sized frame and nothing queued: encode it as is */
+      if (av_audio_fifo_size(encoder->fifo) == 0 &&
+          (frame_size <= 0 || frame->nb_samples == frame_size))
+        return encode_frame(encoder, frame);
+
+      /* Otherwise only re-chunk through the FIFO, without conversion */
+      ret = av_audio_fifo_write(encoder->fifo, (void **)frame->data,
+                                frame->nb_samples);
+      if (ret < frame->nb_samples) {
+        fprintf(stderr, "Failed to write samples to FIFO\n");
+        return AVERROR(ENOMEM);
+      }
+      return encode_from_fifo(encoder, 0);
+    }
+
     /* Initialize SwrContext with input format on first frame */
     if (!swr_is_initialized(encoder->swr_ctx)) {
       if ((ret = av_opt_set_chlayout(encoder->swr_ctx, "in_chlayout",
@@ -378,7 +646,7 @@ int audio_enc_write_frame(struct audio_enc *encoder, AVFrame *frame) {
         return ret;
       }
 
-      ret = swr_init(encoder->swr_ctx);
+      ret = audio_resample_init(encoder->swr_ctx, encoder->resample_quality);
       if (ret < 0) {
         logerr("Failed to initialize SwrContext", ret);
         return ret;
@@ -434,6 +702,32 @@ int audio_enc_write_frame(struct audio_enc *encoder, AVFrame *frame) {
   }
 }
 
+int audio_enc_write_sdp(struct audio_enc *encoder, const char *path) {
+  char sdp[4096];
+  int ret;
+
+  ret = av_sdp_create(&encoder->fmt_ctx, 1, sdp, sizeof(sdp));
+  if (ret < 0) {
+    logerr("Failed to create SDP", ret);
+    return ret;
+  }
+
+  if (!path) {
+    printf("SDP:\n%s\n", sdp);
+    return 0;
+  }
+
+  FILE *file = fopen(path, "w");
+  if (!file) {
+    ret = AVERROR(errno);
+    logerr("Failed to open SDP file", ret);
+    return ret;
+  }
+  fprintf(file, "%s\n", sdp);
+  fclose(file);
+  return 0;
+}
+
 int audio_enc_finalize(struct audio_enc *encoder) {
   int ret;
 
@@ -463,8 +757,9 @@ void audio_enc_free(struct audio_enc *encoder) {
   if (!encoder)
     return;
 
-  /* Close output file */
-  if (encoder->fmt_ctx && !(encoder->fmt_ctx->oformat->flags & AVFMT_NOFILE)) {
+  /* Close output file; a shared container belongs to the caller */
+  if (encoder->fmt_ctx && !encoder->shared &&
+      !(encoder->fmt_ctx->oformat->flags & AVFMT_NOFILE)) {
     avio_closep(&encoder->fmt_ctx->pb);
   }
 
@@ -485,7 +780,7 @@ void audio_enc_free(struct audio_enc *encoder) {
     avcodec_free_context(&encoder->codec_ctx);
 
   /* Free format context */
-  if (encoder->fmt_ctx)
+  if (encoder->fmt_ctx && !encoder->shared)
     avformat_free_context(encoder->fmt_ctx);
 
   memset(encoder, 0, sizeof(*encoder));
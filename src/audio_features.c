@@ -0,0 +1,409 @@
+#include "../include/audio_features.h"
+#include <libavutil/channel_layout.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Total .npy header size; a multiple of 64 so the data is aligned */
+#define NPY_HEADER_SIZE 128
+
+static double hz_to_mel(double hz) { return 2595.0 * log10(1.0 + hz / 700.0); }
+
+static double mel_to_hz(double mel) {
+  return 700.0 * (pow(10.0, mel / 2595.0) - 1.0);
+}
+
+/**
+ * @brief Write the .npy header for the frames written so far.
+ */
+static int write_header(struct audio_features *feat) {
+  const union {
+    uint16_t value;
+    uint8_t bytes[2];
+  } order = {1};
+  char header[NPY_HEADER_SIZE];
+  int len;
+
+  memset(header, ' ', sizeof(header));
+  memcpy(header, "\x93NUMPY\x01\x00", 8);
+  header[8] = (NPY_HEADER_SIZE - 10) & 0xff;
+  header[9] = (NPY_HEADER_SIZE - 10) >> 8;
+  len = snprintf(header + 10, NPY_HEADER_SIZE - 10,
+                 "{'descr': '%cf4', 'fortran_order': False, "
+                 "'shape': (%lld, %d), }",
+                 order.bytes[0] ? '<' : '>', (long long)feat->frames,
+                 feat->config.n_mels);
+  if (len < 0 || len >= NPY_HEADER_SIZE - 11)
+    return AVERROR(EINVAL);
+  header[10 + len] = ' ';
+  header[NPY_HEADER_SIZE - 1] = '\n';
+
+  if (fseek(feat->file, 0, SEEK_SET) != 0 ||
+      fwrite(header, 1, sizeof(header), feat->file) != sizeof(header))
+    return AVERROR(EIO);
+  return fseek(feat->file, 0, SEEK_END) == 0 ? 0 : AVERROR(EIO);
+}
+
+/**
+ * @brief Compute the HTK mel filterbank over the FFT bins.
+ */
+static int init_mel_filters(struct audio_features *feat) {
+  int n_mels = feat->config.n_mels;
+  double bin_hz = (double)feat->config.sample_rate / feat->n_fft;
+  double mel_max = hz_to_mel(feat->config.sample_rate / 2.0);
+  int total = 0;
+
+  feat->mel_start = av_calloc(n_mels, sizeof(int));
+  feat->mel_len = av_calloc(n_mels, sizeof(int));
+  feat->mel_offset = av_calloc(n_mels, sizeof(int));
+  if (!feat->mel_start || !feat->mel_len || !feat->mel_offset)
+    return AVERROR(ENOMEM);
+
+  /* Bins strictly inside each triangle */
+  for (int m = 0; m < n_mels; m++) {
+    double lo = mel_to_hz(mel_max * m / (n_mels + 1));
+    double hi = mel_to_hz(mel_max * (m + 2) / (n_mels + 1));
+    int start = (int)floor(lo / bin_hz) + 1;
+    int end = (int)ceil(hi / bin_hz) - 1;
+    if (end >= feat->nb_bins)
+      end = feat->nb_bins - 1;
+    feat->mel_start[m] = start;
+    feat->mel_len[m] = end >= start ? end - start + 1 : 0;
+    feat->mel_offset[m] = total;
+    total += feat->mel_len[m];
+  }
+
+  feat->mel_weights = av_malloc_array(total ? total : 1, sizeof(float));
+  if (!feat->mel_weights)
+    return AVERROR(ENOMEM);
+
+  for (int m = 0; m < n_mels; m++) {
+    double lo = mel_to_hz(mel_max * m / (n_mels + 1));
+    double center = mel_to_hz(mel_max * (m + 1) / (n_mels + 1));
+    double hi = mel_to_hz(mel_max * (m + 2) / (n_mels + 1));
+    float *w = feat->mel_weights + feat->mel_offset[m];
+    for (int i = 0; i < feat->mel_len[m]; i++) {
+      double f = (feat->mel_start[m] + i) * bin_hz;
+      double up = (f - lo) / (center - lo);
+      double down = (hi - f) / (hi - center);
+      w[i] = (float)fmax(0.0, fmin(up, down));
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief Pool job: log-mel energies of a range of frames of the block.
+ */
+static void features_job(void *arg) {
+  struct audio_features_job *job = arg;
+  struct audio_features *feat = job->feat;
+  const struct audio_features_config *config = &feat->config;
+
+  for (int f = job->first; f < job->first + job->count; f++) {
+    const float *x = feat->pending + (int64_t)f * config->hop;
+    float *out = feat->output + (int64_t)f * config->n_mels;
+
+    for (int i = 0; i < config->window; i++)
+      job->fft_in[i] = x[i] * feat->window[i];
+    memset(job->fft_in + config->window, 0,
+           (feat->n_fft - config->window) * sizeof(float));
+    job->tx_fn(job->tx, job->fft_out, job->fft_in, sizeof(float));
+
+    for (int b = 0; b < feat->nb_bins; b++)
+      job->power[b] = job->fft_out[b].re * job->fft_out[b].re +
+                      job->fft_out[b].im * job->fft_out[b].im;
+
+    for (int m = 0; m < config->n_mels; m++) {
+      const float *w = feat->mel_weights + feat->mel_offset[m];
+      const float *p = job->power + feat->mel_start[m];
+      float sum = 0.0f;
+      for (int i = 0; i < feat->mel_len[m]; i++)
+        sum += w[i] * p[i];
+      out[m] = logf(fmaxf(sum, AUDIO_FEATURES_FLOOR));
+    }
+  }
+}
+
+/**
+ * @brief Compute the first `nb_frames` frames of the pending samples on the
+ *        pool and append them to the file.
+ */
+static int run_block(struct audio_features *feat, int nb_frames) {
+  int ret = 0;
+
+  for (int j = 0; j < feat->nb_jobs; j++) {
+    struct audio_features_job *job = &feat->jobs[j];
+    job->first = j * AUDIO_FEATURES_BATCH;
+    job->count = nb_frames - job->first;
+    if (job->count <= 0)
+      break;
+    if (job->count > AUDIO_FEATURES_BATCH)
+      job->count = AUDIO_FEATURES_BATCH;
+    if ((ret = audio_pool_submit(&feat->pool, features_job, job)) < 0)
+      break;
+  }
+  audio_pool_wait(&feat->pool);
+  if (ret < 0)
+    return ret;
+
+  size_t count = (size_t)nb_frames * feat->config.n_mels;
+  if (fwrite(feat->output, sizeof(float), count, feat->file) != count)
+    return AVERROR(EIO);
+  feat->frames += nb_frames;
+  return 0;
+}
+
+/**
+ * @brief Add mono samples at the analysis rate, running every full block.
+ */
+static int feed(struct audio_features *feat, const float *samples,
+                int count) {
+  int block_frames = feat->nb_jobs * AUDIO_FEATURES_BATCH;
+  int advance = block_frames * feat->config.hop;
+  int ret;
+
+  while (count > 0) {
+    int n = feat->block_samples - feat->nb_pending;
+    if (n > count)
+      n = count;
+    memcpy(feat->pending + feat->nb_pending, samples, n * sizeof(float));
+    feat->nb_pending += n;
+    samples += n;
+    count -= n;
+
+    if (feat->nb_pending == feat->block_samples) {
+      if ((ret = run_block(feat, block_frames)) < 0)
+        return ret;
+      feat->nb_pending -= advance;
+      memmove(feat->pending, feat->pending + advance,
+              feat->nb_pending * sizeof(float));
+      feat->covered = feat->config.window - feat->config.hop;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief Resample a frame (or drain the resampler with NULL) and feed it.
+ *
+ * @return Number of resampled samples, or negative AVERROR code on failure.
+ */
+static int resample(struct audio_features *feat, const AVFrame *frame) {
+  int in_count = frame ? frame->nb_samples : 0;
+  int capacity = swr_get_out_samples(feat->swr, in_count);
+  int ret;
+
+  if (capacity <= 0)
+    return capacity;
+  av_fast_malloc(&feat->scratch, &feat->scratch_size,
+                 (size_t)capacity * sizeof(float));
+  if (!feat->scratch)
+    return AVERROR(ENOMEM);
+
+  ret = swr_convert(feat->swr, (uint8_t **)&feat->scratch, capacity,
+                    frame ? (const uint8_t **)frame->extended_data : NULL,
+                    in_count);
+  if (ret > 0) {
+    int err = feed(feat, feat->scratch, ret);
+    if (err < 0)
+      return err;
+  }
+  return ret;
+}
+
+void audio_features_config_default(struct audio_features_config *config) {
+  config->sample_rate = AUDIO_FEATURES_RATE;
+  config->window = AUDIO_FEATURES_WINDOW;
+  config->hop = AUDIO_FEATURES_HOP;
+  config->n_mels = AUDIO_FEATURES_MELS;
+}
+
+int audio_features_config_parse(struct audio_features_config *config,
+                                const char *str) {
+  while (*str) {
+    const char *eq = strchr(str, '=');
+    char *end;
+    int *field;
+
+    if (!eq)
+      return AVERROR(EINVAL);
+    if (eq - str == 4 && strncmp(str, "rate", 4) == 0)
+      field = &config->sample_rate;
+    else if (eq - str == 6 && strncmp(str, "window", 6) == 0)
+      field = &config->window;
+    else if (eq - str == 3 && strncmp(str, "hop", 3) == 0)
+      field = &config->hop;
+    else if (eq - str == 4 && strncmp(str, "mels", 4) == 0)
+      field = &config->n_mels;
+    else
+      return AVERROR(EINVAL);
+
+    long value = strtol(eq + 1, &end, 10);
+    if (end == eq + 1 || (*end != ',' && *end != '\0') || value <= 0 ||
+        value > 1 << 20)
+      return AVERROR(EINVAL);
+    *field = (int)value;
+    str = *end == ',' ? end + 1 : end;
+  }
+
+  if (config->sample_rate < 1000 || config->window < 16 ||
+      config->window > 1 << 16 || config->hop > config->window ||
+      config->n_mels > 1024)
+    return AVERROR(EINVAL);
+  return 0;
+}
+
+int audio_features_init(struct audio_features *feat, const char *path,
+                        const struct audio_features_config *config,
+                        int nb_threads) {
+  const float scale = 1.0f;
+  int ret;
+
+  memset(feat, 0, sizeof(*feat));
+  feat->config = *config;
+  feat->n_fft = 1;
+  while (feat->n_fft < config->window)
+    feat->n_fft <<= 1;
+  feat->nb_bins = feat->n_fft / 2 + 1;
+
+  feat->file = fopen(path, "wb");
+  if (!feat->file)
+    return AVERROR(errno);
+  if ((ret = write_header(feat)) < 0)
+    goto fail;
+
+  ret = audio_pool_init(&feat->pool, nb_threads);
+  if (ret < 0)
+    goto fail;
+  feat->nb_jobs = feat->pool.nb_threads;
+
+  feat->jobs = av_calloc(feat->nb_jobs, sizeof(*feat->jobs));
+  if (!feat->jobs) {
+    ret = AVERROR(ENOMEM);
+    goto fail;
+  }
+  for (int j = 0; j < feat->nb_jobs; j++) {
+    struct audio_features_job *job = &feat->jobs[j];
+    job->feat = feat;
+    ret = av_tx_init(&job->tx, &job->tx_fn, AV_TX_FLOAT_RDFT, 0, feat->n_fft,
+                     &scale, 0);
+    if (ret < 0)
+      goto fail;
+    job->fft_in = av_malloc_array(feat->n_fft, sizeof(float));
+    job->fft_out = av_malloc_array(feat->nb_bins, sizeof(AVComplexFloat));
+    job->power = av_malloc_array(feat->nb_bins, sizeof(float));
+    if (!job->fft_in || !job->fft_out || !job->power) {
+      ret = AVERROR(ENOMEM);
+      goto fail;
+    }
+  }
+
+  int block_frames = feat->nb_jobs * AUDIO_FEATURES_BATCH;
+  feat->block_samples = (block_frames - 1) * config->hop + config->window;
+  feat->pending = av_malloc_array(feat->block_samples, sizeof(float));
+  feat->output =
+      av_malloc_array((size_t)block_frames * config->n_mels, sizeof(float));
+  feat->window = av_malloc_array(config->window, sizeof(float));
+  if (!feat->pending || !feat->output || !feat->window) {
+    ret = AVERROR(ENOMEM);
+    goto fail;
+  }
+
+  /* Periodic Hann, as used for spectrogram features */
+  for (int i = 0; i < config->window; i++)
+    feat->window[i] = 0.5f - 0.5f * cosf(2.0f * (float)M_PI * i /
+                                         config->window);
+
+  if ((ret = init_mel_filters(feat)) < 0)
+    goto fail;
+  return 0;
+
+fail:
+  audio_features_free(feat);
+  return ret;
+}
+
+int audio_features_process(struct audio_features *feat, const AVFrame *frame) {
+  const AVChannelLayout mono = AV_CHANNEL_LAYOUT_MONO;
+  int ret;
+
+  if (!feat->swr) {
+    if (frame->sample_rate <= 0 || frame->ch_layout.nb_channels <= 0)
+      return AVERROR(EINVAL);
+    feat->sample_rate = frame->sample_rate;
+    feat->channels = frame->ch_layout.nb_channels;
+    ret = swr_alloc_set_opts2(&feat->swr, &mono, AV_SAMPLE_FMT_FLT,
+                              feat->config.sample_rate, &frame->ch_layout,
+                              frame->format, frame->sample_rate, 0, NULL);
+    if (ret < 0 || (ret = swr_init(feat->swr)) < 0)
+      return ret;
+  } else if (frame->sample_rate != feat->sample_rate ||
+             frame->ch_layout.nb_channels != feat->channels) {
+    return AVERROR(EINVAL);
+  }
+
+  ret = resample(feat, frame);
+  return ret < 0 ? ret : 0;
+}
+
+int audio_features_finish(struct audio_features *feat) {
+  const struct audio_features_config *config = &feat->config;
+  int ret;
+
+  /* Drain the resampler's delay */
+  if (feat->swr) {
+    while ((ret = resample(feat, NULL)) > 0)
+      ;
+    if (ret < 0)
+      return ret;
+  }
+
+  /* Zero-pad the samples no frame covers yet into the last frames */
+  if (feat->nb_pending > feat->covered) {
+    int nb_frames = feat->nb_pending <= config->window
+                        ? 1
+                        : (feat->nb_pending - config->window + config->hop -
+                           1) / config->hop + 1;
+    int needed = (nb_frames - 1) * config->hop + config->window;
+    memset(feat->pending + feat->nb_pending, 0,
+           (needed - feat->nb_pending) * sizeof(float));
+    if ((ret = run_block(feat, nb_frames)) < 0)
+      return ret;
+    feat->nb_pending = 0;
+  }
+
+  ret = write_header(feat);
+  if (fclose(feat->file) != 0 && ret >= 0)
+    ret = AVERROR(EIO);
+  feat->file = NULL;
+  return ret;
+}
+
+void audio_features_free(struct audio_features *feat) {
+  if (feat->file) {
+    fclose(feat->file);
+    feat->file = NULL;
+  }
+  if (feat->pool.threads)
+    audio_pool_free(&feat->pool);
+  for (int j = 0; feat->jobs && j < feat->nb_jobs; j++) {
+    av_tx_uninit(&feat->jobs[j].tx);
+    av_freep(&feat->jobs[j].fft_in);
+    av_freep(&feat->jobs[j].fft_out);
+    av_freep(&feat->jobs[j].power);
+  }
+  av_freep(&feat->jobs);
+  swr_free(&feat->swr);
+  av_freep(&feat->window);
+  av_freep(&feat->mel_weights);
+  av_freep(&feat->mel_start);
+  av_freep(&feat->mel_len);
+  av_freep(&feat->mel_offset);
+  av_freep(&feat->pending);
+  av_freep(&feat->output);
+  av_freep(&feat->scratch);
+  feat->scratch_size = 0;
+}
@@ -1,11 +1,13 @@
 #include "../include/audio_filter.h"
+#include <limits.h>
+#include <math.h>
 #include <stdio.h>
 
 /**
- * @brief Initialize an audio filter graph with the specified parameters.
+ * @brief Build the libavfilter graph for a filter description.
  *
  * This function constructs an FFmpeg filter graph for processing audio frames.
- * It creates a chain: abuffer -> [user filters] -> abuffersink.
+ * It creates a chain: abuffer -> [user filters] -> aformat -> abuffersink.
  * The implementation uses the FFmpeg 8.0+ API which requires allocating filter
  * contexts, setting parameters via av_opt_set functions, then initializing
  * each filter explicitly.
@@ -16,26 +18,15 @@
  * - Explicitly calls avfilter_init_str() after setting all options
  * - Uses "channel_layout" parameter name (not "ch_layout")
  *
- * @param filter Pointer to audio_filter struct to initialize.
- * @param sample_rate Input audio sample rate in Hz (e.g., 44100).
- * @param format Input audio sample format (e.g., AV_SAMPLE_FMT_S16).
- * @param ch_layout Input channel layout structure describing speaker arrangement.
- * @param filter_desc FFmpeg filter description string (e.g., "atempo=1.25,volume=0.5").
- * @return 0 on success, negative AVERROR code on failure.
+ * @param nb_threads libavfilter worker threads, or 0 for its default.
  */
-int audio_filter_init(struct audio_filter *filter, int sample_rate,
+static int init_graph(struct audio_filter *filter, int sample_rate,
                       enum AVSampleFormat format,
                       const AVChannelLayout *ch_layout,
-                      const char *filter_desc) {
+                      const char *filter_desc, int nb_threads) {
   int ret;
   char layout_str[128];
 
-  /* Validate input channel layout */
-  if (!ch_layout || ch_layout->nb_channels == 0) {
-    fprintf(stderr, "Invalid channel layout provided to audio filter\n");
-    return AVERROR(EINVAL);
-  }
-
   /* Convert channel layout to string representation (e.g., "stereo", "5.1") */
   if (av_channel_layout_describe(ch_layout, layout_str, sizeof(layout_str)) <
       0) {
@@ -63,8 +54,18 @@ int audio_filter_init(struct audio_filter *filter, int sample_rate,
   if (!graph)
     return AVERROR(ENOMEM);
 
+  /*
+   * The thread count must be set before the first filter is created.
+   * Slice threading is the graph default (and the only type libavfilter
+   * implements); filters like afftdn and arnndn split their work per
+   * channel across these threads.
+   */
+  if (nb_threads > 0)
+    graph->nb_threads = nb_threads;
+
   AVFilterContext *src_ctx = NULL;
   AVFilterContext *sink_ctx = NULL;
+  AVFilterContext *format_ctx = NULL;
 
   /* Allocate input/output link structures for filter chain connection */
   AVFilterInOut *outputs = avfilter_inout_alloc();
@@ -128,6 +129,32 @@ int audio_filter_init(struct audio_filter *filter, int sample_rate,
     goto fail;
   }
 
+  /*
+   * Step 2b: Pin the output sample format to the input format with an
+   * aformat filter in front of the sink. Filters such as afftdn emit planar
+   * float; pinning keeps every pulled frame in the pipeline's packed format
+   * so raw PCM output and later stages can use it directly. Sample rate and
+   * channel layout remain free (aresample, pan).
+   */
+  const AVFilter *aformat = avfilter_get_by_name("aformat");
+  if (!aformat) {
+    fprintf(stderr, "Failed to find aformat filter.\n");
+    ret = AVERROR_FILTER_NOT_FOUND;
+    goto fail;
+  }
+  format_ctx = avfilter_graph_alloc_filter(graph, aformat, "out_format");
+  if (!format_ctx) {
+    fprintf(stderr, "Failed to allocate aformat filter\n");
+    ret = AVERROR(ENOMEM);
+    goto fail;
+  }
+  if ((ret = av_opt_set(format_ctx, "sample_fmts", fmt_name, AV_OPT_SEARCH_CHILDREN)) < 0 ||
+      (ret = avfilter_init_str(format_ctx, NULL)) < 0 ||
+      (ret = avfilter_link(format_ctx, 0, sink_ctx, 0)) < 0) {
+    fprintf(stderr, "Failed to set up aformat: %s\n", av_err2str(ret));
+    goto fail;
+  }
+
   /* Validate input/output link allocation */
   if (!outputs || !inputs) {
     ret = AVERROR(ENOMEM);
@@ -139,7 +166,7 @@ int audio_filter_init(struct audio_filter *filter, int sample_rate,
   /*
    * Step 3: Set up filter chain endpoints.
    * outputs points to the source (abuffer)
-   * inputs points to the sink (abuffersink)
+   * inputs points to the sink side (aformat -> abuffersink)
    */
   outputs->name = av_strdup("in");
   if (!outputs->name) {
@@ -159,7 +186,7 @@ int audio_filter_init(struct audio_filter *filter, int sample_rate,
     avfilter_inout_free(&inputs);
     goto fail;
   }
-  inputs->filter_ctx = sink_ctx;
+  inputs->filter_ctx = format_ctx;
   inputs->pad_idx = 0;
   inputs->next = NULL;
 
@@ -185,7 +212,6 @@ int audio_filter_init(struct audio_filter *filter, int sample_rate,
   }
 
   /* Store the initialized graph and filter contexts in the output structure */
-  memset(filter, 0, sizeof(*filter));
   filter->graph = graph;
   filter->src_ctx = src_ctx;
   filter->sink_ctx = sink_ctx;
@@ -202,6 +228,364 @@ fail:
   return ret;
 }
 
+/*
+ * Per-channel mode
+ *
+ * Channel-independent chains (afftdn, arnndn, equalizers, ...) are run as one
+ * mono graph per input channel. Every pushed frame is split into mono
+ * frames, each channel graph is fed and drained on the thread pool, and the
+ * results are queued in per-channel FIFOs. Pulls re-interleave whatever all
+ * channels have produced, so ordering holds and output pts continue from
+ * the first input pts without gaps.
+ */
+
+/**
+ * @brief Copy one channel of an interleaved buffer into a mono buffer.
+ */
+static void deinterleave(uint8_t *dst, const uint8_t *src, int nb_samples,
+                         int channels, int ch, int bps) {
+  if (bps == 2) {
+    const int16_t *s = (const int16_t *)src + ch;
+    int16_t *d = (int16_t *)dst;
+    for (int n = 0; n < nb_samples; n++)
+      d[n] = s[n * channels];
+  } else if (bps == 4) {
+    const int32_t *s = (const int32_t *)src + ch;
+    int32_t *d = (int32_t *)dst;
+    for (int n = 0; n < nb_samples; n++)
+      d[n] = s[n * channels];
+  } else {
+    for (int n = 0; n < nb_samples; n++)
+      memcpy(dst + n * bps, src + ((int64_t)n * channels + ch) * bps, bps);
+  }
+}
+
+/**
+ * @brief Copy a mono buffer into one channel of an interleaved buffer.
+ */
+static void interleave(uint8_t *dst, const uint8_t *src, int nb_samples,
+                       int channels, int ch, int bps) {
+  if (bps == 2) {
+    const int16_t *s = (const int16_t *)src;
+    int16_t *d = (int16_t *)dst + ch;
+    for (int n = 0; n < nb_samples; n++)
+      d[n * channels] = s[n];
+  } else if (bps == 4) {
+    const int32_t *s = (const int32_t *)src;
+    int32_t *d = (int32_t *)dst + ch;
+    for (int n = 0; n < nb_samples; n++)
+      d[n * channels] = s[n];
+  } else {
+    for (int n = 0; n < nb_samples; n++)
+      memcpy(dst + ((int64_t)n * channels + ch) * bps, src + n * bps, bps);
+  }
+}
+
+/**
+ * @brief Pool job: feed one channel graph and drain it into its FIFO.
+ */
+static void split_job(void *arg) {
+  struct audio_filter_channel *ch = arg;
+  int ret;
+
+  ch->ret = audio_filter_push(&ch->filter, ch->flush ? NULL : ch->in);
+  if (ch->ret < 0)
+    return;
+
+  while ((ret = audio_filter_pull(&ch->filter, ch->out)) >= 0) {
+    if (av_audio_fifo_write(ch->fifo, (void **)ch->out->data,
+                            ch->out->nb_samples) < ch->out->nb_samples) {
+      ch->ret = AVERROR(ENOMEM);
+      break;
+    }
+  }
+  av_frame_unref(ch->out);
+}
+
+static int init_split(struct audio_filter *filter, int sample_rate,
+                      enum AVSampleFormat format,
+                      const AVChannelLayout *ch_layout,
+                      const char *filter_desc, int nb_threads) {
+  const AVChannelLayout mono = AV_CHANNEL_LAYOUT_MONO;
+  int nb = ch_layout->nb_channels;
+  int ret;
+
+  if (av_sample_fmt_is_planar(format)) {
+    fprintf(stderr, "Per-channel filtering needs packed samples\n");
+    return AVERROR(EINVAL);
+  }
+
+  filter->split = av_calloc(nb, sizeof(*filter->split));
+  if (!filter->split)
+    return AVERROR(ENOMEM);
+  filter->nb_split = nb;
+  filter->split_fmt = format;
+  filter->split_pts = AV_NOPTS_VALUE;
+
+  ret = av_channel_layout_copy(&filter->split_layout, ch_layout);
+  if (ret < 0)
+    goto fail;
+
+  for (int c = 0; c < nb; c++) {
+    struct audio_filter_channel *ch = &filter->split[c];
+    AVChannelLayout out_layout = {0};
+
+    /* Each channel graph runs single threaded; the pool provides the
+     * parallelism across channels */
+    ch->filter.sample_rate = sample_rate;
+    ret = init_graph(&ch->filter, sample_rate, format, &mono, filter_desc, 1);
+    if (ret < 0)
+      goto fail;
+
+    ret = av_buffersink_get_ch_layout(ch->filter.sink_ctx, &out_layout);
+    if (ret < 0)
+      goto fail;
+    if (out_layout.nb_channels != 1) {
+      fprintf(stderr, "Filter chain is not channel-independent, "
+                      "cannot filter channels separately\n");
+      av_channel_layout_uninit(&out_layout);
+      ret = AVERROR(EINVAL);
+      goto fail;
+    }
+    av_channel_layout_uninit(&out_layout);
+
+    ch->in = av_frame_alloc();
+    ch->out = av_frame_alloc();
+    ch->fifo = av_audio_fifo_alloc(format, 1, 4096);
+    if (!ch->in || !ch->out || !ch->fifo) {
+      ret = AVERROR(ENOMEM);
+      goto fail;
+    }
+  }
+
+  filter->split_rate = av_buffersink_get_sample_rate(filter->split[0].filter.sink_ctx);
+
+  ret = audio_pool_init(&filter->split_pool, nb_threads > 0 ? nb_threads : nb);
+  if (ret < 0)
+    goto fail;
+
+  return 0;
+
+fail:
+  fprintf(stderr, "Per-channel filter init failed: %s\n", av_err2str(ret));
+  audio_filter_free(filter);
+  return ret;
+}
+
+static int split_push(struct audio_filter *filter, AVFrame *frame) {
+  int bps = av_get_bytes_per_sample(filter->split_fmt);
+  int ret;
+
+  if (frame) {
+    /* Output timestamps continue from the first input frame */
+    if (filter->split_pts == AV_NOPTS_VALUE && frame->pts != AV_NOPTS_VALUE)
+      filter->split_pts =
+          av_rescale(frame->pts, filter->split_rate, frame->sample_rate);
+
+    for (int c = 0; c < filter->nb_split; c++) {
+      AVFrame *in = filter->split[c].in;
+
+      av_frame_unref(in);
+      in->nb_samples = frame->nb_samples;
+      in->format = filter->split_fmt;
+      in->sample_rate = frame->sample_rate;
+      in->pts = frame->pts;
+      av_channel_layout_default(&in->ch_layout, 1);
+      if ((ret = av_frame_get_buffer(in, 0)) < 0)
+        return ret;
+
+      deinterleave(in->data[0], frame->data[0], frame->nb_samples,
+                   filter->nb_split, c, bps);
+    }
+    av_frame_unref(frame);
+  } else {
+    filter->split_eof = 1;
+  }
+
+  /* Run every channel graph in parallel and wait for all of them */
+  for (int c = 0; c < filter->nb_split; c++) {
+    filter->split[c].flush = !frame;
+    ret = audio_pool_submit(&filter->split_pool, split_job, &filter->split[c]);
+    if (ret < 0) {
+      audio_pool_wait(&filter->split_pool);
+      return ret;
+    }
+  }
+  audio_pool_wait(&filter->split_pool);
+
+  for (int c = 0; c < filter->nb_split; c++) {
+    if (filter->split[c].ret < 0)
+      return filter->split[c].ret;
+  }
+  return 0;
+}
+
+static int split_pull(struct audio_filter *filter, AVFrame *frame) {
+  int bps = av_get_bytes_per_sample(filter->split_fmt);
+  int nb_samples = INT_MAX;
+  int ret;
+
+  /* Only samples every channel has produced can be emitted */
+  for (int c = 0; c < filter->nb_split; c++)
+    nb_samples = FFMIN(nb_samples, av_audio_fifo_size(filter->split[c].fifo));
+
+  if (filter->split_frame_size > 0) {
+    if (nb_samples >= filter->split_frame_size)
+      nb_samples = filter->split_frame_size;
+    else if (!filter->split_eof)
+      nb_samples = 0;
+  }
+  if (nb_samples <= 0)
+    return filter->split_eof ? AVERROR_EOF : AVERROR(EAGAIN);
+
+  frame->nb_samples = nb_samples;
+  frame->format = filter->split_fmt;
+  frame->sample_rate = filter->split_rate;
+  frame->time_base = (AVRational){1, filter->split_rate};
+  frame->pts = filter->split_pts == AV_NOPTS_VALUE ? 0 : filter->split_pts;
+  filter->split_pts = frame->pts + nb_samples;
+  if ((ret = av_channel_layout_copy(&frame->ch_layout, &filter->split_layout)) < 0 ||
+      (ret = av_frame_get_buffer(frame, 0)) < 0)
+    return ret;
+
+  if (filter->split_scratch_size < nb_samples * bps) {
+    av_freep(&filter->split_scratch);
+    filter->split_scratch = av_malloc(nb_samples * bps);
+    if (!filter->split_scratch) {
+      filter->split_scratch_size = 0;
+      return AVERROR(ENOMEM);
+    }
+    filter->split_scratch_size = nb_samples * bps;
+  }
+
+  for (int c = 0; c < filter->nb_split; c++) {
+    void *planes[1] = {filter->split_scratch};
+    ret = av_audio_fifo_read(filter->split[c].fifo, planes, nb_samples);
+    if (ret < nb_samples)
+      return ret < 0 ? ret : AVERROR_BUG;
+    interleave(frame->data[0], filter->split_scratch, nb_samples,
+               filter->nb_split, c, bps);
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Feed a frame to the graph, cutting it at queued command times.
+ *
+ * libavfilter runs queued commands on the first frame whose start time is
+ * at or past the command time, so a command landing inside a frame would
+ * otherwise be late by up to a frame. The tail is a second reference to
+ * the same buffer, so no samples are copied.
+ */
+static int graph_push(struct audio_filter *filter, AVFrame *frame) {
+  int64_t start, end, cut = INT64_MAX;
+  int ret;
+
+  if (!frame || !filter->nb_pending || frame->pts == AV_NOPTS_VALUE)
+    return av_buffersrc_add_frame_flags(filter->src_ctx, frame, 0);
+
+  start = frame->pts;
+  end = start + frame->nb_samples;
+
+  /* Commands at or before the frame start fire on this frame as is */
+  for (int i = 0; i < filter->nb_pending;) {
+    if (filter->pending[i] <= start) {
+      filter->pending[i] = filter->pending[--filter->nb_pending];
+      continue;
+    }
+    cut = FFMIN(cut, filter->pending[i]);
+    i++;
+  }
+  if (cut >= end)
+    return av_buffersrc_add_frame_flags(filter->src_ctx, frame, 0);
+
+  AVFrame *tail = av_frame_clone(frame);
+  if (!tail)
+    return AVERROR(ENOMEM);
+
+  int planar = av_sample_fmt_is_planar(frame->format);
+  int planes = planar ? frame->ch_layout.nb_channels : 1;
+  int offset = (int)(cut - start);
+  int step = av_get_bytes_per_sample(frame->format) *
+             (planar ? 1 : frame->ch_layout.nb_channels);
+
+  for (int p = 0; p < planes; p++) {
+    tail->extended_data[p] += offset * step;
+    if (tail->extended_data != tail->data && p < AV_NUM_DATA_POINTERS)
+      tail->data[p] += offset * step;
+  }
+  tail->nb_samples -= offset;
+  tail->pts = cut;
+  frame->nb_samples = offset;
+
+  ret = av_buffersrc_add_frame_flags(filter->src_ctx, frame, 0);
+  if (ret >= 0)
+    ret = graph_push(filter, tail);
+  av_frame_free(&tail);
+  return ret;
+}
+
+/**
+ * @brief Initialize an audio filter with the specified parameters.
+ *
+ * Picks the cheapest engine able to run the whole chain:
+ * 1. the native DSP engine for simple gain/pan/fade/clip chains,
+ * 2. one mono libavfilter graph per channel on a thread pool when
+ *    AUDIO_FILTER_SPLIT_CHANNELS is set,
+ * 3. a single libavfilter graph otherwise.
+ *
+ * @param filter Pointer to audio_filter struct to initialize.
+ * @param sample_rate Input audio sample rate in Hz (e.g., 44100).
+ * @param format Input audio sample format (e.g., AV_SAMPLE_FMT_S16).
+ * @param ch_layout Input channel layout structure describing speaker arrangement.
+ * @param filter_desc FFmpeg filter description string (e.g., "atempo=1.25,volume=0.5").
+ * @param nb_threads Threads for libavfilter (or the channel pool), 0 for default.
+ * @param flags Combination of AUDIO_FILTER_* flags.
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+int audio_filter_init(struct audio_filter *filter, int sample_rate,
+                      enum AVSampleFormat format,
+                      const AVChannelLayout *ch_layout,
+                      const char *filter_desc, int nb_threads, int flags) {
+  int ret;
+
+  /* Validate input channel layout */
+  if (!ch_layout || ch_layout->nb_channels == 0) {
+    fprintf(stderr, "Invalid channel layout provided to audio filter\n");
+    return AVERROR(EINVAL);
+  }
+
+  /*
+   * Step 0: Try the native DSP engine. It handles the whole chain in place
+   * on the frame buffer, skipping graph setup, format negotiation and the
+   * per-frame buffersrc/buffersink overhead. Anything it does not support
+   * falls through to libavfilter.
+   */
+  memset(filter, 0, sizeof(*filter));
+  filter->sample_rate = sample_rate;
+  ret = audio_dsp_chain_init(&filter->dsp, filter_desc, sample_rate, format,
+                             ch_layout);
+  if (ret >= 0) {
+    filter->dsp_frame = av_frame_alloc();
+    if (!filter->dsp_frame) {
+      audio_dsp_chain_free(&filter->dsp);
+      return AVERROR(ENOMEM);
+    }
+    filter->use_dsp = 1;
+    return 0;
+  }
+  if (ret != AVERROR(ENOSYS))
+    return ret;
+
+  if ((flags & AUDIO_FILTER_SPLIT_CHANNELS) && ch_layout->nb_channels > 1)
+    return init_split(filter, sample_rate, format, ch_layout, filter_desc,
+                      nb_threads);
+
+  return init_graph(filter, sample_rate, format, ch_layout, filter_desc,
+                    nb_threads);
+}
+
 /**
  * @brief Push an audio frame into the filter graph for processing.
  *
@@ -209,50 +593,193 @@ fail:
  * will be processed through the filter chain (e.g., tempo adjustment,
  * volume changes, etc.) and can be retrieved using audio_filter_pull.
  *
- * The AV_BUFFERSRC_FLAG_KEEP_REF flag ensures the original frame data
- * is not modified, allowing the caller to continue using the frame
- * after this call if needed.
+ * The frame's data references are moved into the graph rather than copied
+ * (no AV_BUFFERSRC_FLAG_KEEP_REF), so the caller's frame is reset on return
+ * and can be reused for the next decoded chunk. Frames without reference
+ * counted buffers are copied once by libavfilter.
+ *
+ * Passing NULL signals end of stream; the remaining buffered samples can
+ * then be drained with audio_filter_pull until it returns AVERROR_EOF.
  *
  * @param filter Pointer to initialized audio_filter structure.
- * @param frame Audio frame to process (must be valid and contain audio data).
+ * @param frame Audio frame to process, or NULL to flush.
  * @return 0 on success, negative AVERROR code on failure.
  */
 int audio_filter_push(struct audio_filter *filter, AVFrame *frame) {
-  return av_buffersrc_add_frame_flags(filter->src_ctx, frame,
-                                      AV_BUFFERSRC_FLAG_KEEP_REF);
+  if (frame && filter->max_held_bytes > 0) {
+    filter->held_bytes += av_samples_get_buffer_size(
+        NULL, frame->ch_layout.nb_channels, frame->nb_samples, frame->format,
+        1);
+    if (filter->held_bytes > filter->max_held_bytes)
+      return AVERROR(ENOBUFS);
+  }
+
+  if (filter->use_dsp) {
+    int ret;
+
+    /* Flushing: the native engine holds no delayed samples */
+    if (!frame) {
+      filter->dsp_eof = 1;
+      return 0;
+    }
+
+    /* Take over the frame and process it in place once writable */
+    av_frame_unref(filter->dsp_frame);
+    if (frame->buf[0]) {
+      av_frame_move_ref(filter->dsp_frame, frame);
+    } else if ((ret = av_frame_ref(filter->dsp_frame, frame)) < 0) {
+      return ret;
+    }
+
+    ret = av_frame_make_writable(filter->dsp_frame);
+    if (ret >= 0)
+      ret = audio_dsp_chain_process(&filter->dsp, filter->dsp_frame);
+    if (ret < 0)
+      av_frame_unref(filter->dsp_frame);
+    return ret;
+  }
+
+  if (filter->nb_split)
+    return split_push(filter, frame);
+
+  return graph_push(filter, frame);
 }
 
 /**
  * @brief Pull a processed audio frame from the filter graph.
  *
- * Retrieves one filtered audio frame from the abuffersink output filter.
- * The function allocates a new frame structure and fills it with the
- * processed audio data. The caller is responsible for freeing the frame
- * using av_frame_free when finished.
+ * Retrieves one filtered audio frame from the abuffersink output filter into
+ * a caller-owned frame. The frame is unreferenced first, so the same AVFrame
+ * can be reused for every pull; no per-frame allocation takes place.
  *
- * This function may be called multiple times after a single push operation,
- * as some filters (e.g., atempo) can produce multiple output frames from
- * one input frame.
+ * This function should be called in a loop after each push until it returns
+ * AVERROR(EAGAIN), as some filters (e.g., atempo) can produce multiple output
+ * frames from one input frame.
  *
  * @param filter Pointer to initialized audio_filter structure.
- * @param out_frame Pointer to receive the allocated filtered frame.
+ * @param frame Caller-owned frame that receives the filtered data.
  * @return 0 on success, AVERROR(EAGAIN) if more input is needed,
  *         AVERROR_EOF at end of stream, or other negative AVERROR on failure.
  */
-int audio_filter_pull(struct audio_filter *filter, AVFrame **out_frame) {
-  *out_frame = av_frame_alloc();
-  if (*out_frame == NULL) {
-    return AVERROR(ENOMEM);
+int audio_filter_pull(struct audio_filter *filter, AVFrame *frame) {
+  int ret;
+
+  av_frame_unref(frame);
+
+  if (filter->use_dsp) {
+    /* Hand out the processed frame, at most once per push */
+    if (!filter->dsp_frame->buf[0])
+      return filter->dsp_eof ? AVERROR_EOF : AVERROR(EAGAIN);
+    av_frame_move_ref(frame, filter->dsp_frame);
+    filter->held_bytes = 0;
+    return 0;
   }
 
-  int ret = av_buffersink_get_frame(filter->sink_ctx, *out_frame);
-  if (ret < 0) {
-    av_frame_free(out_frame);
-    *out_frame = NULL;
+  if (filter->nb_split)
+    ret = split_pull(filter, frame);
+  else
+    ret = av_buffersink_get_frame_flags(filter->sink_ctx, frame, 0);
+
+  /* Output flows, so the input pushed so far is not piling up */
+  if (ret >= 0)
+    filter->held_bytes = 0;
+  return ret;
+}
+
+/**
+ * @brief Change a filter parameter without rebuilding the graph.
+ *
+ * Immediate commands go through avfilter_graph_send_command. Timed ones are
+ * queued with avfilter_graph_queue_command and their sample position is
+ * remembered, so graph_push can cut the input frame exactly there.
+ *
+ * @param filter Pointer to initialized audio_filter structure.
+ * @param target Filter instance or filter name, or "all".
+ * @param cmd Command name.
+ * @param arg Command argument.
+ * @param time Input time in seconds, or negative to apply immediately.
+ * @return 0 on success, negative AVERROR code on failure.
+ */
+int audio_filter_command(struct audio_filter *filter, const char *target,
+                         const char *cmd, const char *arg, double time) {
+  int64_t at = time >= 0 ? llrint(time * filter->sample_rate) : -1;
+  int ret;
+
+  if (filter->use_dsp) {
+    ret = audio_dsp_chain_command(&filter->dsp, target, cmd, arg, at);
+    if (ret < 0)
+      fprintf(stderr, "Filter command '%s %s %s' not supported: %s\n", target,
+              cmd, arg ? arg : "", av_err2str(ret));
+    return ret;
+  }
+
+  if (filter->nb_split) {
+    for (int c = 0; c < filter->nb_split; c++) {
+      ret = audio_filter_command(&filter->split[c].filter, target, cmd, arg,
+                                 time);
+      if (ret < 0)
+        return ret;
+    }
+    return 0;
+  }
+
+  if (at < 0) {
+    char res[256] = "";
+    ret = avfilter_graph_send_command(filter->graph, target, cmd, arg, res,
+                                      sizeof(res), 0);
+  } else if (filter->nb_pending >= AUDIO_FILTER_MAX_PENDING) {
+    ret = AVERROR(ENOBUFS);
+  } else {
+    /* Queue at the exact sample time so the frame cut in graph_push and
+     * libavfilter's timestamp check agree */
+    ret = avfilter_graph_queue_command(filter->graph, target, cmd, arg, 0,
+                                       (double)at / filter->sample_rate);
+    if (ret >= 0)
+      filter->pending[filter->nb_pending++] = at;
   }
+
+  if (ret < 0)
+    fprintf(stderr, "Filter command '%s %s %s' failed: %s\n", target, cmd,
+            arg ? arg : "", av_err2str(ret));
   return ret;
 }
 
+/**
+ * @brief Make the filter emit frames of a fixed number of samples.
+ *
+ * Uses av_buffersink_set_frame_size() so frames leave the graph already
+ * sized to the encoder's frame_size and can be encoded without going
+ * through the encoder FIFO. Only the last frame may be shorter. The native
+ * engine keeps the decoder's frame sizes and relies on the encoder FIFO.
+ *
+ * @param filter Pointer to initialized audio_filter structure.
+ * @param nb_samples Samples per frame, or 0 to leave frame sizes unchanged.
+ */
+void audio_filter_set_frame_size(struct audio_filter *filter, int nb_samples) {
+  if (filter->nb_split) {
+    filter->split_frame_size = nb_samples > 0 ? nb_samples : 0;
+    return;
+  }
+  if (filter->use_dsp || !filter->sink_ctx || nb_samples <= 0)
+    return;
+  av_buffersink_set_frame_size(filter->sink_ctx, nb_samples);
+}
+
+/**
+ * @brief Bound the input a filter may hold back without output.
+ *
+ * Filters that need their whole input before producing anything (e.g.,
+ * areverse) would otherwise buffer the entire stream.
+ *
+ * @param filter Pointer to initialized audio_filter structure.
+ * @param max_bytes Limit in bytes, or 0 for none.
+ */
+void audio_filter_set_max_held(struct audio_filter *filter,
+                               int64_t max_bytes) {
+  filter->max_held_bytes = max_bytes > 0 ? max_bytes : 0;
+  filter->held_bytes = 0;
+}
+
 /**
  * @brief Free all resources associated with an audio filter graph.
  *
@@ -267,6 +794,26 @@ int audio_filter_pull(struct audio_filter *filter, AVFrame **out_frame) {
  * @param filter Pointer to audio_filter structure to free.
  */
 void audio_filter_free(struct audio_filter *filter) {
+  if (filter->use_dsp) {
+    av_frame_free(&filter->dsp_frame);
+    audio_dsp_chain_free(&filter->dsp);
+    filter->use_dsp = 0;
+  }
+  if (filter->split) {
+    audio_pool_free(&filter->split_pool);
+    for (int c = 0; c < filter->nb_split; c++) {
+      struct audio_filter_channel *ch = &filter->split[c];
+      audio_filter_free(&ch->filter);
+      av_frame_free(&ch->in);
+      av_frame_free(&ch->out);
+      if (ch->fifo)
+        av_audio_fifo_free(ch->fifo);
+    }
+    av_freep(&filter->split);
+    av_freep(&filter->split_scratch);
+    av_channel_layout_uninit(&filter->split_layout);
+    filter->nb_split = 0;
+  }
   if (filter->graph) {
     avfilter_graph_free(&filter->graph);
     filter->graph = NULL;
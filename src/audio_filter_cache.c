@@ -0,0 +1,164 @@
+#include "../include/audio_filter_cache.h"
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * @brief Pool job: configure the spare filter of an entry.
+ */
+static void build_spare(void *arg) {
+  struct audio_filter_cache_entry *entry = arg;
+  struct audio_filter *filter = av_mallocz(sizeof(*filter));
+
+  if (!filter)
+    return;
+  if (audio_filter_init(filter, entry->sample_rate, entry->format,
+                        &entry->ch_layout, entry->desc, entry->nb_threads,
+                        entry->flags) < 0) {
+    av_free(filter);
+    return;
+  }
+  entry->spare = filter;
+}
+
+/**
+ * @brief Pool job: free a filter handed back by a finished job.
+ */
+static void free_filter(void *arg) {
+  struct audio_filter *filter = arg;
+
+  audio_filter_free(filter);
+  av_free(filter);
+}
+
+static void entry_free(struct audio_filter_cache_entry *entry) {
+  if (entry->spare)
+    free_filter(entry->spare);
+  av_freep(&entry->desc);
+  av_channel_layout_uninit(&entry->ch_layout);
+  memset(entry, 0, sizeof(*entry));
+}
+
+static int entry_matches(const struct audio_filter_cache_entry *entry,
+                         int sample_rate, enum AVSampleFormat format,
+                         const AVChannelLayout *ch_layout,
+                         const char *filter_desc, int nb_threads, int flags) {
+  return entry->sample_rate == sample_rate && entry->format == format &&
+         entry->nb_threads == nb_threads && entry->flags == flags &&
+         strcmp(entry->desc, filter_desc) == 0 &&
+         av_channel_layout_compare(&entry->ch_layout, ch_layout) == 0;
+}
+
+/**
+ * @brief Find the entry for a key, or make room for it.
+ */
+static struct audio_filter_cache_entry *
+get_entry(struct audio_filter_cache *cache, int sample_rate,
+          enum AVSampleFormat format, const AVChannelLayout *ch_layout,
+          const char *filter_desc, int nb_threads, int flags) {
+  struct audio_filter_cache_entry *entry = NULL;
+
+  for (int i = 0; i < cache->nb_entries; i++) {
+    if (entry_matches(&cache->entries[i], sample_rate, format, ch_layout,
+                      filter_desc, nb_threads, flags))
+      return &cache->entries[i];
+  }
+
+  /* New key: take a free slot or evict the least recently used entry */
+  if (cache->nb_entries < AUDIO_FILTER_CACHE_SIZE) {
+    entry = &cache->entries[cache->nb_entries++];
+  } else {
+    entry = &cache->entries[0];
+    for (int i = 1; i < cache->nb_entries; i++) {
+      if (cache->entries[i].last_use < entry->last_use)
+        entry = &cache->entries[i];
+    }
+    entry_free(entry);
+  }
+
+  entry->desc = av_strdup(filter_desc);
+  if (!entry->desc ||
+      av_channel_layout_copy(&entry->ch_layout, ch_layout) < 0) {
+    entry_free(entry);
+    return NULL;
+  }
+  entry->sample_rate = sample_rate;
+  entry->format = format;
+  entry->nb_threads = nb_threads;
+  entry->flags = flags;
+  return entry;
+}
+
+int audio_filter_cache_init(struct audio_filter_cache *cache) {
+  memset(cache, 0, sizeof(*cache));
+
+  /* One thread: spares are built one job ahead, not in bulk */
+  return audio_pool_init(&cache->pool, 1);
+}
+
+int audio_filter_cache_acquire(struct audio_filter_cache *cache,
+                               struct audio_filter **filter, int sample_rate,
+                               enum AVSampleFormat format,
+                               const AVChannelLayout *ch_layout,
+                               const char *filter_desc, int nb_threads,
+                               int flags) {
+  int64_t start = av_gettime_relative();
+  struct audio_filter_cache_entry *entry;
+  int hit = 0;
+  int ret;
+
+  /* Spares are only touched once the background thread is idle */
+  audio_pool_wait(&cache->pool);
+
+  entry = get_entry(cache, sample_rate, format, ch_layout, filter_desc,
+                    nb_threads, flags);
+
+  if (entry && entry->spare) {
+    *filter = entry->spare;
+    entry->spare = NULL;
+    hit = 1;
+  } else {
+    *filter = av_mallocz(sizeof(**filter));
+    if (!*filter)
+      return AVERROR(ENOMEM);
+    ret = audio_filter_init(*filter, sample_rate, format, ch_layout,
+                            filter_desc, nb_threads, flags);
+    if (ret < 0) {
+      av_freep(filter);
+      return ret;
+    }
+  }
+
+  if (entry) {
+    entry->last_use = ++cache->clock;
+    /* Prepare the next job's filter while this one runs; failing to queue
+     * it only costs that job a synchronous build */
+    audio_pool_submit(&cache->pool, build_spare, entry);
+  }
+
+  if (hit) {
+    cache->hits++;
+    cache->hit_us += av_gettime_relative() - start;
+  } else {
+    cache->misses++;
+    cache->miss_us += av_gettime_relative() - start;
+  }
+  return 0;
+}
+
+void audio_filter_cache_release(struct audio_filter_cache *cache,
+                                struct audio_filter **filter) {
+  if (!*filter)
+    return;
+  if (audio_pool_submit(&cache->pool, free_filter, *filter) < 0)
+    free_filter(*filter);
+  *filter = NULL;
+}
+
+void audio_filter_cache_free(struct audio_filter_cache *cache) {
+  audio_pool_free(&cache->pool);
+  for (int i = 0; i < cache->nb_entries; i++)
+    entry_free(&cache->entries[i]);
+  cache->nb_entries = 0;
+}
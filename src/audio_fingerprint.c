@@ -0,0 +1,281 @@
+#include "../include/audio_fingerprint.h"
+#include <libavutil/base64.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/error.h>
+#include <libavutil/intreadwrite.h>
+#include <libavutil/mem.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#define NB_BINS (AUDIO_FINGERPRINT_WINDOW / 2 + 1)
+
+/**
+ * @brief Set up the resampler, FFT and tables from the first frame.
+ */
+static int configure(struct audio_fingerprint *fp, const AVFrame *frame) {
+  const AVChannelLayout mono = AV_CHANNEL_LAYOUT_MONO;
+  const float scale = 1.0f;
+  int ret;
+
+  if (frame->sample_rate <= 0 || frame->ch_layout.nb_channels <= 0)
+    return AVERROR(EINVAL);
+  fp->sample_rate = frame->sample_rate;
+  fp->channels = frame->ch_layout.nb_channels;
+
+  ret = swr_alloc_set_opts2(&fp->swr, &mono, AV_SAMPLE_FMT_FLT,
+                            AUDIO_FINGERPRINT_RATE, &frame->ch_layout,
+                            frame->format, frame->sample_rate, 0, NULL);
+  if (ret < 0 || (ret = swr_init(fp->swr)) < 0)
+    return ret;
+
+  ret = av_tx_init(&fp->tx, &fp->tx_fn, AV_TX_FLOAT_RDFT, 0,
+                   AUDIO_FINGERPRINT_WINDOW, &scale, 0);
+  if (ret < 0)
+    return ret;
+
+  fp->block = av_malloc_array(AUDIO_FINGERPRINT_WINDOW, sizeof(float));
+  fp->window = av_malloc_array(AUDIO_FINGERPRINT_WINDOW, sizeof(float));
+  fp->fft_in = av_malloc_array(AUDIO_FINGERPRINT_WINDOW, sizeof(float));
+  fp->fft_out = av_malloc_array(NB_BINS, sizeof(AVComplexFloat));
+  fp->bin_chroma = av_malloc(NB_BINS);
+  if (!fp->block || !fp->window || !fp->fft_in || !fp->fft_out ||
+      !fp->bin_chroma)
+    return AVERROR(ENOMEM);
+
+  for (int i = 0; i < AUDIO_FINGERPRINT_WINDOW; i++)
+    fp->window[i] =
+        0.5f - 0.5f * cosf(2.0f * (float)M_PI * i /
+                           (AUDIO_FINGERPRINT_WINDOW - 1));
+
+  /* Fold each bin onto the pitch class of its nearest MIDI note */
+  for (int i = 0; i < NB_BINS; i++) {
+    double freq = (double)i * AUDIO_FINGERPRINT_RATE / AUDIO_FINGERPRINT_WINDOW;
+    if (freq < AUDIO_FINGERPRINT_MIN_FREQ ||
+        freq > AUDIO_FINGERPRINT_MAX_FREQ) {
+      fp->bin_chroma[i] = -1;
+      continue;
+    }
+    long note = lrint(69.0 + 12.0 * log2(freq / 440.0));
+    fp->bin_chroma[i] = (int8_t)(((note % 12) + 12) % 12);
+  }
+  return 0;
+}
+
+/**
+ * @brief Append a sub-fingerprint.
+ */
+static int add_value(struct audio_fingerprint *fp, uint32_t value) {
+  if (fp->nb_values == fp->capacity) {
+    int capacity = fp->capacity ? fp->capacity * 2 : 1024;
+    uint32_t *values =
+        av_realloc_array(fp->values, capacity, sizeof(*fp->values));
+    if (!values)
+      return AVERROR(ENOMEM);
+    fp->values = values;
+    fp->capacity = capacity;
+  }
+  fp->values[fp->nb_values++] = value;
+  return 0;
+}
+
+/**
+ * @brief Turn the full block into a chroma vector and, once the smoothing
+ *        window is primed, a sub-fingerprint.
+ */
+static int analyse_block(struct audio_fingerprint *fp) {
+  float *chroma = fp->chroma[fp->nb_chroma % AUDIO_FINGERPRINT_SMOOTH];
+  float smoothed[12];
+  double norm = 0.0;
+
+  for (int i = 0; i < AUDIO_FINGERPRINT_WINDOW; i++)
+    fp->fft_in[i] = fp->block[i] * fp->window[i];
+  fp->tx_fn(fp->tx, fp->fft_out, fp->fft_in, sizeof(float));
+
+  memset(chroma, 0, 12 * sizeof(float));
+  for (int i = 0; i < NB_BINS; i++) {
+    int k = fp->bin_chroma[i];
+    if (k >= 0)
+      chroma[k] += fp->fft_out[i].re * fp->fft_out[i].re +
+                   fp->fft_out[i].im * fp->fft_out[i].im;
+  }
+
+  /* Normalized so the fingerprint does not depend on the level; silence
+   * stays all zero */
+  for (int k = 0; k < 12; k++)
+    norm += (double)chroma[k] * chroma[k];
+  norm = sqrt(norm);
+  for (int k = 0; k < 12; k++)
+    chroma[k] = norm > 1e-9 ? (float)(chroma[k] / norm) : 0.0f;
+
+  if (++fp->nb_chroma < AUDIO_FINGERPRINT_SMOOTH)
+    return 0;
+
+  for (int k = 0; k < 12; k++) {
+    smoothed[k] = 0.0f;
+    for (int j = 0; j < AUDIO_FINGERPRINT_SMOOTH; j++)
+      smoothed[k] += fp->chroma[j][k];
+    smoothed[k] /= AUDIO_FINGERPRINT_SMOOTH;
+  }
+
+  int ret = 0;
+  if (fp->nb_chroma > AUDIO_FINGERPRINT_SMOOTH) {
+    /* Bits 0-11: against the next pitch class; 12-23: against the previous
+     * vector; 24-31: against the pitch class a major third up */
+    uint32_t value = 0;
+    for (int k = 0; k < 12; k++) {
+      value |= (uint32_t)(smoothed[k] > smoothed[(k + 1) % 12]) << k;
+      value |= (uint32_t)(smoothed[k] > fp->previous[k]) << (12 + k);
+    }
+    for (int k = 0; k < 8; k++)
+      value |= (uint32_t)(smoothed[k] > smoothed[(k + 4) % 12]) << (24 + k);
+    ret = add_value(fp, value);
+  }
+  memcpy(fp->previous, smoothed, sizeof(smoothed));
+  return ret;
+}
+
+/**
+ * @brief Add mono samples at the analysis rate, analysing every full block.
+ */
+static int feed(struct audio_fingerprint *fp, const float *samples,
+                int count) {
+  int ret;
+
+  while (count > 0) {
+    int n = AUDIO_FINGERPRINT_WINDOW - fp->filled;
+    if (n > count)
+      n = count;
+    memcpy(fp->block + fp->filled, samples, n * sizeof(float));
+    fp->filled += n;
+    samples += n;
+    count -= n;
+
+    if (fp->filled == AUDIO_FINGERPRINT_WINDOW) {
+      if ((ret = analyse_block(fp)) < 0)
+        return ret;
+      memmove(fp->block, fp->block + AUDIO_FINGERPRINT_HOP,
+              (AUDIO_FINGERPRINT_WINDOW - AUDIO_FINGERPRINT_HOP) *
+                  sizeof(float));
+      fp->filled = AUDIO_FINGERPRINT_WINDOW - AUDIO_FINGERPRINT_HOP;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief Pass resampled samples on, up to the length limit.
+ */
+static int consume(struct audio_fingerprint *fp, int count) {
+  if (fp->max_samples > 0 && fp->samples + count >= fp->max_samples) {
+    count = (int)(fp->max_samples - fp->samples);
+    fp->done = 1;
+  }
+  fp->samples += count;
+  return feed(fp, fp->scratch, count);
+}
+
+void audio_fingerprint_init(struct audio_fingerprint *fp,
+                            double max_seconds) {
+  memset(fp, 0, sizeof(*fp));
+  if (max_seconds > 0)
+    fp->max_samples = (int64_t)(max_seconds * AUDIO_FINGERPRINT_RATE);
+}
+
+int audio_fingerprint_process(struct audio_fingerprint *fp,
+                              const AVFrame *frame) {
+  int ret;
+
+  if (fp->done)
+    return 0;
+  if (!fp->swr) {
+    if ((ret = configure(fp, frame)) < 0)
+      return ret;
+  } else if (frame->sample_rate != fp->sample_rate ||
+             frame->ch_layout.nb_channels != fp->channels) {
+    return AVERROR(EINVAL);
+  }
+
+  int capacity = swr_get_out_samples(fp->swr, frame->nb_samples);
+  if (capacity < 0)
+    return capacity;
+  av_fast_malloc(&fp->scratch, &fp->scratch_size,
+                 (size_t)capacity * sizeof(float));
+  if (!fp->scratch)
+    return AVERROR(ENOMEM);
+
+  ret = swr_convert(fp->swr, (uint8_t **)&fp->scratch, capacity,
+                    (const uint8_t **)frame->extended_data, frame->nb_samples);
+  if (ret < 0)
+    return ret;
+  return consume(fp, ret);
+}
+
+int audio_fingerprint_write(struct audio_fingerprint *fp, const char *path) {
+  int ret;
+
+  if (!fp->swr)
+    return AVERROR(EINVAL);
+
+  /* The resampler still holds its filter delay */
+  while (!fp->done) {
+    int capacity = swr_get_out_samples(fp->swr, 0);
+    if (capacity <= 0)
+      break;
+    av_fast_malloc(&fp->scratch, &fp->scratch_size,
+                   (size_t)capacity * sizeof(float));
+    if (!fp->scratch)
+      return AVERROR(ENOMEM);
+    ret = swr_convert(fp->swr, (uint8_t **)&fp->scratch, capacity, NULL, 0);
+    if (ret < 0)
+      return ret;
+    if (ret == 0)
+      break;
+    if ((ret = consume(fp, ret)) < 0)
+      return ret;
+  }
+
+  size_t size = (size_t)fp->nb_values * 4;
+  uint8_t *raw = av_malloc(size + 1);
+  char *text = av_malloc(AV_BASE64_SIZE(size));
+  if (!raw || !text) {
+    av_free(raw);
+    av_free(text);
+    return AVERROR(ENOMEM);
+  }
+  for (int i = 0; i < fp->nb_values; i++)
+    AV_WL32(raw + 4 * i, fp->values[i]);
+  if (!av_base64_encode(text, AV_BASE64_SIZE(size), raw, size))
+    text[0] = '\0';
+  av_free(raw);
+
+  FILE *file = fopen(path, "w");
+  if (!file) {
+    ret = AVERROR(errno);
+    av_free(text);
+    return ret;
+  }
+  fprintf(file,
+          "{\n  \"algorithm\": \"audx-chroma\",\n  \"version\": %d,\n"
+          "  \"sample_rate\": %d,\n  \"hop\": %d,\n  \"duration\": %.3f,\n"
+          "  \"values\": %d,\n  \"fingerprint\": \"%s\"\n}\n",
+          AUDIO_FINGERPRINT_VERSION, AUDIO_FINGERPRINT_RATE,
+          AUDIO_FINGERPRINT_HOP, (double)fp->samples / AUDIO_FINGERPRINT_RATE,
+          fp->nb_values, text);
+  av_free(text);
+
+  return fclose(file) == 0 ? 0 : AVERROR(EIO);
+}
+
+void audio_fingerprint_free(struct audio_fingerprint *fp) {
+  swr_free(&fp->swr);
+  av_tx_uninit(&fp->tx);
+  av_freep(&fp->block);
+  av_freep(&fp->window);
+  av_freep(&fp->fft_in);
+  av_freep(&fp->fft_out);
+  av_freep(&fp->bin_chroma);
+  av_freep(&fp->values);
+  av_freep(&fp->scratch);
+  fp->scratch_size = 0;
+}
@@ -0,0 +1,54 @@
+#include "../include/audio_memory.h"
+#include <errno.h>
+#include <libavutil/error.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+int64_t audio_memory_rss(void) {
+  long long size, resident;
+
+  /* statm: total and resident size in pages */
+  FILE *file = fopen("/proc/self/statm", "r");
+  if (file) {
+    int n = fscanf(file, "%lld %lld", &size, &resident);
+    fclose(file);
+    if (n == 2)
+      return (int64_t)resident * sysconf(_SC_PAGESIZE);
+  }
+
+  /* Without procfs only the peak is known, which bounds the current size */
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) < 0)
+    return AVERROR(errno);
+  return (int64_t)usage.ru_maxrss * 1024;
+}
+
+int audio_memory_init(struct audio_memory *mem, int64_t limit) {
+  memset(mem, 0, sizeof(*mem));
+  mem->limit = limit;
+
+  int64_t rss = audio_memory_rss();
+  if (rss < 0)
+    return (int)rss;
+  mem->baseline = mem->peak = rss;
+  return rss < limit ? 0 : AVERROR(EINVAL);
+}
+
+int64_t audio_memory_budget(const struct audio_memory *mem) {
+  return mem->limit - mem->baseline;
+}
+
+int audio_memory_check(struct audio_memory *mem) {
+  if (++mem->calls < AUDIO_MEMORY_CHECK_INTERVAL)
+    return 0;
+  mem->calls = 0;
+
+  int64_t rss = audio_memory_rss();
+  if (rss < 0)
+    return 0;
+  if (rss > mem->peak)
+    mem->peak = rss;
+  return rss > mem->limit ? AVERROR(ENOMEM) : 0;
+}
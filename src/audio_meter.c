@@ -0,0 +1,487 @@
+#include "../include/audio_meter.h"
+#include "../include/audio_dsp.h"
+#include <libavutil/channel_layout.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+#include <libavutil/samplefmt.h>
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define AUDIO_METER_SSE2 1
+#endif
+
+/* Per-group state sizes, in floats (4 lanes each) */
+#define BIQUAD_STATE 16
+#define TP_HISTORY (2 * AUDIO_METER_TP_TAPS * 4)
+
+/* ------------------------------------------------------------------------ */
+/* Setup                                                                    */
+/* ------------------------------------------------------------------------ */
+
+/**
+ * @brief Compute the BS.1770 K-weighting filters for any sample rate.
+ *
+ * The standard gives coefficients for 48 kHz only; these are the analog
+ * prototypes (high shelf at ~1682 Hz, +4 dB, and a ~38 Hz high-pass)
+ * re-derived with the bilinear transform, as done by libebur128.
+ */
+static void init_k_weighting(struct audio_meter *meter) {
+  double f0 = 1681.974450955533;
+  double gain_db = 3.999843853973347;
+  double q = 0.7071752369554196;
+  double k = tan(M_PI * f0 / meter->sample_rate);
+  double vh = pow(10.0, gain_db / 20.0);
+  double vb = pow(vh, 0.4996667741545416);
+  double a0 = 1.0 + k / q + k * k;
+
+  meter->shelf_b[0] = (vh + vb * k / q + k * k) / a0;
+  meter->shelf_b[1] = 2.0 * (k * k - vh) / a0;
+  meter->shelf_b[2] = (vh - vb * k / q + k * k) / a0;
+  meter->shelf_a[0] = 1.0f;
+  meter->shelf_a[1] = 2.0 * (k * k - 1.0) / a0;
+  meter->shelf_a[2] = (1.0 - k / q + k * k) / a0;
+
+  f0 = 38.13547087602444;
+  q = 0.5003270373238773;
+  k = tan(M_PI * f0 / meter->sample_rate);
+  a0 = 1.0 + k / q + k * k;
+
+  meter->hp_b[0] = 1.0f;
+  meter->hp_b[1] = -2.0f;
+  meter->hp_b[2] = 1.0f;
+  meter->hp_a[0] = 1.0f;
+  meter->hp_a[1] = 2.0 * (k * k - 1.0) / a0;
+  meter->hp_a[2] = (1.0 - k / q + k * k) / a0;
+}
+
+void audio_meter_true_peak_filter(
+    float coeffs[AUDIO_METER_OVERSAMPLE][AUDIO_METER_TP_TAPS]) {
+  const int len = AUDIO_METER_OVERSAMPLE * AUDIO_METER_TP_TAPS;
+  const int center = len / 2;
+
+  /* Hann-windowed sinc centred on a sample, so phase 0 reproduces the input
+   * exactly and only the phases in between need computing */
+  for (int p = 0; p < AUDIO_METER_OVERSAMPLE; p++) {
+    for (int j = 0; j < AUDIO_METER_TP_TAPS; j++) {
+      int n = p + AUDIO_METER_OVERSAMPLE * (AUDIO_METER_TP_TAPS - 1 - j);
+      double t = (double)(n - center) / AUDIO_METER_OVERSAMPLE;
+      double sinc = t == 0.0 ? 1.0 : sin(M_PI * t) / (M_PI * t);
+      double window = 0.5 - 0.5 * cos(2.0 * M_PI * n / len);
+      coeffs[p][j] = sinc * window;
+    }
+  }
+}
+
+/**
+ * @brief BS.1770 channel weight: 0 for LFE, 1.41 (+1.5 dB) for surrounds.
+ */
+static float channel_weight(const AVChannelLayout *layout, int index) {
+  switch (av_channel_layout_channel_from_index(layout, index)) {
+  case AV_CHAN_LOW_FREQUENCY:
+  case AV_CHAN_LOW_FREQUENCY_2:
+    return 0.0f;
+  case AV_CHAN_SIDE_LEFT:
+  case AV_CHAN_SIDE_RIGHT:
+  case AV_CHAN_BACK_LEFT:
+  case AV_CHAN_BACK_RIGHT:
+  case AV_CHAN_SURROUND_DIRECT_LEFT:
+  case AV_CHAN_SURROUND_DIRECT_RIGHT:
+    return 1.41f;
+  default:
+    return 1.0f;
+  }
+}
+
+/**
+ * @brief Fix the meter's format from the first frame and allocate its state.
+ */
+static int configure(struct audio_meter *meter, const AVFrame *frame) {
+  int channels = frame->ch_layout.nb_channels;
+
+  if (frame->sample_rate <= 0 || channels <= 0)
+    return AVERROR(EINVAL);
+
+  meter->sample_rate = frame->sample_rate;
+  meter->channels = channels;
+  meter->nb_groups = (channels + 3) / 4;
+  meter->step_samples = meter->sample_rate * AUDIO_METER_STEP_MS / 1000;
+
+  meter->weights = av_calloc(meter->nb_groups * 4, sizeof(float));
+  meter->biquad_state =
+      av_calloc(meter->nb_groups * BIQUAD_STATE, sizeof(float));
+  meter->tp_history = av_calloc(meter->nb_groups * TP_HISTORY, sizeof(float));
+  meter->true_peak = av_calloc(meter->nb_groups * 4, sizeof(float));
+  meter->sample_peak = av_calloc(meter->nb_groups * 4, sizeof(float));
+  if (!meter->weights || !meter->biquad_state || !meter->tp_history ||
+      !meter->true_peak || !meter->sample_peak)
+    return AVERROR(ENOMEM);
+
+  for (int c = 0; c < channels; c++)
+    meter->weights[c] = channel_weight(&frame->ch_layout, c);
+
+  init_k_weighting(meter);
+  audio_meter_true_peak_filter(meter->tp_coeffs);
+  return 0;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Kernels                                                                  */
+/* ------------------------------------------------------------------------ */
+
+/**
+ * @brief Convert `count` samples from `offset` into the scratch buffer as
+ *        normalized floats, four interleaved channels per group.
+ */
+static int convert_input(struct audio_meter *meter, const AVFrame *frame,
+                         int offset, int count) {
+  size_t size = (size_t)meter->nb_groups * count * 4 * sizeof(float);
+
+  av_fast_malloc(&meter->scratch, &meter->scratch_size, size);
+  if (!meter->scratch)
+    return AVERROR(ENOMEM);
+  /* Unused lanes of the last group stay silent */
+  if (meter->channels % 4)
+    memset(meter->scratch + (size_t)(meter->nb_groups - 1) * count * 4, 0,
+           (size_t)count * 4 * sizeof(float));
+
+  for (int c = 0; c < meter->channels; c++) {
+    float *dst = meter->scratch + (size_t)(c / 4) * count * 4 + c % 4;
+    int ret = audio_dsp_read_channel(frame, c, offset, count, dst, 4);
+    if (ret < 0)
+      return ret;
+  }
+  return 0;
+}
+
+/**
+ * @brief Run `count` samples of one channel group through the K-weighting
+ *        filters and the true-peak interpolator.
+ *
+ * @return The group's channel-weighted sum of squared K-weighted samples.
+ */
+static double process_group(struct audio_meter *meter, int g,
+                            const float *x, int count) {
+  float *state = meter->biquad_state + g * BIQUAD_STATE;
+  float *history = meter->tp_history + g * TP_HISTORY;
+  float *tp = meter->true_peak + g * 4;
+  float *sp = meter->sample_peak + g * 4;
+  const float *w = meter->weights + g * 4;
+  int pos = meter->tp_pos;
+  double energy = 0.0;
+
+#ifdef AUDIO_METER_SSE2
+  const __m128 sign = _mm_set1_ps(-0.0f);
+  const __m128 sb0 = _mm_set1_ps(meter->shelf_b[0]);
+  const __m128 sb1 = _mm_set1_ps(meter->shelf_b[1]);
+  const __m128 sb2 = _mm_set1_ps(meter->shelf_b[2]);
+  const __m128 sa1 = _mm_set1_ps(meter->shelf_a[1]);
+  const __m128 sa2 = _mm_set1_ps(meter->shelf_a[2]);
+  const __m128 ha1 = _mm_set1_ps(meter->hp_a[1]);
+  const __m128 ha2 = _mm_set1_ps(meter->hp_a[2]);
+  __m128 s1 = _mm_loadu_ps(state);
+  __m128 s2 = _mm_loadu_ps(state + 4);
+  __m128 h1 = _mm_loadu_ps(state + 8);
+  __m128 h2 = _mm_loadu_ps(state + 12);
+  __m128 tp_max = _mm_loadu_ps(tp);
+  __m128 sp_max = _mm_loadu_ps(sp);
+  __m128 acc = _mm_setzero_ps();
+
+  for (int i = 0; i < count; i++) {
+    __m128 in = _mm_loadu_ps(x + 4 * i);
+    sp_max = _mm_max_ps(sp_max, _mm_andnot_ps(sign, in));
+
+    /* High shelf, then the RLB high-pass (b = 1, -2, 1); transposed
+     * direct form II */
+    __m128 y = _mm_add_ps(_mm_mul_ps(sb0, in), s1);
+    s1 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(sb1, in), _mm_mul_ps(sa1, y)), s2);
+    s2 = _mm_sub_ps(_mm_mul_ps(sb2, in), _mm_mul_ps(sa2, y));
+    __m128 z = _mm_add_ps(y, h1);
+    h1 = _mm_sub_ps(_mm_sub_ps(h2, _mm_add_ps(y, y)), _mm_mul_ps(ha1, z));
+    h2 = _mm_sub_ps(y, _mm_mul_ps(ha2, z));
+    acc = _mm_add_ps(acc, _mm_mul_ps(z, z));
+
+    /* Interpolate the samples between the last two phase-0 points */
+    _mm_storeu_ps(history + 4 * pos, in);
+    _mm_storeu_ps(history + 4 * (pos + AUDIO_METER_TP_TAPS), in);
+    const float *win = history + 4 * (pos + 1);
+    for (int p = 1; p < AUDIO_METER_OVERSAMPLE; p++) {
+      const float *coef = meter->tp_coeffs[p];
+      __m128 sum = _mm_setzero_ps();
+      for (int j = 0; j < AUDIO_METER_TP_TAPS; j++)
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(coef[j]),
+                                         _mm_loadu_ps(win + 4 * j)));
+      tp_max = _mm_max_ps(tp_max, _mm_andnot_ps(sign, sum));
+    }
+    if (++pos == AUDIO_METER_TP_TAPS)
+      pos = 0;
+  }
+
+  float lanes[4];
+  _mm_storeu_ps(lanes, acc);
+  for (int l = 0; l < 4; l++)
+    energy += (double)w[l] * lanes[l];
+
+  _mm_storeu_ps(state, s1);
+  _mm_storeu_ps(state + 4, s2);
+  _mm_storeu_ps(state + 8, h1);
+  _mm_storeu_ps(state + 12, h2);
+  _mm_storeu_ps(tp, tp_max);
+  _mm_storeu_ps(sp, sp_max);
+#else
+  for (int l = 0; l < 4; l++) {
+    float s1 = state[l], s2 = state[4 + l];
+    float h1 = state[8 + l], h2 = state[12 + l];
+    float acc = 0.0f;
+    int lpos = pos;
+
+    for (int i = 0; i < count; i++) {
+      float in = x[4 * i + l];
+      if (fabsf(in) > sp[l])
+        sp[l] = fabsf(in);
+
+      float y = meter->shelf_b[0] * in + s1;
+      s1 = meter->shelf_b[1] * in - meter->shelf_a[1] * y + s2;
+      s2 = meter->shelf_b[2] * in - meter->shelf_a[2] * y;
+      float z = y + h1;
+      h1 = h2 - 2.0f * y - meter->hp_a[1] * z;
+      h2 = y - meter->hp_a[2] * z;
+      acc += z * z;
+
+      history[4 * lpos + l] = in;
+      history[4 * (lpos + AUDIO_METER_TP_TAPS) + l] = in;
+      const float *win = history + 4 * (lpos + 1) + l;
+      for (int p = 1; p < AUDIO_METER_OVERSAMPLE; p++) {
+        float sum = 0.0f;
+        for (int j = 0; j < AUDIO_METER_TP_TAPS; j++)
+          sum += meter->tp_coeffs[p][j] * win[4 * j];
+        if (fabsf(sum) > tp[l])
+          tp[l] = fabsf(sum);
+      }
+      if (++lpos == AUDIO_METER_TP_TAPS)
+        lpos = 0;
+    }
+
+    state[l] = s1;
+    state[4 + l] = s2;
+    state[8 + l] = h1;
+    state[12 + l] = h2;
+    energy += (double)w[l] * acc;
+  }
+#endif
+
+  return energy;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Gating                                                                   */
+/* ------------------------------------------------------------------------ */
+
+static double energy_to_lufs(double energy) {
+  return energy > 0.0 ? -0.691 + 10.0 * log10(energy) : -HUGE_VAL;
+}
+
+/**
+ * @brief Add a block to a gating histogram. Blocks below the absolute gate
+ *        (-70 LUFS) are dropped.
+ */
+static void add_block(int64_t *hist, double *energy_sum, double energy) {
+  double lufs = energy_to_lufs(energy);
+  if (lufs < AUDIO_METER_HIST_MIN)
+    return;
+
+  int bin = (int)((lufs - AUDIO_METER_HIST_MIN) * 10.0);
+  if (bin >= AUDIO_METER_HIST_BINS)
+    bin = AUDIO_METER_HIST_BINS - 1;
+  hist[bin]++;
+  energy_sum[bin] += energy;
+}
+
+/**
+ * @brief Lowest histogram bin at or above `lufs`.
+ */
+static int gate_bin(double lufs) {
+  int bin = (int)ceil((lufs - AUDIO_METER_HIST_MIN) * 10.0 - 0.5);
+  return bin < 0 ? 0 : bin;
+}
+
+/**
+ * @brief Close the current sub-block and update the momentary and
+ *        short-term windows ending there.
+ */
+static void end_step(struct audio_meter *meter) {
+  meter->steps[meter->nb_steps % AUDIO_METER_SHORT_TERM_STEPS] =
+      meter->step_energy / meter->step_filled;
+  meter->nb_steps++;
+  meter->step_energy = 0.0;
+  meter->step_filled = 0;
+
+  /* Silence lets the filter state decay into denormals, which are slow */
+  for (int i = 0; i < meter->nb_groups * BIQUAD_STATE; i++)
+    if (fabsf(meter->biquad_state[i]) < 1e-30f)
+      meter->biquad_state[i] = 0.0f;
+
+  if (meter->nb_steps >= AUDIO_METER_MOMENTARY_STEPS) {
+    double sum = 0.0;
+    for (int i = 1; i <= AUDIO_METER_MOMENTARY_STEPS; i++)
+      sum += meter->steps[(meter->nb_steps - i) % AUDIO_METER_SHORT_TERM_STEPS];
+    double energy = sum / AUDIO_METER_MOMENTARY_STEPS;
+    add_block(meter->block_hist, meter->block_energy, energy);
+    meter->momentary_max =
+        fmax(meter->momentary_max, energy_to_lufs(energy));
+  }
+
+  if (meter->nb_steps >= AUDIO_METER_SHORT_TERM_STEPS) {
+    double sum = 0.0;
+    for (int i = 0; i < AUDIO_METER_SHORT_TERM_STEPS; i++)
+      sum += meter->steps[i];
+    double energy = sum / AUDIO_METER_SHORT_TERM_STEPS;
+    add_block(meter->short_hist, meter->short_energy, energy);
+    meter->short_term_max =
+        fmax(meter->short_term_max, energy_to_lufs(energy));
+  }
+}
+
+/* ------------------------------------------------------------------------ */
+/* Public API                                                               */
+/* ------------------------------------------------------------------------ */
+
+void audio_meter_init(struct audio_meter *meter) {
+  memset(meter, 0, sizeof(*meter));
+  meter->momentary_max = -HUGE_VAL;
+  meter->short_term_max = -HUGE_VAL;
+}
+
+int audio_meter_process(struct audio_meter *meter, const AVFrame *frame) {
+  int ret;
+
+  if (!meter->sample_rate) {
+    if ((ret = configure(meter, frame)) < 0)
+      return ret;
+  } else if (frame->sample_rate != meter->sample_rate ||
+             frame->ch_layout.nb_channels != meter->channels) {
+    return AVERROR(EINVAL);
+  }
+
+  /* Process in runs that end on sub-block boundaries */
+  for (int offset = 0; offset < frame->nb_samples;) {
+    int count = meter->step_samples - meter->step_filled;
+    if (count > frame->nb_samples - offset)
+      count = frame->nb_samples - offset;
+
+    if ((ret = convert_input(meter, frame, offset, count)) < 0)
+      return ret;
+    for (int g = 0; g < meter->nb_groups; g++)
+      meter->step_energy += process_group(
+          meter, g, meter->scratch + (size_t)g * count * 4, count);
+    meter->tp_pos = (meter->tp_pos + count) % AUDIO_METER_TP_TAPS;
+
+    meter->step_filled += count;
+    if (meter->step_filled == meter->step_samples)
+      end_step(meter);
+    offset += count;
+  }
+
+  meter->samples += frame->nb_samples;
+  return 0;
+}
+
+void audio_meter_result(const struct audio_meter *meter,
+                        struct audio_loudness *result) {
+  memset(result, 0, sizeof(*result));
+  result->samples = meter->samples;
+  result->sample_rate = meter->sample_rate;
+  result->momentary_max = meter->momentary_max;
+  result->short_term_max = meter->short_term_max;
+
+  /* Integrated: mean of the blocks above the absolute gate, then of those
+   * less than 10 LU below that mean */
+  double sum = 0.0;
+  int64_t count = 0;
+  for (int i = 0; i < AUDIO_METER_HIST_BINS; i++) {
+    sum += meter->block_energy[i];
+    count += meter->block_hist[i];
+  }
+  result->integrated = -HUGE_VAL;
+  if (count > 0) {
+    int gate = gate_bin(energy_to_lufs(sum / count) - 10.0);
+    sum = 0.0;
+    count = 0;
+    for (int i = gate; i < AUDIO_METER_HIST_BINS; i++) {
+      sum += meter->block_energy[i];
+      count += meter->block_hist[i];
+    }
+    if (count > 0)
+      result->integrated = energy_to_lufs(sum / count);
+  }
+
+  /* Range: 10th to 95th percentile of the short-term blocks less than
+   * 20 LU below their mean */
+  sum = 0.0;
+  count = 0;
+  for (int i = 0; i < AUDIO_METER_HIST_BINS; i++) {
+    sum += meter->short_energy[i];
+    count += meter->short_hist[i];
+  }
+  if (count > 0) {
+    int gate = gate_bin(energy_to_lufs(sum / count) - 20.0);
+    count = 0;
+    for (int i = gate; i < AUDIO_METER_HIST_BINS; i++)
+      count += meter->short_hist[i];
+
+    int64_t lo_rank = (int64_t)(count * 0.10);
+    int64_t hi_rank = (int64_t)(count * 0.95);
+    int lo = -1, hi = -1;
+    int64_t seen = 0;
+    for (int i = gate; i < AUDIO_METER_HIST_BINS && hi < 0; i++) {
+      seen += meter->short_hist[i];
+      if (lo < 0 && seen > lo_rank)
+        lo = i;
+      if (seen > hi_rank)
+        hi = i;
+    }
+    if (lo >= 0 && hi >= 0)
+      result->range = (hi - lo) / 10.0;
+  }
+
+  float true_peak = 0.0f, sample_peak = 0.0f;
+  for (int c = 0; c < meter->channels; c++) {
+    true_peak = fmaxf(true_peak, meter->true_peak[c]);
+    sample_peak = fmaxf(sample_peak, meter->sample_peak[c]);
+  }
+  /* Phase 0 of the interpolator is the sample itself */
+  true_peak = fmaxf(true_peak, sample_peak);
+  result->true_peak = true_peak > 0.0f ? 20.0 * log10(true_peak) : -HUGE_VAL;
+  result->sample_peak =
+      sample_peak > 0.0f ? 20.0 * log10(sample_peak) : -HUGE_VAL;
+}
+
+static void write_json_value(FILE *file, const char *name, double value,
+                             const char *sep) {
+  if (isfinite(value))
+    fprintf(file, "\"%s\": %.2f%s", name, value, sep);
+  else
+    fprintf(file, "\"%s\": null%s", name, sep);
+}
+
+void audio_meter_write_json(const struct audio_loudness *result, FILE *file) {
+  fputc('{', file);
+  write_json_value(file, "integrated_lufs", result->integrated, ", ");
+  write_json_value(file, "range_lu", result->range, ", ");
+  write_json_value(file, "true_peak_dbtp", result->true_peak, ", ");
+  write_json_value(file, "sample_peak_dbfs", result->sample_peak, ", ");
+  write_json_value(file, "momentary_max_lufs", result->momentary_max, ", ");
+  write_json_value(file, "short_term_max_lufs", result->short_term_max, "");
+  fputc('}', file);
+}
+
+void audio_meter_free(struct audio_meter *meter) {
+  av_freep(&meter->weights);
+  av_freep(&meter->biquad_state);
+  av_freep(&meter->tp_history);
+  av_freep(&meter->true_peak);
+  av_freep(&meter->sample_peak);
+  av_freep(&meter->scratch);
+  meter->scratch_size = 0;
+}
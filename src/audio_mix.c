@@ -0,0 +1,333 @@
+#include "../include/audio_mix.h"
+#include "../include/audio_dsp.h"
+#include <errno.h>
+#include <libavutil/common.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * @brief Wake the threads sleeping in wait_for(), if any.
+ *
+ * Called after moving a queue index. The index and `waiting` are sequentially
+ * consistent, so either the sleeper sees the new index before sleeping or
+ * this sees the sleeper and signals under the lock it sleeps with.
+ */
+static void notify(struct audio_mix *mix) {
+  if (atomic_load(&mix->waiting) == 0)
+    return;
+  pthread_mutex_lock(&mix->lock);
+  pthread_cond_broadcast(&mix->cond);
+  pthread_mutex_unlock(&mix->lock);
+}
+
+/**
+ * @brief Sleep until `index` moves away from `seen`, `eof` (if not NULL)
+ *        is set or the mix stops.
+ */
+static void wait_for(struct audio_mix *mix, atomic_uint *index, unsigned seen,
+                     atomic_int *eof) {
+  pthread_mutex_lock(&mix->lock);
+  atomic_fetch_add(&mix->waiting, 1);
+  while (atomic_load(index) == seen && !(eof && atomic_load(eof)) &&
+         !atomic_load(&mix->abort))
+    pthread_cond_wait(&mix->cond, &mix->lock);
+  atomic_fetch_sub(&mix->waiting, 1);
+  pthread_mutex_unlock(&mix->lock);
+}
+
+/**
+ * @brief Ramp the start of an input up from silence.
+ */
+static int fade_in(struct audio_mix_input *in, uint8_t *data, int nb_samples) {
+  int channels = in->mix->channels;
+  int n = (int)FFMIN(nb_samples, in->fade - in->decoded);
+
+  av_fast_malloc(&in->ramp, &in->ramp_size,
+                 (size_t)n * channels * sizeof(*in->ramp));
+  if (!in->ramp)
+    return AVERROR(ENOMEM);
+  for (int i = 0; i < n; i++) {
+    float gain = (float)(in->decoded + i) / in->fade;
+    for (int c = 0; c < channels; c++)
+      in->ramp[i * channels + c] = gain;
+  }
+  audio_dsp_gains_s16((int16_t *)data, in->ramp, n * channels);
+  return 0;
+}
+
+/**
+ * @brief Pool job: open (unless already open) and decode one input into its
+ *        queue.
+ */
+static void decode_input(void *arg) {
+  struct audio_mix_input *in = arg;
+  struct audio_mix *mix = in->mix;
+  uint8_t *data;
+  int size, ret = 0;
+
+  if (!in->open) {
+    ret = audio_dec_init(&in->decoder, in->path, mix->sample_rate,
+                         &mix->ch_layout, mix->resample_quality, 0);
+    if (ret < 0)
+      fprintf(stderr, "Cannot open %s\n", in->path);
+    in->open = ret >= 0;
+  }
+
+  while (ret >= 0 && !atomic_load(&mix->abort) &&
+         (ret = audio_decoder_read(&in->decoder, &data, &size)) > 0) {
+    if (!data || size <= 0)
+      continue;
+
+    int nb_samples = size / mix->frame_bytes;
+    if (in->decoded < in->fade && (ret = fade_in(in, data, nb_samples)) < 0) {
+      av_free(data);
+      break;
+    }
+    in->decoded += nb_samples;
+
+    /* Wait for a free slot */
+    unsigned tail = atomic_load(&in->tail);
+    unsigned head;
+    while ((head = atomic_load(&in->head)) + AUDIO_MIX_QUEUE == tail &&
+           !atomic_load(&mix->abort))
+      wait_for(mix, &in->head, head, NULL);
+    if (atomic_load(&mix->abort)) {
+      av_free(data);
+      break;
+    }
+
+    in->queue[tail % AUDIO_MIX_QUEUE] =
+        (struct audio_mix_chunk){data, nb_samples};
+    atomic_store(&in->tail, tail + 1);
+    notify(mix);
+  }
+
+  in->ret = ret;
+  atomic_store(&in->eof, 1);
+  notify(mix);
+}
+
+int audio_mix_init(struct audio_mix *mix,
+                   const struct audio_mix_source *sources, int nb_inputs,
+                   int sample_rate, const AVChannelLayout *ch_layout,
+                   enum audio_resample_quality resample_quality, int flags) {
+  int ret;
+
+  memset(mix, 0, sizeof(*mix));
+  mix->flags = flags;
+  mix->resample_quality = resample_quality;
+  if (nb_inputs < 1)
+    return AVERROR(EINVAL);
+
+  if (pthread_mutex_init(&mix->lock, NULL) != 0)
+    return AVERROR(ENOMEM);
+  if (pthread_cond_init(&mix->cond, NULL) != 0) {
+    pthread_mutex_destroy(&mix->lock);
+    return AVERROR(ENOMEM);
+  }
+  mix->sync_init = 1;
+
+  mix->inputs = av_calloc(nb_inputs, sizeof(*mix->inputs));
+  if (!mix->inputs) {
+    ret = AVERROR(ENOMEM);
+    goto fail;
+  }
+  mix->nb_inputs = nb_inputs;
+
+  /* The first input decides the format the others are converted to */
+  struct audio_dec *first = &mix->inputs[0].decoder;
+  ret = audio_dec_init(first, sources[0].path, sample_rate, ch_layout,
+                       resample_quality, 0);
+  if (ret < 0) {
+    fprintf(stderr, "Cannot open %s\n", sources[0].path);
+    goto fail;
+  }
+  mix->inputs[0].open = 1;
+  mix->sample_rate = first->sample_rate;
+  mix->channels = first->channels;
+  mix->format = first->dst_fmt;
+  if ((ret = av_channel_layout_copy(&mix->ch_layout,
+                                    &first->dst_ch_layout)) < 0)
+    goto fail;
+  mix->frame_bytes = mix->channels * av_get_bytes_per_sample(mix->format);
+
+  for (int i = 0; i < nb_inputs; i++) {
+    struct audio_mix_input *in = &mix->inputs[i];
+    in->mix = mix;
+    in->path = sources[i].path;
+    in->gain = (float)pow(10.0, sources[i].gain / 20.0);
+    in->offset = FFMAX(llrint(sources[i].offset * mix->sample_rate), 0);
+    in->fade = FFMAX(llrint(sources[i].fade * mix->sample_rate), 0);
+  }
+
+  mix->acc = av_malloc_array((size_t)AUDIO_MIX_BLOCK * mix->channels,
+                             sizeof(*mix->acc));
+  if (!mix->acc) {
+    ret = AVERROR(ENOMEM);
+    goto fail;
+  }
+
+  /* One thread per input: every decoder runs whenever its queue has room */
+  if ((ret = audio_pool_init(&mix->pool, nb_inputs)) < 0)
+    goto fail;
+  for (int i = 0; i < nb_inputs; i++)
+    if ((ret = audio_pool_submit(&mix->pool, decode_input,
+                                 &mix->inputs[i])) < 0)
+      goto fail;
+  return 0;
+
+fail:
+  audio_mix_free(mix);
+  return ret;
+}
+
+/**
+ * @brief Take the input's next chunk, waiting for its decoder thread.
+ *
+ * @return 1 with a chunk in `in->current`, 0 at the end of the input, or a
+ * negative AVERROR code from its thread.
+ */
+static int next_chunk(struct audio_mix *mix, struct audio_mix_input *in) {
+  av_freep(&in->current.data);
+  in->current.nb_samples = 0;
+  in->current_pos = 0;
+
+  unsigned head = atomic_load(&in->head);
+  for (;;) {
+    if (atomic_load(&in->tail) != head)
+      break;
+    /* eof is set after the last chunk was queued */
+    if (atomic_load(&in->eof)) {
+      if (atomic_load(&in->tail) != head)
+        break;
+      return in->ret < 0 ? in->ret : 0;
+    }
+    wait_for(mix, &in->tail, head, &in->eof);
+  }
+
+  in->current = in->queue[head % AUDIO_MIX_QUEUE];
+  atomic_store(&in->head, head + 1);
+  notify(mix);
+  return 1;
+}
+
+/**
+ * @brief Add an input to the accumulator from block offset `from` up to
+ *        `to`, or until it ends.
+ *
+ * @return Block offset reached, or a negative AVERROR code.
+ */
+static int mix_input(struct audio_mix *mix, struct audio_mix_input *in,
+                     int from, int to) {
+  int channels = mix->channels;
+  int at = from, ret;
+
+  while (at < to) {
+    if (in->current_pos == in->current.nb_samples) {
+      if ((ret = next_chunk(mix, in)) < 0)
+        return ret;
+      if (ret == 0) {
+        in->finished = 1;
+        break;
+      }
+    }
+    int n = FFMIN(to - at, in->current.nb_samples - in->current_pos);
+    audio_dsp_mix_s16(mix->acc + (size_t)at * channels,
+                      (const int16_t *)in->current.data +
+                          (size_t)in->current_pos * channels,
+                      n * channels, in->gain);
+    at += n;
+    in->current_pos += n;
+  }
+  return at;
+}
+
+int audio_mix_read(struct audio_mix *mix, uint8_t **out_data, int *out_size) {
+  int block = AUDIO_MIX_BLOCK;
+  int length = 0, open = 0;
+
+  *out_data = NULL;
+  *out_size = 0;
+  if (mix->done)
+    return 0;
+
+  memset(mix->acc, 0, (size_t)block * mix->channels * sizeof(*mix->acc));
+
+  for (int i = 0; i < mix->nb_inputs; i++) {
+    struct audio_mix_input *in = &mix->inputs[i];
+    if (in->finished)
+      continue;
+
+    /* Not started yet: silence for this whole block */
+    int64_t start = in->offset - mix->position;
+    if (start >= block) {
+      open = 1;
+      continue;
+    }
+
+    int at = mix_input(mix, in, (int)FFMAX(start, 0), block);
+    if (at < 0)
+      return at;
+    length = FFMAX(length, at);
+    if (!in->finished)
+      open = 1;
+
+    /* The first input ended: the others only fill the block up to there */
+    if (i == 0 && in->finished && (mix->flags & AUDIO_MIX_END_FIRST)) {
+      block = length = at;
+      open = 0;
+    }
+  }
+
+  if (open)
+    length = block;
+  else
+    mix->done = 1;
+  if (length == 0)
+    return 0;
+
+  int16_t *out = av_malloc((size_t)length * mix->frame_bytes);
+  if (!out)
+    return AVERROR(ENOMEM);
+  audio_dsp_store_s16(out, mix->acc, length * mix->channels);
+  mix->position += length;
+
+  *out_data = (uint8_t *)out;
+  *out_size = length * mix->frame_bytes;
+  return 1;
+}
+
+void audio_mix_free(struct audio_mix *mix) {
+  if (mix->sync_init) {
+    /* Wake decoder threads waiting for room, then wait for them */
+    atomic_store(&mix->abort, 1);
+    pthread_mutex_lock(&mix->lock);
+    pthread_cond_broadcast(&mix->cond);
+    pthread_mutex_unlock(&mix->lock);
+  }
+  audio_pool_free(&mix->pool);
+
+  for (int i = 0; i < mix->nb_inputs; i++) {
+    struct audio_mix_input *in = &mix->inputs[i];
+    unsigned tail = atomic_load(&in->tail);
+    for (unsigned j = atomic_load(&in->head); j != tail; j++)
+      av_free(in->queue[j % AUDIO_MIX_QUEUE].data);
+    av_freep(&in->current.data);
+    av_freep(&in->ramp);
+    if (in->open)
+      audio_dec_free(&in->decoder);
+  }
+  av_freep(&mix->inputs);
+  mix->nb_inputs = 0;
+
+  if (mix->sync_init) {
+    pthread_cond_destroy(&mix->cond);
+    pthread_mutex_destroy(&mix->lock);
+    mix->sync_init = 0;
+  }
+  av_freep(&mix->acc);
+  av_channel_layout_uninit(&mix->ch_layout);
+}
@@ -0,0 +1,457 @@
+#include "../include/audio_normalize.h"
+#include "../include/audio_dsp.h"
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+#include <libavutil/murmur3.h>
+#include <libavutil/samplefmt.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+/* Samples between the newest input and the sample the detector finishes */
+#define DETECT_DELAY (AUDIO_METER_TP_TAPS / 2)
+
+/* ------------------------------------------------------------------------ */
+/* Sample conversion                                                        */
+/* ------------------------------------------------------------------------ */
+
+#define FROM_FLOAT(type, expr)                                                 \
+  do {                                                                         \
+    for (int c = 0; c < channels; c++) {                                       \
+      type *dst = planar ? (type *)frame->extended_data[c]                     \
+                         : (type *)frame->data[0] + c;                         \
+      int stride = planar ? 1 : channels;                                      \
+      for (int i = 0; i < count; i++) {                                        \
+        float v = src[i * channels + c];                                       \
+        dst[i * stride] = (expr);                                              \
+      }                                                                        \
+    }                                                                          \
+  } while (0)
+
+/**
+ * @brief Convert the first `count` samples of a frame to interleaved floats.
+ */
+static int to_float(const AVFrame *frame, float *dst, int count) {
+  int channels = frame->ch_layout.nb_channels;
+  int ret;
+
+  for (int c = 0; c < channels; c++)
+    if ((ret = audio_dsp_read_channel(frame, c, 0, count, dst + c,
+                                      channels)) < 0)
+      return ret;
+  return 0;
+}
+
+/**
+ * @brief Write `count` interleaved floats back into a frame, saturating
+ *        integer formats.
+ */
+static void from_float(AVFrame *frame, const float *src, int count) {
+  int channels = frame->ch_layout.nb_channels;
+  int planar = av_sample_fmt_is_planar(frame->format);
+
+  switch (av_get_packed_sample_fmt(frame->format)) {
+  case AV_SAMPLE_FMT_S16:
+    FROM_FLOAT(int16_t, (int16_t)lrintf(fminf(fmaxf(v * 32768.0f, -32768.0f),
+                                              32767.0f)));
+    break;
+  case AV_SAMPLE_FMT_S32:
+    FROM_FLOAT(int32_t, (int32_t)llrint(fmin(fmax(v * 2147483648.0,
+                                                  -2147483648.0),
+                                             2147483647.0)));
+    break;
+  case AV_SAMPLE_FMT_FLT:
+    FROM_FLOAT(float, v);
+    break;
+  default:
+    FROM_FLOAT(double, v);
+    break;
+  }
+}
+
+/* ------------------------------------------------------------------------ */
+/* Gain and limiter                                                         */
+/* ------------------------------------------------------------------------ */
+
+/**
+ * @brief Scale a frame in place by the constant gain.
+ */
+static void apply_gain(struct audio_normalizer *norm, AVFrame *frame) {
+  int planar = av_sample_fmt_is_planar(frame->format);
+  int nb_planes = planar ? frame->ch_layout.nb_channels : 1;
+  int count = frame->nb_samples * (planar ? 1 : frame->ch_layout.nb_channels);
+
+  for (int p = 0; p < nb_planes; p++) {
+    uint8_t *data = frame->extended_data[p];
+
+    switch (av_get_packed_sample_fmt(frame->format)) {
+    case AV_SAMPLE_FMT_S16:
+      audio_dsp_gain_s16((int16_t *)data, count, norm->gain);
+      break;
+    case AV_SAMPLE_FMT_FLT:
+      audio_dsp_gain_flt((float *)data, count, norm->gain);
+      break;
+    case AV_SAMPLE_FMT_S32: {
+      int32_t *s = (int32_t *)data;
+      for (int i = 0; i < count; i++)
+        s[i] = (int32_t)llrint(
+            fmin(fmax(s[i] * (double)norm->gain, -2147483648.0), 2147483647.0));
+      break;
+    }
+    default: {
+      double *s = (double *)data;
+      for (int i = 0; i < count; i++)
+        s[i] *= norm->gain;
+      break;
+    }
+    }
+  }
+}
+
+/**
+ * @brief Run `count` interleaved samples through the limiter.
+ *
+ * `out` receives the delayed input and `gains` the gain of each of its
+ * values; the caller multiplies them with the SIMD gain kernel. `in` and
+ * `out` may be the same buffer: an output sample is never written ahead of
+ * the input being read.
+ *
+ * @return Number of samples written to `out`.
+ */
+static int limit(struct audio_normalizer *norm, const float *in, float *out,
+                 float *gains, int count) {
+  const int channels = norm->ch_layout.nb_channels;
+  const int lookahead = norm->lookahead;
+  const int ring = norm->delay + 1;
+  int written = 0;
+
+  for (int i = 0; i < count; i++) {
+    int64_t n = norm->consumed++;
+    float *slot = norm->delay_line + (n % ring) * channels;
+    memcpy(slot, in + i * channels, channels * sizeof(float));
+
+    /* Largest interpolated value between samples n-6 and n-5 */
+    float interval = 0.0f;
+    for (int c = 0; c < channels; c++) {
+      float *history = norm->tp_history + c * 2 * AUDIO_METER_TP_TAPS;
+      history[norm->tp_pos] = slot[c];
+      history[norm->tp_pos + AUDIO_METER_TP_TAPS] = slot[c];
+      const float *win = history + norm->tp_pos + 1;
+      for (int p = 1; p < AUDIO_METER_OVERSAMPLE; p++) {
+        float sum = 0.0f;
+        for (int j = 0; j < AUDIO_METER_TP_TAPS; j++)
+          sum += norm->tp_coeffs[p][j] * win[j];
+        interval = fmaxf(interval, fabsf(sum));
+      }
+    }
+    if (++norm->tp_pos == AUDIO_METER_TP_TAPS)
+      norm->tp_pos = 0;
+
+    int64_t k = n - DETECT_DELAY;
+    if (k < 0) {
+      norm->prev_interval = interval;
+      continue;
+    }
+
+    /* Peak around sample k: the sample and both adjacent intervals */
+    const float *xk = norm->delay_line + (k % ring) * channels;
+    float peak = fmaxf(interval, norm->prev_interval);
+    for (int c = 0; c < channels; c++)
+      peak = fmaxf(peak, fabsf(xk[c]));
+    norm->prev_interval = interval;
+
+    float level = peak * norm->gain;
+    float gain = level > norm->ceiling ? norm->ceiling / level : 1.0f;
+
+    /* Sliding minimum over [k - lookahead + 1, k]: the deque holds sample
+     * indices with increasing gains, the front is the minimum */
+    if (norm->deque_len > 0 &&
+        norm->deque[norm->deque_head] <= k - lookahead) {
+      norm->deque_head = (norm->deque_head + 1) % lookahead;
+      norm->deque_len--;
+    }
+    while (norm->deque_len > 0) {
+      int back = (norm->deque_head + norm->deque_len - 1) % lookahead;
+      if (norm->gains[norm->deque[back] % lookahead] < gain)
+        break;
+      norm->deque_len--;
+    }
+    norm->deque[(norm->deque_head + norm->deque_len) % lookahead] = k;
+    norm->deque_len++;
+    norm->gains[k % lookahead] = gain;
+
+    /* Moving average of the minimums, then release */
+    int64_t j = k - lookahead + 1;
+    float minimum = norm->gains[norm->deque[norm->deque_head] % lookahead];
+    float *old = norm->minimums + ((j % lookahead) + lookahead) % lookahead;
+    norm->minimum_sum += minimum - *old;
+    *old = minimum;
+    float env = norm->envelope + (1.0f - norm->envelope) * norm->release;
+    env = fminf(env, (float)(norm->minimum_sum / lookahead));
+    norm->envelope = env;
+
+    if (j < 0)
+      continue;
+
+    const float *xj = norm->delay_line + (j % ring) * channels;
+    float g = norm->gain * env;
+    memcpy(out + written * channels, xj, channels * sizeof(float));
+    for (int c = 0; c < channels; c++)
+      gains[written * channels + c] = g;
+    written++;
+
+    if (env < 1.0f) {
+      norm->limited++;
+      norm->min_gain = fminf(norm->min_gain, env);
+    }
+  }
+
+  return written;
+}
+
+void audio_normalize_init(struct audio_normalizer *norm, double gain_db,
+                          double true_peak_db, double ceiling_db) {
+  memset(norm, 0, sizeof(*norm));
+  norm->gain = pow(10.0, gain_db / 20.0);
+  norm->ceiling = pow(10.0, ceiling_db / 20.0);
+  norm->format = -1;
+  norm->min_gain = 1.0f;
+  norm->envelope = 1.0f;
+
+  /* No sample can reach the ceiling: a plain gain is enough */
+  norm->limit = true_peak_db + gain_db > ceiling_db;
+}
+
+/**
+ * @brief Fix the format from the first frame and set up the limiter.
+ */
+static int configure(struct audio_normalizer *norm, const AVFrame *frame) {
+  int ret;
+
+  norm->sample_rate = frame->sample_rate;
+  norm->format = frame->format;
+  if ((ret = av_channel_layout_copy(&norm->ch_layout, &frame->ch_layout)) < 0)
+    return ret;
+  if (!norm->limit)
+    return 0;
+
+  int channels = frame->ch_layout.nb_channels;
+  norm->lookahead = norm->sample_rate * AUDIO_NORMALIZE_LOOKAHEAD_MS / 1000;
+  if (norm->lookahead < 1)
+    norm->lookahead = 1;
+  norm->delay = DETECT_DELAY + norm->lookahead - 1;
+  norm->release = 1.0f - expf(-1000.0f / ((float)AUDIO_NORMALIZE_RELEASE_MS *
+                                          norm->sample_rate));
+  audio_meter_true_peak_filter(norm->tp_coeffs);
+
+  norm->tp_history =
+      av_calloc(channels * 2 * AUDIO_METER_TP_TAPS, sizeof(float));
+  norm->gains = av_calloc(norm->lookahead, sizeof(float));
+  norm->deque = av_calloc(norm->lookahead, sizeof(*norm->deque));
+  norm->minimums = av_calloc(norm->lookahead, sizeof(float));
+  norm->delay_line =
+      av_calloc((size_t)(norm->delay + 1) * channels, sizeof(float));
+  if (!norm->tp_history || !norm->gains || !norm->deque || !norm->minimums ||
+      !norm->delay_line)
+    return AVERROR(ENOMEM);
+
+  /* Before the start the gain is unity */
+  for (int i = 0; i < norm->lookahead; i++)
+    norm->minimums[i] = 1.0f;
+  norm->minimum_sum = norm->lookahead;
+  return 0;
+}
+
+int audio_normalize_process(struct audio_normalizer *norm, AVFrame *frame) {
+  int ret;
+
+  if (norm->format < 0) {
+    if ((ret = configure(norm, frame)) < 0)
+      return ret;
+  } else if (frame->format != norm->format ||
+             frame->sample_rate != norm->sample_rate ||
+             frame->ch_layout.nb_channels != norm->ch_layout.nb_channels) {
+    return AVERROR(EINVAL);
+  }
+  if ((ret = av_frame_make_writable(frame)) < 0)
+    return ret;
+
+  if (!norm->limit) {
+    apply_gain(norm, frame);
+    return 0;
+  }
+
+  int channels = norm->ch_layout.nb_channels;
+  size_t size = (size_t)frame->nb_samples * channels * sizeof(float);
+  av_fast_malloc(&norm->scratch, &norm->scratch_size, size);
+  av_fast_malloc(&norm->sample_gains, &norm->sample_gains_size, size);
+  if (!norm->scratch || !norm->sample_gains)
+    return AVERROR(ENOMEM);
+
+  if ((ret = to_float(frame, norm->scratch, frame->nb_samples)) < 0)
+    return ret;
+  int count = limit(norm, norm->scratch, norm->scratch, norm->sample_gains,
+                    frame->nb_samples);
+  audio_dsp_gains_flt(norm->scratch, norm->sample_gains, count * channels);
+  from_float(frame, norm->scratch, count);
+  frame->nb_samples = count;
+  return 0;
+}
+
+int audio_normalize_flush(struct audio_normalizer *norm, AVFrame *frame) {
+  int ret;
+
+  av_frame_unref(frame);
+  if (!norm->limit || norm->consumed == 0)
+    return 0;
+
+  /* Push silence until the last real sample comes out */
+  int tail = norm->delay;
+  int channels = norm->ch_layout.nb_channels;
+  size_t size = (size_t)tail * channels * sizeof(float);
+  av_fast_malloc(&norm->scratch, &norm->scratch_size, size);
+  av_fast_malloc(&norm->sample_gains, &norm->sample_gains_size, size);
+  if (!norm->scratch || !norm->sample_gains)
+    return AVERROR(ENOMEM);
+  memset(norm->scratch, 0, size);
+
+  int64_t end = norm->consumed;
+  int count = limit(norm, norm->scratch, norm->scratch, norm->sample_gains,
+                    tail);
+  audio_dsp_gains_flt(norm->scratch, norm->sample_gains, count * channels);
+  if (count > end)
+    count = end;
+  if (count == 0)
+    return 0;
+
+  frame->format = norm->format;
+  frame->sample_rate = norm->sample_rate;
+  frame->nb_samples = count;
+  if ((ret = av_channel_layout_copy(&frame->ch_layout, &norm->ch_layout)) <
+          0 ||
+      (ret = av_frame_get_buffer(frame, 0)) < 0)
+    return ret;
+  from_float(frame, norm->scratch, count);
+  return 0;
+}
+
+void audio_normalize_free(struct audio_normalizer *norm) {
+  av_freep(&norm->tp_history);
+  av_freep(&norm->gains);
+  av_freep(&norm->deque);
+  av_freep(&norm->minimums);
+  av_freep(&norm->delay_line);
+  av_freep(&norm->scratch);
+  norm->scratch_size = 0;
+  av_freep(&norm->sample_gains);
+  norm->sample_gains_size = 0;
+  av_channel_layout_uninit(&norm->ch_layout);
+}
+
+/* ------------------------------------------------------------------------ */
+/* Measurement cache                                                        */
+/* ------------------------------------------------------------------------ */
+
+int audio_normalize_key(const char *path, const char *settings, char key[33]) {
+  struct stat st;
+  uint8_t buf[1 << 16];
+  uint8_t hash[16];
+  size_t got;
+  int ret = 0;
+
+  if (stat(path, &st) < 0 || !S_ISREG(st.st_mode))
+    return AVERROR(ENOTSUP);
+
+  FILE *file = fopen(path, "rb");
+  if (!file)
+    return AVERROR(errno);
+  struct AVMurMur3 *ctx = av_murmur3_alloc();
+  if (!ctx) {
+    fclose(file);
+    return AVERROR(ENOMEM);
+  }
+
+  av_murmur3_init(ctx);
+  while ((got = fread(buf, 1, sizeof(buf), file)) > 0)
+    av_murmur3_update(ctx, buf, got);
+  if (ferror(file))
+    ret = AVERROR(EIO);
+  av_murmur3_update(ctx, (const uint8_t *)settings, strlen(settings));
+  av_murmur3_final(ctx, hash);
+
+  for (int i = 0; i < 16; i++)
+    snprintf(key + 2 * i, 3, "%02x", hash[i]);
+
+  av_free(ctx);
+  fclose(file);
+  return ret;
+}
+
+/**
+ * @brief Path of the sidecar file of an input.
+ */
+static char *sidecar_path(const char *path) {
+  size_t len = strlen(path) + sizeof(AUDIO_NORMALIZE_SIDECAR);
+  char *sidecar = av_malloc(len);
+  if (sidecar)
+    snprintf(sidecar, len, "%s%s", path, AUDIO_NORMALIZE_SIDECAR);
+  return sidecar;
+}
+
+int audio_normalize_cache_load(const char *path, const char *key,
+                               struct audio_loudness *result) {
+  char line[512], name[33];
+  struct audio_loudness entry;
+  long long samples;
+  int found = 0;
+
+  char *sidecar = sidecar_path(path);
+  FILE *file = sidecar ? fopen(sidecar, "r") : NULL;
+  av_free(sidecar);
+  if (!file)
+    return 0;
+
+  /* One "<key> <I> <LRA> <TP> <SP> <M max> <S max> <samples> <rate>" line
+   * per measurement; the last match wins */
+  while (fgets(line, sizeof(line), file)) {
+    memset(&entry, 0, sizeof(entry));
+    if (sscanf(line, "%32s %lf %lf %lf %lf %lf %lf %lld %d", name,
+               &entry.integrated, &entry.range, &entry.true_peak,
+               &entry.sample_peak, &entry.momentary_max,
+               &entry.short_term_max, &samples, &entry.sample_rate) == 9 &&
+        strcmp(name, key) == 0) {
+      entry.samples = samples;
+      *result = entry;
+      found = 1;
+    }
+  }
+
+  fclose(file);
+  return found;
+}
+
+int audio_normalize_cache_store(const char *path, const char *key,
+                                const struct audio_loudness *result) {
+  char line[512];
+
+  char *sidecar = sidecar_path(path);
+  if (!sidecar)
+    return AVERROR(ENOMEM);
+  FILE *file = fopen(sidecar, "a");
+  av_free(sidecar);
+  if (!file)
+    return AVERROR(errno);
+
+  /* A single write keeps concurrent appends from interleaving */
+  int len = snprintf(line, sizeof(line),
+                     "%s %.17g %.17g %.17g %.17g %.17g %.17g %lld %d\n", key,
+                     result->integrated, result->range, result->true_peak,
+                     result->sample_peak, result->momentary_max,
+                     result->short_term_max, (long long)result->samples,
+                     result->sample_rate);
+  int ret = fwrite(line, 1, len, file) == (size_t)len ? 0 : AVERROR(EIO);
+  if (fclose(file) != 0 && ret == 0)
+    ret = AVERROR(EIO);
+  return ret;
+}
@@ -0,0 +1,293 @@
+#define _GNU_SOURCE /* copy_file_range() */
+#include "../include/audio_output_cache.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libavutil/avstring.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+#include <libavutil/murmur3.h>
+#include <libavutil/time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#endif
+
+/**
+ * @brief Entry seen while enforcing the size cap.
+ */
+struct cache_entry {
+  char *path;
+  int64_t size;
+  int64_t mtime;
+};
+
+static char *entry_path(const struct audio_output_cache *cache,
+                        const char *key) {
+  return av_asprintf("%s/%s", cache->dir, key);
+}
+
+/**
+ * @brief Copy a file's bytes to an empty file.
+ *
+ * The copy never shares an inode with `src`, so rewriting either file in
+ * place leaves the other intact. It is a reflink where the file system
+ * supports one (Btrfs, XFS, bcachefs), otherwise an in-kernel
+ * copy_file_range(), and read()/write() as the last resort.
+ */
+static int copy_file(const char *src, int out) {
+  uint8_t buf[1 << 16];
+  ssize_t n = -1;
+  int ret = 0;
+
+  int in = open(src, O_RDONLY);
+  if (in < 0)
+    return AVERROR(errno);
+
+#ifdef __linux__
+  if (ioctl(out, FICLONE, in) == 0) {
+    close(in);
+    return 0;
+  }
+  while ((n = copy_file_range(in, NULL, out, NULL, 1 << 30, 0)) > 0)
+    ;
+  /* Unsupported between these file systems: read() and write() go on from
+   * the file offsets it left */
+  if (n < 0 && errno != EXDEV && errno != ENOSYS && errno != EOPNOTSUPP &&
+      errno != EINVAL)
+    ret = AVERROR(errno);
+#endif
+
+  if (ret == 0 && n < 0) {
+    while ((n = read(in, buf, sizeof(buf))) > 0) {
+      if (write(out, buf, n) != n) {
+        ret = AVERROR(EIO);
+        break;
+      }
+    }
+    if (n < 0 && ret == 0)
+      ret = AVERROR(errno);
+  }
+  close(in);
+  return ret;
+}
+
+/**
+ * @brief Create `dst` as a copy of `src` under a temporary name, then
+ *        rename it into place.
+ *
+ * @param tmp mkstemp() template on the file system of `dst`; freed.
+ */
+static int publish(const char *src, const char *dst, char *tmp) {
+  int ret = 0;
+
+  if (!tmp)
+    return AVERROR(ENOMEM);
+  int fd = mkstemp(tmp);
+  if (fd < 0) {
+    ret = AVERROR(errno);
+    av_free(tmp);
+    return ret;
+  }
+  /* mkstemp() creates the file private; give it the usual permissions */
+  mode_t mask = umask(0);
+  umask(mask);
+  fchmod(fd, 0666 & ~mask);
+
+  ret = copy_file(src, fd);
+  if (close(fd) < 0 && ret == 0)
+    ret = AVERROR(errno);
+  if (ret == 0 && rename(tmp, dst) < 0)
+    ret = AVERROR(errno);
+  if (ret < 0)
+    unlink(tmp);
+  av_free(tmp);
+  return ret;
+}
+
+static int compare_mtime(const void *a, const void *b) {
+  const struct cache_entry *x = a, *y = b;
+  return (x->mtime > y->mtime) - (x->mtime < y->mtime);
+}
+
+/**
+ * @brief Remove least recently used entries until the directory fits the
+ *        size cap.
+ */
+static int evict(struct audio_output_cache *cache) {
+  struct cache_entry *entries = NULL;
+  int nb_entries = 0, capacity = 0;
+  int64_t total = 0;
+  struct dirent *de;
+  int ret = 0;
+
+  DIR *dir = opendir(cache->dir);
+  if (!dir)
+    return AVERROR(errno);
+
+  while ((de = readdir(dir))) {
+    struct stat st;
+    if (de->d_name[0] == '.')
+      continue;
+    char *path = entry_path(cache, de->d_name);
+    if (!path) {
+      ret = AVERROR(ENOMEM);
+      break;
+    }
+    if (stat(path, &st) < 0 || !S_ISREG(st.st_mode)) {
+      av_free(path);
+      continue;
+    }
+    if (nb_entries == capacity) {
+      capacity = capacity ? capacity * 2 : 64;
+      struct cache_entry *grown =
+          av_realloc_array(entries, capacity, sizeof(*entries));
+      if (!grown) {
+        av_free(path);
+        ret = AVERROR(ENOMEM);
+        break;
+      }
+      entries = grown;
+    }
+    entries[nb_entries++] = (struct cache_entry){
+        .path = path, .size = st.st_size, .mtime = st.st_mtime};
+    total += st.st_size;
+  }
+  closedir(dir);
+
+  if (ret == 0 && total > cache->max_size) {
+    qsort(entries, nb_entries, sizeof(*entries), compare_mtime);
+    for (int i = 0; i < nb_entries && total > cache->max_size; i++) {
+      if (unlink(entries[i].path) == 0) {
+        total -= entries[i].size;
+        cache->evicted++;
+      }
+    }
+  }
+
+  for (int i = 0; i < nb_entries; i++)
+    av_free(entries[i].path);
+  av_free(entries);
+  return ret;
+}
+
+int audio_output_cache_init(struct audio_output_cache *cache, const char *dir,
+                            int64_t max_size, int fast) {
+  struct stat st;
+
+  memset(cache, 0, sizeof(*cache));
+  cache->max_size = max_size > 0 ? max_size : AUDIO_OUTPUT_CACHE_SIZE;
+  cache->fast = fast;
+
+  if (mkdir(dir, 0777) < 0 && errno != EEXIST)
+    return AVERROR(errno);
+  if (stat(dir, &st) < 0)
+    return AVERROR(errno);
+  if (!S_ISDIR(st.st_mode))
+    return AVERROR(ENOTDIR);
+
+  cache->dir = av_strdup(dir);
+  return cache->dir ? 0 : AVERROR(ENOMEM);
+}
+
+int audio_output_cache_key(const struct audio_output_cache *cache,
+                           const char *input, const char *settings,
+                           char key[33]) {
+  struct stat st;
+  uint8_t hash[16];
+  int ret = 0;
+
+  if (stat(input, &st) < 0 || !S_ISREG(st.st_mode))
+    return AVERROR(ENOTSUP);
+
+  struct AVMurMur3 *ctx = av_murmur3_alloc();
+  if (!ctx)
+    return AVERROR(ENOMEM);
+  av_murmur3_init(ctx);
+
+  if (cache->fast) {
+    char meta[160];
+    snprintf(meta, sizeof(meta), "meta:%lld:%lld.%09ld:%llu:%llu;",
+             (long long)st.st_size, (long long)st.st_mtim.tv_sec,
+             (long)st.st_mtim.tv_nsec, (unsigned long long)st.st_dev,
+             (unsigned long long)st.st_ino);
+    av_murmur3_update(ctx, (const uint8_t *)meta, strlen(meta));
+  } else {
+    uint8_t buf[1 << 16];
+    size_t got;
+    FILE *file = fopen(input, "rb");
+    if (!file) {
+      ret = AVERROR(errno);
+      av_free(ctx);
+      return ret;
+    }
+    av_murmur3_update(ctx, (const uint8_t *)"data:", 5);
+    while ((got = fread(buf, 1, sizeof(buf), file)) > 0)
+      av_murmur3_update(ctx, buf, got);
+    if (ferror(file))
+      ret = AVERROR(EIO);
+    fclose(file);
+  }
+  av_murmur3_update(ctx, (const uint8_t *)settings, strlen(settings));
+  av_murmur3_final(ctx, hash);
+  av_free(ctx);
+
+  for (int i = 0; i < 16; i++)
+    snprintf(key + 2 * i, 3, "%02x", hash[i]);
+  return ret;
+}
+
+int audio_output_cache_fetch(struct audio_output_cache *cache,
+                             const char *key, const char *output) {
+  int64_t start = av_gettime_relative();
+  struct stat st;
+  int ret;
+
+  char *path = entry_path(cache, key);
+  if (!path)
+    return AVERROR(ENOMEM);
+  if (stat(path, &st) < 0 || !S_ISREG(st.st_mode)) {
+    av_free(path);
+    cache->misses++;
+    return 0;
+  }
+
+  /* Refresh the entry for the LRU order. A copy, not a link: writers
+   * truncate existing outputs in place, which would rewrite the entry */
+  utime(path, NULL);
+  ret = publish(path, output, av_asprintf("%s.XXXXXX", output));
+  av_free(path);
+  if (ret < 0)
+    return ret;
+
+  cache->hits++;
+  cache->hit_us += av_gettime_relative() - start;
+  return 1;
+}
+
+int audio_output_cache_store(struct audio_output_cache *cache,
+                             const char *key, const char *output) {
+  int ret;
+
+  char *path = entry_path(cache, key);
+  if (!path)
+    return AVERROR(ENOMEM);
+  /* A copy, so later changes to the output cannot alter the entry */
+  ret = publish(output, path, av_asprintf("%s/.%s.XXXXXX", cache->dir, key));
+  av_free(path);
+  if (ret < 0)
+    return ret;
+
+  cache->stores++;
+  return evict(cache);
+}
+
+void audio_output_cache_free(struct audio_output_cache *cache) {
+  av_freep(&cache->dir);
+}
@@ -0,0 +1,58 @@
+#include "../include/audio_pacer.h"
+#include <libavutil/time.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+void audio_pacer_init(struct audio_pacer *pacer, int64_t spin_us,
+                      int64_t late_us) {
+  memset(pacer, 0, sizeof(*pacer));
+  pacer->spin_us = spin_us > 0 ? spin_us : AUDIO_PACER_SPIN_US;
+  pacer->late_us = late_us > 0 ? late_us : AUDIO_PACER_LATE_US;
+}
+
+/**
+ * @brief Sleep until an absolute av_gettime_relative() time.
+ *
+ * av_gettime_relative() is based on CLOCK_MONOTONIC, so the deadline can be
+ * passed to clock_nanosleep() as is, without drift from relative sleeps.
+ */
+static void sleep_until(int64_t deadline) {
+  struct timespec ts = {
+      .tv_sec = deadline / 1000000,
+      .tv_nsec = (deadline % 1000000) * 1000,
+  };
+
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+    ;
+}
+
+int64_t audio_pacer_wait(struct audio_pacer *pacer, int64_t pts_us) {
+  int64_t now = av_gettime_relative();
+
+  if (!pacer->started) {
+    pacer->base_time = now;
+    pacer->base_pts = pts_us;
+    pacer->started = 1;
+  }
+
+  int64_t deadline = pacer->base_time + (pts_us - pacer->base_pts);
+
+  /* Coarse sleep, then spin through the scheduler's wake-up jitter */
+  if (deadline - now > pacer->spin_us)
+    sleep_until(deadline - pacer->spin_us);
+  while ((now = av_gettime_relative()) < deadline)
+    ;
+
+  int64_t lateness = now - deadline;
+  int64_t jitter = lateness < 0 ? -lateness : lateness;
+
+  pacer->packets++;
+  pacer->jitter_sum += jitter;
+  if (jitter > pacer->jitter_max)
+    pacer->jitter_max = jitter;
+  if (lateness > pacer->late_us)
+    pacer->late++;
+
+  return lateness;
+}
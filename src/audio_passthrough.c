@@ -0,0 +1,208 @@
+#define _GNU_SOURCE /* copy_file_range() */
+#include "../include/audio_passthrough.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <libavutil/common.h>
+#include <libavutil/error.h>
+#include <libavutil/intreadwrite.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+#define WAVE_FORMAT_PCM 0x0001
+#define WAVE_FORMAT_EXTENSIBLE 0xfffe
+
+/**
+ * @brief Read exactly `size` bytes at `offset`.
+ */
+static int read_at(int fd, int64_t offset, uint8_t *buf, size_t size) {
+  return pread(fd, buf, size, offset) == (ssize_t)size ? 0 : -1;
+}
+
+/**
+ * @brief Walk the chunks of a RIFF/WAVE file up to its data chunk.
+ */
+static int probe_wav(struct audio_passthrough *pt, int fd, int64_t file_size) {
+  uint8_t chunk[8], fmt[40];
+  int64_t pos = 12;
+  int have_fmt = 0;
+
+  while (read_at(fd, pos, chunk, 8) == 0) {
+    uint32_t size = AV_RL32(chunk + 4);
+    pos += 8;
+
+    if (!memcmp(chunk, "fmt ", 4)) {
+      if (size < 16 || read_at(fd, pos, fmt, FFMIN(size, sizeof(fmt))) < 0)
+        return 0;
+      int tag = AV_RL16(fmt);
+      int bits = AV_RL16(fmt + 14);
+
+      /* Extensible: the sub-format GUID starts with the format tag */
+      if (tag == WAVE_FORMAT_EXTENSIBLE) {
+        if (size < 40 || AV_RL16(fmt + 18) != 16)
+          return 0;
+        pt->channel_mask = AV_RL32(fmt + 20);
+        tag = AV_RL16(fmt + 24);
+      }
+      pt->channels = AV_RL16(fmt + 2);
+      pt->sample_rate = AV_RL32(fmt + 4);
+      if (tag != WAVE_FORMAT_PCM || bits != 16 || pt->channels <= 0 ||
+          pt->sample_rate <= 0 || AV_RL16(fmt + 12) != 2 * pt->channels)
+        return 0;
+      have_fmt = 1;
+    } else if (!memcmp(chunk, "data", 4)) {
+      if (!have_fmt)
+        return 0;
+      pt->offset = pos;
+      /* Streamed files leave the size unset: the data runs to the end */
+      pt->size = size == 0 || size == UINT32_MAX ? file_size - pos : size;
+      return 1;
+    }
+    pos += size + (size & 1);
+  }
+  return 0;
+}
+
+/**
+ * @brief Walk the chunks of an AIFF-C file: only 'sowt' compression holds
+ *        little-endian samples.
+ */
+static int probe_aifc(struct audio_passthrough *pt, int fd) {
+  uint8_t chunk[8], comm[22], ssnd[8];
+  int64_t pos = 12;
+  int have_comm = 0;
+
+  while (read_at(fd, pos, chunk, 8) == 0) {
+    uint32_t size = AV_RB32(chunk + 4);
+    pos += 8;
+
+    if (!memcmp(chunk, "COMM", 4)) {
+      if (size < 22 || read_at(fd, pos, comm, 22) < 0)
+        return 0;
+      /* 80-bit extended float rate: only whole rates are usable */
+      int exp = (AV_RB16(comm + 8) & 0x7fff) - 16383 - 63;
+      uint64_t mantissa = AV_RB64(comm + 10);
+      if (exp > 0 || exp < -63 ||
+          (mantissa & ((UINT64_C(1) << -exp) - 1)) != 0)
+        return 0;
+      pt->channels = AV_RB16(comm);
+      pt->sample_rate = (int)(mantissa >> -exp);
+      if (AV_RB16(comm + 6) != 16 || memcmp(comm + 18, "sowt", 4) ||
+          pt->channels <= 0 || pt->sample_rate <= 0)
+        return 0;
+      have_comm = 1;
+    } else if (!memcmp(chunk, "SSND", 4)) {
+      if (!have_comm || size < 8 || read_at(fd, pos, ssnd, 8) < 0)
+        return 0;
+      uint32_t skip = AV_RB32(ssnd);
+      if (skip > size - 8)
+        return 0;
+      pt->offset = pos + 8 + skip;
+      pt->size = size - 8 - skip;
+      return 1;
+    }
+    pos += size + (size & 1);
+  }
+  return 0;
+}
+
+int audio_passthrough_probe(struct audio_passthrough *pt, const char *path) {
+  uint8_t header[12];
+  struct stat st;
+  int found = 0;
+
+  memset(pt, 0, sizeof(*pt));
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return 0;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+      read_at(fd, 0, header, 12) == 0) {
+    if (!memcmp(header, "RIFF", 4) && !memcmp(header + 8, "WAVE", 4))
+      found = probe_wav(pt, fd, st.st_size);
+    else if (!memcmp(header, "FORM", 4) && !memcmp(header + 8, "AIFC", 4))
+      found = probe_aifc(pt, fd);
+  }
+  close(fd);
+  if (!found)
+    return 0;
+
+  /* Truncated files end early; a partial last sample frame is dropped */
+  int frame_bytes = 2 * pt->channels;
+  pt->size = FFMIN(pt->size, st.st_size - pt->offset);
+  pt->size -= pt->size % frame_bytes;
+  return pt->size >= 0;
+}
+
+/**
+ * @brief Copy `size` bytes of `in` from `offset` to the position of `out`,
+ *        in the kernel where possible.
+ *
+ * Each method continues where the previous one stopped; a method the file
+ * systems do not support fails on its first call.
+ */
+static int copy_range(struct audio_passthrough *pt, int in, int out,
+                      int64_t offset, int64_t size) {
+  off_t off = offset;
+  int64_t end = offset + size;
+  ssize_t n = 0;
+
+#ifdef __linux__
+  pt->method = "copy_file_range";
+  while (off < end &&
+         (n = copy_file_range(in, &off, out, NULL, end - off, 0)) > 0)
+    ;
+  if (off < end && n < 0 && errno != EXDEV && errno != ENOSYS &&
+      errno != EOPNOTSUPP && errno != EINVAL)
+    return AVERROR(errno);
+
+  if (off < end && n != 0) {
+    pt->method = "sendfile";
+    while (off < end && (n = sendfile(out, in, &off, end - off)) > 0)
+      ;
+    if (off < end && n < 0 && errno != ENOSYS && errno != EINVAL)
+      return AVERROR(errno);
+  }
+#endif
+
+  if (off < end && n != 0) {
+    uint8_t buf[1 << 16];
+    pt->method = "read/write";
+    while (off < end &&
+           (n = pread(in, buf, FFMIN(end - off, (int64_t)sizeof(buf)), off)) >
+               0) {
+      if (write(out, buf, n) != n)
+        return AVERROR(EIO);
+      off += n;
+    }
+    if (n < 0)
+      return AVERROR(errno);
+  }
+
+  pt->copied = off - offset;
+  /* The input shrank while being copied */
+  return off < end ? AVERROR(EIO) : 0;
+}
+
+int audio_passthrough_copy(struct audio_passthrough *pt, const char *input,
+                           const char *output) {
+  int ret;
+
+  int in = open(input, O_RDONLY);
+  if (in < 0)
+    return AVERROR(errno);
+  int out = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (out < 0) {
+    ret = AVERROR(errno);
+    close(in);
+    return ret;
+  }
+
+  ret = copy_range(pt, in, out, pt->offset, pt->size);
+  close(in);
+  if (close(out) < 0 && ret == 0)
+    ret = AVERROR(errno);
+  return ret;
+}
@@ -0,0 +1,252 @@
+#include "../include/audio_peaks.h"
+#include "../include/audio_dsp.h"
+#include <float.h>
+#include <libavutil/error.h>
+#include <libavutil/intreadwrite.h>
+#include <libavutil/mem.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Header, level table entry and value sizes of the file format */
+#define HEADER_SIZE 32
+#define LEVEL_ENTRY_SIZE 24
+#define BUCKET_VALUES 3
+
+/**
+ * @brief Start an empty partial bucket.
+ */
+static void reset_bucket(struct audio_peaks *peaks,
+                         struct audio_peaks_level *level) {
+  for (int c = 0; c < peaks->channels; c++) {
+    level->min[c] = FLT_MAX;
+    level->max[c] = -FLT_MAX;
+    level->sumsq[c] = 0.0;
+  }
+  level->filled = 0;
+}
+
+/**
+ * @brief Fix the format from the first frame and allocate the levels.
+ */
+static int configure(struct audio_peaks *peaks, const AVFrame *frame) {
+  if (frame->sample_rate <= 0 || frame->ch_layout.nb_channels <= 0)
+    return AVERROR(EINVAL);
+
+  peaks->sample_rate = frame->sample_rate;
+  peaks->channels = frame->ch_layout.nb_channels;
+  peaks->planes = av_calloc(peaks->channels, sizeof(*peaks->planes));
+  if (!peaks->planes)
+    return AVERROR(ENOMEM);
+
+  for (int l = 0; l < AUDIO_PEAKS_LEVELS; l++) {
+    struct audio_peaks_level *level = &peaks->levels[l];
+    level->samples_per_bucket = AUDIO_PEAKS_BASE << l;
+    level->min = av_calloc(peaks->channels, sizeof(float));
+    level->max = av_calloc(peaks->channels, sizeof(float));
+    level->sumsq = av_calloc(peaks->channels, sizeof(double));
+    if (!level->min || !level->max || !level->sumsq)
+      return AVERROR(ENOMEM);
+    reset_bucket(peaks, level);
+  }
+  return 0;
+}
+
+static inline int16_t quantize(float v) {
+  return (int16_t)lrintf(fminf(fmaxf(v, -1.0f), 1.0f) * 32767.0f);
+}
+
+/**
+ * @brief Store the partial bucket of level `l`, merge it into the level
+ *        above and start a new one.
+ */
+static int finish_bucket(struct audio_peaks *peaks, int l) {
+  struct audio_peaks_level *level = &peaks->levels[l];
+  int bucket_size = peaks->channels * BUCKET_VALUES * sizeof(int16_t);
+
+  if (level->nb_buckets == level->capacity) {
+    int64_t capacity = level->capacity ? level->capacity * 2 : 1024;
+    uint8_t *data = av_realloc(level->data, capacity * bucket_size);
+    if (!data)
+      return AVERROR(ENOMEM);
+    level->data = data;
+    level->capacity = capacity;
+  }
+
+  uint8_t *dst = level->data + level->nb_buckets * bucket_size;
+  for (int c = 0; c < peaks->channels; c++) {
+    AV_WL16(dst, quantize(level->min[c]));
+    AV_WL16(dst + 2, quantize(level->max[c]));
+    AV_WL16(dst + 4, quantize(sqrt(level->sumsq[c] / level->filled)));
+    dst += BUCKET_VALUES * sizeof(int16_t);
+  }
+  level->nb_buckets++;
+
+  if (l + 1 < AUDIO_PEAKS_LEVELS) {
+    struct audio_peaks_level *parent = &peaks->levels[l + 1];
+    for (int c = 0; c < peaks->channels; c++) {
+      parent->min[c] = fminf(parent->min[c], level->min[c]);
+      parent->max[c] = fmaxf(parent->max[c], level->max[c]);
+      parent->sumsq[c] += level->sumsq[c];
+    }
+    parent->filled += level->filled;
+  }
+  reset_bucket(peaks, level);
+
+  if (l + 1 < AUDIO_PEAKS_LEVELS &&
+      peaks->levels[l + 1].filled == peaks->levels[l + 1].samples_per_bucket)
+    return finish_bucket(peaks, l + 1);
+  return 0;
+}
+
+void audio_peaks_init(struct audio_peaks *peaks) {
+  memset(peaks, 0, sizeof(*peaks));
+}
+
+int audio_peaks_process(struct audio_peaks *peaks, const AVFrame *frame) {
+  struct audio_peaks_level *base = &peaks->levels[0];
+  int ret;
+
+  if (!peaks->channels) {
+    if ((ret = configure(peaks, frame)) < 0)
+      return ret;
+  } else if (frame->sample_rate != peaks->sample_rate ||
+             frame->ch_layout.nb_channels != peaks->channels) {
+    return AVERROR(EINVAL);
+  }
+
+  av_fast_malloc(&peaks->scratch, &peaks->scratch_size,
+                 (size_t)frame->nb_samples * peaks->channels * sizeof(float));
+  if (!peaks->scratch)
+    return AVERROR(ENOMEM);
+  for (int c = 0; c < peaks->channels; c++)
+    peaks->planes[c] = peaks->scratch + (size_t)c * frame->nb_samples;
+  if ((ret = audio_dsp_read_float(frame, 0, frame->nb_samples,
+                                  peaks->planes)) < 0)
+    return ret;
+
+  /* Reduce runs that end on bucket boundaries of the finest level */
+  for (int offset = 0; offset < frame->nb_samples;) {
+    int count = base->samples_per_bucket - base->filled;
+    if (count > frame->nb_samples - offset)
+      count = frame->nb_samples - offset;
+
+    for (int c = 0; c < peaks->channels; c++)
+      audio_dsp_stats_flt(peaks->planes[c] + offset, count, &base->min[c],
+                          &base->max[c], &base->sumsq[c]);
+    base->filled += count;
+    offset += count;
+
+    if (base->filled == base->samples_per_bucket &&
+        (ret = finish_bucket(peaks, 0)) < 0)
+      return ret;
+  }
+
+  peaks->samples += frame->nb_samples;
+  return 0;
+}
+
+/**
+ * @brief Write the JSON description of a peaks file.
+ */
+static int write_json(const struct audio_peaks *peaks, const char *path,
+                      const int64_t *offsets) {
+  size_t len = strlen(path) + sizeof(".json");
+  char *json_path = av_malloc(len);
+  if (!json_path)
+    return AVERROR(ENOMEM);
+  snprintf(json_path, len, "%s.json", path);
+  FILE *file = fopen(json_path, "w");
+  av_free(json_path);
+  if (!file)
+    return AVERROR(errno);
+
+  fprintf(file,
+          "{\n  \"format\": \"audx-peaks\",\n  \"version\": %d,\n"
+          "  \"sample_rate\": %d,\n  \"channels\": %d,\n"
+          "  \"samples\": %lld,\n"
+          "  \"values\": [\"min\", \"max\", \"rms\"],\n"
+          "  \"type\": \"int16le\",\n  \"scale\": 32767,\n  \"levels\": [\n",
+          AUDIO_PEAKS_VERSION, peaks->sample_rate, peaks->channels,
+          (long long)peaks->samples);
+  for (int l = 0; l < AUDIO_PEAKS_LEVELS; l++)
+    fprintf(file,
+            "    {\"samples_per_bucket\": %d, \"buckets\": %lld, "
+            "\"offset\": %lld}%s\n",
+            peaks->levels[l].samples_per_bucket,
+            (long long)peaks->levels[l].nb_buckets, (long long)offsets[l],
+            l + 1 < AUDIO_PEAKS_LEVELS ? "," : "");
+  fprintf(file, "  ]\n}\n");
+
+  return fclose(file) == 0 ? 0 : AVERROR(EIO);
+}
+
+int audio_peaks_write(struct audio_peaks *peaks, const char *path) {
+  uint8_t header[HEADER_SIZE + AUDIO_PEAKS_LEVELS * LEVEL_ENTRY_SIZE];
+  int64_t offsets[AUDIO_PEAKS_LEVELS];
+  static const uint8_t zeros[8] = {0};
+  int ret;
+
+  if (!peaks->channels)
+    return AVERROR(EINVAL);
+
+  /* The last buckets of each level cover the end of the audio */
+  for (int l = 0; l < AUDIO_PEAKS_LEVELS; l++)
+    if (peaks->levels[l].filled > 0 && (ret = finish_bucket(peaks, l)) < 0)
+      return ret;
+
+  memset(header, 0, sizeof(header));
+  memcpy(header, AUDIO_PEAKS_MAGIC, 8);
+  AV_WL32(header + 8, AUDIO_PEAKS_VERSION);
+  AV_WL32(header + 12, peaks->sample_rate);
+  AV_WL32(header + 16, peaks->channels);
+  AV_WL32(header + 20, AUDIO_PEAKS_LEVELS);
+  AV_WL64(header + 24, peaks->samples);
+
+  int bucket_size = peaks->channels * BUCKET_VALUES * sizeof(int16_t);
+  int64_t offset = sizeof(header);
+  for (int l = 0; l < AUDIO_PEAKS_LEVELS; l++) {
+    uint8_t *entry = header + HEADER_SIZE + l * LEVEL_ENTRY_SIZE;
+    offset = (offset + 7) & ~7LL;
+    offsets[l] = offset;
+    AV_WL32(entry, peaks->levels[l].samples_per_bucket);
+    AV_WL64(entry + 8, peaks->levels[l].nb_buckets);
+    AV_WL64(entry + 16, offset);
+    offset += peaks->levels[l].nb_buckets * bucket_size;
+  }
+
+  FILE *file = fopen(path, "wb");
+  if (!file)
+    return AVERROR(errno);
+
+  ret = 0;
+  int64_t pos = sizeof(header);
+  if (fwrite(header, 1, sizeof(header), file) != sizeof(header))
+    ret = AVERROR(EIO);
+  for (int l = 0; l < AUDIO_PEAKS_LEVELS && ret == 0; l++) {
+    size_t size = peaks->levels[l].nb_buckets * bucket_size;
+    size_t pad = offsets[l] - pos;
+    if ((pad && fwrite(zeros, 1, pad, file) != pad) ||
+        (size && fwrite(peaks->levels[l].data, 1, size, file) != size))
+      ret = AVERROR(EIO);
+    pos = offsets[l] + size;
+  }
+  if (fclose(file) != 0 && ret == 0)
+    ret = AVERROR(EIO);
+  if (ret < 0)
+    return ret;
+
+  return write_json(peaks, path, offsets);
+}
+
+void audio_peaks_free(struct audio_peaks *peaks) {
+  for (int l = 0; l < AUDIO_PEAKS_LEVELS; l++) {
+    av_freep(&peaks->levels[l].data);
+    av_freep(&peaks->levels[l].min);
+    av_freep(&peaks->levels[l].max);
+    av_freep(&peaks->levels[l].sumsq);
+  }
+  av_freep(&peaks->planes);
+  av_freep(&peaks->scratch);
+  peaks->scratch_size = 0;
+}
@@ -0,0 +1,113 @@
+#include "../include/audio_pool.h"
+#include <libavutil/cpu.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * @brief Worker loop: pop jobs until the pool shuts down.
+ */
+static void *worker(void *opaque) {
+  struct audio_pool *pool = opaque;
+
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    while (!pool->head && !pool->quit)
+      pthread_cond_wait(&pool->work_cond, &pool->lock);
+    if (!pool->head && pool->quit)
+      break;
+
+    struct audio_pool_job *job = pool->head;
+    pool->head = job->next;
+    if (!pool->head)
+      pool->tail = NULL;
+    pthread_mutex_unlock(&pool->lock);
+
+    job->fn(job->arg);
+    av_free(job);
+
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->pending == 0)
+      pthread_cond_broadcast(&pool->done_cond);
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return NULL;
+}
+
+int audio_pool_init(struct audio_pool *pool, int nb_threads) {
+  memset(pool, 0, sizeof(*pool));
+
+  if (nb_threads <= 0)
+    nb_threads = av_cpu_count();
+  if (nb_threads <= 0)
+    nb_threads = 1;
+
+  pool->threads = av_calloc(nb_threads, sizeof(*pool->threads));
+  if (!pool->threads)
+    return AVERROR(ENOMEM);
+
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->work_cond, NULL);
+  pthread_cond_init(&pool->done_cond, NULL);
+
+  for (int i = 0; i < nb_threads; i++) {
+    if (pthread_create(&pool->threads[i], NULL, worker, pool) != 0) {
+      fprintf(stderr, "Failed to start pool thread %d\n", i);
+      audio_pool_free(pool);
+      return AVERROR(EAGAIN);
+    }
+    pool->nb_threads++;
+  }
+
+  return 0;
+}
+
+int audio_pool_submit(struct audio_pool *pool, audio_pool_fn fn, void *arg) {
+  struct audio_pool_job *job = av_mallocz(sizeof(*job));
+  if (!job)
+    return AVERROR(ENOMEM);
+  job->fn = fn;
+  job->arg = arg;
+
+  pthread_mutex_lock(&pool->lock);
+  if (pool->tail)
+    pool->tail->next = job;
+  else
+    pool->head = job;
+  pool->tail = job;
+  pool->pending++;
+  pthread_cond_signal(&pool->work_cond);
+  pthread_mutex_unlock(&pool->lock);
+
+  return 0;
+}
+
+void audio_pool_wait(struct audio_pool *pool) {
+  pthread_mutex_lock(&pool->lock);
+  while (pool->pending > 0)
+    pthread_cond_wait(&pool->done_cond, &pool->lock);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+void audio_pool_free(struct audio_pool *pool) {
+  if (!pool->threads)
+    return;
+
+  audio_pool_wait(pool);
+
+  pthread_mutex_lock(&pool->lock);
+  pool->quit = 1;
+  pthread_cond_broadcast(&pool->work_cond);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (int i = 0; i < pool->nb_threads; i++)
+    pthread_join(pool->threads[i], NULL);
+
+  pthread_cond_destroy(&pool->done_cond);
+  pthread_cond_destroy(&pool->work_cond);
+  pthread_mutex_destroy(&pool->lock);
+  av_freep(&pool->threads);
+  memset(pool, 0, sizeof(*pool));
+}
@@ -0,0 +1,73 @@
+#include "../include/audio_resample.h"
+#include <stdio.h>
+
+/**
+ * @brief Set the libswresample options for a preset.
+ *
+ * Only options that differ from the libswresample defaults are touched, so
+ * AUDIO_RESAMPLE_DEFAULT leaves the context exactly as configured.
+ */
+static int apply_quality(SwrContext *swr, enum audio_resample_quality quality) {
+  int ret = 0;
+
+  switch (quality) {
+  case AUDIO_RESAMPLE_FAST:
+    /* 8 taps instead of 32, and one dot product per sample: the nearest
+     * phase is used instead of interpolating between two */
+    if ((ret = av_opt_set_int(swr, "filter_size", 8, 0)) < 0 ||
+        (ret = av_opt_set_int(swr, "linear_interp", 0, 0)) < 0 ||
+        (ret = av_opt_set_double(swr, "cutoff", 0.90, 0)) < 0)
+      return ret;
+    break;
+  case AUDIO_RESAMPLE_HIGH:
+    /* Long Kaiser-windowed filter, fine phase table, cutoff near Nyquist */
+    if ((ret = av_opt_set_int(swr, "filter_size", 64, 0)) < 0 ||
+        (ret = av_opt_set_int(swr, "phase_shift", 14, 0)) < 0 ||
+        (ret = av_opt_set_int(swr, "exact_rational", 1, 0)) < 0 ||
+        (ret = av_opt_set_double(swr, "cutoff", 0.98, 0)) < 0)
+      return ret;
+    break;
+  case AUDIO_RESAMPLE_SOXR:
+    /* SoX resampler, "very high quality" precision (28 bits) */
+    if ((ret = av_opt_set_int(swr, "resampler", SWR_ENGINE_SOXR, 0)) < 0 ||
+        (ret = av_opt_set_double(swr, "precision", 28.0, 0)) < 0)
+      return ret;
+    break;
+  case AUDIO_RESAMPLE_DEFAULT:
+  default:
+    break;
+  }
+
+  return ret;
+}
+
+int audio_resample_init(SwrContext *swr, enum audio_resample_quality quality) {
+  int ret = apply_quality(swr, quality);
+  if (ret >= 0)
+    ret = swr_init(swr);
+
+  /* libswresample may be built without libsoxr: fall back to the swr engine */
+  if (ret < 0 && quality == AUDIO_RESAMPLE_SOXR) {
+    fprintf(stderr, "Warning: soxr resampler unavailable, using 'high'\n");
+    av_opt_set_int(swr, "resampler", SWR_ENGINE_SWR, 0);
+    ret = apply_quality(swr, AUDIO_RESAMPLE_HIGH);
+    if (ret >= 0)
+      ret = swr_init(swr);
+  }
+
+  return ret;
+}
+
+const char *audio_resample_quality_name(enum audio_resample_quality quality) {
+  switch (quality) {
+  case AUDIO_RESAMPLE_FAST:
+    return "fast";
+  case AUDIO_RESAMPLE_HIGH:
+    return "high";
+  case AUDIO_RESAMPLE_SOXR:
+    return "soxr";
+  case AUDIO_RESAMPLE_DEFAULT:
+  default:
+    return "default";
+  }
+}
@@ -0,0 +1,381 @@
+#include "../include/audio_segment.h"
+#include <libavutil/avstring.h>
+#include <libavutil/mem.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * @brief One segment waiting for or being encoded on a worker thread.
+ */
+struct audio_segment_job {
+  struct audio_segmenter *seg;
+
+  /** Encoder opened up front (segment 0 only), otherwise NULL. */
+  struct audio_enc *preopened;
+
+  char *path;
+
+  /** Priming overlap followed by the segment's own samples. */
+  uint8_t *samples;
+  int nb_samples;
+  int overlap;
+
+  /** Timeline position of the first sample kept in the output. */
+  int64_t start;
+
+  int ret;
+};
+
+static int open_encoder(struct audio_segmenter *seg, struct audio_enc *enc,
+                        const char *path) {
+  const struct audio_segment_config *cfg = &seg->config;
+
+  return audio_enc_init(enc, path, "mpegts", cfg->codec_name,
+                        seg->sample_rate, &seg->ch_layout, cfg->quality,
+                        cfg->bitrate_str, cfg->resample_quality, 0,
+                        cfg->frame_ms);
+}
+
+/**
+ * @brief Pool job: encode one segment into its own file.
+ */
+static void encode_segment(void *arg) {
+  struct audio_segment_job *job = arg;
+  struct audio_segmenter *seg = job->seg;
+  struct audio_enc local;
+  struct audio_enc *enc = job->preopened;
+  int frame_bytes = av_get_bytes_per_sample(seg->format) *
+                    seg->ch_layout.nb_channels;
+  int chunk = seg->frame_size > 0 ? seg->frame_size : 1024;
+  AVFrame *frame = NULL;
+  int ret;
+
+  if (!enc) {
+    enc = &local;
+    if ((ret = open_encoder(seg, enc, job->path)) < 0) {
+      job->ret = ret;
+      return;
+    }
+  }
+
+  /* Priming samples sit before the segment start on the shared timeline,
+   * and their packets are dropped */
+  enc->pts = job->start - job->overlap;
+  if (job->overlap > 0)
+    enc->min_pts = job->start;
+
+  frame = av_frame_alloc();
+  if (!frame) {
+    ret = AVERROR(ENOMEM);
+    goto end;
+  }
+
+  for (int offset = 0; offset < job->nb_samples; offset += chunk) {
+    int n = FFMIN(chunk, job->nb_samples - offset);
+
+    frame->nb_samples = n;
+    frame->format = seg->format;
+    frame->sample_rate = seg->sample_rate;
+    if ((ret = av_channel_layout_copy(&frame->ch_layout, &seg->ch_layout)) < 0 ||
+        (ret = av_frame_get_buffer(frame, 0)) < 0)
+      goto end;
+    memcpy(frame->data[0], job->samples + (size_t)offset * frame_bytes,
+           (size_t)n * frame_bytes);
+
+    ret = audio_enc_write_frame(enc, frame);
+    av_frame_unref(frame);
+    if (ret < 0)
+      goto end;
+  }
+
+  ret = audio_enc_finalize(enc);
+
+end:
+  if (ret < 0)
+    fprintf(stderr, "Failed to encode segment %s\n", job->path);
+  av_frame_free(&frame);
+  audio_enc_free(enc);
+  if (job->preopened)
+    av_freep(&job->preopened);
+  job->ret = ret;
+}
+
+static void job_free(struct audio_segment_job *job) {
+  if (job->preopened) {
+    audio_enc_free(job->preopened);
+    av_freep(&job->preopened);
+  }
+  av_freep(&job->samples);
+  av_freep(&job->path);
+  av_free(job);
+}
+
+/**
+ * @brief Wait for every queued segment and collect errors.
+ */
+static void wait_jobs(struct audio_segmenter *seg) {
+  audio_pool_wait(&seg->pool);
+  for (int i = 0; i < seg->nb_inflight; i++) {
+    if (seg->inflight[i]->ret < 0 && seg->error >= 0)
+      seg->error = seg->inflight[i]->ret;
+    job_free(seg->inflight[i]);
+  }
+  seg->nb_inflight = 0;
+}
+
+/**
+ * @brief Cut the next `nb_samples` from the FIFO into a segment job.
+ */
+static int submit_segment(struct audio_segmenter *seg, int nb_samples) {
+  int frame_bytes = av_get_bytes_per_sample(seg->format) *
+                    seg->ch_layout.nb_channels;
+  struct audio_segment_job *job;
+  int ret;
+
+  if (seg->error < 0)
+    return seg->error;
+
+  /* Bound memory: at most max_inflight decoded segments are held */
+  if (seg->nb_inflight >= seg->max_inflight) {
+    wait_jobs(seg);
+    if (seg->error < 0)
+      return seg->error;
+  }
+
+  double *durations = av_realloc_array(seg->durations, seg->nb_durations + 1,
+                                       sizeof(*durations));
+  if (!durations)
+    return AVERROR(ENOMEM);
+  seg->durations = durations;
+
+  job = av_mallocz(sizeof(*job));
+  if (!job)
+    return AVERROR(ENOMEM);
+  job->seg = seg;
+  job->overlap = seg->tail_samples;
+  job->nb_samples = seg->tail_samples + nb_samples;
+  job->start = seg->next_start;
+  job->path = av_asprintf("%s_%05d.ts", seg->segment_prefix, seg->index);
+  job->samples = av_malloc((size_t)FFMAX(job->nb_samples, 1) * frame_bytes);
+  if (!job->path || !job->samples) {
+    job_free(job);
+    return AVERROR(ENOMEM);
+  }
+
+  /* Priming overlap from the previous segment, then the new samples */
+  memcpy(job->samples, seg->tail, (size_t)seg->tail_samples * frame_bytes);
+  void *dst[1] = {job->samples + (size_t)seg->tail_samples * frame_bytes};
+  ret = av_audio_fifo_read(seg->fifo, dst, nb_samples);
+  if (ret < nb_samples) {
+    job_free(job);
+    return ret < 0 ? ret : AVERROR_BUG;
+  }
+
+  /* The end of this segment primes the next one */
+  seg->tail_samples = FFMIN(seg->overlap, job->nb_samples);
+  memcpy(seg->tail,
+         job->samples + (size_t)(job->nb_samples - seg->tail_samples) * frame_bytes,
+         (size_t)seg->tail_samples * frame_bytes);
+
+  if (seg->index == 0) {
+    job->preopened = seg->first_enc;
+    seg->first_enc = NULL;
+  }
+
+  seg->durations[seg->nb_durations++] = (double)nb_samples / seg->sample_rate;
+  seg->next_start += nb_samples;
+  seg->index++;
+
+  seg->inflight[seg->nb_inflight++] = job;
+  ret = audio_pool_submit(&seg->pool, encode_segment, job);
+  if (ret < 0) {
+    /* Run it here rather than lose the segment */
+    encode_segment(job);
+  }
+  return 0;
+}
+
+static int write_playlist(struct audio_segmenter *seg) {
+  const char *name = strrchr(seg->segment_prefix, '/');
+  double max_duration = 0;
+
+  name = name ? name + 1 : seg->segment_prefix;
+  for (int i = 0; i < seg->nb_durations; i++)
+    max_duration = FFMAX(max_duration, seg->durations[i]);
+
+  FILE *file = fopen(seg->playlist_path, "w");
+  if (!file) {
+    perror("Failed to write playlist");
+    return AVERROR(EIO);
+  }
+
+  fprintf(file, "#EXTM3U\n");
+  fprintf(file, "#EXT-X-VERSION:3\n");
+  fprintf(file, "#EXT-X-TARGETDURATION:%d\n", (int)ceil(max_duration));
+  fprintf(file, "#EXT-X-MEDIA-SEQUENCE:0\n");
+  fprintf(file, "#EXT-X-PLAYLIST-TYPE:VOD\n");
+  for (int i = 0; i < seg->nb_durations; i++)
+    fprintf(file, "#EXTINF:%.6f,\n%s_%05d.ts\n", seg->durations[i], name, i);
+  fprintf(file, "#EXT-X-ENDLIST\n");
+
+  if (fclose(file) != 0)
+    return AVERROR(EIO);
+  return 0;
+}
+
+int audio_segment_init(struct audio_segmenter *seg, const char *playlist_path,
+                       const struct audio_segment_config *config,
+                       int sample_rate, enum AVSampleFormat format,
+                       const AVChannelLayout *ch_layout) {
+  int ret;
+
+  memset(seg, 0, sizeof(*seg));
+  seg->config = *config;
+  seg->sample_rate = sample_rate;
+  seg->format = format;
+
+  if (av_sample_fmt_is_planar(format) || config->segment_seconds <= 0) {
+    fprintf(stderr, "Invalid segment configuration\n");
+    return AVERROR(EINVAL);
+  }
+
+  ret = av_channel_layout_copy(&seg->ch_layout, ch_layout);
+  if (ret < 0)
+    goto fail;
+
+  /* "out/podcast.m3u8" -> segments "out/podcast_00000.ts", ... */
+  seg->playlist_path = av_strdup(playlist_path);
+  seg->segment_prefix = av_strdup(playlist_path);
+  if (!seg->playlist_path || !seg->segment_prefix) {
+    ret = AVERROR(ENOMEM);
+    goto fail;
+  }
+  char *ext = strrchr(seg->segment_prefix, '.');
+  if (ext && !strchr(ext, '/'))
+    *ext = '\0';
+
+  /* Open segment 0's encoder now: its frame size and priming delay decide
+   * the segment length and the overlap of every other segment */
+  seg->first_enc = av_mallocz(sizeof(*seg->first_enc));
+  char *first_path = av_asprintf("%s_%05d.ts", seg->segment_prefix, 0);
+  if (!seg->first_enc || !first_path) {
+    av_free(first_path);
+    ret = AVERROR(ENOMEM);
+    goto fail;
+  }
+  ret = open_encoder(seg, seg->first_enc, first_path);
+  av_free(first_path);
+  if (ret < 0) {
+    av_freep(&seg->first_enc);
+    goto fail;
+  }
+
+  AVCodecContext *codec_ctx = seg->first_enc->codec_ctx;
+  seg->frame_size = codec_ctx->frame_size;
+  if (seg->frame_size > 0) {
+    /* Whole frames of overlap, aligned so that a packet starts exactly at
+     * the segment boundary after the encoder's delay */
+    int padding = FFMAX(codec_ctx->initial_padding, 0);
+    int frames = (padding + seg->frame_size - 1) / seg->frame_size + 1;
+    seg->overlap = frames * seg->frame_size - padding;
+
+    int64_t frames_per_segment =
+        llrint(config->segment_seconds * sample_rate / seg->frame_size);
+    seg->segment_samples = FFMAX(frames_per_segment, 1) * seg->frame_size;
+  } else {
+    seg->segment_samples =
+        FFMAX(llrint(config->segment_seconds * sample_rate), 1);
+  }
+
+  int frame_bytes = av_get_bytes_per_sample(format) * ch_layout->nb_channels;
+  seg->fifo = av_audio_fifo_alloc(format, ch_layout->nb_channels,
+                                  (int)FFMIN(seg->segment_samples, INT_MAX));
+  seg->tail = av_malloc((size_t)FFMAX(seg->overlap, 1) * frame_bytes);
+  if (!seg->fifo || !seg->tail) {
+    ret = AVERROR(ENOMEM);
+    goto fail;
+  }
+
+  ret = audio_pool_init(&seg->pool, config->nb_threads);
+  if (ret < 0)
+    goto fail;
+  seg->max_inflight = seg->pool.nb_threads * 2;
+  if (config->max_memory > 0) {
+    /* The FIFO holds one segment, every job in flight another */
+    int64_t segment_bytes = (seg->segment_samples + seg->overlap) *
+                            frame_bytes;
+    int64_t fit = config->max_memory / segment_bytes - 1;
+    seg->max_inflight = (int)av_clip64(fit, 1, seg->max_inflight);
+  }
+  seg->inflight = av_calloc(seg->max_inflight, sizeof(*seg->inflight));
+  if (!seg->inflight) {
+    ret = AVERROR(ENOMEM);
+    goto fail;
+  }
+
+  return 0;
+
+fail:
+  audio_segment_free(seg);
+  return ret;
+}
+
+int audio_segment_write_frame(struct audio_segmenter *seg,
+                              const AVFrame *frame) {
+  int ret;
+
+  if (frame->sample_rate != seg->sample_rate || frame->format != seg->format ||
+      frame->ch_layout.nb_channels != seg->ch_layout.nb_channels) {
+    fprintf(stderr, "Segmented output needs a constant input format\n");
+    return AVERROR(EINVAL);
+  }
+
+  ret = av_audio_fifo_write(seg->fifo, (void **)frame->data, frame->nb_samples);
+  if (ret < frame->nb_samples)
+    return ret < 0 ? ret : AVERROR(ENOMEM);
+
+  while (av_audio_fifo_size(seg->fifo) >= seg->segment_samples) {
+    if ((ret = submit_segment(seg, (int)seg->segment_samples)) < 0)
+      return ret;
+  }
+  return 0;
+}
+
+int audio_segment_finalize(struct audio_segmenter *seg) {
+  int ret = 0;
+
+  /* The last, shorter segment (or an empty first one) */
+  if (av_audio_fifo_size(seg->fifo) > 0 || seg->index == 0)
+    ret = submit_segment(seg, av_audio_fifo_size(seg->fifo));
+
+  wait_jobs(seg);
+  if (ret < 0)
+    return ret;
+  if (seg->error < 0)
+    return seg->error;
+
+  return write_playlist(seg);
+}
+
+void audio_segment_free(struct audio_segmenter *seg) {
+  if (seg->pool.threads)
+    wait_jobs(seg);
+  audio_pool_free(&seg->pool);
+  av_freep(&seg->inflight);
+
+  if (seg->first_enc) {
+    audio_enc_free(seg->first_enc);
+    av_freep(&seg->first_enc);
+  }
+  if (seg->fifo) {
+    av_audio_fifo_free(seg->fifo);
+    seg->fifo = NULL;
+  }
+  av_freep(&seg->tail);
+  av_freep(&seg->durations);
+  av_freep(&seg->playlist_path);
+  av_freep(&seg->segment_prefix);
+  av_channel_layout_uninit(&seg->ch_layout);
+}
@@ -0,0 +1,195 @@
+#include "../include/audio_spill.h"
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+#include <libavutil/samplefmt.h>
+#include <string.h>
+
+void audio_spill_init(struct audio_spill *spill, size_t mem_max,
+                      int64_t disk_max) {
+  memset(spill, 0, sizeof(*spill));
+  spill->mem_max = mem_max > 0 ? mem_max : AUDIO_SPILL_MEMORY;
+  spill->disk_max = disk_max > 0 ? disk_max : AUDIO_SPILL_DISK;
+  spill->format = -1;
+}
+
+/**
+ * @brief Bytes of one plane and number of planes of a frame.
+ */
+static int plane_size(const struct audio_spill *spill, int nb_samples,
+                      int *nb_planes) {
+  int planar = av_sample_fmt_is_planar(spill->format);
+  int channels = spill->ch_layout.nb_channels;
+
+  *nb_planes = planar ? channels : 1;
+  return nb_samples * av_get_bytes_per_sample(spill->format) *
+         (planar ? 1 : channels);
+}
+
+/**
+ * @brief Drop everything stored and stop accepting frames.
+ */
+static void set_overflow(struct audio_spill *spill) {
+  av_freep(&spill->mem);
+  spill->mem_size = spill->mem_used = 0;
+  if (spill->file) {
+    fclose(spill->file);
+    spill->file = NULL;
+  }
+  spill->file_used = 0;
+  spill->overflow = 1;
+}
+
+/**
+ * @brief Append raw bytes to the memory part, or to the file once memory
+ *        is full.
+ */
+static int append(struct audio_spill *spill, const void *data, size_t size) {
+  if (!spill->file && spill->mem_used + size <= spill->mem_max) {
+    if (spill->mem_used + size > spill->mem_size) {
+      size_t new_size = spill->mem_size ? spill->mem_size * 2 : 1 << 20;
+      while (new_size < spill->mem_used + size)
+        new_size *= 2;
+      if (new_size > spill->mem_max)
+        new_size = spill->mem_max;
+      uint8_t *mem = av_realloc(spill->mem, new_size);
+      if (!mem)
+        return AVERROR(ENOMEM);
+      spill->mem = mem;
+      spill->mem_size = new_size;
+    }
+    memcpy(spill->mem + spill->mem_used, data, size);
+    spill->mem_used += size;
+    return 0;
+  }
+
+  if (!spill->file && !(spill->file = tmpfile()))
+    return AVERROR(errno);
+  if (fwrite(data, 1, size, spill->file) != size)
+    return AVERROR(EIO);
+  spill->file_used += size;
+  return 0;
+}
+
+int audio_spill_write_frame(struct audio_spill *spill, const AVFrame *frame) {
+  int ret;
+
+  if (spill->overflow)
+    return 0;
+  if (spill->reading)
+    return AVERROR(EINVAL);
+
+  if (spill->format < 0) {
+    spill->format = frame->format;
+    spill->sample_rate = frame->sample_rate;
+    if ((ret = av_channel_layout_copy(&spill->ch_layout, &frame->ch_layout)) <
+        0)
+      return ret;
+  } else if (frame->format != spill->format ||
+             frame->sample_rate != spill->sample_rate ||
+             av_channel_layout_compare(&frame->ch_layout,
+                                       &spill->ch_layout)) {
+    return AVERROR(EINVAL);
+  }
+
+  int nb_planes;
+  int size = plane_size(spill, frame->nb_samples, &nb_planes);
+  int64_t record = sizeof(int32_t) + (int64_t)size * nb_planes;
+
+  /* Would not fit in memory nor on disk: give up and let the caller
+   * produce the stream again */
+  if ((spill->file || spill->mem_used + record > spill->mem_max) &&
+      spill->file_used + record > spill->disk_max) {
+    set_overflow(spill);
+    return 0;
+  }
+
+  int32_t nb_samples = frame->nb_samples;
+  if ((ret = append(spill, &nb_samples, sizeof(nb_samples))) < 0)
+    goto fail;
+  for (int i = 0; i < nb_planes; i++)
+    if ((ret = append(spill, frame->extended_data[i], size)) < 0)
+      goto fail;
+  spill->nb_frames++;
+  return 0;
+
+fail:
+  /* A full temp directory behaves like running out of room */
+  set_overflow(spill);
+  return ret == AVERROR(ENOMEM) ? ret : 0;
+}
+
+/**
+ * @brief Read raw bytes from the memory part, then from the file.
+ */
+static int consume(struct audio_spill *spill, void *data, size_t size) {
+  if (spill->mem_read < spill->mem_used) {
+    if (spill->mem_read + size > spill->mem_used)
+      return AVERROR_INVALIDDATA;
+    memcpy(data, spill->mem + spill->mem_read, size);
+    spill->mem_read += size;
+    return 0;
+  }
+
+  if (!spill->file)
+    return AVERROR_EOF;
+  size_t got = fread(data, 1, size, spill->file);
+  if (got == 0 && feof(spill->file))
+    return AVERROR_EOF;
+  return got == size ? 0 : AVERROR(EIO);
+}
+
+int audio_spill_read_frame(struct audio_spill *spill, AVFrame *frame) {
+  int ret;
+
+  if (spill->overflow)
+    return AVERROR(EINVAL);
+  if (!spill->reading) {
+    spill->reading = 1;
+    spill->mem_read = 0;
+    if (spill->file && fseek(spill->file, 0, SEEK_SET) < 0)
+      return AVERROR(errno);
+  }
+
+  av_frame_unref(frame);
+
+  int32_t nb_samples;
+  if ((ret = consume(spill, &nb_samples, sizeof(nb_samples))) < 0)
+    return ret;
+
+  frame->format = spill->format;
+  frame->sample_rate = spill->sample_rate;
+  frame->nb_samples = nb_samples;
+  if ((ret = av_channel_layout_copy(&frame->ch_layout, &spill->ch_layout)) <
+          0 ||
+      (ret = av_frame_get_buffer(frame, 0)) < 0)
+    return ret;
+
+  int nb_planes;
+  int size = plane_size(spill, nb_samples, &nb_planes);
+  for (int i = 0; i < nb_planes; i++)
+    if ((ret = consume(spill, frame->extended_data[i], size)) < 0)
+      return ret == AVERROR_EOF ? AVERROR_INVALIDDATA : ret;
+
+  return 0;
+}
+
+void audio_spill_reset(struct audio_spill *spill) {
+  if (spill->file) {
+    fclose(spill->file);
+    spill->file = NULL;
+  }
+  spill->file_used = 0;
+  spill->mem_used = 0;
+  spill->mem_read = 0;
+  spill->reading = 0;
+  spill->overflow = 0;
+  spill->nb_frames = 0;
+}
+
+void audio_spill_free(struct audio_spill *spill) {
+  av_freep(&spill->mem);
+  if (spill->file)
+    fclose(spill->file);
+  av_channel_layout_uninit(&spill->ch_layout);
+  memset(spill, 0, sizeof(*spill));
+}
@@ -0,0 +1,464 @@
+#include "../include/audio_streams.h"
+#include <errno.h>
+#include <libavutil/avstring.h>
+#include <libavutil/dict.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Collect the input stream index of every selected audio stream.
+ *
+ * @param indices Receives up to `in_ctx->nb_streams` indices, in selection
+ * order.
+ * @param numbers Receives the matching audio stream numbers.
+ * @return Number of selected streams, or a negative AVERROR code.
+ */
+static int select_streams(AVFormatContext *in_ctx, const char *selection,
+                          int *indices, int *numbers) {
+  int nb_audio = 0, nb = 0;
+
+  for (unsigned i = 0; i < in_ctx->nb_streams; i++)
+    if (in_ctx->streams[i]->codecpar->codec_type == AVMEDIA_TYPE_AUDIO)
+      indices[nb_audio++] = (int)i;
+  if (nb_audio == 0) {
+    fprintf(stderr, "Input has no audio streams\n");
+    return AVERROR_STREAM_NOT_FOUND;
+  }
+
+  if (strcmp(selection, "all") == 0) {
+    for (int i = 0; i < nb_audio; i++)
+      numbers[i] = i;
+    return nb_audio;
+  }
+
+  int audio[nb_audio];
+  memcpy(audio, indices, sizeof(audio));
+
+  const char *p = selection;
+  while (*p) {
+    char *end;
+    long number = strtol(p, &end, 10);
+    if (end == p || (*end && *end != ',') || number < 0 || number >= nb_audio) {
+      fprintf(stderr, "Invalid audio stream selection '%s' (%d streams)\n",
+              selection, nb_audio);
+      return AVERROR(EINVAL);
+    }
+    for (int i = 0; i < nb; i++) {
+      if (numbers[i] == number) {
+        fprintf(stderr, "Audio stream %ld selected twice\n", number);
+        return AVERROR(EINVAL);
+      }
+    }
+    numbers[nb] = (int)number;
+    indices[nb++] = audio[number];
+    p = *end ? end + 1 : end;
+  }
+  if (nb == 0) {
+    fprintf(stderr, "Empty audio stream selection\n");
+    return AVERROR(EINVAL);
+  }
+  return nb;
+}
+
+/**
+ * @brief Output file of one stream: `pattern` with "%d" replaced by its
+ *        number.
+ */
+static char *stream_path(const char *pattern, int number) {
+  const char *pos = strstr(pattern, "%d");
+  return av_asprintf("%.*s%d%s", (int)(pos - pattern), pattern, number,
+                     pos + 2);
+}
+
+/**
+ * @brief audio_enc packet sink of a shared container: keep the packet for
+ *        the demuxing thread to mux.
+ */
+static int collect_packet(void *opaque, AVPacket *pkt) {
+  struct audio_stream_chain *chain = opaque;
+
+  if (chain->nb_out == chain->out_size) {
+    int size = chain->out_size ? chain->out_size * 2 : AUDIO_STREAMS_BATCH;
+    AVPacket **out = av_realloc_array(chain->out, size, sizeof(*out));
+    if (!out)
+      return AVERROR(ENOMEM);
+    chain->out = out;
+    chain->out_size = size;
+  }
+  if (!(chain->out[chain->nb_out] = av_packet_clone(pkt)))
+    return AVERROR(ENOMEM);
+  chain->nb_out++;
+  return 0;
+}
+
+static void copy_tags(const AVStream *in, AVStream *out) {
+  static const char *const keys[] = {"language", "title"};
+
+  for (size_t i = 0; i < FF_ARRAY_ELEMS(keys); i++) {
+    const AVDictionaryEntry *tag = av_dict_get(in->metadata, keys[i], NULL, 0);
+    if (tag)
+      av_dict_set(&out->metadata, keys[i], tag->value, 0);
+  }
+}
+
+static int open_chain(struct audio_streams *streams,
+                      struct audio_stream_chain *chain, const char *output,
+                      const struct audio_streams_config *config) {
+  struct audio_dec *decoder = &chain->decoder;
+  int ret;
+
+  for (int i = 0; i < AUDIO_STREAMS_BATCH; i++)
+    if (!(chain->queue[i] = av_packet_alloc()))
+      return AVERROR(ENOMEM);
+  chain->frame = av_frame_alloc();
+  chain->filtered = av_frame_alloc();
+  if (!chain->frame || !chain->filtered)
+    return AVERROR(ENOMEM);
+
+  ret = audio_dec_init_stream(decoder, streams->in_ctx, chain->input_index,
+                              config->sample_rate, config->ch_layout,
+                              config->resample_quality);
+  if (ret < 0) {
+    fprintf(stderr, "Failed to open decoder of audio stream %d\n",
+            chain->number);
+    return ret;
+  }
+
+  if (streams->out_ctx) {
+    ret = audio_enc_init_shared(
+        &chain->encoder, streams->out_ctx, config->codec_name,
+        decoder->sample_rate, &decoder->dst_ch_layout, config->quality,
+        config->bitrate_str, config->resample_quality, config->frame_ms);
+  } else {
+    if (!(chain->path = stream_path(output, chain->number)))
+      return AVERROR(ENOMEM);
+    ret = audio_enc_init(&chain->encoder, chain->path, config->format_name,
+                         config->codec_name, decoder->sample_rate,
+                         &decoder->dst_ch_layout, config->quality,
+                         config->bitrate_str, config->resample_quality, 0,
+                         config->frame_ms);
+  }
+  if (ret < 0) {
+    fprintf(stderr, "Failed to open encoder of audio stream %d\n",
+            chain->number);
+    return ret;
+  }
+  chain->encoder_open = 1;
+
+  if (streams->out_ctx) {
+    chain->encoder.packet_sink = collect_packet;
+    chain->encoder.sink_opaque = chain;
+    copy_tags(streams->in_ctx->streams[chain->input_index],
+              chain->encoder.stream);
+  }
+
+  if (config->filter_desc) {
+    /* The chains already run in parallel: one filter thread each */
+    ret = audio_filter_init(&chain->filter, decoder->sample_rate,
+                            decoder->dst_fmt, &decoder->dst_ch_layout,
+                            config->filter_desc, 1, 0);
+    if (ret < 0) {
+      fprintf(stderr, "Failed to create filter of audio stream %d\n",
+              chain->number);
+      return ret;
+    }
+    chain->has_filter = 1;
+    audio_filter_set_frame_size(&chain->filter,
+                                chain->encoder.codec_ctx->frame_size);
+  }
+  return 0;
+}
+
+int audio_streams_init(struct audio_streams *streams, const char *input,
+                       const char *output, const char *selection,
+                       const struct audio_streams_config *config) {
+  int *indices = NULL, *numbers = NULL;
+  int ret;
+
+  memset(streams, 0, sizeof(*streams));
+
+  if ((ret = avformat_open_input(&streams->in_ctx, input, NULL, NULL)) < 0) {
+    fprintf(stderr, "Could not open input file '%s'\n", input);
+    return ret;
+  }
+  if ((ret = avformat_find_stream_info(streams->in_ctx, NULL)) < 0) {
+    fprintf(stderr, "Could not find stream information\n");
+    goto fail;
+  }
+
+  unsigned nb_streams = streams->in_ctx->nb_streams;
+  indices = av_malloc_array(nb_streams, sizeof(*indices));
+  numbers = av_malloc_array(nb_streams, sizeof(*numbers));
+  streams->route = av_malloc_array(nb_streams, sizeof(*streams->route));
+  streams->pkt = av_packet_alloc();
+  if (!indices || !numbers || !streams->route || !streams->pkt) {
+    ret = AVERROR(ENOMEM);
+    goto fail;
+  }
+
+  if ((ret = select_streams(streams->in_ctx, selection, indices, numbers)) < 0)
+    goto fail;
+  streams->nb_chains = ret;
+  streams->chains = av_calloc(streams->nb_chains, sizeof(*streams->chains));
+  if (!streams->chains) {
+    ret = AVERROR(ENOMEM);
+    goto fail;
+  }
+
+  /* The demuxer skips the packets of unselected streams */
+  for (unsigned i = 0; i < nb_streams; i++) {
+    streams->route[i] = -1;
+    streams->in_ctx->streams[i]->discard = AVDISCARD_ALL;
+  }
+  for (int i = 0; i < streams->nb_chains; i++) {
+    streams->chains[i].input_index = indices[i];
+    streams->chains[i].number = numbers[i];
+    streams->route[indices[i]] = i;
+    streams->in_ctx->streams[indices[i]]->discard = AVDISCARD_DEFAULT;
+  }
+
+  if (!strstr(output, "%d")) {
+    ret = avformat_alloc_output_context2(&streams->out_ctx, NULL,
+                                         config->format_name, output);
+    if (ret < 0) {
+      fprintf(stderr, "Could not create output context for '%s'\n", output);
+      goto fail;
+    }
+  }
+
+  for (int i = 0; i < streams->nb_chains; i++)
+    if ((ret = open_chain(streams, &streams->chains[i], output, config)) < 0)
+      goto fail;
+
+  if (streams->out_ctx) {
+    if (!(streams->out_ctx->oformat->flags & AVFMT_NOFILE) &&
+        (ret = avio_open(&streams->out_ctx->pb, output, AVIO_FLAG_WRITE)) <
+            0) {
+      fprintf(stderr, "Could not open output file '%s'\n", output);
+      goto fail;
+    }
+    if ((ret = avformat_write_header(streams->out_ctx, NULL)) < 0) {
+      fprintf(stderr, "Error writing header\n");
+      goto fail;
+    }
+    streams->header_written = 1;
+  }
+
+  if ((ret = audio_pool_init(&streams->pool, config->nb_threads)) < 0)
+    goto fail;
+
+  av_free(indices);
+  av_free(numbers);
+  return 0;
+
+fail:
+  av_free(indices);
+  av_free(numbers);
+  audio_streams_free(streams);
+  return ret;
+}
+
+/**
+ * @brief Filter (if configured) and encode one decoded frame.
+ */
+static int encode_frame(struct audio_stream_chain *chain, AVFrame *frame) {
+  int ret;
+
+  if (!chain->has_filter)
+    return audio_enc_write_frame(&chain->encoder, frame);
+
+  if ((ret = audio_filter_push(&chain->filter, frame)) < 0)
+    return ret;
+  while ((ret = audio_filter_pull(&chain->filter, chain->filtered)) >= 0) {
+    ret = audio_enc_write_frame(&chain->encoder, chain->filtered);
+    av_frame_unref(chain->filtered);
+    if (ret < 0)
+      return ret;
+  }
+  return ret == AVERROR(EAGAIN) || ret == AVERROR_EOF ? 0 : ret;
+}
+
+/**
+ * @brief Encode every chunk the decoder can produce from the packets sent.
+ */
+static int drain_decoder(struct audio_stream_chain *chain) {
+  struct audio_dec *decoder = &chain->decoder;
+  AVFrame *frame = chain->frame;
+  uint8_t *data;
+  int size, ret;
+
+  while ((ret = audio_dec_receive(decoder, &data, &size)) == 1) {
+    if (!data || size <= 0)
+      continue;
+
+    frame->nb_samples =
+        size / (decoder->channels * av_get_bytes_per_sample(decoder->dst_fmt));
+    frame->format = decoder->dst_fmt;
+    frame->sample_rate = decoder->sample_rate;
+    frame->pts = chain->samples;
+    chain->samples += frame->nb_samples;
+    av_channel_layout_copy(&frame->ch_layout, &decoder->dst_ch_layout);
+
+    ret = avcodec_fill_audio_frame(frame, decoder->channels, decoder->dst_fmt,
+                                   data, size, 1);
+    if (ret >= 0) {
+      frame->buf[0] = av_buffer_create(data, size, av_buffer_default_free,
+                                       NULL, 0);
+      if (!frame->buf[0])
+        ret = AVERROR(ENOMEM);
+    }
+    if (ret < 0) {
+      av_frame_unref(frame);
+      av_freep(&data);
+      return ret;
+    }
+
+    ret = encode_frame(chain, frame);
+    av_frame_unref(frame);
+    if (ret < 0)
+      return ret;
+  }
+  /* audio_dec_receive() logged any decode error; like a corrupt packet, the
+   * frame is skipped and the stream goes on with the next packet */
+  return ret == AVERROR(ENOMEM) ? ret : 0;
+}
+
+/**
+ * @brief Drain the decoder and filter and flush the encoder at end of input.
+ */
+static int finish_chain(struct audio_stream_chain *chain) {
+  int ret;
+
+  audio_dec_send_packet(&chain->decoder, NULL);
+  if ((ret = drain_decoder(chain)) < 0)
+    return ret;
+  if (chain->has_filter && (ret = encode_frame(chain, NULL)) < 0)
+    return ret;
+  if (chain->path)
+    return audio_enc_finalize(&chain->encoder);
+  return audio_enc_write_frame(&chain->encoder, NULL);
+}
+
+/**
+ * @brief Pool job: run a chain over its queued packets.
+ */
+static void run_chain(void *arg) {
+  struct audio_stream_chain *chain = arg;
+  int ret = 0;
+
+  for (int i = 0; i < chain->nb_queued; i++) {
+    /* Like audio_decoder_read(), a rejected (corrupt) packet is skipped */
+    if (ret >= 0 && audio_dec_send_packet(&chain->decoder, chain->queue[i]) >= 0)
+      ret = drain_decoder(chain);
+    av_packet_unref(chain->queue[i]);
+  }
+  chain->nb_queued = 0;
+
+  if (ret >= 0 && chain->eof)
+    ret = finish_chain(chain);
+  chain->ret = ret;
+}
+
+/**
+ * @brief Run every chain with work on the pool, then mux the packets of a
+ *        shared container.
+ */
+static int run_chains(struct audio_streams *streams) {
+  int ret = 0;
+
+  for (int i = 0; i < streams->nb_chains; i++) {
+    struct audio_stream_chain *chain = &streams->chains[i];
+    if ((chain->nb_queued > 0 || chain->eof) &&
+        (ret = audio_pool_submit(&streams->pool, run_chain, chain)) < 0)
+      break;
+  }
+  audio_pool_wait(&streams->pool);
+  if (ret < 0)
+    return ret;
+
+  for (int i = 0; i < streams->nb_chains; i++) {
+    struct audio_stream_chain *chain = &streams->chains[i];
+    for (int j = 0; j < chain->nb_out; j++) {
+      if (ret >= 0)
+        ret = audio_enc_write_packet(&chain->encoder, chain->out[j]);
+      av_packet_free(&chain->out[j]);
+    }
+    chain->nb_out = 0;
+    if (ret >= 0 && chain->ret < 0) {
+      fprintf(stderr, "Error transcoding audio stream %d: %s\n", chain->number,
+              av_err2str(chain->ret));
+      ret = chain->ret;
+    }
+  }
+  return ret;
+}
+
+int audio_streams_run(struct audio_streams *streams) {
+  AVPacket *pkt = streams->pkt;
+  int ret;
+
+  while ((ret = av_read_frame(streams->in_ctx, pkt)) >= 0) {
+    int c = pkt->stream_index < (int)streams->in_ctx->nb_streams
+                ? streams->route[pkt->stream_index]
+                : -1;
+    if (c < 0) {
+      av_packet_unref(pkt);
+      continue;
+    }
+
+    struct audio_stream_chain *chain = &streams->chains[c];
+    av_packet_move_ref(chain->queue[chain->nb_queued++], pkt);
+    if (chain->nb_queued == AUDIO_STREAMS_BATCH &&
+        (ret = run_chains(streams)) < 0)
+      return ret;
+  }
+  /* As in audio_decoder_read(), a read error ends the input */
+  if (ret != AVERROR_EOF)
+    fprintf(stderr, "Error reading input: %s\n", av_err2str(ret));
+
+  for (int i = 0; i < streams->nb_chains; i++)
+    streams->chains[i].eof = 1;
+  if ((ret = run_chains(streams)) < 0)
+    return ret;
+
+  if (streams->out_ctx)
+    return av_write_trailer(streams->out_ctx);
+  return 0;
+}
+
+void audio_streams_free(struct audio_streams *streams) {
+  audio_pool_free(&streams->pool);
+
+  for (int i = 0; i < streams->nb_chains; i++) {
+    struct audio_stream_chain *chain = &streams->chains[i];
+
+    for (int j = 0; j < AUDIO_STREAMS_BATCH; j++)
+      av_packet_free(&chain->queue[j]);
+    for (int j = 0; j < chain->nb_out; j++)
+      av_packet_free(&chain->out[j]);
+    av_freep(&chain->out);
+    av_frame_free(&chain->frame);
+    av_frame_free(&chain->filtered);
+    if (chain->has_filter)
+      audio_filter_free(&chain->filter);
+    if (chain->encoder_open)
+      audio_enc_free(&chain->encoder);
+    audio_dec_free(&chain->decoder);
+    av_freep(&chain->path);
+  }
+  av_freep(&streams->chains);
+  streams->nb_chains = 0;
+
+  if (streams->out_ctx) {
+    if (!(streams->out_ctx->oformat->flags & AVFMT_NOFILE))
+      avio_closep(&streams->out_ctx->pb);
+    avformat_free_context(streams->out_ctx);
+    streams->out_ctx = NULL;
+  }
+  avformat_close_input(&streams->in_ctx);
+  av_freep(&streams->route);
+  av_packet_free(&streams->pkt);
+}
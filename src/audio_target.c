@@ -0,0 +1,591 @@
+#include "../include/audio_target.h"
+#include "../include/audio_dec.h"
+#include "../include/audio_enc.h"
+#include <errno.h>
+#include <libavformat/avformat.h>
+#include <libavutil/common.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+#include <libswresample/swresample.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+/** Samples per frame fed to the encoder. */
+#define FEED_SAMPLES 1024
+
+/** Most candidates tried per round. */
+#define MAX_CANDIDATES 8
+
+/**
+ * @brief Encoded packets of one window.
+ */
+struct packet_list {
+  AVPacket **packets;
+  int nb_packets;
+  int size;
+};
+
+/**
+ * @brief audio_enc packet sink: keep the packet to decode it back.
+ */
+static int collect_packet(void *opaque, AVPacket *pkt) {
+  struct packet_list *list = opaque;
+
+  if (list->nb_packets == list->size) {
+    int size = list->size ? list->size * 2 : 64;
+    AVPacket **packets =
+        av_realloc_array(list->packets, size, sizeof(*packets));
+    if (!packets)
+      return AVERROR(ENOMEM);
+    list->packets = packets;
+    list->size = size;
+  }
+  if (!(list->packets[list->nb_packets] = av_packet_clone(pkt)))
+    return AVERROR(ENOMEM);
+  list->nb_packets++;
+  return 0;
+}
+
+static void free_packets(struct packet_list *list) {
+  for (int i = 0; i < list->nb_packets; i++)
+    av_packet_free(&list->packets[i]);
+  av_freep(&list->packets);
+}
+
+/**
+ * @brief Useful bitrates of the codec: the preset range of
+ *        get_bitrate_for_quality() codecs, widened for low bitrates and
+ *        scaled for more than two channels.
+ */
+static void bitrate_range(struct audio_target *target) {
+  int64_t scale = FFMAX(target->channels, 2) / 2;
+
+  if (strcmp(target->config.codec_name, "libopus") == 0) {
+    target->min_bitrate = 16000 * scale;
+    target->max_bitrate = 256000 * scale;
+  } else {
+    target->min_bitrate = 32000 * scale;
+    target->max_bitrate = 320000 * scale;
+  }
+}
+
+/**
+ * @brief Decode up to `count` samples from `position`, or from the current
+ *        position when it is negative.
+ */
+static int read_window(struct audio_dec *decoder, int64_t position, int count,
+                       struct audio_target_window *window) {
+  int frame_bytes = decoder->channels * (int)sizeof(float);
+  uint8_t *data;
+  int size, ret;
+
+  if (position >= 0 && (ret = audio_dec_seek(decoder, position)) < 0)
+    return ret;
+  window->samples =
+      av_malloc_array((size_t)count * decoder->channels, sizeof(float));
+  if (!window->samples)
+    return AVERROR(ENOMEM);
+
+  while (window->nb_samples < count &&
+         (ret = audio_decoder_read(decoder, &data, &size)) > 0) {
+    if (!data)
+      continue;
+    int n = FFMIN(size / frame_bytes, count - window->nb_samples);
+    memcpy(window->samples + (size_t)window->nb_samples * decoder->channels,
+           data, (size_t)n * frame_bytes);
+    window->nb_samples += n;
+    av_free(data);
+  }
+  return ret < 0 ? ret : 0;
+}
+
+int audio_target_init(struct audio_target *target, const char *input,
+                      const struct audio_target_config *config) {
+  struct audio_dec decoder;
+  int decoder_open = 0;
+  int64_t start = av_gettime_relative();
+  int ret;
+
+  memset(target, 0, sizeof(*target));
+  target->config = *config;
+  target->config.ch_layout = NULL;
+
+  const AVCodec *codec = avcodec_find_encoder_by_name(config->codec_name);
+  if (!codec) {
+    fprintf(stderr, "Codec '%s' not found\n", config->codec_name);
+    return AVERROR_ENCODER_NOT_FOUND;
+  }
+  const AVCodecDescriptor *desc = avcodec_descriptor_get(codec->id);
+  if (desc && (desc->props & AV_CODEC_PROP_LOSSLESS)) {
+    fprintf(stderr, "Codec '%s' is lossless; a quality target needs a "
+                    "lossy codec\n", config->codec_name);
+    return AVERROR(EINVAL);
+  }
+
+  /* The windows get the full run's rate and layout, but in float: the score
+   * is computed in float, and the S16 rounding of the full run (without
+   * --bit-depth) lies far below the coding noise of any lossy bitrate */
+  ret = audio_dec_init(&decoder, input, config->sample_rate, config->ch_layout,
+                       config->resample_quality, AUDIO_DEC_FLOAT);
+  if (ret < 0)
+    return ret;
+  decoder_open = 1;
+  if ((ret = av_channel_layout_copy(&target->ch_layout,
+                                    &decoder.dst_ch_layout)) < 0)
+    goto fail;
+  target->channels = decoder.channels;
+  target->config.sample_rate = decoder.sample_rate;
+
+  /* Spread the windows over long inputs, otherwise take them back to back
+   * from the start */
+  int length = (int)lrint(AUDIO_TARGET_WINDOW_SECONDS * decoder.sample_rate);
+  int64_t duration = decoder.fmt_ctx->duration;
+  int64_t total = duration > 0 ? av_rescale(duration, decoder.sample_rate,
+                                            AV_TIME_BASE)
+                               : 0;
+  int spread = total >= (int64_t)length * AUDIO_TARGET_WINDOWS * 2;
+
+  for (int i = 0; i < AUDIO_TARGET_WINDOWS; i++) {
+    struct audio_target_window *window = &target->windows[i];
+    int64_t position =
+        spread ? (total - length) * (2 * i + 1) / (2 * AUDIO_TARGET_WINDOWS)
+               : -1;
+
+    if ((ret = read_window(&decoder, position, length, window)) < 0) {
+      fprintf(stderr, "Cannot read a window of the input to sample it\n");
+      goto fail;
+    }
+    target->nb_windows++;
+    if (!spread && window->nb_samples < length)
+      break;
+  }
+
+  /* A short tail of the input adds little but noise to the score */
+  struct audio_target_window *last = &target->windows[target->nb_windows - 1];
+  if (target->nb_windows > 1 && last->nb_samples < decoder.sample_rate) {
+    av_freep(&last->samples);
+    target->nb_windows--;
+  }
+  if (target->windows[0].nb_samples < AUDIO_TARGET_FFT) {
+    fprintf(stderr, "Input too short for a quality search\n");
+    ret = AVERROR(EINVAL);
+    goto fail;
+  }
+  audio_dec_free(&decoder);
+  decoder_open = 0;
+
+  bitrate_range(target);
+
+  /* Log-spaced bands from 100 Hz to 20 kHz or the Nyquist frequency */
+  double top = FFMIN(20000.0, target->config.sample_rate / 2.0);
+  double bottom = FFMIN(100.0, top / 16);
+  for (int b = 0; b <= AUDIO_TARGET_BANDS; b++) {
+    double freq = bottom * pow(top / bottom, (double)b / AUDIO_TARGET_BANDS);
+    int bin = (int)lrint(freq * AUDIO_TARGET_FFT / target->config.sample_rate);
+    bin = FFMAX(bin, b ? target->band_start[b - 1] + 1 : 1);
+    target->band_start[b] = FFMIN(bin, AUDIO_TARGET_FFT / 2);
+  }
+  for (int i = 0; i < AUDIO_TARGET_FFT; i++)
+    target->window[i] =
+        0.5f - 0.5f * cosf(2.0f * (float)M_PI * i / AUDIO_TARGET_FFT);
+
+  if ((ret = audio_pool_init(&target->pool, config->nb_threads)) < 0)
+    goto fail;
+  /* Enough candidates to keep every thread busy, at least three to narrow
+   * the range quickly */
+  target->candidates_per_round =
+      av_clip(target->pool.nb_threads / target->nb_windows, 3,
+              MAX_CANDIDATES);
+  target->jobs = av_calloc(target->candidates_per_round * target->nb_windows,
+                           sizeof(*target->jobs));
+  if (!target->jobs) {
+    ret = AVERROR(ENOMEM);
+    goto fail;
+  }
+  target->time_us = av_gettime_relative() - start;
+  return 0;
+
+fail:
+  if (decoder_open)
+    audio_dec_free(&decoder);
+  audio_target_free(target);
+  return ret;
+}
+
+/**
+ * @brief Convert a decoded frame (or, with NULL, the resampler's delay) to
+ *        packed float at the window's rate and layout and append it.
+ */
+static int append_decoded(struct audio_target *target, SwrContext **swr,
+                          const AVFrame *frame, float **out, int *nb_out,
+                          int *capacity) {
+  int channels = target->channels;
+  int ret;
+
+  if (!*swr) {
+    if (!frame)
+      return 0;
+    ret = swr_alloc_set_opts2(swr, &target->ch_layout, AV_SAMPLE_FMT_FLT,
+                              target->config.sample_rate, &frame->ch_layout,
+                              frame->format, frame->sample_rate, 0, NULL);
+    if (ret < 0 || (ret = audio_resample_init(
+                        *swr, target->config.resample_quality)) < 0)
+      return ret;
+  }
+
+  int max = swr_get_out_samples(*swr, frame ? frame->nb_samples : 0);
+  if (max < 0)
+    return max;
+  if (*nb_out + max > *capacity) {
+    int size = FFMAX(*capacity * 2, *nb_out + max);
+    float *samples =
+        av_realloc_array(*out, (size_t)size * channels, sizeof(float));
+    if (!samples)
+      return AVERROR(ENOMEM);
+    *out = samples;
+    *capacity = size;
+  }
+
+  uint8_t *dst = (uint8_t *)(*out + (size_t)*nb_out * channels);
+  int n = swr_convert(*swr, &dst, max,
+                      frame ? (const uint8_t **)frame->extended_data : NULL,
+                      frame ? frame->nb_samples : 0);
+  if (n < 0)
+    return n;
+  *nb_out += n;
+  return 0;
+}
+
+/**
+ * @brief Encode a window at the job's bitrate and decode it back, without
+ *        the codec delay.
+ *
+ * @param out Receives the decoded samples, packed float (owned by the
+ * caller).
+ */
+static int transcode_window(struct audio_target *target,
+                            const struct audio_target_job *job, float **out,
+                            int *nb_out) {
+  const struct audio_target_window *window = &target->windows[job->window];
+  int channels = target->channels;
+  int rate = target->config.sample_rate;
+  struct packet_list list = {0};
+  struct audio_enc encoder;
+  int encoder_open = 0;
+  AVFormatContext *fmt_ctx = NULL;
+  AVCodecContext *dec_ctx = NULL;
+  SwrContext *swr = NULL;
+  char bitrate[32];
+  int capacity = 0;
+  int ret;
+
+  *out = NULL;
+  *nb_out = 0;
+  AVFrame *frame = av_frame_alloc();
+  if (!frame)
+    return AVERROR(ENOMEM);
+
+  /* The container only decides whether the codec writes global headers,
+   * which the decoder needs; nothing is written to it */
+  if ((ret = avformat_alloc_output_context2(&fmt_ctx, NULL, "matroska",
+                                            NULL)) < 0)
+    goto end;
+  snprintf(bitrate, sizeof(bitrate), "%lld", (long long)job->bitrate);
+  ret = audio_enc_init_shared(&encoder, fmt_ctx, target->config.codec_name,
+                              rate, &target->ch_layout, AUDIO_QUALITY_HIGH,
+                              bitrate, target->config.resample_quality,
+                              target->config.frame_ms);
+  if (ret < 0)
+    goto end;
+  encoder_open = 1;
+  encoder.packet_sink = collect_packet;
+  encoder.sink_opaque = &list;
+
+  for (int pos = 0; pos < window->nb_samples && ret >= 0;
+       pos += FEED_SAMPLES) {
+    av_frame_unref(frame);
+    frame->format = AV_SAMPLE_FMT_FLT;
+    frame->sample_rate = rate;
+    frame->nb_samples = FFMIN(FEED_SAMPLES, window->nb_samples - pos);
+    if ((ret = av_channel_layout_copy(&frame->ch_layout,
+                                      &target->ch_layout)) < 0 ||
+        (ret = av_frame_get_buffer(frame, 0)) < 0)
+      break;
+    memcpy(frame->data[0], window->samples + (size_t)pos * channels,
+           (size_t)frame->nb_samples * channels * sizeof(float));
+    ret = audio_enc_write_frame(&encoder, frame);
+  }
+  if (ret >= 0)
+    ret = audio_enc_write_frame(&encoder, NULL);
+  av_frame_unref(frame);
+  if (ret < 0)
+    goto end;
+
+  /* Decode the packets back */
+  const AVCodec *codec = avcodec_find_decoder(encoder.codec_ctx->codec_id);
+  if (!codec) {
+    ret = AVERROR_DECODER_NOT_FOUND;
+    goto end;
+  }
+  if (!(dec_ctx = avcodec_alloc_context3(codec))) {
+    ret = AVERROR(ENOMEM);
+    goto end;
+  }
+  if ((ret = avcodec_parameters_to_context(dec_ctx,
+                                           encoder.stream->codecpar)) < 0)
+    goto end;
+  dec_ctx->pkt_timebase = encoder.codec_ctx->time_base;
+  if ((ret = avcodec_open2(dec_ctx, codec, NULL)) < 0)
+    goto end;
+
+  for (int i = 0; i <= list.nb_packets && ret >= 0; i++) {
+    ret = avcodec_send_packet(dec_ctx, i < list.nb_packets ? list.packets[i]
+                                                           : NULL);
+    while (ret >= 0) {
+      ret = avcodec_receive_frame(dec_ctx, frame);
+      if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+        ret = 0;
+        break;
+      }
+      if (ret < 0)
+        break;
+      ret = append_decoded(target, &swr, frame, out, nb_out, &capacity);
+      av_frame_unref(frame);
+    }
+  }
+  if (ret >= 0)
+    ret = append_decoded(target, &swr, NULL, out, nb_out, &capacity);
+  if (ret < 0)
+    goto end;
+
+  /* The decoded audio starts with the codec delay */
+  int skip = (int)FFMIN(av_rescale(encoder.codec_ctx->initial_padding, rate,
+                                   encoder.codec_ctx->sample_rate),
+                        *nb_out);
+  memmove(*out, *out + (size_t)skip * channels,
+          (size_t)(*nb_out - skip) * channels * sizeof(float));
+  *nb_out -= skip;
+
+end:
+  if (ret < 0) {
+    av_freep(out);
+    *nb_out = 0;
+  }
+  swr_free(&swr);
+  avcodec_free_context(&dec_ctx);
+  if (encoder_open)
+    audio_enc_free(&encoder);
+  avformat_free_context(fmt_ctx);
+  free_packets(&list);
+  av_frame_free(&frame);
+  return ret;
+}
+
+/**
+ * @brief Spectral SNR of `test` against `ref` (see struct audio_target).
+ *
+ * @param score Receives the score in dB, or NAN if every frame is silent.
+ */
+static int score_window(struct audio_target *target, const float *ref,
+                        const float *test, int nb_samples, double *score) {
+  const int n = AUDIO_TARGET_FFT;
+  const int bins = n / 2 + 1;
+  /* -70 dBFS: a full-scale sine reaches (n / 4)^2 in its bin */
+  const float silence = (float)n * n / 16 * 1e-7f;
+  const float scale = 1.0f;
+  int channels = target->channels;
+  AVTXContext *tx = NULL;
+  av_tx_fn tx_fn;
+  double sum = 0.0;
+  int64_t count = 0;
+  int ret;
+
+  float *in = av_malloc_array(n, sizeof(*in));
+  AVComplexFloat *spec = av_malloc_array(2 * bins, sizeof(*spec));
+  if (!in || !spec) {
+    ret = AVERROR(ENOMEM);
+    goto end;
+  }
+  if ((ret = av_tx_init(&tx, &tx_fn, AV_TX_FLOAT_RDFT, 0, n, &scale, 0)) < 0)
+    goto end;
+
+  for (int pos = 0; pos + n <= nb_samples; pos += n / 2) {
+    for (int c = 0; c < channels; c++) {
+      AVComplexFloat *r = spec, *t = spec + bins;
+      float total = 0.0f;
+
+      for (int i = 0; i < n; i++)
+        in[i] = ref[(size_t)(pos + i) * channels + c] * target->window[i];
+      tx_fn(tx, r, in, sizeof(float));
+      for (int i = 0; i < n; i++)
+        in[i] = test[(size_t)(pos + i) * channels + c] * target->window[i];
+      tx_fn(tx, t, in, sizeof(float));
+
+      for (int k = 1; k < bins; k++)
+        total += r[k].re * r[k].re + r[k].im * r[k].im;
+      if (total < silence)
+        continue;
+
+      for (int b = 0; b < AUDIO_TARGET_BANDS; b++) {
+        double energy = 0.0, error = 0.0;
+        for (int k = target->band_start[b]; k < target->band_start[b + 1];
+             k++) {
+          double mr = hypotf(r[k].re, r[k].im);
+          double mt = hypotf(t[k].re, t[k].im);
+          energy += mr * mr;
+          error += (mr - mt) * (mr - mt);
+        }
+        /* Bands 50 dB under the frame carry nothing audible */
+        if (energy < total * 1e-5)
+          continue;
+        sum += FFMAX(10.0 * log10(energy / FFMAX(error, energy * 1e-5)), 0.0);
+        count++;
+      }
+    }
+  }
+  *score = count ? sum / count : NAN;
+  ret = 0;
+
+end:
+  av_tx_uninit(&tx);
+  av_free(in);
+  av_free(spec);
+  return ret;
+}
+
+/**
+ * @brief Pool job: encode, decode and score one window at one bitrate.
+ */
+static void run_job(void *arg) {
+  struct audio_target_job *job = arg;
+  struct audio_target *target = job->target;
+  const struct audio_target_window *window = &target->windows[job->window];
+  float *decoded;
+  int nb_decoded;
+
+  job->ret = transcode_window(target, job, &decoded, &nb_decoded);
+  if (job->ret >= 0)
+    job->ret = score_window(target, window->samples, decoded,
+                            FFMIN(window->nb_samples, nb_decoded),
+                            &job->score);
+  av_free(decoded);
+}
+
+/**
+ * @brief Score every window at each bitrate, in parallel.
+ *
+ * @param scores Receives each bitrate's worst window score.
+ */
+static int run_round(struct audio_target *target, const int64_t *bitrates,
+                     int nb_bitrates, double *scores) {
+  int nb_windows = target->nb_windows;
+  int nb_jobs = 0;
+  int ret = 0;
+
+  for (int c = 0; c < nb_bitrates && ret >= 0; c++) {
+    for (int w = 0; w < nb_windows && ret >= 0; w++) {
+      struct audio_target_job *job = &target->jobs[nb_jobs];
+      *job = (struct audio_target_job){target, w, bitrates[c], NAN, 0};
+      if ((ret = audio_pool_submit(&target->pool, run_job, job)) >= 0)
+        nb_jobs++;
+    }
+  }
+  audio_pool_wait(&target->pool);
+  if (ret < 0)
+    return ret;
+
+  for (int c = 0; c < nb_bitrates; c++) {
+    double worst = NAN;
+    for (int w = 0; w < nb_windows; w++) {
+      const struct audio_target_job *job = &target->jobs[c * nb_windows + w];
+      if (job->ret < 0) {
+        fprintf(stderr, "Failed to encode a sample at %lld bit/s\n",
+                (long long)job->bitrate);
+        return job->ret;
+      }
+      if (!isnan(job->score) && (isnan(worst) || job->score < worst))
+        worst = job->score;
+    }
+    /* Silent windows are perfect at any bitrate */
+    scores[c] = isnan(worst) ? 50.0 : worst;
+  }
+
+  target->rounds++;
+  target->candidates += nb_bitrates;
+  target->encodes += nb_jobs;
+  return 0;
+}
+
+static int64_t round_bitrate(int64_t bitrate) {
+  return (bitrate + 500) / 1000 * 1000;
+}
+
+int audio_target_search(struct audio_target *target) {
+  int k = target->candidates_per_round;
+  int64_t bitrates[MAX_CANDIDATES];
+  double scores[MAX_CANDIDATES];
+  int64_t low = target->min_bitrate, high = target->max_bitrate;
+  int64_t start = av_gettime_relative();
+  int ret;
+
+  /* First round: the whole range, both ends included */
+  for (int i = 0; i < k; i++)
+    bitrates[i] = round_bitrate(low + (high - low) * i / (k - 1));
+  if ((ret = run_round(target, bitrates, k, scores)) < 0)
+    return ret;
+
+  /* Lowest passing bitrate and the failing one below it */
+  int first = 0;
+  while (first < k && scores[first] < target->config.target)
+    first++;
+  if (first == k) {
+    target->bitrate = high;
+    target->score = scores[k - 1];
+    target->met = 0;
+    goto done;
+  }
+  int64_t pass = bitrates[first], fail = first ? bitrates[first - 1] : 0;
+  double pass_score = scores[first];
+
+  /* Narrow down between the two; nothing to do if the lowest passed */
+  while (first > 0 && pass - fail > AUDIO_TARGET_STEP) {
+    int nb = 0;
+    for (int i = 1; i <= k; i++) {
+      int64_t bitrate = round_bitrate(fail + (pass - fail) * i / (k + 1));
+      if (bitrate > fail && bitrate < pass &&
+          (nb == 0 || bitrate != bitrates[nb - 1]))
+        bitrates[nb++] = bitrate;
+    }
+    if (nb == 0)
+      break;
+    if ((ret = run_round(target, bitrates, nb, scores)) < 0)
+      return ret;
+
+    for (int i = 0; i < nb; i++) {
+      if (scores[i] >= target->config.target) {
+        pass = bitrates[i];
+        pass_score = scores[i];
+        break;
+      }
+      fail = bitrates[i];
+    }
+  }
+  target->bitrate = pass;
+  target->score = pass_score;
+  target->met = 1;
+
+done:
+  target->time_us += av_gettime_relative() - start;
+  return 0;
+}
+
+void audio_target_free(struct audio_target *target) {
+  audio_pool_free(&target->pool);
+  for (int i = 0; i < target->nb_windows; i++)
+    av_freep(&target->windows[i].samples);
+  target->nb_windows = 0;
+  av_freep(&target->jobs);
+  av_channel_layout_uninit(&target->ch_layout);
+}
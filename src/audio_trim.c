@@ -0,0 +1,246 @@
+#include "../include/audio_trim.h"
+#include "../include/audio_dsp.h"
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+#include <libavutil/samplefmt.h>
+#include <math.h>
+#include <string.h>
+
+/**
+ * @brief Point `trim->view` at `count` samples of `frame` from `offset`,
+ *        without copying.
+ */
+static int make_view(struct audio_trim *trim, const AVFrame *frame,
+                     int offset, int count) {
+  AVFrame *view = trim->view;
+  int planar = av_sample_fmt_is_planar(frame->format);
+  int nb_planes = planar ? trim->channels : 1;
+  size_t shift = (size_t)offset * av_get_bytes_per_sample(frame->format) *
+                 (planar ? 1 : trim->channels);
+  int ret;
+
+  av_frame_unref(view);
+  if ((ret = av_frame_ref(view, frame)) < 0)
+    return ret;
+
+  for (int i = 0; i < nb_planes; i++)
+    view->extended_data[i] += shift;
+  if (view->extended_data != view->data)
+    for (int i = 0; i < nb_planes && i < AV_NUM_DATA_POINTERS; i++)
+      view->data[i] += shift;
+  view->nb_samples = count;
+  if (view->pts != AV_NOPTS_VALUE)
+    view->pts += offset;
+  return 0;
+}
+
+/**
+ * @brief Find the first and last sample over the threshold on any channel.
+ */
+static int scan(struct audio_trim *trim, const AVFrame *frame, int *first,
+                int *last) {
+  int n = frame->nb_samples;
+  int channels = trim->channels;
+  int f, l, ret;
+
+  switch (frame->format) {
+  case AV_SAMPLE_FMT_FLT:
+    audio_dsp_find_loud_flt((const float *)frame->data[0], n * channels,
+                            trim->threshold, &f, &l);
+    *first = f < 0 ? -1 : f / channels;
+    *last = l < 0 ? -1 : l / channels;
+    return 0;
+  case AV_SAMPLE_FMT_S16:
+    audio_dsp_find_loud_s16((const int16_t *)frame->data[0], n * channels,
+                            trim->threshold_s16, &f, &l);
+    *first = f < 0 ? -1 : f / channels;
+    *last = l < 0 ? -1 : l / channels;
+    return 0;
+  default:
+    break;
+  }
+
+  /* Planar input, or formats without a kernel converted to planar floats */
+  const float *const *planes = (const float *const *)frame->extended_data;
+  if (frame->format != AV_SAMPLE_FMT_FLTP &&
+      frame->format != AV_SAMPLE_FMT_S16P) {
+    av_fast_malloc(&trim->scratch, &trim->scratch_size,
+                   (size_t)n * channels * sizeof(float));
+    if (!trim->scratch)
+      return AVERROR(ENOMEM);
+    for (int c = 0; c < channels; c++)
+      trim->planes[c] = trim->scratch + (size_t)c * n;
+    if ((ret = audio_dsp_read_float(frame, 0, n, trim->planes)) < 0)
+      return ret;
+    planes = (const float *const *)trim->planes;
+  }
+
+  *first = *last = -1;
+  for (int c = 0; c < channels; c++) {
+    if (frame->format == AV_SAMPLE_FMT_S16P)
+      audio_dsp_find_loud_s16((const int16_t *)frame->extended_data[c], n,
+                              trim->threshold_s16, &f, &l);
+    else
+      audio_dsp_find_loud_flt(planes[c], n, trim->threshold, &f, &l);
+    if (f >= 0 && (*first < 0 || f < *first))
+      *first = f;
+    if (l > *last)
+      *last = l;
+  }
+  return 0;
+}
+
+/**
+ * @brief Add silent samples of `frame` to the current run, holding the part
+ *        that might still be kept.
+ */
+static int hold(struct audio_trim *trim, const AVFrame *frame, int offset,
+                int count) {
+  int ret;
+
+  trim->run += count;
+
+  /* A leading run this long is dropped whatever follows */
+  if (!trim->started && trim->run >= trim->min_samples) {
+    if (trim->held > 0) {
+      audio_spill_reset(&trim->spill);
+      trim->held = 0;
+    }
+    return 0;
+  }
+
+  int64_t cap = trim->started && !trim->compress_gaps ? INT64_MAX
+                                                      : trim->min_samples;
+  int64_t keep = cap - trim->held;
+  if (keep > count)
+    keep = count;
+  if (keep <= 0)
+    return 0;
+
+  if ((ret = make_view(trim, frame, offset, (int)keep)) < 0 ||
+      (ret = audio_spill_write_frame(&trim->spill, trim->view)) < 0)
+    return ret;
+  trim->held += keep;
+  return 0;
+}
+
+/**
+ * @brief Emit the held part of the run and start a new run.
+ *
+ * If the held audio overflowed the spill it is dropped like a compressed
+ * gap.
+ */
+static int release(struct audio_trim *trim, audio_trim_emit emit,
+                   void *opaque) {
+  int64_t kept = 0;
+  int ret;
+
+  if (trim->held > 0 && !trim->spill.overflow) {
+    while ((ret = audio_spill_read_frame(&trim->spill, trim->release)) >= 0)
+      if ((ret = emit(opaque, trim->release)) < 0)
+        return ret;
+    if (ret != AVERROR_EOF)
+      return ret;
+    kept = trim->held;
+  }
+
+  if (trim->started)
+    trim->removed_gaps += trim->run - kept;
+  audio_spill_reset(&trim->spill);
+  av_frame_unref(trim->release);
+  trim->run = trim->held = 0;
+  return 0;
+}
+
+int audio_trim_init(struct audio_trim *trim, double threshold_db,
+                    double min_duration, int compress_gaps,
+                    size_t max_memory) {
+  memset(trim, 0, sizeof(*trim));
+  trim->threshold = (float)pow(10.0, threshold_db / 20.0);
+  trim->threshold_s16 =
+      (int16_t)lrint(fmin(trim->threshold * 32768.0, 32767.0));
+  trim->min_duration = min_duration;
+  trim->compress_gaps = compress_gaps;
+  trim->format = -1;
+  audio_spill_init(&trim->spill, max_memory, 0);
+
+  trim->view = av_frame_alloc();
+  trim->release = av_frame_alloc();
+  if (!trim->view || !trim->release) {
+    audio_trim_free(trim);
+    return AVERROR(ENOMEM);
+  }
+  return 0;
+}
+
+int audio_trim_process(struct audio_trim *trim, const AVFrame *frame,
+                       audio_trim_emit emit, void *opaque) {
+  int first, last, ret;
+
+  if (trim->format < 0) {
+    if (frame->sample_rate <= 0 || frame->ch_layout.nb_channels <= 0)
+      return AVERROR(EINVAL);
+    trim->format = frame->format;
+    trim->sample_rate = frame->sample_rate;
+    trim->channels = frame->ch_layout.nb_channels;
+    trim->min_samples = llrint(trim->min_duration * trim->sample_rate);
+    trim->planes = av_calloc(trim->channels, sizeof(*trim->planes));
+    if (!trim->planes)
+      return AVERROR(ENOMEM);
+  } else if (frame->format != trim->format ||
+             frame->sample_rate != trim->sample_rate ||
+             frame->ch_layout.nb_channels != trim->channels) {
+    return AVERROR(EINVAL);
+  }
+
+  if ((ret = scan(trim, frame, &first, &last)) < 0)
+    return ret;
+  trim->samples += frame->nb_samples;
+
+  if (first < 0)
+    return hold(trim, frame, 0, frame->nb_samples);
+
+  /* Close the run before the first loud sample */
+  if (first > 0 && (ret = hold(trim, frame, 0, first)) < 0)
+    return ret;
+  if (trim->run > 0) {
+    if (!trim->started && trim->run >= trim->min_samples) {
+      trim->removed_head = trim->run;
+      trim->run = 0;
+    } else if ((ret = release(trim, emit, opaque)) < 0) {
+      return ret;
+    }
+  }
+  trim->started = 1;
+
+  if ((ret = make_view(trim, frame, first, last - first + 1)) < 0 ||
+      (ret = emit(opaque, trim->view)) < 0)
+    return ret;
+
+  /* The silent end of the frame starts the next run */
+  if (last + 1 < frame->nb_samples)
+    return hold(trim, frame, last + 1, frame->nb_samples - last - 1);
+  return 0;
+}
+
+int audio_trim_flush(struct audio_trim *trim, audio_trim_emit emit,
+                     void *opaque) {
+  if (trim->run >= trim->min_samples) {
+    trim->removed_tail = trim->run;
+    audio_spill_reset(&trim->spill);
+    trim->run = trim->held = 0;
+    return 0;
+  }
+
+  /* Too short to trim */
+  return release(trim, emit, opaque);
+}
+
+void audio_trim_free(struct audio_trim *trim) {
+  av_frame_free(&trim->view);
+  av_frame_free(&trim->release);
+  audio_spill_free(&trim->spill);
+  av_freep(&trim->planes);
+  av_freep(&trim->scratch);
+  trim->scratch_size = 0;
+}